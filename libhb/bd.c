@@ -23,12 +23,31 @@ struct hb_bd_s
     hb_stream_t  * stream;
     int            chapter;
     int            next_chap;
+    uint8_t        pkt[192];
+
+    // While reading ahead libbluray belongs to the readahead thread.
+    // The events it reports are queued with the position of the
+    // aligned unit they came with.
+    hb_readahead_t * readahead;
+    hb_lock_t    * event_lock;
+    hb_list_t    * event_list;
 };
 
+typedef struct
+{
+    uint64_t       pos;
+    BD_EVENT       event;
+} hb_bd_event_t;
+
+// libbluray reads the m2ts files in aligned units of 32 packets
+#define BD_ALIGNED_UNIT     6144
+#define BD_READAHEAD_BLOCK  ( 32 * BD_ALIGNED_UNIT )
+#define BD_READAHEAD_COUNT  16
+
 /***********************************************************************
  * Local prototypes
  **********************************************************************/
-static int           next_packet( BLURAY *bd, uint8_t *pkt );
+static int           next_packet( hb_bd_t *d, const uint8_t **pkt );
 static int title_info_compare_mpls(const void *, const void *);
 
 /***********************************************************************
@@ -579,6 +598,141 @@ int hb_bd_main_feature( hb_bd_t * d, hb_list_t * list_title )
     return longest;
 }
 
+/***********************************************************************
+ * Readahead
+ ***********************************************************************
+ * libbluray is only read on the readahead thread, in aligned units so
+ * that the events that come with each unit can be queued with its
+ * position.  hb_bd_read() picks them up when it gets there.
+ **********************************************************************/
+static int bd_readahead_fill( void * opaque, int64_t pos, uint8_t * buf,
+                              int size )
+{
+    hb_bd_t * d = opaque;
+    hb_bd_event_t * e;
+    BD_EVENT event;
+    int off, result;
+
+    // pos is where libbluray is, see bd_readahead_resume()
+    for ( off = 0; off < size; off += result )
+    {
+        result = bd_read( d->bd, buf + off, BD_ALIGNED_UNIT );
+        while ( bd_get_event( d->bd, &event ) )
+        {
+            if ( event.event == BD_EVENT_STILL )
+            {
+                bd_read_skip_still( d->bd );
+                continue;
+            }
+            e = malloc( sizeof( hb_bd_event_t ) );
+            e->pos = pos + off;
+            e->event = event;
+            hb_lock( d->event_lock );
+            hb_list_add( d->event_list, e );
+            hb_unlock( d->event_lock );
+        }
+        if ( result < BD_ALIGNED_UNIT )
+        {
+            if ( result < 0 )
+            {
+                return off > 0 ? off : -1;
+            }
+            off += result;
+            break;
+        }
+    }
+    return off;
+}
+
+static void bd_clear_events( hb_bd_t * d )
+{
+    hb_bd_event_t * e;
+
+    hb_lock( d->event_lock );
+    while ( ( e = hb_list_item( d->event_list, 0 ) ) != NULL )
+    {
+        hb_list_rem( d->event_list, e );
+        free( e );
+    }
+    hb_unlock( d->event_lock );
+}
+
+// Takes libbluray back from the readahead thread
+static void bd_readahead_pause( hb_bd_t * d )
+{
+    if ( d->readahead )
+    {
+        hb_readahead_stop( d->readahead );
+        bd_clear_events( d );
+    }
+}
+
+// Hands libbluray to the readahead thread, reading on from where it is
+static void bd_readahead_resume( hb_bd_t * d )
+{
+    if ( d->readahead )
+    {
+        hb_readahead_start( d->readahead, bd_tell( d->bd ) );
+    }
+}
+
+// Next libbluray event at or before the packet just read
+static int bd_next_event( hb_bd_t * d, BD_EVENT * event )
+{
+    hb_bd_event_t * e;
+    int result = 0;
+
+    if ( !d->readahead )
+    {
+        return bd_get_event( d->bd, event );
+    }
+    hb_lock( d->event_lock );
+    e = hb_list_item( d->event_list, 0 );
+    if ( e != NULL && e->pos < hb_readahead_tell( d->readahead ) )
+    {
+        *event = e->event;
+        hb_list_rem( d->event_list, e );
+        free( e );
+        result = 1;
+    }
+    hb_unlock( d->event_lock );
+    return result;
+}
+
+/***********************************************************************
+ * hb_bd_set_readahead
+ ***********************************************************************
+ *
+ **********************************************************************/
+void hb_bd_set_readahead( hb_bd_t * d, int enable )
+{
+    if ( enable && d->readahead == NULL )
+    {
+        d->readahead = hb_readahead_init( "bd readahead", bd_readahead_fill,
+                                          d, BD_READAHEAD_BLOCK,
+                                          BD_READAHEAD_COUNT, 1 );
+        if ( d->readahead )
+        {
+            d->event_lock = hb_lock_init();
+            d->event_list = hb_list_init();
+            bd_readahead_resume( d );
+        }
+    }
+    else if ( !enable && d->readahead != NULL )
+    {
+        uint64_t pos = hb_readahead_tell( d->readahead );
+
+        hb_readahead_close( &d->readahead );
+        bd_clear_events( d );
+        hb_list_close( &d->event_list );
+        hb_lock_close( &d->event_lock );
+        if ( pos != bd_tell( d->bd ) )
+        {
+            bd_seek( d->bd, pos );
+        }
+    }
+}
+
 /***********************************************************************
  * hb_bd_start
  ***********************************************************************
@@ -609,6 +763,7 @@ int hb_bd_start( hb_bd_t * d, hb_title_t *title )
  **********************************************************************/
 void hb_bd_stop( hb_bd_t * d )
 {
+    hb_bd_set_readahead( d, 0 );
     if( d->stream ) hb_stream_close( &d->stream );
 }
 
@@ -621,25 +776,31 @@ int hb_bd_seek( hb_bd_t * d, float f )
 {
     uint64_t packet = f * d->pkt_count;
 
+    bd_readahead_pause( d );
     bd_seek(d->bd, packet * 192);
     d->next_chap = bd_get_current_chapter( d->bd ) + 1;
     hb_ts_stream_reset(d->stream);
+    bd_readahead_resume( d );
     return 1;
 }
 
 int hb_bd_seek_pts( hb_bd_t * d, uint64_t pts )
 {
+    bd_readahead_pause( d );
     bd_seek_time(d->bd, pts);
     d->next_chap = bd_get_current_chapter( d->bd ) + 1;
     hb_ts_stream_reset(d->stream);
+    bd_readahead_resume( d );
     return 1;
 }
 
 int hb_bd_seek_chapter( hb_bd_t * d, int c )
 {
     d->next_chap = c;
+    bd_readahead_pause( d );
     bd_seek_chapter( d->bd, c - 1 );
     hb_ts_stream_reset(d->stream);
+    bd_readahead_resume( d );
     return 1;
 }
 
@@ -652,7 +813,7 @@ hb_buffer_t * hb_bd_read( hb_bd_t * d )
 {
     int result;
     int error_count = 0;
-    uint8_t buf[192];
+    const uint8_t *buf;
     BD_EVENT event;
     uint64_t pos;
     hb_buffer_t * b;
@@ -666,12 +827,21 @@ hb_buffer_t * hb_bd_read( hb_bd_t * d )
         {
             new_chap = d->chapter = d->next_chap;
         }
-        result = next_packet( d->bd, buf );
+        result = next_packet( d, &buf );
         if ( result < 0 )
         {
             hb_error("bd: Read Error");
-            pos = bd_tell( d->bd );
+            if ( d->readahead )
+            {
+                pos = hb_readahead_tell( d->readahead );
+                bd_readahead_pause( d );
+            }
+            else
+            {
+                pos = bd_tell( d->bd );
+            }
             bd_seek( d->bd, pos + 192 );
+            bd_readahead_resume( d );
             error_count++;
             if (error_count > 10)
             {
@@ -686,7 +856,7 @@ hb_buffer_t * hb_bd_read( hb_bd_t * d )
         }
 
         error_count = 0;
-        while ( bd_get_event( d->bd, &event ) )
+        while ( bd_next_event( d, &event ) )
         {
             switch ( event.event )
             {
@@ -702,6 +872,7 @@ hb_buffer_t * hb_bd_read( hb_bd_t * d )
                     break;
 
                 case BD_EVENT_STILL:
+                    // The readahead thread skips these itself
                     bd_read_skip_still( d->bd );
                     break;
 
@@ -748,6 +919,7 @@ void hb_bd_close( hb_bd_t ** _d )
             bd_free_title_info( d->title_info[ii] );
         free( d->title_info );
     }
+    hb_bd_set_readahead( d, 0 );
     if( d->stream ) hb_stream_close( &d->stream );
     if( d->bd ) bd_close( d->bd );
     if( d->path ) free( d->path );
@@ -764,10 +936,12 @@ void hb_bd_close( hb_bd_t ** _d )
 void hb_bd_set_angle( hb_bd_t * d, int angle )
 {
 
+    bd_readahead_pause( d );
     if ( !bd_select_angle( d->bd, angle) )
     {
         hb_log("bd_select_angle failed");
     }
+    bd_readahead_resume( d );
 }
 
 static int check_ts_sync(const uint8_t *buf)
@@ -843,13 +1017,21 @@ static uint64_t align_to_next_packet(BLURAY *bd, uint8_t *pkt)
     return start - orig + pos;
 }
 
-static int next_packet( BLURAY *bd, uint8_t *pkt )
+static int next_packet( hb_bd_t *d, const uint8_t **pkt )
 {
     int result;
 
     while ( 1 )
     {
-        result = bd_read( bd, pkt, 192 );
+        if ( d->readahead )
+        {
+            result = hb_readahead_get( d->readahead, 192, pkt );
+        }
+        else
+        {
+            result = bd_read( d->bd, d->pkt, 192 );
+            *pkt = d->pkt;
+        }
         if ( result < 0 )
         {
             return -1;
@@ -859,13 +1041,31 @@ static int next_packet( BLURAY *bd, uint8_t *pkt )
             return 0;
         }
         // Sync byte is byte 4.  0-3 are timestamp.
-        if (pkt[4] == 0x47)
+        if ((*pkt)[4] == 0x47)
         {
             return 1;
         }
         // lost sync - back up to where we started then try to re-establish.
-        uint64_t pos = bd_tell(bd);
-        uint64_t pos2 = align_to_next_packet(bd, pkt);
+        uint64_t pos, pos2;
+        if ( d->readahead )
+        {
+            // align_to_next_packet wants libbluray right after the packet.
+            // bd_seek goes to the start of the aligned unit, read up to it.
+            uint8_t skip[192];
+
+            pos = hb_readahead_tell( d->readahead );
+            memcpy( d->pkt, *pkt, 192 );
+            bd_readahead_pause( d );
+            bd_seek( d->bd, pos );
+            while ( pos > bd_tell( d->bd ) )
+            {
+                if ( bd_read( d->bd, skip, 192 ) != 192 )
+                    break;
+            }
+        }
+        pos = bd_tell(d->bd);
+        pos2 = align_to_next_packet(d->bd, d->pkt);
+        bd_readahead_resume( d );
         if ( pos2 == 0 )
         {
             hb_log( "next_packet: eof while re-establishing sync @ %"PRId64, pos );
@@ -323,6 +323,7 @@ struct hb_job_s
     int             crop[4];
     int             deinterlace;
     hb_list_t     * list_filter;
+    int             fuse_filters;   // run adjacent stripe filters together
     int             width;
     int             height;
     int             keep_ratio;
@@ -423,6 +424,7 @@ struct hb_job_s
     /* Allow MP4 files > 4 gigs */
     int             largeFileSize;
     int             mp4_optimize;
+    int             mp4_segment_duration; // seconds, 0 for a single file
     int             ipod_atom;
 
     int                     indepth_scan;
@@ -452,6 +454,8 @@ struct hb_job_s
     uint64_t        st_pause_date;
     uint64_t        st_paused;
 
+    volatile int    write_stalled;  // encoding waits on the muxer's writes
+
     hb_fifo_t     * fifo_mpeg2;   /* MPEG-2 video ES */
     hb_fifo_t     * fifo_raw;     /* Raw pictures */
     hb_fifo_t     * fifo_sync;    /* Raw pictures, framerate corrected */
@@ -828,6 +832,7 @@ struct hb_state_s
             int   minutes;
             int   seconds;
             int   sequence_id;
+            int   write_stalled;  /* output can't keep up with encoding */
         } working;
 
         struct
@@ -960,6 +965,14 @@ extern hb_work_object_t hb_reader;
 #define HB_FILTER_DROP    3
 #define HB_FILTER_DONE    4
 
+// Filter capability flags (hb_filter_object_t.flags)
+//
+// HB_FILTER_FLAG_INPLACE: work() writes its output over the input frame
+// and returns the input buffer in *buf_out instead of allocating a new
+// frame. filter_loop() makes sure the filter holds the only reference to
+// the frame data before calling work() (see hb_buffer_make_writable()).
+#define HB_FILTER_FLAG_INPLACE  0x01
+
 typedef struct hb_filter_init_s
 {
     hb_job_t    * job;
@@ -998,6 +1011,17 @@ struct hb_filter_object_s
     void        (* close) ( hb_filter_object_t * );
     int         (* info)  ( hb_filter_object_t *, hb_filter_info_t * );
 
+    // Optional stripe interface used when filters are fused, see
+    // fused_filter_loop(). stripe_begin() sets up the output frame for
+    // an input frame, then stripe_work() is called for consecutive
+    // stripes of luma rows [start, stop) of the input, top to bottom.
+    void        (* stripe_begin) ( hb_filter_object_t *, hb_buffer_t *,
+                                   hb_buffer_t ** );
+    void        (* stripe_work)  ( hb_filter_object_t *, hb_buffer_t *,
+                                   hb_buffer_t *, int, int );
+
+    int                 flags;  // HB_FILTER_FLAG_*, may be set by init()
+
     hb_fifo_t   * fifo_in;
     hb_fifo_t   * fifo_out;
 
@@ -1013,6 +1037,10 @@ struct hb_filter_object_s
     // These are used to bridge the chapter to the next buffer
     int                 chapter_val;
     int64_t             chapter_time;
+
+    // Fused filters are run by the thread of the first filter of the run
+    hb_filter_object_t * fuse_next;
+    int                  fused;
 #endif
 };
 
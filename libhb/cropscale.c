@@ -34,6 +34,15 @@ static int hb_crop_scale_info( hb_filter_object_t * filter,
 
 static void hb_crop_scale_close( hb_filter_object_t * filter );
 
+static void hb_crop_scale_stripe_begin( hb_filter_object_t * filter,
+                                        hb_buffer_t * in,
+                                        hb_buffer_t ** out );
+
+static void hb_crop_scale_stripe_work( hb_filter_object_t * filter,
+                                       hb_buffer_t * in,
+                                       hb_buffer_t * out,
+                                       int start, int stop );
+
 hb_filter_object_t hb_filter_crop_scale =
 {
     .id            = HB_FILTER_CROP_SCALE,
@@ -44,6 +53,8 @@ hb_filter_object_t hb_filter_crop_scale =
     .work          = hb_crop_scale_work,
     .close         = hb_crop_scale_close,
     .info          = hb_crop_scale_info,
+    .stripe_begin  = hb_crop_scale_stripe_begin,
+    .stripe_work   = hb_crop_scale_stripe_work,
 };
 
 static int hb_crop_scale_init( hb_filter_object_t * filter,
@@ -121,21 +132,26 @@ static void hb_crop_scale_close( hb_filter_object_t * filter )
     filter->private_data = NULL;
 }
 
-static hb_buffer_t* crop_scale( hb_filter_private_t * pv, hb_buffer_t * in )
+// Returns 1 when the frame passes through unchanged
+static int crop_scale_passthru( hb_filter_private_t * pv, hb_buffer_t * in )
 {
-    AVPicture           pic_in;
-    AVPicture           pic_out;
-    AVPicture           pic_crop;
-    hb_buffer_t * out;
-    out = hb_video_buffer_init( pv->width_out, pv->height_out );
-
-    hb_avpicture_fill( &pic_in, in );
-    hb_avpicture_fill( &pic_out, out );
+    // If width or height were not set, set them now based on the
+    // input width & height
+    if ( pv->width_out <= 0 || pv->height_out <= 0 )
+    {
+        pv->width_out = in->f.width - (pv->crop[2] + pv->crop[3]);
+        pv->height_out = in->f.height - (pv->crop[0] + pv->crop[1]);
+    }
+    return ( in->f.fmt == pv->pix_fmt_out &&
+             !pv->crop[0] && !pv->crop[1] && !pv->crop[2] && !pv->crop[3] &&
+             in->f.width == pv->width_out && in->f.height == pv->height_out );
+}
 
-    // Crop; this alters the pointer to the data to point to the
-    // correct place for cropped frame
-    av_picture_crop( &pic_crop, &pic_in, in->f.fmt,
-                     pv->crop[0], pv->crop[2] );
+static hb_buffer_t* crop_scale_begin( hb_filter_private_t * pv,
+                                      hb_buffer_t * in )
+{
+    hb_buffer_t * out;
+    out = hb_video_buffer_init_nozero( pv->width_out, pv->height_out );
 
     if ( !pv->context ||
          pv->width_in   != in->f.width  ||
@@ -157,19 +173,93 @@ static hb_buffer_t* crop_scale( hb_filter_private_t * pv, hb_buffer_t * in )
         pv->pix_fmt = in->f.fmt;
     }
 
+    out->s = in->s;
+    hb_buffer_move_subs( out, in );
+    return out;
+}
+
+/*
+ * Scale source rows [start, stop) of the uncropped input.  Successive
+ * calls must cover the cropped picture in order, top to bottom, as
+ * swscale requires when it is fed slices.
+ */
+static void crop_scale_rows( hb_filter_private_t * pv, hb_buffer_t * in,
+                             hb_buffer_t * out, int start, int stop )
+{
+    AVPicture           pic_in;
+    AVPicture           pic_out;
+    AVPicture           pic_crop;
+    const uint8_t     * src[4];
+    int                 top = pv->crop[0];
+    int                 bottom = in->f.height - pv->crop[1];
+    int                 vsub, p;
+
+    if ( start < top )
+        start = top;
+    if ( stop > bottom )
+        stop = bottom;
+    if ( stop <= start )
+        return;
+
+    hb_avpicture_fill( &pic_in, in );
+    hb_avpicture_fill( &pic_out, out );
+
+    // Crop; this alters the pointer to the data to point to the
+    // correct place for cropped frame
+    av_picture_crop( &pic_crop, &pic_in, in->f.fmt,
+                     pv->crop[0], pv->crop[2] );
+
+    // Point at the first row of the slice within the cropped frame
+    vsub = av_pix_fmt_descriptors[in->f.fmt].log2_chroma_h;
+    for ( p = 0; p < 4; p++ )
+    {
+        src[p] = pic_crop.data[p];
+        if ( src[p] != NULL )
+            src[p] += ( ( start - top ) >> ( p ? vsub : 0 ) ) *
+                      pic_crop.linesize[p];
+    }
+
     // Scale pic_crop into pic_render according to the
     // context set up above
     sws_scale(pv->context,
-              (const uint8_t* const*)pic_crop.data,
-              pic_crop.linesize,
-              0, in->f.height - (pv->crop[0] + pv->crop[1]),
+              src, pic_crop.linesize,
+              start - top, stop - start,
               pic_out.data,  pic_out.linesize);
+}
 
-    out->s = in->s;
-    hb_buffer_move_subs( out, in );
+static hb_buffer_t* crop_scale( hb_filter_private_t * pv, hb_buffer_t * in )
+{
+    hb_buffer_t * out;
+
+    out = crop_scale_begin( pv, in );
+    crop_scale_rows( pv, in, out, 0, in->f.height );
     return out;
 }
 
+static void hb_crop_scale_stripe_begin( hb_filter_object_t * filter,
+                                        hb_buffer_t * in,
+                                        hb_buffer_t ** out )
+{
+    hb_filter_private_t * pv = filter->private_data;
+
+    if ( !pv || crop_scale_passthru( pv, in ) )
+    {
+        *out = in;
+        return;
+    }
+    *out = crop_scale_begin( pv, in );
+}
+
+static void hb_crop_scale_stripe_work( hb_filter_object_t * filter,
+                                       hb_buffer_t * in,
+                                       hb_buffer_t * out,
+                                       int start, int stop )
+{
+    if ( out == in )
+        return;
+    crop_scale_rows( filter->private_data, in, out, start, stop );
+}
+
 static int hb_crop_scale_work( hb_filter_object_t * filter,
                                hb_buffer_t ** buf_in,
                                hb_buffer_t ** buf_out )
@@ -184,23 +274,7 @@ static int hb_crop_scale_work( hb_filter_object_t * filter,
         return HB_FILTER_DONE;
     }
 
-    if ( !pv )
-    {
-        *buf_out = in;
-        *buf_in = NULL;
-        return HB_FILTER_OK;
-    }
-
-    // If width or height were not set, set them now based on the
-    // input width & height
-    if ( pv->width_out <= 0 || pv->height_out <= 0 )
-    {
-        pv->width_out = in->f.width - (pv->crop[2] + pv->crop[3]);
-        pv->height_out = in->f.height - (pv->crop[0] + pv->crop[1]);
-    }
-    if ( in->f.fmt == pv->pix_fmt_out &&
-         !pv->crop[0] && !pv->crop[1] && !pv->crop[2] && !pv->crop[3] &&
-         in->f.width == pv->width_out && in->f.height == pv->height_out )
+    if ( !pv || crop_scale_passthru( pv, in ) )
     {
         *buf_out = in;
         *buf_in = NULL;
@@ -19,10 +19,27 @@
 #include "hb.h"
 #include "hbffmpeg.h"
 #include "mpeg2dec/mpeg2.h"
+#include "taskset.h"
 
 #define PP7_QP_DEFAULT    5
 #define PP7_MODE_DEFAULT  2
 
+/*
+ * With QP 0 the strength of each block comes from the quantizer the
+ * decoder used for it (hb_buffer_t.qp).  Blocks quantized at or below
+ * PP7_QP_SKIP have no visible blocking and are left alone.
+ */
+#define PP7_QP_SKIP       1
+
+#define DEBLOCK_PASS_COPY    0
+#define DEBLOCK_PASS_FILTER  1
+
+#if ( defined( __GNUC__ ) || defined( __clang__ ) ) && \
+    ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define PP7_X86 1
+#include <immintrin.h>
+#endif
+
 #define XMIN(a,b) ((a) < (b) ? (a) : (b))
 #define XMAX(a,b) ((a) > (b) ? (a) : (b))
 
@@ -41,15 +58,36 @@ static const uint8_t  __attribute__((aligned(8))) pp7_dither[8][8] =
     { 42,  26,  38,  22,  41,  25,  37,  21, },
 };
 
+typedef struct
+{
+    void (* dct_a_row)( DCTELEM *, uint8_t *, int, int );
+    void (* filter_block)( DCTELEM *, uint8_t *, int, int, int,
+                           const uint8_t *, int );
+} pp7_dsp_t;
+
 struct hb_filter_private_s
 {
     int           pp7_qp;
     int           pp7_mode;
-    int           pp7_mpeg2;
-    int           pp7_temp_stride;
-    uint8_t     * pp7_src;
+    pp7_dsp_t     dsp;
+
+    int           cpu_count;
+    taskset_t     deblock_taskset;   // Deblock segments - one per CPU
+    int           pass;              // DEBLOCK_PASS_* of the next cycle
+    hb_buffer_t * buf;               // Frame being deblocked
 };
 
+// Each segment has its own scratch area
+typedef struct deblock_thread_arg_s {
+    hb_filter_private_t *pv;
+    int segment;
+    int stride[3];
+    uint8_t * pp7_src[3];           // Padded copy of the segment's rows
+    int pp7_src_size[3];
+    DCTELEM * pp7_temp;             // Vertical transforms of one row
+    int pp7_temp_size;
+} deblock_thread_arg_t;
+
 static int hb_deblock_init( hb_filter_object_t * filter,
                             hb_filter_init_t * init );
 
@@ -68,6 +106,7 @@ hb_filter_object_t hb_filter_deblock =
     .init          = hb_deblock_init,
     .work          = hb_deblock_work,
     .close         = hb_deblock_close,
+    .flags         = HB_FILTER_FLAG_INPLACE,
 };
 
 static inline void pp7_dct_a( DCTELEM * dst, uint8_t * src, int stride )
@@ -141,6 +180,14 @@ static const int pp7_factor[16] =
 };
 
 static int pp7_threshold[99][16];
+static int16_t pp7_threshold16[99][16];
+static const int16_t __attribute__((aligned(16))) pp7_factor16[16] =
+{
+    N/(N0*N0), N/(N0*N1), N/(N0*N0),N/(N0*N2),
+    N/(N1*N0), N/(N1*N1), N/(N1*N0),N/(N1*N2),
+    N/(N0*N0), N/(N0*N1), N/(N0*N0),N/(N0*N2),
+    N/(N2*N0), N/(N2*N1), N/(N2*N0),N/(N2*N2),
+};
 
 static void pp7_init_threshold( void )
 {
@@ -154,6 +201,7 @@ static void pp7_init_threshold( void )
             pp7_threshold[qp][i] =
                 ((i&1)?SN2:SN0) * ((i&4)?SN2:SN0) *
                  XMAX(1,qp) * (1<<2) - 1 - bias;
+            pp7_threshold16[qp][i] = pp7_threshold[qp][i];
         }
     }
 }
@@ -236,108 +284,580 @@ static int pp7_soft_threshold( DCTELEM * src, int qp )
     return (a + (1<<11)) >> 12;
 }
 
-static int ( * pp7_requantize )( DCTELEM * src, int qp ) = pp7_hard_threshold;
+static int pp7_requantize( DCTELEM * src, int qp, int mode )
+{
+    switch( mode )
+    {
+        case 1:
+            return pp7_soft_threshold( src, qp );
+        case 2:
+            return pp7_medium_threshold( src, qp );
+        default:
+            return pp7_hard_threshold( src, qp );
+    }
+}
 
-static void pp7_filter( hb_filter_private_t * pv,
-                        uint8_t * dst,
-                        uint8_t * src,
-                        int width,
-                        int height,
-                        uint8_t * qp_store,
-                        int qp_stride,
-                        int is_luma)
+/*
+ * Row functions.  pp7_dct_a is run on every group of 4 columns of a row
+ * up front, leaving the vertical transform of column c at temp[4*c].
+ * The filter_block functions then finish the transform, requantize and
+ * dither output pixels [x, end) of the row, which all use the same qp.
+ */
+static void pp7_dct_a_row_c( DCTELEM * temp, uint8_t * src, int stride,
+                             int count )
 {
-    int x, y;
+    int c;
 
-    const int  stride = is_luma ? pv->pp7_temp_stride : ((width+16+15)&(~15));
-    uint8_t  * p_src  = pv->pp7_src + 8*stride;
-    DCTELEM  * block  = (DCTELEM *)(pv->pp7_src);
-    DCTELEM  * temp   = (DCTELEM *)(pv->pp7_src + 32);
+    for( c = 0; c < count; c += 4 )
+    {
+        pp7_dct_a( temp + 4*c, src + c, stride );
+    }
+}
 
-    if( !src || !dst )
+static void pp7_filter_block_c( DCTELEM * temp, uint8_t * dst, int x,
+                                int end, int qp, const uint8_t * dither,
+                                int mode )
+{
+    DCTELEM block[16];
+    int v;
+
+    for( ; x < end; x++ )
     {
-        return;
+        pp7_dct_b( block, temp + 4*x );
+
+        v = pp7_requantize( block, qp, mode );
+        v = (v + dither[x&7]) >> 6;
+        if( (unsigned)v > 255 )
+        {
+            v = (-v) >> 31;
+        }
+        dst[x] = v;
     }
+}
 
-    for( y = 0; y < height; y++ )
+#if PP7_X86
+/*
+ * SSE2 and AVX2 versions of the row functions.  The transforms are done
+ * in 16 bit lanes, which gives the same low 16 bits the C code stores in
+ * a DCTELEM.  A coefficient passes the threshold when |level| > t1, which
+ * is what the unsigned compares of the C code test.
+ */
+__attribute__((target("sse2")))
+static void pp7_dct_a_row_sse2( DCTELEM * temp, uint8_t * src, int stride,
+                                int count )
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i r0, r1, r2, r3, r4, r5, r6;
+    __m128i s, s0, s1, s2, s3, d0, d1, d2, d3, t01, t23;
+    int c;
+
+    for( c = 0; c + 8 <= count; c += 8 )
     {
-        int index = 8 + 8*stride + y*stride;
-        memcpy( p_src + index, src + y*width, width );
+        uint8_t * p = src + c;
+
+        r0 = _mm_unpacklo_epi8( _mm_loadl_epi64( (__m128i*)(p + 0*stride) ), zero );
+        r1 = _mm_unpacklo_epi8( _mm_loadl_epi64( (__m128i*)(p + 1*stride) ), zero );
+        r2 = _mm_unpacklo_epi8( _mm_loadl_epi64( (__m128i*)(p + 2*stride) ), zero );
+        r3 = _mm_unpacklo_epi8( _mm_loadl_epi64( (__m128i*)(p + 3*stride) ), zero );
+        r4 = _mm_unpacklo_epi8( _mm_loadl_epi64( (__m128i*)(p + 4*stride) ), zero );
+        r5 = _mm_unpacklo_epi8( _mm_loadl_epi64( (__m128i*)(p + 5*stride) ), zero );
+        r6 = _mm_unpacklo_epi8( _mm_loadl_epi64( (__m128i*)(p + 6*stride) ), zero );
+
+        s0 = _mm_add_epi16( r0, r6 );
+        s1 = _mm_add_epi16( r1, r5 );
+        s2 = _mm_add_epi16( r2, r4 );
+        s  = _mm_add_epi16( r3, r3 );
+
+        s3 = _mm_sub_epi16( s, s0 );
+        s0 = _mm_add_epi16( s, s0 );
+        s  = _mm_add_epi16( s2, s1 );
+        s2 = _mm_sub_epi16( s2, s1 );
+
+        d0 = _mm_add_epi16( s0, s );
+        d2 = _mm_sub_epi16( s0, s );
+        d1 = _mm_add_epi16( _mm_add_epi16( s3, s3 ), s2 );
+        d3 = _mm_sub_epi16( s3, _mm_add_epi16( s2, s2 ) );
+
+        // Interleave to 4 coefficients per column
+        t01 = _mm_unpacklo_epi16( d0, d1 );
+        t23 = _mm_unpacklo_epi16( d2, d3 );
+        _mm_storeu_si128( (__m128i*)(temp + 4*c +  0), _mm_unpacklo_epi32( t01, t23 ) );
+        _mm_storeu_si128( (__m128i*)(temp + 4*c +  8), _mm_unpackhi_epi32( t01, t23 ) );
+        t01 = _mm_unpackhi_epi16( d0, d1 );
+        t23 = _mm_unpackhi_epi16( d2, d3 );
+        _mm_storeu_si128( (__m128i*)(temp + 4*c + 16), _mm_unpacklo_epi32( t01, t23 ) );
+        _mm_storeu_si128( (__m128i*)(temp + 4*c + 24), _mm_unpackhi_epi32( t01, t23 ) );
+    }
+    pp7_dct_a_row_c( temp + 4*c, src + c, stride, count - c );
+}
+
+/*
+ * Requantize one row of coefficients of the blocks in level.  t1 holds
+ * the thresholds and lane0 selects the DC coefficients, which are always
+ * kept as they are.  Like pp7_requantize(), any mode other than soft (1)
+ * or medium (2) is a hard threshold.
+ */
+__attribute__((target("sse2")))
+static inline __m128i pp7_threshold_sse2( __m128i level, __m128i t1,
+                                          __m128i lane0, int mode )
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i neg_t1 = _mm_sub_epi16( zero, t1 );
+    __m128i pass, val, adj;
 
+    pass = _mm_or_si128( _mm_cmpgt_epi16( level, t1 ),
+                         _mm_cmpgt_epi16( neg_t1, level ) );
+    if( mode != 1 && mode != 2 )
+    {
+        val = level;
+    }
+    else
+    {
+        // level - t1 for positive levels, level + t1 for negative ones
+        adj = _mm_sub_epi16( level,
+                _mm_or_si128( _mm_and_si128( _mm_cmpgt_epi16( level, zero ), t1 ),
+                              _mm_andnot_si128( _mm_cmpgt_epi16( level, zero ),
+                                                neg_t1 ) ) );
+        if( mode == 2 )
+        {
+            __m128i t2 = _mm_add_epi16( t1, t1 );
+            __m128i keep = _mm_or_si128(
+                                _mm_cmpgt_epi16( level, t2 ),
+                                _mm_cmpgt_epi16( _mm_sub_epi16( zero, t2 ), level ) );
+            val = _mm_or_si128( _mm_and_si128( keep, level ),
+                                _mm_andnot_si128( keep, _mm_add_epi16( adj, adj ) ) );
+        }
+        else
+        {
+            val = adj;
+        }
+    }
+    val = _mm_and_si128( val, pass );
+    return _mm_or_si128( _mm_and_si128( lane0, level ),
+                         _mm_andnot_si128( lane0, val ) );
+}
+
+// Two pixels at a time, a row of a block is 4 DCTELEMs
+__attribute__((target("sse2")))
+static void pp7_filter_block_sse2( DCTELEM * temp, uint8_t * dst, int x,
+                                   int end, int qp, const uint8_t * dither,
+                                   int mode )
+{
+    const int16_t * thr = pp7_threshold16[qp];
+    const __m128i lane0 = _mm_setr_epi16( -1, 0, 0, 0, -1, 0, 0, 0 );
+    __m128i t[4], f[4];
+    __m128i r0, r1, r2, r3, r4, r5, r6;
+    __m128i s, s0, s1, s2, s3, acc;
+    int j, v;
+
+    for( j = 0; j < 4; j++ )
+    {
+        t[j] = _mm_loadl_epi64( (__m128i*)(thr + 4*j) );
+        t[j] = _mm_unpacklo_epi64( t[j], t[j] );
+        f[j] = _mm_loadl_epi64( (__m128i*)(pp7_factor16 + 4*j) );
+        f[j] = _mm_unpacklo_epi64( f[j], f[j] );
+    }
+
+    for( ; x + 2 <= end; x += 2 )
+    {
+        DCTELEM * tp = temp + 4*x;
+
+        r0 = _mm_loadu_si128( (__m128i*)(tp + 0*4) );
+        r1 = _mm_loadu_si128( (__m128i*)(tp + 1*4) );
+        r2 = _mm_loadu_si128( (__m128i*)(tp + 2*4) );
+        r3 = _mm_loadu_si128( (__m128i*)(tp + 3*4) );
+        r4 = _mm_loadu_si128( (__m128i*)(tp + 4*4) );
+        r5 = _mm_loadu_si128( (__m128i*)(tp + 5*4) );
+        r6 = _mm_loadu_si128( (__m128i*)(tp + 6*4) );
+
+        s0 = _mm_add_epi16( r0, r6 );
+        s1 = _mm_add_epi16( r1, r5 );
+        s2 = _mm_add_epi16( r2, r4 );
+        s  = _mm_add_epi16( r3, r3 );
+
+        s3 = _mm_sub_epi16( s, s0 );
+        s0 = _mm_add_epi16( s, s0 );
+        s  = _mm_add_epi16( s2, s1 );
+        s2 = _mm_sub_epi16( s2, s1 );
+
+        acc =                     _mm_madd_epi16( pp7_threshold_sse2(
+                    _mm_add_epi16( s0, s ), t[0], lane0, mode ), f[0] );
+        acc = _mm_add_epi32( acc, _mm_madd_epi16( pp7_threshold_sse2(
+                    _mm_add_epi16( _mm_add_epi16( s3, s3 ), s2 ),
+                    t[1], _mm_setzero_si128(), mode ), f[1] ) );
+        acc = _mm_add_epi32( acc, _mm_madd_epi16( pp7_threshold_sse2(
+                    _mm_sub_epi16( s0, s ),
+                    t[2], _mm_setzero_si128(), mode ), f[2] ) );
+        acc = _mm_add_epi32( acc, _mm_madd_epi16( pp7_threshold_sse2(
+                    _mm_sub_epi16( s3, _mm_add_epi16( s2, s2 ) ),
+                    t[3], _mm_setzero_si128(), mode ), f[3] ) );
+
+        // Sums for the two pixels end up in lanes 0 and 2
+        acc = _mm_add_epi32( acc, _mm_srli_epi64( acc, 32 ) );
+
+        v = (_mm_cvtsi128_si32( acc ) + (1<<11)) >> 12;
+        v = (v + dither[x&7]) >> 6;
+        if( (unsigned)v > 255 )
+        {
+            v = (-v) >> 31;
+        }
+        dst[x] = v;
+
+        v = (_mm_cvtsi128_si32( _mm_srli_si128( acc, 8 ) ) + (1<<11)) >> 12;
+        v = (v + dither[(x+1)&7]) >> 6;
+        if( (unsigned)v > 255 )
+        {
+            v = (-v) >> 31;
+        }
+        dst[x+1] = v;
+    }
+    pp7_filter_block_c( temp, dst, x, end, qp, dither, mode );
+}
+
+#ifdef AV_CPU_FLAG_AVX2
+__attribute__((target("avx2")))
+static inline __m256i pp7_threshold_avx2( __m256i level, __m256i t1,
+                                          __m256i lane0, int mode )
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i neg_t1 = _mm256_sub_epi16( zero, t1 );
+    __m256i pass, val, adj;
+
+    pass = _mm256_or_si256( _mm256_cmpgt_epi16( level, t1 ),
+                            _mm256_cmpgt_epi16( neg_t1, level ) );
+    if( mode != 1 && mode != 2 )
+    {
+        val = level;
+    }
+    else
+    {
+        adj = _mm256_sub_epi16( level,
+                _mm256_blendv_epi8( neg_t1, t1,
+                                    _mm256_cmpgt_epi16( level, zero ) ) );
+        if( mode == 2 )
+        {
+            __m256i t2 = _mm256_add_epi16( t1, t1 );
+            __m256i keep = _mm256_or_si256(
+                                _mm256_cmpgt_epi16( level, t2 ),
+                                _mm256_cmpgt_epi16( _mm256_sub_epi16( zero, t2 ),
+                                                    level ) );
+            val = _mm256_blendv_epi8( _mm256_add_epi16( adj, adj ), level,
+                                      keep );
+        }
+        else
+        {
+            val = adj;
+        }
+    }
+    val = _mm256_and_si256( val, pass );
+    return _mm256_blendv_epi8( val, level, lane0 );
+}
+
+// Four pixels at a time
+__attribute__((target("avx2")))
+static void pp7_filter_block_avx2( DCTELEM * temp, uint8_t * dst, int x,
+                                   int end, int qp, const uint8_t * dither,
+                                   int mode )
+{
+    const int16_t * thr = pp7_threshold16[qp];
+    const __m256i lane0 = _mm256_set1_epi64x( 0xffff );
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i t[4], f[4];
+    __m256i r0, r1, r2, r3, r4, r5, r6;
+    __m256i s, s0, s1, s2, s3, acc;
+    int32_t sum[8] __attribute__((aligned(32)));
+    int i, j, v;
+
+    for( j = 0; j < 4; j++ )
+    {
+        int64_t q;
+
+        memcpy( &q, thr + 4*j, sizeof(q) );
+        t[j] = _mm256_set1_epi64x( q );
+        memcpy( &q, pp7_factor16 + 4*j, sizeof(q) );
+        f[j] = _mm256_set1_epi64x( q );
+    }
+
+    for( ; x + 4 <= end; x += 4 )
+    {
+        DCTELEM * tp = temp + 4*x;
+
+        r0 = _mm256_loadu_si256( (__m256i*)(tp + 0*4) );
+        r1 = _mm256_loadu_si256( (__m256i*)(tp + 1*4) );
+        r2 = _mm256_loadu_si256( (__m256i*)(tp + 2*4) );
+        r3 = _mm256_loadu_si256( (__m256i*)(tp + 3*4) );
+        r4 = _mm256_loadu_si256( (__m256i*)(tp + 4*4) );
+        r5 = _mm256_loadu_si256( (__m256i*)(tp + 5*4) );
+        r6 = _mm256_loadu_si256( (__m256i*)(tp + 6*4) );
+
+        s0 = _mm256_add_epi16( r0, r6 );
+        s1 = _mm256_add_epi16( r1, r5 );
+        s2 = _mm256_add_epi16( r2, r4 );
+        s  = _mm256_add_epi16( r3, r3 );
+
+        s3 = _mm256_sub_epi16( s, s0 );
+        s0 = _mm256_add_epi16( s, s0 );
+        s  = _mm256_add_epi16( s2, s1 );
+        s2 = _mm256_sub_epi16( s2, s1 );
+
+        acc =                        _mm256_madd_epi16( pp7_threshold_avx2(
+                    _mm256_add_epi16( s0, s ), t[0], lane0, mode ), f[0] );
+        acc = _mm256_add_epi32( acc, _mm256_madd_epi16( pp7_threshold_avx2(
+                    _mm256_add_epi16( _mm256_add_epi16( s3, s3 ), s2 ),
+                    t[1], zero, mode ), f[1] ) );
+        acc = _mm256_add_epi32( acc, _mm256_madd_epi16( pp7_threshold_avx2(
+                    _mm256_sub_epi16( s0, s ),
+                    t[2], zero, mode ), f[2] ) );
+        acc = _mm256_add_epi32( acc, _mm256_madd_epi16( pp7_threshold_avx2(
+                    _mm256_sub_epi16( s3, _mm256_add_epi16( s2, s2 ) ),
+                    t[3], zero, mode ), f[3] ) );
+
+        // Sums for the four pixels end up in lanes 0, 2, 4 and 6
+        acc = _mm256_add_epi32( acc, _mm256_srli_epi64( acc, 32 ) );
+        _mm256_store_si256( (__m256i*)sum, acc );
+
+        for( i = 0; i < 4; i++ )
+        {
+            v = (sum[2*i] + (1<<11)) >> 12;
+            v = (v + dither[(x+i)&7]) >> 6;
+            if( (unsigned)v > 255 )
+            {
+                v = (-v) >> 31;
+            }
+            dst[x+i] = v;
+        }
+    }
+    pp7_filter_block_sse2( temp, dst, x, end, qp, dither, mode );
+}
+#endif
+#endif
+
+static void pp7_dsp_init( pp7_dsp_t * dsp )
+{
+    dsp->dct_a_row    = pp7_dct_a_row_c;
+    dsp->filter_block = pp7_filter_block_c;
+
+#if PP7_X86
+    int cpu_flags = av_get_cpu_flags();
+
+    if( cpu_flags & AV_CPU_FLAG_SSE2 )
+    {
+        dsp->dct_a_row    = pp7_dct_a_row_sse2;
+        dsp->filter_block = pp7_filter_block_sse2;
+    }
+#ifdef AV_CPU_FLAG_AVX2
+    if( cpu_flags & AV_CPU_FLAG_AVX2 )
+    {
+        dsp->filter_block = pp7_filter_block_avx2;
+    }
+#endif
+#endif
+}
+
+/*
+ * Copy rows [y_start, y_stop) of a plane into the padded scratch area of
+ * a segment, along with 8 rows above and below.  Rows and columns beyond
+ * the edges of the plane are mirrored.
+ */
+static void pp7_copy_band( uint8_t * p_src, int stride, uint8_t * src,
+                           int width, int height, int y_start, int y_stop )
+{
+    int x, y;
+
+    for( y = y_start - 8; y < y_stop + 8; y++ )
+    {
+        int sy = y;
+        uint8_t * row = p_src + (y - y_start + 8)*stride + 8;
+
+        if( sy < 0 )
+        {
+            sy = -sy - 1;
+        }
+        if( sy >= height )
+        {
+            sy = 2*height - sy - 1;
+        }
+        sy = XMAX( 0, XMIN( sy, height - 1 ) );
+
+        memcpy( row, src + sy*width, width );
         for( x = 0; x < 8; x++ )
         {
-            p_src[index         - x - 1] = p_src[index +         x    ];
-            p_src[index + width + x    ] = p_src[index + width - x - 1];
+            row[        - x - 1] = row[        x    ];
+            row[width + x    ] = row[width - x - 1];
         }
     }
+}
 
-    for( y = 0; y < 8; y++ )
+/*
+ * Bring a decoder quantizer to the MPEG-1 scale of pp7_threshold16.
+ */
+static inline int pp7_norm_qscale( int qscale, int type )
+{
+    switch( type )
     {
-        memcpy( p_src + (     7-y)*stride,
-                p_src + (     y+8)*stride, stride );
-        memcpy( p_src + (height+8+y)*stride,
-                p_src + (height-y+7)*stride, stride );
+        case HB_QSCALE_TYPE_MPEG1:
+            return qscale;
+        case HB_QSCALE_TYPE_MPEG2:
+            return qscale >> 1;
+        case HB_QSCALE_TYPE_H264:
+            return qscale >> 2;
+        case HB_QSCALE_TYPE_VP56:
+            return ( 63 - qscale + 2 ) >> 2;
     }
+    return qscale;
+}
 
-    for( y = 0; y < height; y++ )
+/*
+ * Quantizer of the macroblock at column mb_x of macroblock row mb_y.
+ * The plane may be a little wider than the decoded picture.
+ */
+static inline int pp7_table_qp( const struct qp * qp_table, int mb_x, int mb_y )
+{
+    mb_x = XMIN( mb_x, qp_table->width - 1 );
+    mb_y = XMIN( mb_y, qp_table->height - 1 );
+
+    return pp7_norm_qscale( qp_table->table->data[mb_x +
+                                                  mb_y * qp_table->stride],
+                            qp_table->type );
+}
+
+static void pp7_filter( hb_filter_private_t * pv,
+                        deblock_thread_arg_t * segment,
+                        int plane,
+                        uint8_t * dst,
+                        int width,
+                        int y_start,
+                        int y_stop,
+                        const struct qp * qp_table,
+                        int is_luma)
+{
+    int x, y;
+
+    const int  stride = segment->stride[plane];
+    uint8_t  * p_src  = segment->pp7_src[plane];
+    DCTELEM  * temp   = segment->pp7_temp;
+    const int  count  = 4 * ( 2 + (width + 3) / 4 );
+    const int  qps    = 3 + is_luma;
+
+    for( y = y_start; y < y_stop; y++ )
     {
-        for( x = -8; x < 0; x += 4 )
+        if( qp_table )
         {
-            const int index = x + y*stride + (8-3)*(1+stride) + 8;
-            uint8_t * src   = p_src + index;
-            DCTELEM * tp    = temp+4*x;
+            // The frame is filtered in place, so a row without any block
+            // that needs deblocking can be skipped entirely.
+            int mb_x, mb_width = XMIN( qp_table->width,
+                                       ( width + (1 << qps) - 1 ) >> qps );
 
-            pp7_dct_a( tp+4*8, src, stride );
+            for( mb_x = 0; mb_x < mb_width; mb_x++ )
+            {
+                if( pp7_table_qp( qp_table, mb_x, y >> qps ) > PP7_QP_SKIP )
+                {
+                    break;
+                }
+            }
+            if( mb_x == mb_width )
+            {
+                continue;
+            }
         }
 
+        // p_src row 8 is plane row y_start
+        pv->dsp.dct_a_row( temp, p_src + (y - y_start + 5)*stride + 5,
+                           stride, count );
+
         for( x = 0; x < width; )
         {
-            const int qps = 3 + is_luma;
             int end = XMIN(x+8, width);
 
             int qp;
-            if( pv->pp7_qp )
+            if( qp_table )
             {
-                qp = pv->pp7_qp;
+                qp = pp7_table_qp( qp_table, x >> qps, y >> qps );
+                if( qp <= PP7_QP_SKIP )
+                {
+                    x = end;
+                    continue;
+                }
             }
             else
             {
-                qp = qp_store[ (XMIN(x, width-1)>>qps) +
-                               (XMIN(y, height-1)>>qps) * qp_stride ];
-
-                if( pv->pp7_mpeg2 )
-                {
-                    qp >>= 1;
-                }
+                qp = pv->pp7_qp ? pv->pp7_qp : PP7_QP_DEFAULT;
             }
 
-            for( ; x < end; x++ )
-            {
-                const int index = x + y*stride + (8-3)*(1+stride) + 8;
-                uint8_t * src   = p_src + index;
-                DCTELEM * tp    = temp+4*x;
-                int v;
+            pv->dsp.filter_block( temp, dst + y*width, x, end, qp,
+                                  pp7_dither[y&7], pv->pp7_mode );
+            x = end;
+        }
+    }
+}
 
-                if( (x&3) == 0 )
-                {
-                    pp7_dct_a( tp+4*8, src, stride );
-                }
+/*
+ * Deblock this segment of all three planes.
+ * Runs on the shared worker pool once per taskset_cycle().
+ *
+ * Filtering a pixel reads 3 rows above and below it.  The frame is
+ * filtered in place, so every segment first copies its band of each
+ * plane into its own scratch area (DEBLOCK_PASS_COPY) before any
+ * segment writes to the frame (DEBLOCK_PASS_FILTER).
+ */
+static void deblock_filter_thread( void *thread_args_v )
+{
+    deblock_thread_arg_t *segment = thread_args_v;
+    hb_filter_private_t * pv = segment->pv;
+    hb_buffer_t * buf = pv->buf;
+    int plane;
 
-                pp7_dct_b( block, tp );
+    for( plane = 0; plane < 3; plane++ )
+    {
+        int width  = buf->plane[plane].stride;
+        int height = buf->plane[plane].height;
+        int y_start, y_stop;
 
-                v = pp7_requantize( block, qp );
-                v = (v + pp7_dither[y&7][x&7]) >> 6;
-                if( (unsigned)v > 255 )
-                {
-                    v = (-v) >> 31;
-                }
-                dst[x + y*width] = v;
+        y_start = height * segment->segment / pv->cpu_count;
+        y_stop  = height * ( segment->segment + 1 ) / pv->cpu_count;
+        if( y_start >= y_stop )
+        {
+            continue;
+        }
+
+        if( pv->pass == DEBLOCK_PASS_COPY )
+        {
+            int stride = (width+16+15)&(~15);
+            int size   = stride * ( y_stop - y_start + 16 );
+            int temp   = 4 * 4 * ( 2 + (width + 3) / 4 ) + 16;
+
+            if( segment->pp7_src_size[plane] < size )
+            {
+                free( segment->pp7_src[plane] );
+                segment->pp7_src[plane] = malloc( size );
+                segment->pp7_src_size[plane] = size;
             }
+            if( segment->pp7_temp_size < temp )
+            {
+                free( segment->pp7_temp );
+                segment->pp7_temp = malloc( temp * sizeof(DCTELEM) );
+                segment->pp7_temp_size = temp;
+            }
+            segment->stride[plane] = stride;
+            pp7_copy_band( segment->pp7_src[plane], stride,
+                           buf->plane[plane].data, width, height,
+                           y_start, y_stop );
+        }
+        else
+        {
+            // Only with QP 0, otherwise the strength is fixed
+            const struct qp * qp_table = NULL;
+            if( !pv->pp7_qp && buf->qp.table )
+            {
+                qp_table = &buf->qp;
+            }
+            pp7_filter( pv, segment, plane, buf->plane[plane].data, width,
+                        y_start, y_stop, qp_table, plane == 0 );
         }
     }
 }
 
-static int hb_deblock_init( hb_filter_object_t * filter, 
+static int hb_deblock_init( hb_filter_object_t * filter,
                             hb_filter_init_t * init )
 {
     filter->private_data = calloc( sizeof(struct hb_filter_private_s), 1 );
@@ -345,7 +865,6 @@ static int hb_deblock_init( hb_filter_object_t * filter,
 
     pv->pp7_qp    = PP7_QP_DEFAULT;
     pv->pp7_mode  = PP7_MODE_DEFAULT;
-    pv->pp7_mpeg2 = 1; /*mpi->qscale_type;*/
 
     if( filter->settings )
     {
@@ -358,25 +877,34 @@ static int hb_deblock_init( hb_filter_object_t * filter,
     }
 
     pp7_init_threshold();
+    pp7_dsp_init( &pv->dsp );
 
-    switch( pv->pp7_mode )
+    pv->cpu_count = hb_get_cpu_count();
+
+    /*
+     * Create deblock taskset.
+     */
+    if( taskset_init( &pv->deblock_taskset, hb_taskpool_get( init->job->h ),
+                      "deblock_filter_segment", pv->cpu_count,
+                      sizeof( deblock_thread_arg_t ),
+                      deblock_filter_thread ) == 0 )
     {
-        case 0:
-            pp7_requantize = pp7_hard_threshold;
-            break;
-        case 1:
-            pp7_requantize = pp7_soft_threshold;
-            break;
-        case 2:
-            pp7_requantize = pp7_medium_threshold;
-            break;
+        hb_error( "deblock could not initialize taskset" );
     }
 
-    int h = (init->height+16+15)&(~15);
-
-    pv->pp7_temp_stride = (init->width+16+15)&(~15);
+    int i;
+    for( i = 0; i < pv->cpu_count; i++ )
+    {
+        deblock_thread_arg_t *thread_args;
 
-    pv->pp7_src = (uint8_t*)malloc( pv->pp7_temp_stride*(h+8)*sizeof(uint8_t) );
+        thread_args = taskset_thread_args( &pv->deblock_taskset, i );
+        if( thread_args == NULL )
+        {
+            break;
+        }
+        thread_args->pv = pv;
+        thread_args->segment = i;
+    }
 
     return 0;
 }
@@ -384,12 +912,27 @@ static int hb_deblock_init( hb_filter_object_t * filter,
 static void hb_deblock_close( hb_filter_object_t * filter )
 {
     hb_filter_private_t * pv = filter->private_data;
+    int i, plane;
 
     if( !pv )
     {
         return;
     }
 
+    for( i = 0; pv->deblock_taskset.task_threads_args != NULL &&
+                i < pv->cpu_count; i++ )
+    {
+        deblock_thread_arg_t *thread_args;
+
+        thread_args = taskset_thread_args( &pv->deblock_taskset, i );
+        for( plane = 0; plane < 3; plane++ )
+        {
+            free( thread_args->pp7_src[plane] );
+        }
+        free( thread_args->pp7_temp );
+    }
+    taskset_fini( &pv->deblock_taskset );
+
     free( pv );
     filter->private_data = NULL;
 }
@@ -399,7 +942,7 @@ static int hb_deblock_work( hb_filter_object_t * filter,
                             hb_buffer_t ** buf_out )
 {
     hb_filter_private_t * pv = filter->private_data;
-    hb_buffer_t * in = *buf_in, * out;
+    hb_buffer_t * in = *buf_in;
 
     if ( in->size <= 0 )
     {
@@ -408,47 +951,22 @@ static int hb_deblock_work( hb_filter_object_t * filter,
         return HB_FILTER_DONE;
     }
 
-    if( /*TODO: mpi->qscale ||*/ pv->pp7_qp )
-    {
-        out = hb_video_buffer_init( in->f.width, in->f.height );
-
-        pp7_filter( pv,
-                out->plane[0].data,
-                in->plane[0].data,
-                in->plane[0].stride,
-                in->plane[0].height,
-                NULL, /* TODO: mpi->qscale*/
-                0,    /* TODO: mpi->qstride*/
-                1 );
-
-        pp7_filter( pv,
-                out->plane[1].data,
-                in->plane[1].data,
-                in->plane[1].stride,
-                in->plane[1].height,
-                NULL, /* TODO: mpi->qscale*/
-                0,    /* TODO: mpi->qstride*/
-                0 );
-
-        pp7_filter( pv,
-                out->plane[2].data,
-                in->plane[2].data,
-                in->plane[2].stride,
-                in->plane[2].height,
-                NULL, /* TODO: mpi->qscale*/
-                0,    /* TODO: mpi->qstride*/
-                0 );
-
-        out->s = in->s;
-        hb_buffer_move_subs( out, in );
-
-        *buf_out = out;
-    }
-    else
-    {
-        *buf_in = NULL;
-        *buf_out = in;
-    }
+    // pp7_filter() works from a padded copy of each plane, so the
+    // result can be written in place (HB_FILTER_FLAG_INPLACE).
+    // With QP 0, frames that come without the decoder's quantizers are
+    // deblocked at PP7_QP_DEFAULT.
+    pv->buf = in;
+
+    pv->pass = DEBLOCK_PASS_COPY;
+    taskset_cycle( &pv->deblock_taskset );
+
+    pv->pass = DEBLOCK_PASS_FILTER;
+    taskset_cycle( &pv->deblock_taskset );
+
+    pv->buf = NULL;
+
+    *buf_in = NULL;
+    *buf_out = in;
 
     return HB_FILTER_OK;
 }
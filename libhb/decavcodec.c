@@ -572,6 +572,35 @@ static uint8_t *copy_plane( uint8_t *dst, uint8_t* src, int dstride, int sstride
     return dst;
 }
 
+// Attach a copy of the decoder's per macroblock quantizers to buf
+// (for the deblock filter).  Only valid when buf has the geometry
+// of the decoded frame.
+static void copy_qp_table( hb_work_private_t *pv, AVFrame *frame,
+                           hb_buffer_t *buf )
+{
+    AVCodecContext *context = pv->context;
+    int y, mb_width, mb_height;
+
+    if ( frame->qscale_table == NULL || frame->qstride <= 0 )
+        return;
+
+    mb_width  = ( context->width + 15 ) >> 4;
+    mb_height = ( context->height + 15 ) >> 4;
+    if ( frame->qstride < mb_width )
+        return;
+
+    buf->qp.table = hb_buffer_init( mb_width * mb_height );
+    for ( y = 0; y < mb_height; y++ )
+    {
+        memcpy( buf->qp.table->data + y * mb_width,
+                frame->qscale_table + y * frame->qstride, mb_width );
+    }
+    buf->qp.stride = mb_width;
+    buf->qp.width  = mb_width;
+    buf->qp.height = mb_height;
+    buf->qp.type   = frame->qscale_type;
+}
+
 // copy one video frame into an HB buf. If the frame isn't in our color space
 // or at least one of its dimensions is odd, use sws_scale to convert/rescale it.
 // Otherwise just copy the bits.
@@ -592,7 +621,7 @@ static hb_buffer_t *copy_frame( hb_work_private_t *pv, AVFrame *frame )
         w =  pv->job->title->width;
         h =  pv->job->title->height;
     }
-    hb_buffer_t *buf = hb_video_buffer_init( w, h );
+    hb_buffer_t *buf = hb_video_buffer_init_nozero( w, h );
     uint8_t *dst = buf->data;
 
     if (context->pix_fmt != AV_PIX_FMT_YUV420P || w != context->width ||
@@ -636,6 +665,11 @@ static hb_buffer_t *copy_frame( hb_work_private_t *pv, AVFrame *frame )
         h = buf->plane[2].height;
         dst = buf->plane[2].data;
         copy_plane( dst, frame->data[2], w, frame->linesize[2], h );
+
+        if ( pv->job )
+        {
+            copy_qp_table( pv, frame, buf );
+        }
     }
     return buf;
 }
@@ -306,6 +306,9 @@ static hb_buffer_t *hb_copy_frame( hb_libmpeg2_t *m )
 
     hb_buffer_t *buf  = hb_video_buffer_init( dst_w, dst_h );
     buf->s.start = -1;
+    // libmpeg2 doesn't export the quantizers of its macroblocks, so unlike
+    // decavcodec's frames these carry no buf->qp table for the deblock
+    // filter.
 
     AVPicture in, out, pic_crop;
 
@@ -40,6 +40,7 @@ Original "Faster" settings:
 #define MODE_GAMMA      128 // Scale gamma when decombing
 #define MODE_FILTER     256 // Filter combing mask
 #define MODE_COMPOSITE  512 // Overlay combing mask onto picture
+#define MODE_SPARSE     1024 // Comb detect every other line pair only
 
 #define FILTER_CLASSIC 1
 #define FILTER_ERODE_DILATE 2
@@ -75,6 +76,11 @@ which will feed EEDI2 interpolations to yadif.
 
 12-15: EEDI2 will override cubic interpolation
 16: DOES NOT WORK BY ITSELF-- mcdeint needs to be fed by another deinterlacer
+
++1024: Sparse comb detection. Only every other line pair is checked for
+       combing, and detection stops at the first block over the threshold.
+       Replaces the mask filter (256), see check_sparse_combing().
+       Ignored with 32 or 512, which need the whole mask.
 *****/
 
 #include "hb.h"
@@ -83,6 +89,7 @@ which will feed EEDI2 interpolations to yadif.
 #include "eedi2.h"
 #include "mcdeint.h"
 #include "taskset.h"
+#include "yadif.h"
 
 #define PARITY_DEFAULT   -1
 
@@ -106,6 +113,32 @@ which will feed EEDI2 interpolations to yadif.
 #define TMP2PF 3
 #define DST2MPF 4
 
+// The eedi2 passes, each one runs on all bands of all planes at once
+#define EEDI2_EDGE_MASK             0
+#define EEDI2_ERODE_EDGE_MASK       1
+#define EEDI2_DILATE_EDGE_MASK      2
+#define EEDI2_ERODE_EDGE_MASK2      3
+#define EEDI2_REMOVE_SMALL_GAPS     4
+#define EEDI2_CALC_DIRECTIONS       5
+#define EEDI2_FILTER_DIR_MAP        6
+#define EEDI2_EXPAND_DIR_MAP        7
+#define EEDI2_FILTER_MAP            8
+#define EEDI2_UPSCALE_BY_2          9
+#define EEDI2_MARK_DIRECTIONS_2X    10
+#define EEDI2_FILTER_DIR_MAP_2X     11
+#define EEDI2_EXPAND_DIR_MAP_2X     12
+#define EEDI2_FILL_GAPS_2X          13
+#define EEDI2_FILL_GAPS_2X2         14
+#define EEDI2_INTERPOLATE_LATTICE   15
+#define EEDI2_COPY_DIR_MAP_2X       16
+#define EEDI2_POST_PROCESS          17
+#define EEDI2_BLUR1_HORIZONTAL      18
+#define EEDI2_BLUR1_VERTICAL        19
+#define EEDI2_CALC_DERIVATIVES      20
+#define EEDI2_BLUR_SQRT2_HORIZONTAL 21
+#define EEDI2_BLUR_SQRT2_VERTICAL   22
+#define EEDI2_POST_PROCESS_CORNER   23
+
 struct yadif_arguments_s {
     hb_buffer_t *dst;
     int parity;
@@ -117,7 +150,7 @@ typedef struct yadif_arguments_s yadif_arguments_t;
 
 typedef struct eedi2_thread_arg_s {
     hb_filter_private_t *pv;
-    int plane;
+    int segment;
 } eedi2_thread_arg_t;
 
 typedef struct decomb_thread_arg_s {
@@ -167,6 +200,7 @@ struct hb_filter_private_s
     int              tff;
 
     int              yadif_ready;
+    yadif_dsp_t      yadif_dsp;
 
     int              mcdeint_mode;
     mcdeint_private_t mcdeint;
@@ -188,24 +222,26 @@ struct hb_filter_private_s
 
     hb_buffer_t    * eedi_half[4];
     hb_buffer_t    * eedi_full[5];
-    int            * cx2;
-    int            * cy2;
-    int            * cxy;
-    int            * tmpc;
+    int            * cx2[3];
+    int            * cy2[3];
+    int            * cxy[3];
+    int            * tmpc[3];
+    int              eedi2_pass;          // EEDI2_* pass of the next cycle
+    int              eedi2_derivative;    // 0 - 2: cx2, cy2, cxy being blurred
 
     int              cpu_count;
     int              segment_height[3];
 
-    taskset_t        yadif_taskset;       // Threads for Yadif - one per CPU
+    taskset_t        yadif_taskset;       // Yadif segments - one per CPU
     yadif_arguments_t *yadif_arguments;   // Arguments to thread for work
 
-    taskset_t        decomb_filter_taskset; // Threads for comb detection
-    taskset_t        decomb_check_taskset;  // Threads for comb check
-    taskset_t        mask_filter_taskset; // Threads for decomb mask filter
-    taskset_t        mask_erode_taskset;  // Threads for decomb mask erode
-    taskset_t        mask_dilate_taskset; // Threads for decomb mask dilate
+    taskset_t        decomb_filter_taskset; // Segments for comb detection
+    taskset_t        decomb_check_taskset;  // Segments for comb check
+    taskset_t        mask_filter_taskset; // Segments for decomb mask filter
+    taskset_t        mask_erode_taskset;  // Segments for decomb mask erode
+    taskset_t        mask_dilate_taskset; // Segments for decomb mask dilate
 
-    taskset_t        eedi2_taskset;       // Threads for eedi2 - one per plane
+    taskset_t        eedi2_taskset;       // Segments for eedi2 - one per CPU
 };
 
 static int hb_decomb_init( hb_filter_object_t * filter,
@@ -761,6 +797,12 @@ void detect_gamma_combed_segment( hb_filter_private_t * pv, int segment_start, i
 
             memset(mask, 0, stride);
 
+            if( ( pv->mode & MODE_SPARSE ) && ( y & 2 ) )
+            {
+                /* Sparse detection skips every other line pair */
+                continue;
+            }
+
             for( x = 0; x < width; x++ )
             {
                 float up_diff, down_diff;
@@ -874,6 +916,12 @@ void detect_combed_segment( hb_filter_private_t * pv, int segment_start, int seg
 
             memset(mask, 0, stride);
 
+            if( ( pv->mode & MODE_SPARSE ) && ( y & 2 ) )
+            {
+                /* Sparse detection skips every other line pair */
+                continue;
+            }
+
             for( x = 0; x < width; x++ )
             {
                 int up_diff = cur[0] - cur[up_1];
@@ -958,9 +1006,101 @@ void detect_combed_segment( hb_filter_private_t * pv, int segment_start, int seg
     }
 }
 
-// This function calls all the eedi2 filters in sequence for a given plane.
-// It outputs the final interpolated image to pv->eedi_full[DST2PF].
-void eedi2_interpolate_plane( hb_filter_private_t * pv, int plane )
+/*
+ * Sparse comb detection and check in one pass.  Only every other pair of
+ * lines is comb detected, and each row of blocks is checked right after
+ * it is detected, so detection stops once a block is over the threshold.
+ *
+ * In place of the mask filter, a pixel only counts when it is combed on
+ * both lines of its pair, next to another combed pixel, and on the
+ * neighbouring sampled pair as well.  Each counted pixel stands for the
+ * 4 mask pixels, two lines in two pairs, it would be in the full mask.
+ */
+void check_sparse_combing( hb_filter_private_t * pv, int segment, int start, int stop )
+{
+    int threshold       = pv->block_threshold;
+    int block_width     = pv->block_width;
+    int block_height    = pv->block_height;
+    int stride          = pv->mask->plane[0].stride;
+    int width           = pv->mask->plane[0].width;
+    int block_score;
+    int x, y, block_x, block_y;
+    uint8_t * top, * bottom, * near;
+
+    for( y = start; y < ( stop - block_height + 1 ); y = y + block_height )
+    {
+        if( pv->mode & MODE_GAMMA )
+        {
+            detect_gamma_combed_segment( pv, y, y + block_height );
+        }
+        else
+        {
+            detect_combed_segment( pv, y, y + block_height );
+        }
+
+        for( x = 0; x < ( width - block_width ); x = x + block_width )
+        {
+            block_score = 0;
+
+            for( block_y = ( y + 3 ) & ~3; block_y < y + block_height - 1;
+                 block_y += 4 )
+            {
+                top    = &pv->mask->plane[0].data[block_y * stride];
+                bottom = top + stride;
+
+                /* The sampled pair below, or above for the last pair of
+                   the block row, must be combed at the same place too. */
+                if( block_y + 5 < y + block_height )
+                {
+                    near = top + 4 * stride;
+                }
+                else if( block_y - 4 >= y )
+                {
+                    near = top - 4 * stride;
+                }
+                else
+                {
+                    near = NULL;
+                }
+
+                for( block_x = x; block_x < x + block_width; block_x++ )
+                {
+                    if( block_x > 0 && block_x < width - 1 &&
+                        top[block_x - 1] & top[block_x] & top[block_x + 1] &
+                        bottom[block_x] &&
+                        ( near == NULL || near[block_x] & near[block_x + stride] ) )
+                    {
+                        block_score += 4;
+                    }
+                }
+            }
+
+            if (pv->comb_check_complete)
+            {
+                // Some other thread found coming before this one
+                return;
+            }
+
+            if( block_score >= ( threshold / 2 ) )
+            {
+                pv->mask_box_x = x;
+                pv->mask_box_y = y;
+
+                pv->block_score[segment] = block_score;
+                if( block_score > threshold )
+                {
+                    pv->comb_check_complete = 1;
+                    return;
+                }
+            }
+        }
+    }
+}
+
+// This function runs one eedi2 filter on a band of rows of a given plane.
+// The passes run in sequence on the whole frame in eedi2_planer, the
+// last one outputs the final interpolated image to pv->eedi_full[DST2PF].
+void eedi2_interpolate_segment( hb_filter_private_t * pv, int plane, int segment )
 {
     /* We need all these pointers. No, seriously.
        I swear. It's not a joke. They're used.
@@ -974,114 +1114,169 @@ void eedi2_interpolate_plane( hb_filter_private_t * pv, int plane )
     uint8_t * msk2p = pv->eedi_full[MSK2PF]->plane[plane].data;
     uint8_t * tmp2p = pv->eedi_full[TMP2PF]->plane[plane].data;
     uint8_t * dst2mp = pv->eedi_full[DST2MPF]->plane[plane].data;
-    int * cx2 = pv->cx2;
-    int * cy2 = pv->cy2;
-    int * cxy = pv->cxy;
-    int * tmpc = pv->tmpc;
+    int * cx2 = pv->cx2[plane];
+    int * cy2 = pv->cy2[plane];
+    int * cxy = pv->cxy[plane];
+    int * tmpc = pv->tmpc[plane];
+    int * derivatives[3] = { cx2, cy2, cxy };
 
     int pitch = pv->eedi_full[0]->plane[plane].stride;
     int height = pv->eedi_full[0]->plane[plane].height;
     int width = pv->eedi_full[0]->plane[plane].width;
     int half_height = pv->eedi_half[0]->plane[plane].height;
 
-    // edge mask
-    eedi2_build_edge_mask( mskp, pitch, srcp, pitch,
-                     pv->magnitude_threshold, pv->variance_threshold, pv->laplacian_threshold,
-                     half_height, width );
-    eedi2_erode_edge_mask( mskp, pitch, tmpp, pitch, pv->erosion_threshold, half_height, width );
-    eedi2_dilate_edge_mask( tmpp, pitch, mskp, pitch, pv->dilation_threshold, half_height, width );
-    eedi2_erode_edge_mask( mskp, pitch, tmpp, pitch, pv->erosion_threshold, half_height, width );
-    eedi2_remove_small_gaps( tmpp, pitch, mskp, pitch, half_height, width );
-
-    // direction mask
-    eedi2_calc_directions( plane, mskp, pitch, srcp, pitch, tmpp, pitch,
-                     pv->maximum_search_distance, pv->noise_threshold,
-                     half_height, width );
-    eedi2_filter_dir_map( mskp, pitch, tmpp, pitch, dstp, pitch, half_height, width );
-    eedi2_expand_dir_map( mskp, pitch, dstp, pitch, tmpp, pitch, half_height, width );
-    eedi2_filter_map( mskp, pitch, tmpp, pitch, dstp, pitch, half_height, width );
-
-    // upscale 2x vertically
-    eedi2_upscale_by_2( srcp, dst2p, half_height, pitch );
-    eedi2_upscale_by_2( dstp, tmp2p2, half_height, pitch );
-    eedi2_upscale_by_2( mskp, msk2p, half_height, pitch );
-
-    // upscale the direction mask
-    eedi2_mark_directions_2x( msk2p, pitch, tmp2p2, pitch, tmp2p, pitch, pv->tff, height, width );
-    eedi2_filter_dir_map_2x( msk2p, pitch, tmp2p, pitch,  dst2mp, pitch, pv->tff, height, width );
-    eedi2_expand_dir_map_2x( msk2p, pitch, dst2mp, pitch, tmp2p, pitch, pv->tff, height, width );
-    eedi2_fill_gaps_2x( msk2p, pitch, tmp2p, pitch, dst2mp, pitch, pv->tff, height, width );
-    eedi2_fill_gaps_2x( msk2p, pitch, dst2mp, pitch, tmp2p, pitch, pv->tff, height, width );
-
-    // interpolate a full-size plane
-    eedi2_interpolate_lattice( plane, tmp2p, pitch, dst2p, pitch, tmp2p2, pitch, pv->tff,
-                         pv->noise_threshold, height, width );
+    // Bands of the half-height and of the full-height planes
+    int start = half_height * segment / pv->cpu_count;
+    int stop = half_height * ( segment + 1 ) / pv->cpu_count;
+    int start2 = height * segment / pv->cpu_count;
+    int stop2 = height * ( segment + 1 ) / pv->cpu_count;
 
-    if( pv->post_processing == 1 || pv->post_processing == 3 )
-    {
-        // make sure the edge directions are consistent
-        eedi2_bit_blit( tmp2p2, pitch, tmp2p, pitch, width, height );
-        eedi2_filter_dir_map_2x( msk2p, pitch, tmp2p, pitch, dst2mp, pitch, pv->tff, height, width );
-        eedi2_expand_dir_map_2x( msk2p, pitch, dst2mp, pitch, tmp2p, pitch, pv->tff, height, width );
-        eedi2_post_process( tmp2p, pitch, tmp2p2, pitch, dst2p, pitch, pv->tff, height, width );
-    }
-    if( pv->post_processing == 2 || pv->post_processing == 3 )
+    switch( pv->eedi2_pass )
     {
+        // edge mask
+        case EEDI2_EDGE_MASK:
+            eedi2_build_edge_mask( mskp, pitch, srcp, pitch,
+                             pv->magnitude_threshold, pv->variance_threshold, pv->laplacian_threshold,
+                             half_height, width, start, stop );
+            break;
+        case EEDI2_ERODE_EDGE_MASK:
+            eedi2_erode_edge_mask( mskp, pitch, tmpp, pitch, pv->erosion_threshold, half_height, width,
+                                   start, stop );
+            break;
+        case EEDI2_DILATE_EDGE_MASK:
+            eedi2_dilate_edge_mask( tmpp, pitch, mskp, pitch, pv->dilation_threshold, half_height, width,
+                                    start, stop );
+            break;
+        case EEDI2_ERODE_EDGE_MASK2:
+            eedi2_erode_edge_mask( mskp, pitch, tmpp, pitch, pv->erosion_threshold, half_height, width,
+                                   start, stop );
+            break;
+        case EEDI2_REMOVE_SMALL_GAPS:
+            eedi2_remove_small_gaps( tmpp, pitch, mskp, pitch, half_height, width, start, stop );
+            break;
+
+        // direction mask
+        case EEDI2_CALC_DIRECTIONS:
+            eedi2_calc_directions( plane, mskp, pitch, srcp, pitch, tmpp, pitch,
+                             pv->maximum_search_distance, pv->noise_threshold,
+                             half_height, width, start, stop );
+            break;
+        case EEDI2_FILTER_DIR_MAP:
+            eedi2_filter_dir_map( mskp, pitch, tmpp, pitch, dstp, pitch, half_height, width,
+                                  start, stop );
+            break;
+        case EEDI2_EXPAND_DIR_MAP:
+            eedi2_expand_dir_map( mskp, pitch, dstp, pitch, tmpp, pitch, half_height, width,
+                                  start, stop );
+            break;
+        case EEDI2_FILTER_MAP:
+            eedi2_filter_map( mskp, pitch, tmpp, pitch, dstp, pitch, half_height, width,
+                              start, stop );
+            break;
+
+        // upscale 2x vertically
+        case EEDI2_UPSCALE_BY_2:
+            eedi2_upscale_by_2( srcp, dst2p, half_height, pitch, start, stop );
+            eedi2_upscale_by_2( dstp, tmp2p2, half_height, pitch, start, stop );
+            eedi2_upscale_by_2( mskp, msk2p, half_height, pitch, start, stop );
+            break;
+
+        // upscale the direction mask
+        case EEDI2_MARK_DIRECTIONS_2X:
+            eedi2_mark_directions_2x( msk2p, pitch, tmp2p2, pitch, tmp2p, pitch, pv->tff, height, width,
+                                      start2, stop2 );
+            break;
+        case EEDI2_FILTER_DIR_MAP_2X:
+            eedi2_filter_dir_map_2x( msk2p, pitch, tmp2p, pitch,  dst2mp, pitch, pv->tff, height, width,
+                                     start2, stop2 );
+            break;
+        case EEDI2_EXPAND_DIR_MAP_2X:
+            eedi2_expand_dir_map_2x( msk2p, pitch, dst2mp, pitch, tmp2p, pitch, pv->tff, height, width,
+                                     start2, stop2 );
+            break;
+        case EEDI2_FILL_GAPS_2X:
+            eedi2_fill_gaps_2x( msk2p, pitch, tmp2p, pitch, dst2mp, pitch, pv->tff, height, width,
+                                start2, stop2 );
+            break;
+        case EEDI2_FILL_GAPS_2X2:
+            eedi2_fill_gaps_2x( msk2p, pitch, dst2mp, pitch, tmp2p, pitch, pv->tff, height, width,
+                                start2, stop2 );
+            break;
+
+        // interpolate a full-size plane
+        case EEDI2_INTERPOLATE_LATTICE:
+            eedi2_interpolate_lattice( plane, tmp2p, pitch, dst2p, pitch, tmp2p2, pitch, pv->tff,
+                                 pv->noise_threshold, height, width, start2, stop2 );
+            break;
+
+        // make sure the edge directions are consistent,
+        // the direction map is then filtered and expanded again
+        case EEDI2_COPY_DIR_MAP_2X:
+            eedi2_bit_blit( tmp2p2 + start2 * pitch, pitch, tmp2p + start2 * pitch, pitch,
+                            width, stop2 - start2 );
+            break;
+        case EEDI2_POST_PROCESS:
+            eedi2_post_process( tmp2p, pitch, tmp2p2, pitch, dst2p, pitch, pv->tff, height, width,
+                                start2, stop2 );
+            break;
+
         // filter junctions and corners
-        eedi2_gaussian_blur1( srcp, pitch, tmpp, pitch, srcp, pitch, half_height, width );
-        eedi2_calc_derivatives( srcp, pitch, half_height, width, cx2, cy2, cxy );
-        eedi2_gaussian_blur_sqrt2( cx2, tmpc, cx2, pitch, half_height, width);
-        eedi2_gaussian_blur_sqrt2( cy2, tmpc, cy2, pitch, half_height, width);
-        eedi2_gaussian_blur_sqrt2( cxy, tmpc, cxy, pitch, half_height, width);
-        eedi2_post_process_corner( cx2, cy2, cxy, pitch, tmp2p2, pitch, dst2p, pitch, height, width, pv->tff );
+        case EEDI2_BLUR1_HORIZONTAL:
+            eedi2_gaussian_blur1_horizontal( srcp, pitch, tmpp, pitch, width, start, stop );
+            break;
+        case EEDI2_BLUR1_VERTICAL:
+            eedi2_gaussian_blur1_vertical( tmpp, pitch, srcp, pitch, half_height, width,
+                                           start, stop );
+            break;
+        case EEDI2_CALC_DERIVATIVES:
+            eedi2_calc_derivatives( srcp, pitch, half_height, width, cx2, cy2, cxy, start, stop );
+            break;
+        case EEDI2_BLUR_SQRT2_HORIZONTAL:
+            eedi2_gaussian_blur_sqrt2_horizontal( derivatives[pv->eedi2_derivative], tmpc,
+                                                  pitch, width, start, stop );
+            break;
+        case EEDI2_BLUR_SQRT2_VERTICAL:
+            eedi2_gaussian_blur_sqrt2_vertical( tmpc, derivatives[pv->eedi2_derivative],
+                                                pitch, half_height, width, start, stop );
+            break;
+        case EEDI2_POST_PROCESS_CORNER:
+            eedi2_post_process_corner( cx2, cy2, cxy, pitch, tmp2p2, pitch, dst2p, pitch, height, width, pv->tff,
+                                       start2, stop2 );
+            break;
     }
 }
 
 /*
- *  eedi2 interpolate this plane in a single thread.
+ *  eedi2 interpolate this segment of all three planes.
  */
 void eedi2_filter_thread( void *thread_args_v )
 {
     hb_filter_private_t * pv;
-    int plane;
+    int segment, plane;
     eedi2_thread_arg_t *thread_args = thread_args_v;
 
     pv = thread_args->pv;
-    plane = thread_args->plane;
-
-    hb_log("eedi2 thread started for plane %d", plane);
+    segment = thread_args->segment;
 
-    while (1)
+    /*
+     * Process segment
+     */
+    for( plane = 0; plane < 3; plane++ )
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->eedi2_taskset, plane );
-
-        if( taskset_thread_stop( &pv->eedi2_taskset, plane ) )
-        {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
-        }
-
-        /*
-         * Process plane
-         */
-        eedi2_interpolate_plane( pv, plane );
-        
-        /*
-         * Finished this segment, let everyone know.
-         */
-        taskset_thread_complete( &pv->eedi2_taskset, plane );
+        eedi2_interpolate_segment( pv, plane, segment );
     }
+}
 
-    taskset_thread_complete( &pv->eedi2_taskset, plane );
+// Runs one eedi2 pass on every segment and waits for it to finish,
+// so the next pass can read the rows around its own segment.
+static void eedi2_run_pass( hb_filter_private_t * pv, int pass )
+{
+    pv->eedi2_pass = pass;
+    taskset_cycle( &pv->eedi2_taskset );
 }
 
 // Sets up the input field planes for EEDI2 in pv->eedi_half[SRCPF]
-// and then runs eedi2_filter_thread for each plane.
+// and then runs each eedi2 pass in sequence on all CPUs.
 void eedi2_planer( hb_filter_private_t * pv )
 {
     /* Copy the first field from the source to a half-height frame. */
@@ -1099,317 +1294,263 @@ void eedi2_planer( hb_filter_private_t * pv )
 
     /*
      * Now that all data is ready for our threads, fire them off
-     * and wait for their completion.
+     * for each pass.
      */
-    taskset_cycle( &pv->eedi2_taskset );
-}
+    int pass;
+    for( pass = EEDI2_EDGE_MASK; pass <= EEDI2_INTERPOLATE_LATTICE; pass++ )
+    {
+        eedi2_run_pass( pv, pass );
+    }
 
+    if( pv->post_processing == 1 || pv->post_processing == 3 )
+    {
+        eedi2_run_pass( pv, EEDI2_COPY_DIR_MAP_2X );
+        eedi2_run_pass( pv, EEDI2_FILTER_DIR_MAP_2X );
+        eedi2_run_pass( pv, EEDI2_EXPAND_DIR_MAP_2X );
+        eedi2_run_pass( pv, EEDI2_POST_PROCESS );
+    }
+    if( pv->post_processing == 2 || pv->post_processing == 3 )
+    {
+        eedi2_run_pass( pv, EEDI2_BLUR1_HORIZONTAL );
+        eedi2_run_pass( pv, EEDI2_BLUR1_VERTICAL );
+        eedi2_run_pass( pv, EEDI2_CALC_DERIVATIVES );
+        // The derivatives share one temporary array per plane
+        for( pv->eedi2_derivative = 0; pv->eedi2_derivative < 3; pv->eedi2_derivative++ )
+        {
+            eedi2_run_pass( pv, EEDI2_BLUR_SQRT2_HORIZONTAL );
+            eedi2_run_pass( pv, EEDI2_BLUR_SQRT2_VERTICAL );
+        }
+        eedi2_run_pass( pv, EEDI2_POST_PROCESS_CORNER );
+    }
+}
 
 void mask_dilate_thread( void *thread_args_v )
 {
     hb_filter_private_t * pv;
-    int segment, segment_start, segment_stop;
+    int segment_start, segment_stop;
     decomb_thread_arg_t *thread_args = thread_args_v;
 
     pv = thread_args->pv;
-    segment = thread_args->segment;
 
-    hb_log("mask dilate thread started for segment %d", segment);
+    int xx, yy, pp;
 
-    while (1)
-    {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->mask_dilate_taskset, segment );
+    int count;
+    int dilation_threshold = 4;
 
-        if (taskset_thread_stop(&pv->mask_dilate_taskset, segment))
-        {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
-        } 
-
-        int xx, yy, pp;
+    for( pp = 0; pp < 1; pp++ )
+    {
+        int width = pv->mask_filtered->plane[pp].width;
+        int height = pv->mask_filtered->plane[pp].height;
+        int stride = pv->mask_filtered->plane[pp].stride;
 
-        int count;
-        int dilation_threshold = 4;
+        int start, stop, p, c, n;
+        segment_start = thread_args->segment_start[pp];
+        segment_stop = segment_start + thread_args->segment_height[pp];
 
-        for( pp = 0; pp < 1; pp++ )
+        if (segment_start == 0)
         {
-            int width = pv->mask_filtered->plane[pp].width;
-            int height = pv->mask_filtered->plane[pp].height;
-            int stride = pv->mask_filtered->plane[pp].stride;
-
-            int start, stop, p, c, n;
-            segment_start = thread_args->segment_start[pp];
-            segment_stop = segment_start + thread_args->segment_height[pp];
-
-            if (segment_start == 0)
-            {
-                start = 1;
-                p = 0;
-                c = 1;
-                n = 2;
-            }
-            else
-            {
-                start = segment_start;
-                p = segment_start - 1;
-                c = segment_start;
-                n = segment_start + 1;
-            }
+            start = 1;
+            p = 0;
+            c = 1;
+            n = 2;
+        }
+        else
+        {
+            start = segment_start;
+            p = segment_start - 1;
+            c = segment_start;
+            n = segment_start + 1;
+        }
 
-            if (segment_stop == height)
-            {
-                stop = height -1;
-            }
-            else
-            {
-                stop = segment_stop;
-            }
+        if (segment_stop == height)
+        {
+            stop = height -1;
+        }
+        else
+        {
+            stop = segment_stop;
+        }
 
-            uint8_t *curp = &pv->mask_filtered->plane[pp].data[p * stride + 1];
-            uint8_t *cur  = &pv->mask_filtered->plane[pp].data[c * stride + 1];
-            uint8_t *curn = &pv->mask_filtered->plane[pp].data[n * stride + 1];
-            uint8_t *dst = &pv->mask_temp->plane[pp].data[c * stride + 1];
+        uint8_t *curp = &pv->mask_filtered->plane[pp].data[p * stride + 1];
+        uint8_t *cur  = &pv->mask_filtered->plane[pp].data[c * stride + 1];
+        uint8_t *curn = &pv->mask_filtered->plane[pp].data[n * stride + 1];
+        uint8_t *dst = &pv->mask_temp->plane[pp].data[c * stride + 1];
 
-            for( yy = start; yy < stop; yy++ )
+        for( yy = start; yy < stop; yy++ )
+        {
+            for( xx = 1; xx < width - 1; xx++ )
             {
-                for( xx = 1; xx < width - 1; xx++ )
+                if (cur[xx])
                 {
-                    if (cur[xx])
-                    {
-                        dst[xx] = 1;
-                        continue;
-                    }
+                    dst[xx] = 1;
+                    continue;
+                }
 
-                    count = curp[xx-1] + curp[xx] + curp[xx+1] +
-                            cur [xx-1] +            cur [xx+1] +
-                            curn[xx-1] + curn[xx] + curn[xx+1];
+                count = curp[xx-1] + curp[xx] + curp[xx+1] +
+                        cur [xx-1] +            cur [xx+1] +
+                        curn[xx-1] + curn[xx] + curn[xx+1];
 
-                    dst[xx] = count >= dilation_threshold;
-                }
-                curp += stride;
-                cur += stride;
-                curn += stride;
-                dst += stride;
+                dst[xx] = count >= dilation_threshold;
             }
+            curp += stride;
+            cur += stride;
+            curn += stride;
+            dst += stride;
         }
-
-        taskset_thread_complete( &pv->mask_dilate_taskset, segment );
     }
-
-    /*
-     * Finished this segment, let everyone know.
-     */
-    taskset_thread_complete( &pv->mask_dilate_taskset, segment );
 }
 
 void mask_erode_thread( void *thread_args_v )
 {
     hb_filter_private_t * pv;
-    int segment, segment_start, segment_stop;
+    int segment_start, segment_stop;
     decomb_thread_arg_t *thread_args = thread_args_v;
 
     pv = thread_args->pv;
-    segment = thread_args->segment;
 
-    hb_log("mask erode thread started for segment %d", segment);
+    int xx, yy, pp;
 
-    while (1)
-    {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->mask_erode_taskset, segment );
+    int count;
+    int erosion_threshold = 2;
 
-        if( taskset_thread_stop( &pv->mask_erode_taskset, segment ) )
-        {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
-        } 
-
-        int xx, yy, pp;
+    for( pp = 0; pp < 1; pp++ )
+    {
+        int width = pv->mask_filtered->plane[pp].width;
+        int height = pv->mask_filtered->plane[pp].height;
+        int stride = pv->mask_filtered->plane[pp].stride;
 
-        int count;
-        int erosion_threshold = 2;
+        int start, stop, p, c, n;
+        segment_start = thread_args->segment_start[pp];
+        segment_stop = segment_start + thread_args->segment_height[pp];
 
-        for( pp = 0; pp < 1; pp++ )
+        if (segment_start == 0)
         {
-            int width = pv->mask_filtered->plane[pp].width;
-            int height = pv->mask_filtered->plane[pp].height;
-            int stride = pv->mask_filtered->plane[pp].stride;
-
-            int start, stop, p, c, n;
-            segment_start = thread_args->segment_start[pp];
-            segment_stop = segment_start + thread_args->segment_height[pp];
-
-            if (segment_start == 0)
-            {
-                start = 1;
-                p = 0;
-                c = 1;
-                n = 2;
-            }
-            else
-            {
-                start = segment_start;
-                p = segment_start - 1;
-                c = segment_start;
-                n = segment_start + 1;
-            }
+            start = 1;
+            p = 0;
+            c = 1;
+            n = 2;
+        }
+        else
+        {
+            start = segment_start;
+            p = segment_start - 1;
+            c = segment_start;
+            n = segment_start + 1;
+        }
 
-            if (segment_stop == height)
-            {
-                stop = height -1;
-            }
-            else
-            {
-                stop = segment_stop;
-            }
+        if (segment_stop == height)
+        {
+            stop = height -1;
+        }
+        else
+        {
+            stop = segment_stop;
+        }
 
-            uint8_t *curp = &pv->mask_temp->plane[pp].data[p * stride + 1];
-            uint8_t *cur  = &pv->mask_temp->plane[pp].data[c * stride + 1];
-            uint8_t *curn = &pv->mask_temp->plane[pp].data[n * stride + 1];
-            uint8_t *dst = &pv->mask_filtered->plane[pp].data[c * stride + 1];
+        uint8_t *curp = &pv->mask_temp->plane[pp].data[p * stride + 1];
+        uint8_t *cur  = &pv->mask_temp->plane[pp].data[c * stride + 1];
+        uint8_t *curn = &pv->mask_temp->plane[pp].data[n * stride + 1];
+        uint8_t *dst = &pv->mask_filtered->plane[pp].data[c * stride + 1];
 
-            for( yy = start; yy < stop; yy++ )
+        for( yy = start; yy < stop; yy++ )
+        {
+            for( xx = 1; xx < width - 1; xx++ )
             {
-                for( xx = 1; xx < width - 1; xx++ )
+                if( cur[xx] == 0 )
                 {
-                    if( cur[xx] == 0 )
-                    {
-                        dst[xx] = 0;
-                        continue;
-                    }
+                    dst[xx] = 0;
+                    continue;
+                }
 
-                    count = curp[xx-1] + curp[xx] + curp[xx+1] +
-                            cur [xx-1] +            cur [xx+1] +
-                            curn[xx-1] + curn[xx] + curn[xx+1];
+                count = curp[xx-1] + curp[xx] + curp[xx+1] +
+                        cur [xx-1] +            cur [xx+1] +
+                        curn[xx-1] + curn[xx] + curn[xx+1];
 
-                    dst[xx] = count >= erosion_threshold;
-                }
-                curp += stride;
-                cur += stride;
-                curn += stride;
-                dst += stride;
+                dst[xx] = count >= erosion_threshold;
             }
+            curp += stride;
+            cur += stride;
+            curn += stride;
+            dst += stride;
         }
-
-        taskset_thread_complete( &pv->mask_erode_taskset, segment );
     }
-
-    /*
-     * Finished this segment, let everyone know.
-     */
-    taskset_thread_complete( &pv->mask_erode_taskset, segment );
 }
 
 void mask_filter_thread( void *thread_args_v )
 {
     hb_filter_private_t * pv;
-    int segment, segment_start, segment_stop;
+    int segment_start, segment_stop;
     decomb_thread_arg_t *thread_args = thread_args_v;
 
     pv = thread_args->pv;
-    segment = thread_args->segment;
 
-    hb_log("mask filter thread started for segment %d", segment);
+    int xx, yy, pp;
 
-    while (1)
+    for( pp = 0; pp < 1; pp++ )
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->mask_filter_taskset, segment );
-
-        if( taskset_thread_stop( &pv->mask_filter_taskset, segment ) )
-        {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
-        } 
+        int width = pv->mask->plane[pp].width;
+        int height = pv->mask->plane[pp].height;
+        int stride = pv->mask->plane[pp].stride;
 
-        int xx, yy, pp;
+        int start, stop, p, c, n;
+        segment_start = thread_args->segment_start[pp];
+        segment_stop = segment_start + thread_args->segment_height[pp];
 
-        for( pp = 0; pp < 1; pp++ )
+        if (segment_start == 0)
         {
-            int width = pv->mask->plane[pp].width;
-            int height = pv->mask->plane[pp].height;
-            int stride = pv->mask->plane[pp].stride;
+            start = 1;
+            p = 0;
+            c = 1;
+            n = 2;
+        }
+        else
+        {
+            start = segment_start;
+            p = segment_start - 1;
+            c = segment_start;
+            n = segment_start + 1;
+        }
 
-            int start, stop, p, c, n;
-            segment_start = thread_args->segment_start[pp];
-            segment_stop = segment_start + thread_args->segment_height[pp];
+        if (segment_stop == height)
+        {
+            stop = height - 1;
+        }
+        else
+        {
+            stop = segment_stop;
+        }
 
-            if (segment_start == 0)
-            {
-                start = 1;
-                p = 0;
-                c = 1;
-                n = 2;
-            }
-            else
-            {
-                start = segment_start;
-                p = segment_start - 1;
-                c = segment_start;
-                n = segment_start + 1;
-            }
+        uint8_t *curp = &pv->mask->plane[pp].data[p * stride + 1];
+        uint8_t *cur = &pv->mask->plane[pp].data[c * stride + 1];
+        uint8_t *curn = &pv->mask->plane[pp].data[n * stride + 1];
+        uint8_t *dst = (pv->filter_mode == FILTER_CLASSIC ) ?
+            &pv->mask_filtered->plane[pp].data[c * stride + 1] :
+            &pv->mask_temp->plane[pp].data[c * stride + 1] ;
 
-            if (segment_stop == height)
-            {
-                stop = height - 1;
-            }
-            else
+        for( yy = start; yy < stop; yy++ )
+        {
+            for( xx = 1; xx < width - 1; xx++ )
             {
-                stop = segment_stop;
-            }
+                int h_count, v_count;
 
-            uint8_t *curp = &pv->mask->plane[pp].data[p * stride + 1];
-            uint8_t *cur = &pv->mask->plane[pp].data[c * stride + 1];
-            uint8_t *curn = &pv->mask->plane[pp].data[n * stride + 1];
-            uint8_t *dst = (pv->filter_mode == FILTER_CLASSIC ) ?
-                &pv->mask_filtered->plane[pp].data[c * stride + 1] :
-                &pv->mask_temp->plane[pp].data[c * stride + 1] ;
+                h_count = cur[xx-1] & cur[xx] & cur[xx+1];
+                v_count = curp[xx] & cur[xx] & curn[xx];
 
-            for( yy = start; yy < stop; yy++ )
-            {
-                for( xx = 1; xx < width - 1; xx++ )
+                if (pv->filter_mode == FILTER_CLASSIC)
                 {
-                    int h_count, v_count;
-
-                    h_count = cur[xx-1] & cur[xx] & cur[xx+1];
-                    v_count = curp[xx] & cur[xx] & curn[xx];
-
-                    if (pv->filter_mode == FILTER_CLASSIC)
-                    {
-                        dst[xx] = h_count;
-                    }
-                    else
-                    {
-                        dst[xx] = h_count & v_count;
-                    }
+                    dst[xx] = h_count;
+                }
+                else
+                {
+                    dst[xx] = h_count & v_count;
                 }
-                curp += stride;
-                cur += stride;
-                curn += stride;
-                dst += stride;
             }
+            curp += stride;
+            cur += stride;
+            curn += stride;
+            dst += stride;
         }
-
-        taskset_thread_complete( &pv->mask_filter_taskset, segment );
     }
-
-    /*
-     * Finished this segment, let everyone know.
-     */
-    taskset_thread_complete( &pv->mask_filter_taskset, segment );
 }
 
 void decomb_check_thread( void *thread_args_v )
@@ -1421,42 +1562,21 @@ void decomb_check_thread( void *thread_args_v )
     pv = thread_args->pv;
     segment = thread_args->segment;
 
-    hb_log("decomb check thread started for segment %d", segment);
+    segment_start = thread_args->segment_start[0];
+    segment_stop = segment_start + thread_args->segment_height[0];
 
-    while (1)
+    if( pv->mode & MODE_SPARSE )
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->decomb_check_taskset, segment );
-
-        if( taskset_thread_stop( &pv->decomb_check_taskset, segment ) )
-        {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
-        } 
-
-        segment_start = thread_args->segment_start[0];
-        segment_stop = segment_start + thread_args->segment_height[0];
-
-        if( pv->mode & MODE_FILTER )
-        {
-            check_filtered_combing_mask(pv, segment, segment_start, segment_stop);
-        }
-        else
-        {
-            check_combing_mask(pv, segment, segment_start, segment_stop);
-        }
-
-        taskset_thread_complete( &pv->decomb_check_taskset, segment );
+        check_sparse_combing(pv, segment, segment_start, segment_stop);
+    }
+    else if( pv->mode & MODE_FILTER )
+    {
+        check_filtered_combing_mask(pv, segment, segment_start, segment_stop);
+    }
+    else
+    {
+        check_combing_mask(pv, segment, segment_start, segment_stop);
     }
-
-    /*
-     * Finished this segment, let everyone know.
-     */
-    taskset_thread_complete( &pv->decomb_check_taskset, segment );
 }
 
 /*
@@ -1465,59 +1585,41 @@ void decomb_check_thread( void *thread_args_v )
 void decomb_filter_thread( void *thread_args_v )
 {
     hb_filter_private_t * pv;
-    int segment, segment_start, segment_stop;
+    int segment_start, segment_stop;
     decomb_thread_arg_t *thread_args = thread_args_v;
 
     pv = thread_args->pv;
-    segment = thread_args->segment;
-
-    hb_log("decomb filter thread started for segment %d", segment);
 
-    while (1)
+    /*
+     * Process segment (for now just from luma)
+     */
+    int pp;
+    for( pp = 0; pp < 1; pp++)
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->decomb_filter_taskset, segment );
+        segment_start = thread_args->segment_start[pp];
+        segment_stop = segment_start + thread_args->segment_height[pp];
 
-        if( taskset_thread_stop( &pv->decomb_filter_taskset, segment ) )
+        if( pv->mode & MODE_GAMMA )
         {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
-        } 
-
-        /*
-         * Process segment (for now just from luma)
-         */
-        int pp;
-        for( pp = 0; pp < 1; pp++)
+            detect_gamma_combed_segment( pv, segment_start, segment_stop );
+        }
+        else
         {
-            segment_start = thread_args->segment_start[pp];
-            segment_stop = segment_start + thread_args->segment_height[pp];
-
-            if( pv->mode & MODE_GAMMA )
-            {
-                detect_gamma_combed_segment( pv, segment_start, segment_stop );
-            }
-            else
-            {
-                detect_combed_segment( pv, segment_start, segment_stop );
-            }
+            detect_combed_segment( pv, segment_start, segment_stop );
         }
-
-        taskset_thread_complete( &pv->decomb_filter_taskset, segment );
     }
-
-    /*
-     * Finished this segment, let everyone know.
-     */
-    taskset_thread_complete( &pv->decomb_filter_taskset, segment );
 }
 
 int comb_segmenter( hb_filter_private_t * pv )
 {
+    if( pv->mode & MODE_SPARSE )
+    {
+        /* Detection is done by the check segments */
+        reset_combing_results(pv);
+        taskset_cycle( &pv->decomb_check_taskset );
+        return check_combing_results(pv);
+    }
+
     /*
      * Now that all data for decomb detection is ready for
      * our threads, fire them off and wait for their completion.
@@ -1615,8 +1717,27 @@ static void yadif_filter_line(
     if( ( y < 3 ) || ( y > ( height - 4 ) )  )
         vertical_edge = 1;
 
+    /* Plain yadif interpolation gets all four slopes checked from the
+       fourth pixel to the fourth last, that part of the line is done
+       by the shared (SIMD) yadif line filter. */
+    int yadif_interior = !eedi2_mode && !( pv->mode & MODE_CUBIC ) &&
+                         width > 6;
+
     for( x = 0; x < width; x++)
     {
+        if( yadif_interior && x == 3 )
+        {
+            pv->yadif_dsp.filter_line( dst - x, prev - x, cur - x, next - x,
+                                       x, width - 3, stride, parity, 1 );
+            dst   += width - 6;
+            cur   += width - 6;
+            prev  += width - 6;
+            next  += width - 6;
+            prev2 += width - 6;
+            next2 += width - 6;
+            x      = width - 3;
+        }
+
         /* Pixel above*/
         int c              = cur[-stride];
         /* Temporal average: the current location in the adjacent fields */
@@ -1721,120 +1842,89 @@ void yadif_decomb_filter_thread( void *thread_args_v )
     pv = thread_args->pv;
     segment = thread_args->segment;
 
-    hb_log("yadif thread started for segment %d", segment);
-
-    while (1)
-    {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->yadif_taskset, segment );
-        
-        if( taskset_thread_stop( &pv->yadif_taskset, segment ) )
-        {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
-        } 
-
-        yadif_work = &pv->yadif_arguments[segment];
+    yadif_work = &pv->yadif_arguments[segment];
 
-        /*
-         * Process all three planes, but only this segment of it.
-         */
-        hb_buffer_t *dst;
-        int parity, tff, is_combed;
+    /*
+     * Process all three planes, but only this segment of it.
+     */
+    hb_buffer_t *dst;
+    int parity, tff, is_combed;
 
-        is_combed = pv->yadif_arguments[segment].is_combed;
-        dst = yadif_work->dst;
-        tff = yadif_work->tff;
-        parity = yadif_work->parity;
+    is_combed = pv->yadif_arguments[segment].is_combed;
+    dst = yadif_work->dst;
+    tff = yadif_work->tff;
+    parity = yadif_work->parity;
 
-        int pp;
-        for (pp = 0; pp < 3; pp++)
-        {
-            int yy;
-            int width = dst->plane[pp].width;
-            int stride = dst->plane[pp].stride;
-            int height = dst->plane[pp].height;
-            int penultimate = height - 2;
+    int pp;
+    for (pp = 0; pp < 3; pp++)
+    {
+        int yy;
+        int width = dst->plane[pp].width;
+        int stride = dst->plane[pp].stride;
+        int height = dst->plane[pp].height;
+        int penultimate = height - 2;
 
-            segment_start = thread_args->segment_start[pp];
-            segment_stop = segment_start + thread_args->segment_height[pp];
+        segment_start = thread_args->segment_start[pp];
+        segment_stop = segment_start + thread_args->segment_height[pp];
 
-            // Filter parity lines
-            int start = parity ? (segment_start + 1) & ~1 : segment_start | 1;
-            uint8_t *dst2 = &dst->plane[pp].data[start * stride];
-            uint8_t *prev = &pv->ref[0]->plane[pp].data[start * stride];
-            uint8_t *cur  = &pv->ref[1]->plane[pp].data[start * stride];
-            uint8_t *next = &pv->ref[2]->plane[pp].data[start * stride];
+        // Filter parity lines
+        int start = parity ? (segment_start + 1) & ~1 : segment_start | 1;
+        uint8_t *dst2 = &dst->plane[pp].data[start * stride];
+        uint8_t *prev = &pv->ref[0]->plane[pp].data[start * stride];
+        uint8_t *cur  = &pv->ref[1]->plane[pp].data[start * stride];
+        uint8_t *next = &pv->ref[2]->plane[pp].data[start * stride];
 
-            if( is_combed == 2 )
+        if( is_combed == 2 )
+        {
+            /* These will be useful if we ever do temporal blending. */
+            for( yy = start; yy < segment_stop; yy += 2 )
             {
-                /* These will be useful if we ever do temporal blending. */
-                for( yy = start; yy < segment_stop; yy += 2 )
-                {
-                    /* This line gets blend filtered, not yadif filtered. */
-                    blend_filter_line(dst2, cur, width, height, stride, yy);
-                    dst2 += stride * 2;
-                    cur += stride * 2;
-                }
+                /* This line gets blend filtered, not yadif filtered. */
+                blend_filter_line(dst2, cur, width, height, stride, yy);
+                dst2 += stride * 2;
+                cur += stride * 2;
             }
-            else if (pv->mode == MODE_CUBIC && is_combed)
+        }
+        else if (pv->mode == MODE_CUBIC && is_combed)
+        {
+            for( yy = start; yy < segment_stop; yy += 2 )
             {
-                for( yy = start; yy < segment_stop; yy += 2 )
-                {
-                    /* Just apply vertical cubic interpolation */
-                    cubic_interpolate_line(dst2, cur, width, height, stride, yy);
-                    dst2 += stride * 2;
-                    cur += stride * 2;
-                }
+                /* Just apply vertical cubic interpolation */
+                cubic_interpolate_line(dst2, cur, width, height, stride, yy);
+                dst2 += stride * 2;
+                cur += stride * 2;
             }
-            else if ((pv->mode & MODE_YADIF) && is_combed == 1)
+        }
+        else if ((pv->mode & MODE_YADIF) && is_combed == 1)
+        {
+            for( yy = start; yy < segment_stop; yy += 2 )
             {
-                for( yy = start; yy < segment_stop; yy += 2 )
+                if( yy > 1 && yy < penultimate )
                 {
-                    if( yy > 1 && yy < penultimate )
-                    {
-                        // This isn't the top or bottom,
-                        // proceed as normal to yadif
-                        yadif_filter_line(pv, dst2, prev, cur, next, pp,
-                                          width, height, stride,
-                                          parity ^ tff, yy);
-                    }
-                    else
-                    {
-                        // parity == 0 (TFF), y1 = y0
-                        // parity == 1 (BFF), y0 = y1
-                        // parity == 0 (TFF), yu = yp
-                        // parity == 1 (BFF), yp = yu
-                        int yp = (yy ^ parity) * stride;
-                        memcpy(dst2, &pv->ref[1]->plane[pp].data[yp], width);
-                    }
-                    dst2 += stride * 2;
-                    prev += stride * 2;
-                    cur += stride * 2;
-                    next += stride * 2;
+                    // This isn't the top or bottom,
+                    // proceed as normal to yadif
+                    yadif_filter_line(pv, dst2, prev, cur, next, pp,
+                                      width, height, stride,
+                                      parity ^ tff, yy);
                 }
-            }
-            else
-            {
-                // No combing, copy frame
-                for( yy = start; yy < segment_stop; yy += 2 )
+                else
                 {
-                    memcpy(dst2, cur, width);
-                    dst2 += stride * 2;
-                    cur += stride * 2;
+                    // parity == 0 (TFF), y1 = y0
+                    // parity == 1 (BFF), y0 = y1
+                    // parity == 0 (TFF), yu = yp
+                    // parity == 1 (BFF), yp = yu
+                    int yp = (yy ^ parity) * stride;
+                    memcpy(dst2, &pv->ref[1]->plane[pp].data[yp], width);
                 }
+                dst2 += stride * 2;
+                prev += stride * 2;
+                cur += stride * 2;
+                next += stride * 2;
             }
-
-            // Copy unfiltered lines
-            start = !parity ? (segment_start + 1) & ~1 : segment_start | 1;
-            dst2 = &dst->plane[pp].data[start * stride];
-            prev = &pv->ref[0]->plane[pp].data[start * stride];
-            cur  = &pv->ref[1]->plane[pp].data[start * stride];
-            next = &pv->ref[2]->plane[pp].data[start * stride];
+        }
+        else
+        {
+            // No combing, copy frame
             for( yy = start; yy < segment_stop; yy += 2 )
             {
                 memcpy(dst2, cur, width);
@@ -1842,19 +1932,27 @@ void yadif_decomb_filter_thread( void *thread_args_v )
                 cur += stride * 2;
             }
         }
-        taskset_thread_complete( &pv->yadif_taskset, segment );
-    }
 
-    /*
-     * Finished this segment, let everyone know.
-     */
-    taskset_thread_complete( &pv->yadif_taskset, segment );
+        // Copy unfiltered lines
+        start = !parity ? (segment_start + 1) & ~1 : segment_start | 1;
+        dst2 = &dst->plane[pp].data[start * stride];
+        prev = &pv->ref[0]->plane[pp].data[start * stride];
+        cur  = &pv->ref[1]->plane[pp].data[start * stride];
+        next = &pv->ref[2]->plane[pp].data[start * stride];
+        for( yy = start; yy < segment_stop; yy += 2 )
+        {
+            memcpy(dst2, cur, width);
+            dst2 += stride * 2;
+            cur += stride * 2;
+        }
+    }
 }
 
-static void yadif_filter( hb_filter_private_t * pv,
-                          hb_buffer_t * dst,
-                          int parity,
-                          int tff)
+/*
+ * Decide how the current frame (pv->ref[1]) gets filtered, see below.
+ * Sets and returns pv->is_combed.
+ */
+static int decomb_check_frame( hb_filter_private_t * pv )
 {
     /* If we're running comb detection, do it now, otherwise default to true. */
     int is_combed;
@@ -1911,70 +2009,74 @@ static void yadif_filter( hb_filter_private_t * pv,
         pv->unfiltered_frames++;
     }
 
+    pv->is_combed = is_combed;
+    return is_combed;
+}
+
+/*
+ * Deinterlace or blend the current frame into dst.  Only called for
+ * frames that decomb_check_frame() found combed, the others are passed
+ * through as they are.
+ */
+static void yadif_filter( hb_filter_private_t * pv,
+                          hb_buffer_t * dst,
+                          int parity,
+                          int tff)
+{
+    int is_combed = pv->is_combed;
+
     if( is_combed == 1 && ( pv->mode & MODE_EEDI2 ) )
     {
         /* Generate an EEDI2 interpolation */
         eedi2_planer( pv );
     }
 
-    pv->is_combed = is_combed;
-    if( is_combed )
+    if( ( pv->mode & MODE_EEDI2 ) && !( pv->mode & MODE_YADIF ) && is_combed == 1 )
     {
-        if( ( pv->mode & MODE_EEDI2 ) && !( pv->mode & MODE_YADIF ) && is_combed == 1 )
+        // Just pass through the EEDI2 interpolation
+        int pp;
+        for( pp = 0; pp < 3; pp++ )
         {
-            // Just pass through the EEDI2 interpolation
-            int pp;
-            for( pp = 0; pp < 3; pp++ )
-            {
-                uint8_t * ref = pv->eedi_full[DST2PF]->plane[pp].data;
-                int ref_stride = pv->eedi_full[DST2PF]->plane[pp].stride;
+            uint8_t * ref = pv->eedi_full[DST2PF]->plane[pp].data;
+            int ref_stride = pv->eedi_full[DST2PF]->plane[pp].stride;
 
-                uint8_t * dest = dst->plane[pp].data;
-                int width = dst->plane[pp].width;
-                int height = dst->plane[pp].height;
-                int stride = dst->plane[pp].stride;
-
-                int yy;
-                for( yy = 0; yy < height; yy++ )
-                {
-                    memcpy(dest, ref, width);
-                    dest += stride;
-                    ref += ref_stride;
-                }
-            }
-        }
-        else
-        {
-            int segment;
+            uint8_t * dest = dst->plane[pp].data;
+            int width = dst->plane[pp].width;
+            int height = dst->plane[pp].height;
+            int stride = dst->plane[pp].stride;
 
-            for( segment = 0; segment < pv->cpu_count; segment++ )
+            int yy;
+            for( yy = 0; yy < height; yy++ )
             {
-                /*
-                 * Setup the work for this plane.
-                 */
-                pv->yadif_arguments[segment].parity = parity;
-                pv->yadif_arguments[segment].tff = tff;
-                pv->yadif_arguments[segment].dst = dst;
-                pv->yadif_arguments[segment].is_combed = is_combed;
+                memcpy(dest, ref, width);
+                dest += stride;
+                ref += ref_stride;
             }
-
-            /*
-             * Allow the taskset threads to make one pass over the data.
-             */
-            taskset_cycle( &pv->yadif_taskset );
-
-            /*
-             * Entire frame is now deinterlaced.
-             */
         }
     }
     else
     {
-        /*  Just passing through... */
+        int segment;
+
+        for( segment = 0; segment < pv->cpu_count; segment++ )
+        {
+            /*
+             * Setup the work for this plane.
+             */
+            pv->yadif_arguments[segment].parity = parity;
+            pv->yadif_arguments[segment].tff = tff;
+            pv->yadif_arguments[segment].dst = dst;
+            pv->yadif_arguments[segment].is_combed = is_combed;
+        }
+
+        /*
+         * Allow the taskset to make one pass over the data.
+         */
+        taskset_cycle( &pv->yadif_taskset );
 
-        /* For mcdeint's benefit... */
-        pv->yadif_arguments[0].is_combed = is_combed; // 0
-        hb_buffer_copy(dst, pv->ref[1]);
+        /*
+         * Entire frame is now deinterlaced.
+         */
     }
 }
 
@@ -2038,7 +2140,23 @@ static int hb_decomb_init( hb_filter_object_t * filter,
                 &pv->parity );
     }
 
+    if( ( pv->mode & MODE_SPARSE ) && ( pv->mode & ( MODE_MASK | MODE_COMPOSITE ) ) )
+    {
+        /* Showing the mask needs all of it, not just what was scanned */
+        hb_log( "decomb: showing the combing mask, sparse comb detection disabled" );
+        pv->mode &= ~MODE_SPARSE;
+    }
+
+    if( pv->mode & MODE_SPARSE )
+    {
+        /* The mask filter needs every line of the mask */
+        pv->mode &= ~MODE_FILTER;
+    }
+
+    yadif_dsp_init( &pv->yadif_dsp );
+
     pv->cpu_count = hb_get_cpu_count();
+    hb_taskpool_t * pool = hb_taskpool_get( init->job->h );
 
     // Make segment sizes an even number of lines
     int height = hb_image_height(init->pix_fmt, init->height, 0);
@@ -2082,8 +2200,9 @@ static int hb_decomb_init( hb_filter_object_t * filter,
      */
     pv->yadif_arguments = malloc( sizeof( yadif_arguments_t ) * pv->cpu_count );
     if( pv->yadif_arguments == NULL ||
-        taskset_init( &pv->yadif_taskset, pv->cpu_count,
-                      sizeof( yadif_thread_arg_t ) ) == 0 )
+        taskset_init( &pv->yadif_taskset, pool, "yadif_filter_segment",
+                      pv->cpu_count, sizeof( yadif_thread_arg_t ),
+                      yadif_decomb_filter_thread ) == 0 )
     {
         hb_error( "yadif could not initialize taskset" );
     }
@@ -2119,21 +2238,15 @@ static int hb_decomb_init( hb_filter_object_t * filter,
             }
         }
         pv->yadif_arguments[ii].dst = NULL;
-        if( taskset_thread_spawn( &pv->yadif_taskset, ii,
-                                 "yadif_filter_segment",
-                                 yadif_decomb_filter_thread,
-                                 HB_NORMAL_PRIORITY ) == 0 )
-        {
-            hb_error( "yadif could not spawn thread" );
-        }
         yadif_prev_thread_args = thread_args;
     }
 
     /*
      * Create comb detection taskset.
      */
-    if( taskset_init( &pv->decomb_filter_taskset, pv->cpu_count,
-                      sizeof( decomb_thread_arg_t ) ) == 0 )
+    if( taskset_init( &pv->decomb_filter_taskset, pool, "decomb_filter_segment",
+                      pv->cpu_count, sizeof( decomb_thread_arg_t ),
+                      decomb_filter_thread ) == 0 )
     {
         hb_error( "decomb could not initialize taskset" );
     }
@@ -2169,14 +2282,6 @@ static int hb_decomb_init( hb_filter_object_t * filter,
             }
         }
 
-        if( taskset_thread_spawn( &pv->decomb_filter_taskset, ii,
-                                 "decomb_filter_segment",
-                                 decomb_filter_thread,
-                                 HB_NORMAL_PRIORITY ) == 0 )
-        {
-            hb_error( "decomb could not spawn thread" );
-        }
-
         decomb_prev_thread_args = thread_args;
     }
 
@@ -2190,8 +2295,9 @@ static int hb_decomb_init( hb_filter_object_t * filter,
     /*
      * Create comb check taskset.
      */
-    if( taskset_init( &pv->decomb_check_taskset, pv->comb_check_nthreads,
-                      sizeof( decomb_thread_arg_t ) ) == 0 )
+    if( taskset_init( &pv->decomb_check_taskset, pool, "decomb_check_segment",
+                      pv->comb_check_nthreads, sizeof( decomb_thread_arg_t ),
+                      decomb_check_thread ) == 0 )
     {
         hb_error( "decomb check could not initialize taskset" );
     }
@@ -2199,7 +2305,7 @@ static int hb_decomb_init( hb_filter_object_t * filter,
     decomb_prev_thread_args = NULL;
     for( ii = 0; ii < pv->comb_check_nthreads; ii++ )
     {
-        decomb_thread_arg_t *thread_args, *decomb_prev_thread_args = NULL;
+        decomb_thread_arg_t *thread_args;
     
         thread_args = taskset_thread_args( &pv->decomb_check_taskset, ii );
         thread_args->pv = pv;
@@ -2234,21 +2340,14 @@ static int hb_decomb_init( hb_filter_object_t * filter,
             }
         }
 
-        if( taskset_thread_spawn( &pv->decomb_check_taskset, ii,
-                                 "decomb_check_segment",
-                                 decomb_check_thread,
-                                 HB_NORMAL_PRIORITY ) == 0 )
-        {
-            hb_error( "decomb check could not spawn thread" );
-        }
-
         decomb_prev_thread_args = thread_args;
     }
 
     if( pv->mode & MODE_FILTER )
     {
-        if( taskset_init( &pv->mask_filter_taskset, pv->cpu_count,
-                          sizeof( decomb_thread_arg_t ) ) == 0 )
+        if( taskset_init( &pv->mask_filter_taskset, pool, "mask_filter_segment",
+                          pv->cpu_count, sizeof( decomb_thread_arg_t ),
+                          mask_filter_thread ) == 0 )
         {
             hb_error( "maske filter could not initialize taskset" );
         }
@@ -2285,21 +2384,14 @@ static int hb_decomb_init( hb_filter_object_t * filter,
                 }
             }
 
-            if( taskset_thread_spawn( &pv->mask_filter_taskset, ii,
-                                     "mask_filter_segment",
-                                     mask_filter_thread,
-                                     HB_NORMAL_PRIORITY ) == 0 )
-            {
-                hb_error( "mask filter could not spawn thread" );
-            }
-
             decomb_prev_thread_args = thread_args;
         }
 
         if( pv->filter_mode == FILTER_ERODE_DILATE )
         {
-            if( taskset_init( &pv->mask_erode_taskset, pv->cpu_count,
-                              sizeof( decomb_thread_arg_t ) ) == 0 )
+            if( taskset_init( &pv->mask_erode_taskset, pool, "mask_erode_segment",
+                              pv->cpu_count, sizeof( decomb_thread_arg_t ),
+                              mask_erode_thread ) == 0 )
             {
                 hb_error( "mask erode could not initialize taskset" );
             }
@@ -2336,19 +2428,12 @@ static int hb_decomb_init( hb_filter_object_t * filter,
                     }
                 }
 
-                if( taskset_thread_spawn( &pv->mask_erode_taskset, ii,
-                                         "mask_erode_segment",
-                                         mask_erode_thread,
-                                         HB_NORMAL_PRIORITY ) == 0 )
-                {
-                    hb_error( "mask erode could not spawn thread" );
-                }
-
                 decomb_prev_thread_args = thread_args;
             }
 
-            if( taskset_init( &pv->mask_dilate_taskset, pv->cpu_count,
-                              sizeof( decomb_thread_arg_t ) ) == 0 )
+            if( taskset_init( &pv->mask_dilate_taskset, pool, "mask_dilate_segment",
+                              pv->cpu_count, sizeof( decomb_thread_arg_t ),
+                              mask_dilate_thread ) == 0 )
             {
                 hb_error( "mask dilate could not initialize taskset" );
             }
@@ -2385,14 +2470,6 @@ static int hb_decomb_init( hb_filter_object_t * filter,
                     }
                 }
 
-                if( taskset_thread_spawn( &pv->mask_dilate_taskset, ii,
-                                         "mask_dilate_segment",
-                                         mask_dilate_thread,
-                                         HB_NORMAL_PRIORITY ) == 0 )
-                {
-                    hb_error( "mask dilate could not spawn thread" );
-                }
-
                 decomb_prev_thread_args = thread_args;
             }
         }
@@ -2403,50 +2480,53 @@ static int hb_decomb_init( hb_filter_object_t * filter,
         /*
          * Create eedi2 taskset.
          */
-        if( taskset_init( &pv->eedi2_taskset, /*thread_count*/3,
-                          sizeof( eedi2_thread_arg_t ) ) == 0 )
+        if( taskset_init( &pv->eedi2_taskset, pool, "eedi2_filter_segment",
+                          pv->cpu_count, sizeof( eedi2_thread_arg_t ),
+                          eedi2_filter_thread ) == 0 )
         {
             hb_error( "eedi2 could not initialize taskset" );
         }
 
         if( pv->post_processing > 1 )
         {
-            int stride = hb_image_stride(init->pix_fmt, init->width, 0);
+            /* Each plane has its own derivative arrays, the planes
+               are filtered at the same time. */
+            int failed = 0;
+            for( ii = 0; ii < 3; ii++ )
+            {
+                int stride = hb_image_stride(init->pix_fmt, init->width, ii);
+                int height = hb_image_height(init->pix_fmt, init->height, ii);
+
+                pv->cx2[ii] = (int*)eedi2_aligned_malloc(
+                        height * stride * sizeof(int), 16);
 
-            pv->cx2 = (int*)eedi2_aligned_malloc(
-                    init->height * stride * sizeof(int), 16);
+                pv->cy2[ii] = (int*)eedi2_aligned_malloc(
+                        height * stride * sizeof(int), 16);
 
-            pv->cy2 = (int*)eedi2_aligned_malloc(
-                    init->height * stride * sizeof(int), 16);
+                pv->cxy[ii] = (int*)eedi2_aligned_malloc(
+                        height * stride * sizeof(int), 16);
 
-            pv->cxy = (int*)eedi2_aligned_malloc(
-                    init->height * stride * sizeof(int), 16);
+                pv->tmpc[ii] = (int*)eedi2_aligned_malloc(
+                        height * stride * sizeof(int), 16);
 
-            pv->tmpc = (int*)eedi2_aligned_malloc(
-                    init->height * stride * sizeof(int), 16);
+                if( !pv->cx2[ii] || !pv->cy2[ii] || !pv->cxy[ii] || !pv->tmpc[ii] )
+                    failed = 1;
+            }
 
-            if( !pv->cx2 || !pv->cy2 || !pv->cxy || !pv->tmpc )
+            if( failed )
                 hb_log("EEDI2: failed to malloc derivative arrays");
             else
                 hb_log("EEDI2: successfully mallloced derivative arrays");
         }
 
-        for( ii = 0; ii < 3; ii++ )
+        for( ii = 0; ii < pv->cpu_count; ii++ )
         {
             eedi2_thread_arg_t *eedi2_thread_args;
 
             eedi2_thread_args = taskset_thread_args( &pv->eedi2_taskset, ii );
 
             eedi2_thread_args->pv = pv;
-            eedi2_thread_args->plane = ii;
-
-            if( taskset_thread_spawn( &pv->eedi2_taskset, ii,
-                                      "eedi2_filter_segment",
-                                      eedi2_filter_thread,
-                                      HB_NORMAL_PRIORITY ) == 0 )
-            {
-                hb_error( "eedi2 could not spawn thread" );
-            }
+            eedi2_thread_args->segment = ii;
         }
     }
     
@@ -2517,10 +2597,13 @@ static void hb_decomb_close( hb_filter_object_t * filter )
 
     if( pv->post_processing > 1  && ( pv->mode & MODE_EEDI2 ) )
     {
-        if (pv->cx2) eedi2_aligned_free(pv->cx2);
-        if (pv->cy2) eedi2_aligned_free(pv->cy2);
-        if (pv->cxy) eedi2_aligned_free(pv->cxy);
-        if (pv->tmpc) eedi2_aligned_free(pv->tmpc);
+        for( ii = 0; ii < 3; ii++ )
+        {
+            if (pv->cx2[ii]) eedi2_aligned_free(pv->cx2[ii]);
+            if (pv->cy2[ii]) eedi2_aligned_free(pv->cy2[ii]);
+            if (pv->cxy[ii]) eedi2_aligned_free(pv->cxy[ii]);
+            if (pv->tmpc[ii]) eedi2_aligned_free(pv->tmpc[ii]);
+        }
     }
     
     free(pv->block_score);
@@ -2543,7 +2626,7 @@ static int hb_decomb_work( hb_filter_object_t * filter,
 {
     hb_filter_private_t * pv = filter->private_data;
     hb_buffer_t * in = *buf_in;
-    hb_buffer_t * last = NULL, * out = NULL;
+    hb_buffer_t * last = NULL, * out = NULL, * buf;
 
     if ( in->size <= 0 )
     {
@@ -2561,7 +2644,7 @@ static int hb_decomb_work( hb_filter_object_t * filter,
     if (!pv->yadif_ready)
     {
         // If yadif is not ready, store another ref and return HB_FILTER_DELAY
-        store_ref(pv, hb_buffer_dup(in));
+        store_ref(pv, hb_buffer_share(in));
         pv->yadif_ready = 1;
         // Wait for next
         return HB_FILTER_DELAY;
@@ -2603,33 +2686,50 @@ static int hb_decomb_work( hb_filter_object_t * filter,
         // tff for eedi2
         pv->tff = !parity;
 
-        if (o_buf[idx] == NULL)
-        {
-            o_buf[idx] = hb_video_buffer_init(in->f.width, in->f.height);
-        }
-
         if (frame)
             pv->skip_comb_check = 1;
         else
             pv->skip_comb_check = 0;
 
-        yadif_filter(pv, o_buf[idx], parity, tff);
+        buf = NULL;
+        if (decomb_check_frame(pv) == 0)
+        {
+            // Unfortunately, all frames must be fed to mcdeint combed or
+            // not since it maintains state that is updated by each frame.
+            // Its output isn't used for uncombed frames.
+            if (pv->mcdeint_mode >= 0)
+            {
+                if (o_buf[idx] == NULL)
+                {
+                    o_buf[idx] = hb_video_buffer_init(in->f.width, in->f.height);
+                }
+                mcdeint_filter(o_buf[idx], pv->ref[1], parity, &pv->mcdeint);
+            }
 
-        // Unfortunately, all frames must be fed to mcdeint combed or
-        // not since it maintains state that is updated by each frame.
-        if (pv->mcdeint_mode >= 0)
+            // Uncombed, the output is the frame itself
+            buf = hb_buffer_share(pv->ref[1]);
+        }
+        else
         {
-            if (o_buf[idx^1] == NULL)
+            if (o_buf[idx] == NULL)
             {
-                o_buf[idx^1] = hb_video_buffer_init(in->f.width, in->f.height);
+                o_buf[idx] = hb_video_buffer_init(in->f.width, in->f.height);
             }
-            /* Perform mcdeint filtering */
-            mcdeint_filter(o_buf[idx^1], o_buf[idx], parity, &pv->mcdeint);
 
-            // If frame was combed, we will use results from mcdeint
-            // else we will use yadif result
-            if (pv->is_combed)
+            yadif_filter(pv, o_buf[idx], parity, tff);
+
+            if (pv->mcdeint_mode >= 0)
+            {
+                if (o_buf[idx^1] == NULL)
+                {
+                    o_buf[idx^1] = hb_video_buffer_init(in->f.width, in->f.height);
+                }
+                /* Perform mcdeint filtering */
+                mcdeint_filter(o_buf[idx^1], o_buf[idx], parity, &pv->mcdeint);
+
+                // Use the results from mcdeint
                 idx ^= 1;
+            }
         }
 
         // Add to list of output buffers (should be at most 2)
@@ -2637,23 +2737,28 @@ static int hb_decomb_work( hb_filter_object_t * filter,
             pv->is_combed == 0 ||
             frame == num_frames - 1)
         {
+            if (buf == NULL)
+            {
+                buf = o_buf[idx];
+
+                // Indicate that buffer was consumed
+                o_buf[idx] = NULL;
+                idx ^= 1;
+            }
             if ( out == NULL )
             {
-                last = out = o_buf[idx];
+                last = out = buf;
             }
             else
             {
-                last->next = o_buf[idx];
+                last->next = buf;
                 last = last->next;
             }
             last->next = NULL;
 
-            // Indicate that buffer was consumed
-            o_buf[idx] = NULL;
-
             /* Copy buffered settings to output buffer settings */
             last->s = pv->ref[1]->s;
-            idx ^= 1;
+            hb_buffer_copy_qp( last, pv->ref[1] );
 
             if ((pv->mode & MODE_MASK) && pv->spatial_metric >= 0 )
             {
@@ -2662,6 +2767,8 @@ static int hb_decomb_work( hb_filter_object_t * filter,
                     ((pv->mode & MODE_MASK) && (pv->mode & MODE_GAMMA)) ||
                     pv->is_combed)
                 {
+                    // An uncombed frame still shares its picture with ref[1]
+                    hb_buffer_make_writable(last);
                     apply_mask(pv, last);
                 }
             }
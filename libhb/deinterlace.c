@@ -21,6 +21,7 @@
 #include "mpeg2dec/mpeg2.h"
 #include "mcdeint.h"
 #include "taskset.h"
+#include "yadif.h"
 
 // yadif_mode is a bit vector with the following flags
 // Note that 2PASS should be enabled when using MCDEINT
@@ -35,10 +36,6 @@
 #define MCDEINT_MODE_DEFAULT   -1
 #define MCDEINT_QP_DEFAULT      1
 
-#define ABS(a) ((a) > 0 ? (a) : (-(a)))
-#define MIN3(a,b,c) MIN(MIN(a,b),c)
-#define MAX3(a,b,c) MAX(MAX(a,b),c)
-
 typedef struct yadif_arguments_s {
     hb_buffer_t * dst;
     int parity;
@@ -55,10 +52,11 @@ struct hb_filter_private_s
     int              yadif_ready;
 
     hb_buffer_t      * yadif_ref[3];
+    yadif_dsp_t      yadif_dsp;
 
     int              cpu_count;
 
-    taskset_t        yadif_taskset;         // Threads for Yadif - one per CPU
+    taskset_t        yadif_taskset;         // Yadif segments - one per CPU
 
     yadif_arguments_t *yadif_arguments;     // Arguments to thread for work
 
@@ -107,63 +105,8 @@ static void yadif_filter_line(
     int                   stride,
     int                   parity)
 {
-    uint8_t *prev2 = parity ? prev : cur ;
-    uint8_t *next2 = parity ? cur  : next;
-
-    int x;
-    for( x = 0; x < width; x++)
-    {
-        int c              = cur[-stride];
-        int d              = (prev2[0] + next2[0])>>1;
-        int e              = cur[+stride];
-        int temporal_diff0 = ABS(prev2[0] - next2[0]);
-        int temporal_diff1 = ( ABS(prev[-stride] - c) + ABS(prev[+stride] - e) ) >> 1;
-        int temporal_diff2 = ( ABS(next[-stride] - c) + ABS(next[+stride] - e) ) >> 1;
-        int diff           = MAX3(temporal_diff0>>1, temporal_diff1, temporal_diff2);
-        int spatial_pred   = (c+e)>>1;
-        int spatial_score  = ABS(cur[-stride-1] - cur[+stride-1]) + ABS(c-e) +
-                             ABS(cur[-stride+1] - cur[+stride+1]) - 1;
-
-#define YADIF_CHECK(j)\
-        {   int score = ABS(cur[-stride-1+j] - cur[+stride-1-j])\
-                      + ABS(cur[-stride  +j] - cur[+stride  -j])\
-                      + ABS(cur[-stride+1+j] - cur[+stride+1-j]);\
-            if( score < spatial_score ){\
-                spatial_score = score;\
-                spatial_pred  = (cur[-stride  +j] + cur[+stride  -j])>>1;\
-
-        YADIF_CHECK(-1) YADIF_CHECK(-2) }} }}
-        YADIF_CHECK( 1) YADIF_CHECK( 2) }} }}
-
-        if( pv->yadif_mode & MODE_YADIF_SPATIAL )
-        {
-            int b = (prev2[-2*stride] + next2[-2*stride])>>1;
-            int f = (prev2[+2*stride] + next2[+2*stride])>>1;
-
-            int max = MAX3(d-e, d-c, MIN(b-c, f-e));
-            int min = MIN3(d-e, d-c, MAX(b-c, f-e));
-
-            diff = MAX3( diff, min, -max );
-        }
-
-        if( spatial_pred > d + diff )
-        {
-            spatial_pred = d + diff;
-        }
-        else if( spatial_pred < d - diff )
-        {
-            spatial_pred = d - diff;
-        }
-
-        dst[0] = spatial_pred;
-
-        dst++;
-        cur++;
-        prev++;
-        next++;
-        prev2++;
-        next2++;
-    }
+    pv->yadif_dsp.filter_line( dst, prev, cur, next, 0, width, stride, parity,
+                               pv->yadif_mode & MODE_YADIF_SPATIAL );
 }
 
 typedef struct yadif_thread_arg_s {
@@ -172,128 +115,101 @@ typedef struct yadif_thread_arg_s {
 } yadif_thread_arg_t;
 
 /*
- * deinterlace this segment of all three planes in a single thread.
+ * deinterlace this segment of all three planes.
+ * Runs on the shared worker pool once per taskset_cycle().
  */
 void yadif_filter_thread( void *thread_args_v )
 {
     yadif_arguments_t *yadif_work = NULL;
     hb_filter_private_t * pv;
-    int run = 1;
     int segment, segment_start, segment_stop;
     yadif_thread_arg_t *thread_args = thread_args_v;
 
     pv = thread_args->pv;
     segment = thread_args->segment;
 
-    hb_log("Yadif Deinterlace thread started for segment %d", segment);
+    yadif_work = &pv->yadif_arguments[segment];
 
-    while( run )
+    if( yadif_work->dst == NULL )
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->yadif_taskset, segment );
-
+        hb_error( "Thread started when no work available" );
+        return;
+    }
 
-        if( taskset_thread_stop( &pv->yadif_taskset, segment ) )
+    /*
+     * Process all three planes, but only this segment of it.
+     */
+    int pp;
+    for(pp = 0; pp < 3; pp++)
+    {
+        hb_buffer_t *dst = yadif_work->dst;
+        int w = dst->plane[pp].width;
+        int s = dst->plane[pp].stride;
+        int h = dst->plane[pp].height;
+        int yy;
+        int parity = yadif_work->parity;
+        int tff = yadif_work->tff;
+        int penultimate = h - 2;
+
+        int segment_height = (h / pv->cpu_count) & ~1;
+        segment_start = segment_height * segment;
+        if( segment == pv->cpu_count - 1 )
         {
             /*
-             * No more work to do, exit this thread.
+             * Final segment
              */
-            run = 0;
-            goto report_completion;
-        } 
-
-        yadif_work = &pv->yadif_arguments[segment];
-
-        if( yadif_work->dst == NULL )
-        {
-            hb_error( "Thread started when no work available" );
-            hb_snooze(500);
-            goto report_completion;
+            segment_stop = h;
+        } else {
+            segment_stop = segment_height * ( segment + 1 );
         }
-        
-        /*
-         * Process all three planes, but only this segment of it.
-         */
-        int pp;
-        for(pp = 0; pp < 3; pp++)
-        {
-            hb_buffer_t *dst = yadif_work->dst;
-            int w = dst->plane[pp].width;
-            int s = dst->plane[pp].stride;
-            int h = dst->plane[pp].height;
-            int yy;
-            int parity = yadif_work->parity;
-            int tff = yadif_work->tff;
-            int penultimate = h - 2;
-
-            int segment_height = (h / pv->cpu_count) & ~1;
-            segment_start = segment_height * segment;
-            if( segment == pv->cpu_count - 1 )
-            {
-                /*
-                 * Final segment
-                 */
-                segment_stop = h;
-            } else {
-                segment_stop = segment_height * ( segment + 1 );
-            }
 
-            uint8_t *dst2 = &dst->plane[pp].data[segment_start * s];
-            uint8_t *prev = &pv->yadif_ref[0]->plane[pp].data[segment_start * s];
-            uint8_t *cur  = &pv->yadif_ref[1]->plane[pp].data[segment_start * s];
-            uint8_t *next = &pv->yadif_ref[2]->plane[pp].data[segment_start * s];
-            for( yy = segment_start; yy < segment_stop; yy++ )
+        uint8_t *dst2 = &dst->plane[pp].data[segment_start * s];
+        uint8_t *prev = &pv->yadif_ref[0]->plane[pp].data[segment_start * s];
+        uint8_t *cur  = &pv->yadif_ref[1]->plane[pp].data[segment_start * s];
+        uint8_t *next = &pv->yadif_ref[2]->plane[pp].data[segment_start * s];
+        for( yy = segment_start; yy < segment_stop; yy++ )
+        {
+            if(((yy ^ parity) &  1))
             {
-                if(((yy ^ parity) &  1))
+                /* This is the bottom field when TFF and vice-versa.
+                   It's the field that gets filtered. Because yadif
+                   needs 2 lines above and below the one being filtered,
+                   we need to mirror the edges. When TFF, this means
+                   replacing the 2nd line with a copy of the 1st,
+                   and the last with the second-to-last.                  */
+                if( yy > 1 && yy < penultimate )
                 {
-                    /* This is the bottom field when TFF and vice-versa.
-                       It's the field that gets filtered. Because yadif
-                       needs 2 lines above and below the one being filtered,
-                       we need to mirror the edges. When TFF, this means
-                       replacing the 2nd line with a copy of the 1st,
-                       and the last with the second-to-last.                  */
-                    if( yy > 1 && yy < penultimate )
-                    {
-                        /* This isn't the top or bottom,
-                         * proceed as normal to yadif. */
-                        yadif_filter_line(pv, dst2, prev, cur, next, w, s, 
-                                          parity ^ tff);
-                    }
-                    else
-                    {
-                        // parity == 0 (TFF), y1 = y0
-                        // parity == 1 (BFF), y0 = y1
-                        // parity == 0 (TFF), yu = yp
-                        // parity == 1 (BFF), yp = yu
-                        uint8_t *src  = &pv->yadif_ref[1]->plane[pp].data[(yy^parity)*s];
-                        memcpy(dst2, src, w);
-                    }
+                    /* This isn't the top or bottom,
+                     * proceed as normal to yadif. */
+                    yadif_filter_line(pv, dst2, prev, cur, next, w, s, 
+                                      parity ^ tff);
                 }
                 else
                 {
-                    /* Preserve this field unfiltered */
-                    memcpy(dst2, cur, w);
+                    // parity == 0 (TFF), y1 = y0
+                    // parity == 1 (BFF), y0 = y1
+                    // parity == 0 (TFF), yu = yp
+                    // parity == 1 (BFF), yp = yu
+                    uint8_t *src  = &pv->yadif_ref[1]->plane[pp].data[(yy^parity)*s];
+                    memcpy(dst2, src, w);
                 }
-                dst2 += s;
-                prev += s;
-                cur += s;
-                next += s;
             }
+            else
+            {
+                /* Preserve this field unfiltered */
+                memcpy(dst2, cur, w);
+            }
+            dst2 += s;
+            prev += s;
+            cur += s;
+            next += s;
         }
-
-report_completion:
-        /*
-         * Finished this segment, let everyone know.
-         */
-        taskset_thread_complete( &pv->yadif_taskset, segment );
     }
 }
 
 
 /*
- * threaded yadif - each thread deinterlaces a single segment of all
+ * threaded yadif - each pool task deinterlaces a single segment of all
  * three planes. Where a segment is defined as the frame divided by
  * the number of CPUs.
  *
@@ -315,7 +231,7 @@ static void yadif_filter( hb_filter_private_t * pv,
         pv->yadif_arguments[segment].dst = dst;
     }
 
-    /* Allow the taskset threads to make one pass over the data. */
+    /* Allow the taskset to make one pass over the data. */
     taskset_cycle( &pv->yadif_taskset );
 
     /*
@@ -353,13 +269,17 @@ static int hb_deinterlace_init( hb_filter_object_t * filter,
     /* Allocate yadif specific buffers */
     if( pv->yadif_mode & MODE_YADIF_ENABLE )
     {
+        yadif_dsp_init( &pv->yadif_dsp );
+
         /*
          * Setup yadif taskset.
          */
         pv->yadif_arguments = malloc( sizeof( yadif_arguments_t ) * pv->cpu_count );
         if( pv->yadif_arguments == NULL ||
-            taskset_init( &pv->yadif_taskset, /*thread_count*/pv->cpu_count,
-                          sizeof( yadif_arguments_t ) ) == 0 )
+            taskset_init( &pv->yadif_taskset, hb_taskpool_get( init->job->h ),
+                          "yadif_filter_segment", pv->cpu_count,
+                          sizeof( yadif_thread_arg_t ),
+                          yadif_filter_thread ) == 0 )
         {
             hb_error( "yadif could not initialize taskset" );
         }
@@ -374,14 +294,6 @@ static int hb_deinterlace_init( hb_filter_object_t * filter,
             thread_args->pv = pv;
             thread_args->segment = ii;
             pv->yadif_arguments[ii].dst = NULL;
-
-            if( taskset_thread_spawn( &pv->yadif_taskset, ii,
-                                      "yadif_filter_segment",
-                                      yadif_filter_thread,
-                                      HB_NORMAL_PRIORITY ) == 0 )
-            {
-                hb_error( "yadif could not spawn thread" );
-            }
         }
     }
 
@@ -442,6 +354,7 @@ static hb_buffer_t * deint_fast(hb_buffer_t * in)
 
     out->s = in->s;
     hb_buffer_move_subs(out, in);
+    hb_buffer_copy_qp(out, in);
 
     return out;
 }
@@ -477,7 +390,7 @@ static int hb_deinterlace_work( hb_filter_object_t * filter,
     if (!pv->yadif_ready)
     {
         // If yadif is not ready, store another ref and return HB_FILTER_DELAY
-        yadif_store_ref(pv, hb_buffer_dup(in));
+        yadif_store_ref(pv, hb_buffer_share(in));
         pv->yadif_ready = 1;
         // Wait for next
         return HB_FILTER_DELAY;
@@ -547,6 +460,7 @@ static int hb_deinterlace_work( hb_filter_object_t * filter,
 
             /* Copy buffered settings to output buffer settings */
             last->s = pv->yadif_ref[1]->s;
+            hb_buffer_copy_qp( last, pv->yadif_ref[1] );
             idx ^= 1;
         }
     }
@@ -19,20 +19,56 @@
 #include "hb.h"
 #include "hbffmpeg.h"
 #include "mpeg2dec/mpeg2.h"
+#include "taskset.h"
 
 #define HQDN3D_SPATIAL_LUMA_DEFAULT    4.0f
 #define HQDN3D_SPATIAL_CHROMA_DEFAULT  3.0f
 #define HQDN3D_TEMPORAL_LUMA_DEFAULT   6.0f
 
+#define HQDN3D_ROWS 4   // rows of horizontal lowpass run together
+
+#define DENOISE_PASS_ROWS     0
+#define DENOISE_PASS_COLUMNS  1
+
 #define ABS(A) ( (A) > 0 ? (A) : -(A) )
 
+#if ( defined( __GNUC__ ) || defined( __clang__ ) ) && \
+    ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define HQDN3D_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct
+{
+    void (* temporal_row)( unsigned char *, unsigned char *,
+                           unsigned short *, int, int, int * );
+    void (* vertical_row)( unsigned int *, unsigned char *,
+                           unsigned int *, int, int, int * );
+    void (* vertical_temporal_row)( unsigned int *, unsigned char *,
+                                    unsigned int *, unsigned short *,
+                                    int, int, int *, int * );
+} hqdn3d_dsp_t;
+
 struct hb_filter_private_s
 {
     int              hqdn3d_coef[4][512*16];
-    unsigned int   * hqdn3d_line;
+    hqdn3d_dsp_t     dsp;
+    unsigned int   * hqdn3d_line[3];
+    unsigned int   * hqdn3d_row[3];
     unsigned short * hqdn3d_frame[3];
+    unsigned int   * hqdn3d_hbuf[3];    // horizontal lowpass of whole planes
+
+    int              cpu_count;
+    taskset_t        denoise_taskset;   // Denoise segments - one per CPU
+    int              pass;              // DENOISE_PASS_* of the next cycle
+    hb_buffer_t    * buf;               // Frame being denoised
 };
 
+typedef struct denoise_thread_arg_s {
+    hb_filter_private_t *pv;
+    int segment;
+} denoise_thread_arg_t;
+
 static int hb_denoise_init( hb_filter_object_t * filter,
                             hb_filter_init_t * init );
 
@@ -42,6 +78,15 @@ static int hb_denoise_work( hb_filter_object_t * filter,
 
 static void hb_denoise_close( hb_filter_object_t * filter );
 
+static void hb_denoise_stripe_begin( hb_filter_object_t * filter,
+                                     hb_buffer_t * in,
+                                     hb_buffer_t ** out );
+
+static void hb_denoise_stripe_work( hb_filter_object_t * filter,
+                                    hb_buffer_t * in,
+                                    hb_buffer_t * out,
+                                    int start, int stop );
+
 hb_filter_object_t hb_filter_denoise =
 {
     .id            = HB_FILTER_DENOISE,
@@ -51,6 +96,9 @@ hb_filter_object_t hb_filter_denoise =
     .init          = hb_denoise_init,
     .work          = hb_denoise_work,
     .close         = hb_denoise_close,
+    .stripe_begin  = hb_denoise_stripe_begin,
+    .stripe_work   = hb_denoise_stripe_work,
+    .flags         = HB_FILTER_FLAG_INPLACE,
 };
 
 static void hqdn3d_precalc_coef( int * ct,
@@ -80,104 +128,401 @@ static inline unsigned int hqdn3d_lowpass_mul( unsigned int prev_mul,
     return curr_mul + coef[d];
 }
 
-static void hqdn3d_denoise_temporal( unsigned char * frame_src,
-                                     unsigned char * frame_dst,
-                                     unsigned short * frame_ant,
-                                     int w, int h,
-                                     int * temporal)
+/*
+ * Every row after the first is filtered in two passes.  The horizontal
+ * lowpass is recursive along the row, which makes it a long chain of
+ * dependent table lookups.  It is run for HQDN3D_ROWS rows at once so
+ * the chains of different rows overlap, into scratch rows.  The vertical
+ * and temporal lowpasses are independent for each pixel of a row, and
+ * these row functions have SIMD versions.
+ */
+static void hqdn3d_horizontal( unsigned char * src, unsigned int * row,
+                               int w, int rows, int * horizontal )
 {
-    int x, y;
-    unsigned int pixel_dst;
+    int x;
+    unsigned int pixel_ant;
 
-    for( y = 0; y < h; y++ )
+    if( rows == 4 )
     {
-        for( x = 0; x < w; x++ )
+        unsigned char * s0 = src,     * s1 = src + w;
+        unsigned char * s2 = src + 2*w, * s3 = src + 3*w;
+        unsigned int  * r0 = row,     * r1 = row + w;
+        unsigned int  * r2 = row + 2*w, * r3 = row + 3*w;
+        unsigned int    a0, a1, a2, a3;
+
+        /* First pixel on each line doesn't have previous pixel */
+        r0[0] = a0 = s0[0]<<16;
+        r1[0] = a1 = s1[0]<<16;
+        r2[0] = a2 = s2[0]<<16;
+        r3[0] = a3 = s3[0]<<16;
+
+        /* The rest of the pixels in the line are normal */
+        for( x = 1; x < w; x++ )
         {
-            pixel_dst = hqdn3d_lowpass_mul( frame_ant[x]<<8,
-                                            frame_src[x]<<16,
-                                            temporal );
+            r0[x] = a0 = hqdn3d_lowpass_mul( a0, s0[x]<<16, horizontal );
+            r1[x] = a1 = hqdn3d_lowpass_mul( a1, s1[x]<<16, horizontal );
+            r2[x] = a2 = hqdn3d_lowpass_mul( a2, s2[x]<<16, horizontal );
+            r3[x] = a3 = hqdn3d_lowpass_mul( a3, s3[x]<<16, horizontal );
+        }
+        return;
+    }
 
-            frame_ant[x] = ((pixel_dst+0x1000007F)>>8);
-            frame_dst[x] = ((pixel_dst+0x10007FFF)>>16);
+    for( ; rows > 0; rows--, src += w, row += w )
+    {
+        row[0] = pixel_ant = src[0]<<16;
+
+        for( x = 1; x < w; x++ )
+        {
+            row[x] = pixel_ant = hqdn3d_lowpass_mul( pixel_ant,
+                                                     src[x]<<16,
+                                                     horizontal );
         }
+    }
+}
+
+static void hqdn3d_temporal_row_c( unsigned char * src, unsigned char * dst,
+                                   unsigned short * frame_ant,
+                                   int x, int w, int * temporal )
+{
+    unsigned int pixel_dst;
 
-        frame_src += w;
-        frame_dst += w;
-        frame_ant += w;
+    for( ; x < w; x++ )
+    {
+        pixel_dst = hqdn3d_lowpass_mul( frame_ant[x]<<8,
+                                        src[x]<<16,
+                                        temporal );
+
+        frame_ant[x] = ((pixel_dst+0x1000007F)>>8);
+        dst[x] = ((pixel_dst+0x10007FFF)>>16);
     }
 }
 
-static void hqdn3d_denoise_spatial( unsigned char * frame_src,
-                                    unsigned char * frame_dst,
-                                    unsigned int * line_ant,
-                                    int w, int h,
-                                    int * horizontal,
-                                    int * vertical )
+static void hqdn3d_vertical_row_c( unsigned int * row, unsigned char * dst,
+                                   unsigned int * line_ant,
+                                   int x, int w, int * vertical )
 {
-    int x, y;
-    int line_offset_src = 0, line_offset_dst = 0;
-    unsigned int pixel_ant;
     unsigned int pixel_dst;
 
-    /* First pixel has no left nor top neighbor. */
-    pixel_dst = line_ant[0] = pixel_ant = frame_src[0]<<16;
-    frame_dst[0] = ((pixel_dst+0x10007FFF)>>16);
+    for( ; x < w; x++ )
+    {
+        pixel_dst = line_ant[x] = hqdn3d_lowpass_mul( line_ant[x],
+                                                      row[x],
+                                                      vertical );
+
+        dst[x] = ((pixel_dst+0x10007FFF)>>16);
+    }
+}
+
+static void hqdn3d_vertical_temporal_row_c( unsigned int * row,
+                                            unsigned char * dst,
+                                            unsigned int * line_ant,
+                                            unsigned short * line_prev,
+                                            int x, int w,
+                                            int * vertical, int * temporal )
+{
+    unsigned int pixel_dst;
 
-    /* First line has no top neighbor, only left. */
-    for( x = 1; x < w; x++ )
+    for( ; x < w; x++ )
     {
-        pixel_dst = line_ant[x] = hqdn3d_lowpass_mul(pixel_ant,
-                                                     frame_src[x]<<16,
-                                                     horizontal);
+        line_ant[x]  = hqdn3d_lowpass_mul( line_ant[x],
+                                           row[x], vertical);
+        pixel_dst    = hqdn3d_lowpass_mul( line_prev[x]<<8,
+                                           line_ant[x],
+                                           temporal );
+        line_prev[x] = ((pixel_dst+0x1000007F)>>8);
+
+        dst[x] = ((pixel_dst+0x10007FFF)>>16);
+    }
+}
+
+#if HQDN3D_X86
+/*
+ * SSE2 and AVX2 versions of the row functions.  They compute exactly what
+ * the C versions do, a vector of pixels at a time, and leave the end of
+ * the row to the C versions.  The lowpass table lookup is a gather on
+ * AVX2 and a store and scalar loads on SSE2.  Results are truncated to
+ * 16 and 8 bits like the C stores do, not saturated.
+ */
+__attribute__((target("sse2")))
+static inline __m128i hqdn3d_lowpass_sse2( __m128i prev, __m128i curr,
+                                           int * coef )
+{
+    int32_t d[4] __attribute__((aligned(16)));
+    __m128i diff = _mm_sub_epi32( prev, curr );
+
+    _mm_store_si128( (__m128i*)d,
+        _mm_srai_epi32( _mm_add_epi32( diff, _mm_set1_epi32( 0x10007FF ) ),
+                        12 ) );
+    return _mm_add_epi32( curr, _mm_setr_epi32( coef[d[0]], coef[d[1]],
+                                                coef[d[2]], coef[d[3]] ) );
+}
 
-        frame_dst[x] = ((pixel_dst+0x10007FFF)>>16);
+// low 16 bits of each 32 bit lane, as 4 16 bit values in the low half
+__attribute__((target("sse2")))
+static inline __m128i hqdn3d_pack16_sse2( __m128i v )
+{
+    v = _mm_srai_epi32( _mm_slli_epi32( v, 16 ), 16 );
+    return _mm_packs_epi32( v, v );
+}
+
+// low 8 bits of each 32 bit lane, as 4 bytes
+__attribute__((target("sse2")))
+static inline int hqdn3d_pack8_sse2( __m128i v )
+{
+    v = _mm_and_si128( v, _mm_set1_epi32( 0xFF ) );
+    v = _mm_packs_epi32( v, v );
+    return _mm_cvtsi128_si32( _mm_packus_epi16( v, v ) );
+}
+
+__attribute__((target("sse2")))
+static void hqdn3d_temporal_row_sse2( unsigned char * src,
+                                      unsigned char * dst,
+                                      unsigned short * frame_ant,
+                                      int x, int w, int * temporal )
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i pix, ant, pixel_dst;
+    int32_t s;
+
+    for( ; x + 4 <= w; x += 4 )
+    {
+        memcpy( &s, src + x, 4 );
+        pix = _mm_unpacklo_epi16(
+                _mm_unpacklo_epi8( _mm_cvtsi32_si128( s ), zero ), zero );
+        ant = _mm_unpacklo_epi16(
+                _mm_loadl_epi64( (__m128i*)(frame_ant + x) ), zero );
+
+        pixel_dst = hqdn3d_lowpass_sse2( _mm_slli_epi32( ant, 8 ),
+                                         _mm_slli_epi32( pix, 16 ),
+                                         temporal );
+
+        _mm_storel_epi64( (__m128i*)(frame_ant + x), hqdn3d_pack16_sse2(
+            _mm_srli_epi32( _mm_add_epi32( pixel_dst,
+                                           _mm_set1_epi32( 0x1000007F ) ), 8 ) ) );
+        s = hqdn3d_pack8_sse2(
+            _mm_srli_epi32( _mm_add_epi32( pixel_dst,
+                                           _mm_set1_epi32( 0x10007FFF ) ), 16 ) );
+        memcpy( dst + x, &s, 4 );
     }
+    hqdn3d_temporal_row_c( src, dst, frame_ant, x, w, temporal );
+}
 
-    for( y = 1; y < h; y++ )
+__attribute__((target("sse2")))
+static void hqdn3d_vertical_row_sse2( unsigned int * row,
+                                      unsigned char * dst,
+                                      unsigned int * line_ant,
+                                      int x, int w, int * vertical )
+{
+    __m128i pixel_dst;
+    int32_t s;
+
+    for( ; x + 4 <= w; x += 4 )
     {
-        unsigned int pixel_ant;
-        line_offset_src += w, line_offset_dst += w;
+        pixel_dst = hqdn3d_lowpass_sse2(
+                        _mm_loadu_si128( (__m128i*)(line_ant + x) ),
+                        _mm_loadu_si128( (__m128i*)(row + x) ),
+                        vertical );
+        _mm_storeu_si128( (__m128i*)(line_ant + x), pixel_dst );
+
+        s = hqdn3d_pack8_sse2(
+            _mm_srli_epi32( _mm_add_epi32( pixel_dst,
+                                           _mm_set1_epi32( 0x10007FFF ) ), 16 ) );
+        memcpy( dst + x, &s, 4 );
+    }
+    hqdn3d_vertical_row_c( row, dst, line_ant, x, w, vertical );
+}
 
-        /* First pixel on each line doesn't have previous pixel */
-        pixel_ant = frame_src[line_offset_src]<<16;
+__attribute__((target("sse2")))
+static void hqdn3d_vertical_temporal_row_sse2( unsigned int * row,
+                                               unsigned char * dst,
+                                               unsigned int * line_ant,
+                                               unsigned short * line_prev,
+                                               int x, int w,
+                                               int * vertical,
+                                               int * temporal )
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i ant, prev, pixel_dst;
+    int32_t s;
 
-        pixel_dst = line_ant[0] = hqdn3d_lowpass_mul( line_ant[0],
-                                                      pixel_ant,
-                                                      vertical);
+    for( ; x + 4 <= w; x += 4 )
+    {
+        ant = hqdn3d_lowpass_sse2( _mm_loadu_si128( (__m128i*)(line_ant + x) ),
+                                   _mm_loadu_si128( (__m128i*)(row + x) ),
+                                   vertical );
+        _mm_storeu_si128( (__m128i*)(line_ant + x), ant );
+
+        prev = _mm_unpacklo_epi16(
+                _mm_loadl_epi64( (__m128i*)(line_prev + x) ), zero );
+        pixel_dst = hqdn3d_lowpass_sse2( _mm_slli_epi32( prev, 8 ), ant,
+                                         temporal );
+
+        _mm_storel_epi64( (__m128i*)(line_prev + x), hqdn3d_pack16_sse2(
+            _mm_srli_epi32( _mm_add_epi32( pixel_dst,
+                                           _mm_set1_epi32( 0x1000007F ) ), 8 ) ) );
+        s = hqdn3d_pack8_sse2(
+            _mm_srli_epi32( _mm_add_epi32( pixel_dst,
+                                           _mm_set1_epi32( 0x10007FFF ) ), 16 ) );
+        memcpy( dst + x, &s, 4 );
+    }
+    hqdn3d_vertical_temporal_row_c( row, dst, line_ant, line_prev, x, w,
+                                    vertical, temporal );
+}
 
-        frame_dst[line_offset_dst] = ((pixel_dst+0x10007FFF)>>16);
+#ifdef AV_CPU_FLAG_AVX2
+__attribute__((target("avx2")))
+static inline __m256i hqdn3d_lowpass_avx2( __m256i prev, __m256i curr,
+                                           int * coef )
+{
+    __m256i d = _mm256_srai_epi32(
+                    _mm256_add_epi32( _mm256_sub_epi32( prev, curr ),
+                                      _mm256_set1_epi32( 0x10007FF ) ), 12 );
+    return _mm256_add_epi32( curr, _mm256_i32gather_epi32( coef, d, 4 ) );
+}
 
-        /* The rest of the pixels in the line are normal */
-        for( x = 1; x < w; x++ )
-        {
-            unsigned int pixel_dst;
+// low 16 bits of each 32 bit lane, as 8 16 bit values
+__attribute__((target("avx2")))
+static inline __m128i hqdn3d_pack16_avx2( __m256i v )
+{
+    v = _mm256_srai_epi32( _mm256_slli_epi32( v, 16 ), 16 );
+    return _mm_packs_epi32( _mm256_castsi256_si128( v ),
+                            _mm256_extracti128_si256( v, 1 ) );
+}
 
-            pixel_ant = hqdn3d_lowpass_mul( pixel_ant,
-                                            frame_src[line_offset_src+x]<<16,
-                                            horizontal );
-            pixel_dst = line_ant[x] = hqdn3d_lowpass_mul( line_ant[x],
-                                                          pixel_ant,
-                                                          vertical );
+// low 8 bits of each 32 bit lane, as 8 bytes in the low half
+__attribute__((target("avx2")))
+static inline __m128i hqdn3d_pack8_avx2( __m256i v )
+{
+    __m128i w;
 
-            frame_dst[line_offset_dst+x]= ((pixel_dst+0x10007FFF)>>16);
-        }
+    v = _mm256_and_si256( v, _mm256_set1_epi32( 0xFF ) );
+    w = _mm_packs_epi32( _mm256_castsi256_si128( v ),
+                         _mm256_extracti128_si256( v, 1 ) );
+    return _mm_packus_epi16( w, w );
+}
+
+__attribute__((target("avx2")))
+static void hqdn3d_temporal_row_avx2( unsigned char * src,
+                                      unsigned char * dst,
+                                      unsigned short * frame_ant,
+                                      int x, int w, int * temporal )
+{
+    __m256i pix, ant, pixel_dst;
+
+    for( ; x + 8 <= w; x += 8 )
+    {
+        pix = _mm256_cvtepu8_epi32( _mm_loadl_epi64( (__m128i*)(src + x) ) );
+        ant = _mm256_cvtepu16_epi32(
+                _mm_loadu_si128( (__m128i*)(frame_ant + x) ) );
+
+        pixel_dst = hqdn3d_lowpass_avx2( _mm256_slli_epi32( ant, 8 ),
+                                         _mm256_slli_epi32( pix, 16 ),
+                                         temporal );
+
+        _mm_storeu_si128( (__m128i*)(frame_ant + x), hqdn3d_pack16_avx2(
+            _mm256_srli_epi32( _mm256_add_epi32( pixel_dst,
+                                   _mm256_set1_epi32( 0x1000007F ) ), 8 ) ) );
+        _mm_storel_epi64( (__m128i*)(dst + x), hqdn3d_pack8_avx2(
+            _mm256_srli_epi32( _mm256_add_epi32( pixel_dst,
+                                   _mm256_set1_epi32( 0x10007FFF ) ), 16 ) ) );
     }
+    hqdn3d_temporal_row_c( src, dst, frame_ant, x, w, temporal );
 }
 
-static void hqdn3d_denoise( unsigned char * frame_src,
-                            unsigned char * frame_dst,
-                            unsigned int * line_ant,
-                            unsigned short ** frame_ant_ptr,
-                            int w,
-                            int h,
-                            int * horizontal,
-                            int * vertical,
-                            int * temporal)
+__attribute__((target("avx2")))
+static void hqdn3d_vertical_row_avx2( unsigned int * row,
+                                      unsigned char * dst,
+                                      unsigned int * line_ant,
+                                      int x, int w, int * vertical )
+{
+    __m256i pixel_dst;
+
+    for( ; x + 8 <= w; x += 8 )
+    {
+        pixel_dst = hqdn3d_lowpass_avx2(
+                        _mm256_loadu_si256( (__m256i*)(line_ant + x) ),
+                        _mm256_loadu_si256( (__m256i*)(row + x) ),
+                        vertical );
+        _mm256_storeu_si256( (__m256i*)(line_ant + x), pixel_dst );
+
+        _mm_storel_epi64( (__m128i*)(dst + x), hqdn3d_pack8_avx2(
+            _mm256_srli_epi32( _mm256_add_epi32( pixel_dst,
+                                   _mm256_set1_epi32( 0x10007FFF ) ), 16 ) ) );
+    }
+    hqdn3d_vertical_row_c( row, dst, line_ant, x, w, vertical );
+}
+
+__attribute__((target("avx2")))
+static void hqdn3d_vertical_temporal_row_avx2( unsigned int * row,
+                                               unsigned char * dst,
+                                               unsigned int * line_ant,
+                                               unsigned short * line_prev,
+                                               int x, int w,
+                                               int * vertical,
+                                               int * temporal )
+{
+    __m256i ant, prev, pixel_dst;
+
+    for( ; x + 8 <= w; x += 8 )
+    {
+        ant = hqdn3d_lowpass_avx2(
+                    _mm256_loadu_si256( (__m256i*)(line_ant + x) ),
+                    _mm256_loadu_si256( (__m256i*)(row + x) ),
+                    vertical );
+        _mm256_storeu_si256( (__m256i*)(line_ant + x), ant );
+
+        prev = _mm256_cvtepu16_epi32(
+                _mm_loadu_si128( (__m128i*)(line_prev + x) ) );
+        pixel_dst = hqdn3d_lowpass_avx2( _mm256_slli_epi32( prev, 8 ), ant,
+                                         temporal );
+
+        _mm_storeu_si128( (__m128i*)(line_prev + x), hqdn3d_pack16_avx2(
+            _mm256_srli_epi32( _mm256_add_epi32( pixel_dst,
+                                   _mm256_set1_epi32( 0x1000007F ) ), 8 ) ) );
+        _mm_storel_epi64( (__m128i*)(dst + x), hqdn3d_pack8_avx2(
+            _mm256_srli_epi32( _mm256_add_epi32( pixel_dst,
+                                   _mm256_set1_epi32( 0x10007FFF ) ), 16 ) ) );
+    }
+    hqdn3d_vertical_temporal_row_c( row, dst, line_ant, line_prev, x, w,
+                                    vertical, temporal );
+}
+#endif
+#endif
+
+static void hqdn3d_dsp_init( hqdn3d_dsp_t * dsp )
+{
+    dsp->temporal_row          = hqdn3d_temporal_row_c;
+    dsp->vertical_row          = hqdn3d_vertical_row_c;
+    dsp->vertical_temporal_row = hqdn3d_vertical_temporal_row_c;
+
+#if HQDN3D_X86
+    int cpu_flags = av_get_cpu_flags();
+
+    if( cpu_flags & AV_CPU_FLAG_SSE2 )
+    {
+        dsp->temporal_row          = hqdn3d_temporal_row_sse2;
+        dsp->vertical_row          = hqdn3d_vertical_row_sse2;
+        dsp->vertical_temporal_row = hqdn3d_vertical_temporal_row_sse2;
+    }
+#ifdef AV_CPU_FLAG_AVX2
+    if( cpu_flags & AV_CPU_FLAG_AVX2 )
+    {
+        dsp->temporal_row          = hqdn3d_temporal_row_avx2;
+        dsp->vertical_row          = hqdn3d_vertical_row_avx2;
+        dsp->vertical_temporal_row = hqdn3d_vertical_temporal_row_avx2;
+    }
+#endif
+#endif
+}
+
+/*
+ * The previous frame is seeded with the first frame.
+ */
+static unsigned short * hqdn3d_frame_ant( unsigned short ** frame_ant_ptr,
+                                          unsigned char * frame_src,
+                                          int w, int h )
 {
     int x, y;
-    int line_offset_src = 0, line_offset_dst = 0;
-    unsigned int pixel_ant;
-    unsigned int pixel_dst;
     unsigned short* frame_ant = (*frame_ant_ptr);
 
     if( !frame_ant)
@@ -194,14 +539,104 @@ static void hqdn3d_denoise( unsigned char * frame_src,
             }
         }
     }
+    return frame_ant;
+}
+
+/*
+ * The hqdn3d functions below filter rows [y_start, y_stop) of a plane.
+ * The spatial filter is recursive from one row to the next through
+ * line_ant, so a plane must be filtered in consecutive row ranges
+ * starting from row 0.
+ */
+static void hqdn3d_denoise_temporal( const hqdn3d_dsp_t * dsp,
+                                     unsigned char * frame_src,
+                                     unsigned char * frame_dst,
+                                     unsigned short * frame_ant,
+                                     int w, int y_start, int y_stop,
+                                     int * temporal)
+{
+    int y;
+
+    for( y = y_start; y < y_stop; y++ )
+    {
+        dsp->temporal_row( frame_src + y * w, frame_dst + y * w,
+                           frame_ant + y * w, 0, w, temporal );
+    }
+}
+
+static void hqdn3d_denoise_spatial( const hqdn3d_dsp_t * dsp,
+                                    unsigned char * frame_src,
+                                    unsigned char * frame_dst,
+                                    unsigned int * line_ant,
+                                    unsigned int * line_row,
+                                    int w, int y_start, int y_stop,
+                                    int * horizontal,
+                                    int * vertical )
+{
+    int x, y, k, rows;
+    unsigned int pixel_ant;
+    unsigned int pixel_dst;
+
+    if( y_start == 0 && y_stop > 0 )
+    {
+        /* First pixel has no left nor top neighbor. */
+        pixel_dst = line_ant[0] = pixel_ant = frame_src[0]<<16;
+        frame_dst[0] = ((pixel_dst+0x10007FFF)>>16);
+
+        /* First line has no top neighbor, only left. */
+        for( x = 1; x < w; x++ )
+        {
+            pixel_dst = line_ant[x] = hqdn3d_lowpass_mul(pixel_ant,
+                                                         frame_src[x]<<16,
+                                                         horizontal);
+
+            frame_dst[x] = ((pixel_dst+0x10007FFF)>>16);
+        }
+        y_start = 1;
+    }
+
+    for( y = y_start; y < y_stop; y += rows )
+    {
+        rows = MIN( HQDN3D_ROWS, y_stop - y );
+        hqdn3d_horizontal( frame_src + y * w, line_row, w, rows, horizontal );
+        for( k = 0; k < rows; k++ )
+        {
+            dsp->vertical_row( line_row + k * w, frame_dst + (y + k) * w,
+                               line_ant, 0, w, vertical );
+        }
+    }
+}
+
+static void hqdn3d_denoise( const hqdn3d_dsp_t * dsp,
+                            unsigned char * frame_src,
+                            unsigned char * frame_dst,
+                            unsigned int * line_ant,
+                            unsigned int * line_row,
+                            unsigned short ** frame_ant_ptr,
+                            int w,
+                            int h,
+                            int y_start,
+                            int y_stop,
+                            int * horizontal,
+                            int * vertical,
+                            int * temporal)
+{
+    int x, y;
+    unsigned int pixel_ant;
+    unsigned int pixel_dst;
+    unsigned short* frame_ant;
+    int k, rows;
+
+    frame_ant = hqdn3d_frame_ant( frame_ant_ptr, frame_src, w, h );
 
     /* If no spatial coefficients, do temporal denoise only */
     if( !horizontal[0] && !vertical[0] )
     {
-        hqdn3d_denoise_temporal( frame_src,
+        hqdn3d_denoise_temporal( dsp,
+                                 frame_src,
                                  frame_dst,
                                  frame_ant,
-                                 w, h,
+                                 w, y_start, y_stop,
                                  temporal);
         return;
     }
@@ -209,74 +644,195 @@ static void hqdn3d_denoise( unsigned char * frame_src,
     /* If no temporal coefficients, do spatial denoise only */
     if( !temporal[0] )
     {
-        hqdn3d_denoise_spatial( frame_src,
+        hqdn3d_denoise_spatial( dsp,
+                                frame_src,
                                 frame_dst,
                                 line_ant,
-                                w, h,
+                                line_row,
+                                w, y_start, y_stop,
                                 horizontal,
                                 vertical);
         return;
     }
 
-    /* First pixel has no left nor top neighbor. Only previous frame */
-    line_ant[0]  = pixel_ant = frame_src[0] << 16;
+    if( y_start == 0 && y_stop > 0 )
+    {
+        /* First pixel has no left nor top neighbor. Only previous frame */
+        line_ant[0]  = pixel_ant = frame_src[0] << 16;
 
-    pixel_dst    = hqdn3d_lowpass_mul( frame_ant[0]<<8,
-                                       pixel_ant,
-                                       temporal );
+        pixel_dst    = hqdn3d_lowpass_mul( frame_ant[0]<<8,
+                                           pixel_ant,
+                                           temporal );
 
-    frame_ant[0] = ((pixel_dst+0x1000007F)>>8);
-    frame_dst[0] = ((pixel_dst+0x10007FFF)>>16);
+        frame_ant[0] = ((pixel_dst+0x1000007F)>>8);
+        frame_dst[0] = ((pixel_dst+0x10007FFF)>>16);
 
-    /* First line has no top neighbor. Only left one for each pixel and last frame */
-    for( x = 1; x < w; x++ )
-    {
-        line_ant[x]  = pixel_ant = hqdn3d_lowpass_mul( pixel_ant,
-                                                       frame_src[x]<<16,
-                                                       horizontal);
+        /* First line has no top neighbor. Only left one for each pixel and last frame */
+        for( x = 1; x < w; x++ )
+        {
+            line_ant[x]  = pixel_ant = hqdn3d_lowpass_mul( pixel_ant,
+                                                           frame_src[x]<<16,
+                                                           horizontal);
 
-        pixel_dst    = hqdn3d_lowpass_mul( frame_ant[x]<<8,
-                                           pixel_ant,
-                                           temporal);
+            pixel_dst    = hqdn3d_lowpass_mul( frame_ant[x]<<8,
+                                               pixel_ant,
+                                               temporal);
 
-        frame_ant[x] = ((pixel_dst+0x1000007F)>>8);
-        frame_dst[x] = ((pixel_dst+0x10007FFF)>>16);
+            frame_ant[x] = ((pixel_dst+0x1000007F)>>8);
+            frame_dst[x] = ((pixel_dst+0x10007FFF)>>16);
+        }
+        y_start = 1;
     }
 
     /* The rest of the lines in the frame are normal */
-    for( y = 1; y < h; y++ )
+    for( y = y_start; y < y_stop; y += rows )
     {
-        unsigned int pixel_ant;
-        unsigned short * line_prev = &frame_ant[y*w];
-        line_offset_src += w, line_offset_dst += w;
+        rows = MIN( HQDN3D_ROWS, y_stop - y );
+        hqdn3d_horizontal( frame_src + y * w, line_row, w, rows, horizontal );
+        for( k = 0; k < rows; k++ )
+        {
+            dsp->vertical_temporal_row( line_row + k * w,
+                                        frame_dst + (y + k) * w, line_ant,
+                                        &frame_ant[(y + k) * w], 0, w,
+                                        vertical, temporal );
+        }
+    }
+}
 
-        /* First pixel on each line doesn't have previous pixel */
-        pixel_ant    = frame_src[line_offset_src]<<16;
-        line_ant[0]  = hqdn3d_lowpass_mul( line_ant[0],
-                                           pixel_ant,
-                                           vertical);
-        pixel_dst    = hqdn3d_lowpass_mul( line_prev[0]<<8,
-                                           line_ant[0],
-                                           temporal);
-        line_prev[0] = ((pixel_dst+0x1000007F)>>8);
+/*
+ * Threaded hqdn3d.  The recursion of the spatial lowpass runs along the
+ * rows horizontally and down the columns vertically, so a plane can't
+ * be cut into stripes that are filtered independently.  Instead each
+ * frame takes two passes over the shared worker pool, both of which give
+ * exactly the same result as the serial code:
+ *
+ * DENOISE_PASS_ROWS: each segment runs the horizontal lowpass on a band
+ *   of rows of every plane, into hqdn3d_hbuf.  Temporal only denoise is
+ *   done completely in this pass.
+ * DENOISE_PASS_COLUMNS: each segment runs the vertical and temporal
+ *   lowpasses on a band of columns of every plane, top to bottom.
+ */
+static void denoise_rows( hb_filter_private_t * pv, int p, int segment )
+{
+    hb_buffer_t * buf = pv->buf;
+    unsigned char * frame = buf->plane[p].data;
+    int w = buf->plane[p].stride;
+    int h = buf->plane[p].height;
+    int * spatial  = pv->hqdn3d_coef[p ? 2 : 0];
+    int * temporal = pv->hqdn3d_coef[p ? 3 : 1];
+    int y, y_start, y_stop, rows;
+
+    y_start = h * segment / pv->cpu_count;
+    y_stop  = h * ( segment + 1 ) / pv->cpu_count;
+
+    if( !spatial[0] )
+    {
+        hqdn3d_denoise_temporal( &pv->dsp, frame, frame,
+                                 pv->hqdn3d_frame[p],
+                                 w, y_start, y_stop, temporal );
+        return;
+    }
 
-        frame_dst[line_offset_dst] = ((pixel_dst+0x10007FFF)>>16);
+    for( y = y_start; y < y_stop; y += rows )
+    {
+        rows = MIN( HQDN3D_ROWS, y_stop - y );
+        hqdn3d_horizontal( frame + y * w, pv->hqdn3d_hbuf[p] + y * w,
+                           w, rows, spatial );
+    }
+
+    if( y_start == 0 && y_stop > 0 && !temporal[0] )
+    {
+        /* The first line of spatial only denoise filters every pixel
+         * against the first pixel, see hqdn3d_denoise_spatial() */
+        unsigned int * hbuf = pv->hqdn3d_hbuf[p];
+        int x;
 
-        /* The rest of the pixels in the line are normal */
         for( x = 1; x < w; x++ )
         {
-            unsigned int pixel_dst;
-            pixel_ant    = hqdn3d_lowpass_mul( pixel_ant,
-                                               frame_src[line_offset_src+x]<<16,
-                                               horizontal );
-            line_ant[x]  = hqdn3d_lowpass_mul( line_ant[x],
-                                               pixel_ant, vertical);
-            pixel_dst    = hqdn3d_lowpass_mul( line_prev[x]<<8,
-                                               line_ant[x],
+            hbuf[x] = hqdn3d_lowpass_mul( frame[0]<<16, frame[x]<<16,
+                                          spatial );
+        }
+    }
+}
+
+static void denoise_columns( hb_filter_private_t * pv, int p, int segment )
+{
+    hb_buffer_t * buf = pv->buf;
+    unsigned char * frame = buf->plane[p].data;
+    unsigned int * line_ant = pv->hqdn3d_line[p];
+    unsigned int * hbuf = pv->hqdn3d_hbuf[p];
+    unsigned short * frame_ant = pv->hqdn3d_frame[p];
+    int w = buf->plane[p].stride;
+    int h = buf->plane[p].height;
+    int * spatial  = pv->hqdn3d_coef[p ? 2 : 0];
+    int * temporal = pv->hqdn3d_coef[p ? 3 : 1];
+    int x, y, x_start, x_stop;
+    unsigned int pixel_dst;
+
+    if( !spatial[0] || h <= 0 )
+    {
+        return;
+    }
+
+    // Keep the bands a multiple of the SIMD width
+    x_start = ( w * segment / pv->cpu_count ) & ~15;
+    x_stop  = ( segment == pv->cpu_count - 1 ) ? w :
+              ( w * ( segment + 1 ) / pv->cpu_count ) & ~15;
+
+    /* First line has no top neighbor */
+    for( x = x_start; x < x_stop; x++ )
+    {
+        line_ant[x] = hbuf[x];
+        if( temporal[0] )
+        {
+            pixel_dst    = hqdn3d_lowpass_mul( frame_ant[x]<<8,
+                                               hbuf[x],
                                                temporal );
-            line_prev[x] = ((pixel_dst+0x1000007F)>>8);
+            frame_ant[x] = ((pixel_dst+0x1000007F)>>8);
+        }
+        else
+        {
+            pixel_dst    = hbuf[x];
+        }
+        frame[x] = ((pixel_dst+0x10007FFF)>>16);
+    }
 
-            frame_dst[line_offset_dst+x] = ((pixel_dst+0x10007FFF)>>16);
+    for( y = 1; y < h; y++ )
+    {
+        if( temporal[0] )
+        {
+            pv->dsp.vertical_temporal_row( hbuf + y * w, frame + y * w,
+                                           line_ant, frame_ant + y * w,
+                                           x_start, x_stop,
+                                           spatial, temporal );
+        }
+        else
+        {
+            pv->dsp.vertical_row( hbuf + y * w, frame + y * w, line_ant,
+                                  x_start, x_stop, spatial );
+        }
+    }
+}
+
+/*
+ * Denoise this segment of all three planes.
+ * Runs on the shared worker pool once per taskset_cycle().
+ */
+static void denoise_filter_thread( void *thread_args_v )
+{
+    denoise_thread_arg_t *thread_args = thread_args_v;
+    hb_filter_private_t * pv = thread_args->pv;
+    int p;
+
+    for( p = 0; p < 3; p++ )
+    {
+        if( pv->pass == DENOISE_PASS_ROWS )
+        {
+            denoise_rows( pv, p, thread_args->segment );
+        }
+        else
+        {
+            denoise_columns( pv, p, thread_args->segment );
         }
     }
 }
@@ -337,6 +893,34 @@ static int hb_denoise_init( hb_filter_object_t * filter,
     hqdn3d_precalc_coef( pv->hqdn3d_coef[2], spatial_chroma );
     hqdn3d_precalc_coef( pv->hqdn3d_coef[3], temporal_chroma );
 
+    hqdn3d_dsp_init( &pv->dsp );
+
+    pv->cpu_count = hb_get_cpu_count();
+
+    /*
+     * Create denoise taskset.
+     */
+    if( pv->cpu_count > 1 &&
+        taskset_init( &pv->denoise_taskset, hb_taskpool_get( init->job->h ),
+                      "denoise_filter_segment", pv->cpu_count,
+                      sizeof( denoise_thread_arg_t ),
+                      denoise_filter_thread ) == 0 )
+    {
+        hb_error( "denoise could not initialize taskset" );
+        taskset_fini( &pv->denoise_taskset );
+        pv->cpu_count = 1;
+    }
+
+    int i;
+    for( i = 0; pv->cpu_count > 1 && i < pv->cpu_count; i++ )
+    {
+        denoise_thread_arg_t *thread_args;
+
+        thread_args = taskset_thread_args( &pv->denoise_taskset, i );
+        thread_args->pv = pv;
+        thread_args->segment = i;
+    }
+
     return 0;
 }
 
@@ -349,10 +933,35 @@ static void hb_denoise_close( hb_filter_object_t * filter )
         return;
     }
 
-	if( pv->hqdn3d_line )
+	if( pv->hqdn3d_line[0] )
+    {
+        free( pv->hqdn3d_line[0] );
+        pv->hqdn3d_line[0] = NULL;
+    }
+	if( pv->hqdn3d_line[1] )
+    {
+        free( pv->hqdn3d_line[1] );
+        pv->hqdn3d_line[1] = NULL;
+    }
+	if( pv->hqdn3d_line[2] )
     {
-        free( pv->hqdn3d_line );
-        pv->hqdn3d_line = NULL;
+        free( pv->hqdn3d_line[2] );
+        pv->hqdn3d_line[2] = NULL;
+    }
+	if( pv->hqdn3d_row[0] )
+    {
+        free( pv->hqdn3d_row[0] );
+        pv->hqdn3d_row[0] = NULL;
+    }
+	if( pv->hqdn3d_row[1] )
+    {
+        free( pv->hqdn3d_row[1] );
+        pv->hqdn3d_row[1] = NULL;
+    }
+	if( pv->hqdn3d_row[2] )
+    {
+        free( pv->hqdn3d_row[2] );
+        pv->hqdn3d_row[2] = NULL;
     }
 	if( pv->hqdn3d_frame[0] )
     {
@@ -370,16 +979,137 @@ static void hb_denoise_close( hb_filter_object_t * filter )
         pv->hqdn3d_frame[2] = NULL;
     }
 
+	if( pv->hqdn3d_hbuf[0] )
+    {
+        free( pv->hqdn3d_hbuf[0] );
+        pv->hqdn3d_hbuf[0] = NULL;
+    }
+	if( pv->hqdn3d_hbuf[1] )
+    {
+        free( pv->hqdn3d_hbuf[1] );
+        pv->hqdn3d_hbuf[1] = NULL;
+    }
+	if( pv->hqdn3d_hbuf[2] )
+    {
+        free( pv->hqdn3d_hbuf[2] );
+        pv->hqdn3d_hbuf[2] = NULL;
+    }
+
+    if( pv->cpu_count > 1 )
+    {
+        taskset_fini( &pv->denoise_taskset );
+    }
+
     free( pv );
     filter->private_data = NULL;
 }
 
+/*
+ * Each plane keeps its own line buffers so that the planes of a frame can
+ * be filtered a stripe at a time, in any interleaving.
+ */
+static void denoise_alloc_lines( hb_filter_private_t * pv, hb_buffer_t * in )
+{
+    int p;
+
+    for( p = 0; p < 3; p++ )
+    {
+        if( !pv->hqdn3d_line[p] )
+        {
+            pv->hqdn3d_line[p] = malloc( in->plane[p].stride * sizeof(int) );
+        }
+        if( !pv->hqdn3d_row[p] )
+        {
+            pv->hqdn3d_row[p] = malloc( HQDN3D_ROWS * in->plane[p].stride *
+                                        sizeof(int) );
+        }
+    }
+}
+
+static void denoise_plane( hb_filter_private_t * pv, hb_buffer_t * in,
+                           int p, int y_start, int y_stop )
+{
+    int * spatial  = pv->hqdn3d_coef[p ? 2 : 0];
+    int * temporal = pv->hqdn3d_coef[p ? 3 : 1];
+
+    // hqdn3d reads each source pixel before writing the same destination
+    // pixel, so the frame is denoised in place (HB_FILTER_FLAG_INPLACE)
+    hqdn3d_denoise( &pv->dsp,
+                    in->plane[p].data,
+                    in->plane[p].data,
+                    pv->hqdn3d_line[p],
+                    pv->hqdn3d_row[p],
+                    &pv->hqdn3d_frame[p],
+                    in->plane[p].stride,
+                    in->plane[p].height,
+                    y_start, y_stop,
+                    spatial,
+                    spatial,
+                    temporal );
+}
+
+/*
+ * threaded hqdn3d, see denoise_filter_thread().
+ *
+ * This function blocks until the frame is denoised.
+ */
+static void denoise_filter( hb_filter_private_t * pv, hb_buffer_t * in )
+{
+    int p;
+
+    for( p = 0; p < 3; p++ )
+    {
+        hqdn3d_frame_ant( &pv->hqdn3d_frame[p], in->plane[p].data,
+                          in->plane[p].stride, in->plane[p].height );
+        if( !pv->hqdn3d_hbuf[p] )
+        {
+            pv->hqdn3d_hbuf[p] = malloc( in->plane[p].stride *
+                                         in->plane[p].height * sizeof(int) );
+        }
+    }
+    pv->buf = in;
+
+    pv->pass = DENOISE_PASS_ROWS;
+    taskset_cycle( &pv->denoise_taskset );
+
+    if( pv->hqdn3d_coef[0][0] || pv->hqdn3d_coef[2][0] )
+    {
+        pv->pass = DENOISE_PASS_COLUMNS;
+        taskset_cycle( &pv->denoise_taskset );
+    }
+    pv->buf = NULL;
+}
+
+static void hb_denoise_stripe_begin( hb_filter_object_t * filter,
+                                     hb_buffer_t * in,
+                                     hb_buffer_t ** out )
+{
+    denoise_alloc_lines( filter->private_data, in );
+    *out = in;
+}
+
+static void hb_denoise_stripe_work( hb_filter_object_t * filter,
+                                    hb_buffer_t * in,
+                                    hb_buffer_t * out,
+                                    int start, int stop )
+{
+    hb_filter_private_t * pv = filter->private_data;
+    int p;
+
+    for( p = 0; p < 3; p++ )
+    {
+        denoise_plane( pv, in, p, hb_plane_row( in, p, start ),
+                                  hb_plane_row( in, p, stop ) );
+    }
+}
+
 static int hb_denoise_work( hb_filter_object_t * filter,
                             hb_buffer_t ** buf_in,
                             hb_buffer_t ** buf_out )
 {
     hb_filter_private_t * pv = filter->private_data;
-    hb_buffer_t * in = *buf_in, * out;
+    hb_buffer_t * in = *buf_in;
+    int p;
 
     if ( in->size <= 0 )
     {
@@ -388,47 +1118,21 @@ static int hb_denoise_work( hb_filter_object_t * filter,
         return HB_FILTER_DONE;
     }
 
-    out = hb_video_buffer_init( in->f.width, in->f.height );
-
-    if( !pv->hqdn3d_line )
+    denoise_alloc_lines( pv, in );
+    if( pv->cpu_count > 1 )
     {
-        pv->hqdn3d_line = malloc( in->plane[0].stride * sizeof(int) );
+        denoise_filter( pv, in );
+    }
+    else
+    {
+        for( p = 0; p < 3; p++ )
+        {
+            denoise_plane( pv, in, p, 0, in->plane[p].height );
+        }
     }
 
-    hqdn3d_denoise( in->plane[0].data,
-                    out->plane[0].data,
-                    pv->hqdn3d_line,
-                    &pv->hqdn3d_frame[0],
-                    in->plane[0].stride,
-                    in->plane[0].height,
-                    pv->hqdn3d_coef[0],
-                    pv->hqdn3d_coef[0],
-                    pv->hqdn3d_coef[1] );
-
-    hqdn3d_denoise( in->plane[1].data,
-                    out->plane[1].data,
-                    pv->hqdn3d_line,
-                    &pv->hqdn3d_frame[1],
-                    in->plane[1].stride,
-                    in->plane[1].height,
-                    pv->hqdn3d_coef[2],
-                    pv->hqdn3d_coef[2],
-                    pv->hqdn3d_coef[3] );
-
-    hqdn3d_denoise( in->plane[2].data,
-                    out->plane[2].data,
-                    pv->hqdn3d_line,
-                    &pv->hqdn3d_frame[2],
-                    in->plane[2].stride,
-                    in->plane[2].height,
-                    pv->hqdn3d_coef[2],
-                    pv->hqdn3d_coef[2],
-                    pv->hqdn3d_coef[3] );
-
-    out->s = in->s;
-    hb_buffer_move_subs( out, in );
-
-    *buf_out = out;
+    *buf_in = NULL;
+    *buf_out = in;
 
     return HB_FILTER_OK;
 }
@@ -10,6 +10,13 @@
 #include "hb.h"
 #include "hbffmpeg.h"
 #include "mpeg2dec/mpeg2.h"
+#include "taskset.h"
+
+#if ( defined( __GNUC__ ) || defined( __clang__ ) ) && \
+    ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define PULLUP_X86 1
+#include <immintrin.h>
+#endif
 
 /*
  *
@@ -73,11 +80,12 @@ struct pullup_context
     int parity;
     /* Internal data */
     struct pullup_field *first, *last, *head;
+    struct pullup_field *unmeasured; /* first field without metrics */
     struct pullup_buffer *buffers;
     int nbuffers;
-    int (*diff)(unsigned char *, unsigned char *, int);
-    int (*comb)(unsigned char *, unsigned char *, int);
-    int (*var)(unsigned char *, unsigned char *, int);
+    void (*diff)(unsigned char *, unsigned char *, int, int *, int, int);
+    void (*comb)(unsigned char *, unsigned char *, int, int *, int, int);
+    void (*var)(unsigned char *, unsigned char *, int, int *, int, int);
     int metric_w, metric_h, metric_len, metric_offset;
     struct pullup_frame *frame;
 };
@@ -93,8 +101,16 @@ struct hb_filter_private_s
     struct pullup_context * pullup_ctx;
     int                     pullup_fakecount;
     int                     pullup_skipflag;
+
+    int                     cpu_count;
+    taskset_t               metric_taskset;  // Metric segments - one per CPU
 };
 
+typedef struct detelecine_thread_arg_s {
+    hb_filter_private_t *pv;
+    int segment;
+} detelecine_thread_arg_t;
+
 static int hb_detelecine_init( hb_filter_object_t * filter,
                                hb_filter_init_t * init );
 
@@ -164,6 +180,235 @@ static int pullup_var_y( unsigned char * a, unsigned char * b, int s )
     return 4*var;
 }
 
+/*
+ * The metric functions below compute the metrics of blocks [i, n) of a
+ * row of 8 pixel wide blocks, the first block being at a and b.
+ */
+static void pullup_diff_row( unsigned char * a, unsigned char * b, int s,
+                             int * dest, int i, int n )
+{
+    for( ; i < n; i++ )
+    {
+        dest[i] = pullup_diff_y( a + (i<<3), b + (i<<3), s );
+    }
+}
+
+static void pullup_licomb_row( unsigned char * a, unsigned char * b, int s,
+                               int * dest, int i, int n )
+{
+    for( ; i < n; i++ )
+    {
+        dest[i] = pullup_licomb_y( a + (i<<3), b + (i<<3), s );
+    }
+}
+
+static void pullup_var_row( unsigned char * a, unsigned char * b, int s,
+                            int * dest, int i, int n )
+{
+    for( ; i < n; i++ )
+    {
+        dest[i] = pullup_var_y( a + (i<<3), b + (i<<3), s );
+    }
+}
+
+#if PULLUP_X86
+/*
+ * psadbw sums the absolute differences of each 8 bytes on its own, which
+ * is a whole row of a block for diff and var.  comb is done in 16 bits,
+ * each column of a block sums to at most 4080 there.  All of them give
+ * exactly the same result as the C versions.
+ */
+__attribute__((target("sse2")))
+static void pullup_diff_row_sse2( unsigned char * a, unsigned char * b, int s,
+                                  int * dest, int i, int n )
+{
+    int k;
+
+    for( ; i + 2 <= n; i += 2 )
+    {
+        unsigned char * pa = a + (i<<3);
+        unsigned char * pb = b + (i<<3);
+        __m128i sum = _mm_setzero_si128();
+        for( k = 0; k < 4; k++ )
+        {
+            sum = _mm_add_epi64( sum,
+                    _mm_sad_epu8( _mm_loadu_si128( (__m128i*)(pa + k*s) ),
+                                  _mm_loadu_si128( (__m128i*)(pb + k*s) ) ) );
+        }
+        dest[i]   = _mm_cvtsi128_si32( sum );
+        dest[i+1] = _mm_cvtsi128_si32( _mm_srli_si128( sum, 8 ) );
+    }
+    pullup_diff_row( a, b, s, dest, i, n );
+}
+
+__attribute__((target("sse2")))
+static void pullup_var_row_sse2( unsigned char * a, unsigned char * b, int s,
+                                 int * dest, int i, int n )
+{
+    int k;
+
+    for( ; i + 2 <= n; i += 2 )
+    {
+        unsigned char * pa = a + (i<<3);
+        __m128i sum = _mm_setzero_si128();
+        for( k = 0; k < 3; k++ )
+        {
+            sum = _mm_add_epi64( sum,
+                    _mm_sad_epu8( _mm_loadu_si128( (__m128i*)(pa + k*s) ),
+                                  _mm_loadu_si128( (__m128i*)(pa + (k+1)*s) ) ) );
+        }
+        dest[i]   = 4 * _mm_cvtsi128_si32( sum );
+        dest[i+1] = 4 * _mm_cvtsi128_si32( _mm_srli_si128( sum, 8 ) );
+    }
+    pullup_var_row( a, b, s, dest, i, n );
+}
+
+__attribute__((target("sse2")))
+static inline __m128i pullup_comb_sse2( __m128i a, __m128i an,
+                                        __m128i b, __m128i bp )
+{
+    __m128i t1 = _mm_sub_epi16( _mm_add_epi16( a, a ), _mm_add_epi16( bp, b ) );
+    __m128i t2 = _mm_sub_epi16( _mm_add_epi16( b, b ), _mm_add_epi16( a, an ) );
+    t1 = _mm_max_epi16( t1, _mm_sub_epi16( _mm_setzero_si128(), t1 ) );
+    t2 = _mm_max_epi16( t2, _mm_sub_epi16( _mm_setzero_si128(), t2 ) );
+    return _mm_add_epi16( t1, t2 );
+}
+
+__attribute__((target("sse2")))
+static void pullup_licomb_row_sse2( unsigned char * a, unsigned char * b, int s,
+                                    int * dest, int i, int n )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one  = _mm_set1_epi16( 1 );
+    int k;
+
+    for( ; i + 2 <= n; i += 2 )
+    {
+        unsigned char * pa = a + (i<<3);
+        unsigned char * pb = b + (i<<3);
+        __m128i lo = zero, hi = zero;
+        for( k = 0; k < 4; k++ )
+        {
+            __m128i va  = _mm_loadu_si128( (__m128i*)(pa + k*s) );
+            __m128i van = _mm_loadu_si128( (__m128i*)(pa + (k+1)*s) );
+            __m128i vb  = _mm_loadu_si128( (__m128i*)(pb + k*s) );
+            __m128i vbp = _mm_loadu_si128( (__m128i*)(pb + (k-1)*s) );
+            lo = _mm_add_epi16( lo, pullup_comb_sse2(
+                        _mm_unpacklo_epi8( va,  zero ), _mm_unpacklo_epi8( van, zero ),
+                        _mm_unpacklo_epi8( vb,  zero ), _mm_unpacklo_epi8( vbp, zero ) ) );
+            hi = _mm_add_epi16( hi, pullup_comb_sse2(
+                        _mm_unpackhi_epi8( va,  zero ), _mm_unpackhi_epi8( van, zero ),
+                        _mm_unpackhi_epi8( vb,  zero ), _mm_unpackhi_epi8( vbp, zero ) ) );
+        }
+        // Sum the 8 words of lo and of hi
+        lo = _mm_madd_epi16( lo, one );
+        hi = _mm_madd_epi16( hi, one );
+        __m128i sum = _mm_add_epi32( _mm_unpacklo_epi32( lo, hi ),
+                                     _mm_unpackhi_epi32( lo, hi ) );
+        sum = _mm_add_epi32( sum, _mm_srli_si128( sum, 8 ) );
+        dest[i]   = _mm_cvtsi128_si32( sum );
+        dest[i+1] = _mm_cvtsi128_si32( _mm_srli_si128( sum, 4 ) );
+    }
+    pullup_licomb_row( a, b, s, dest, i, n );
+}
+
+#ifdef AV_CPU_FLAG_AVX2
+__attribute__((target("avx2")))
+static void pullup_diff_row_avx2( unsigned char * a, unsigned char * b, int s,
+                                  int * dest, int i, int n )
+{
+    int k;
+
+    for( ; i + 4 <= n; i += 4 )
+    {
+        unsigned char * pa = a + (i<<3);
+        unsigned char * pb = b + (i<<3);
+        __m256i sum = _mm256_setzero_si256();
+        for( k = 0; k < 4; k++ )
+        {
+            sum = _mm256_add_epi64( sum,
+                    _mm256_sad_epu8( _mm256_loadu_si256( (__m256i*)(pa + k*s) ),
+                                     _mm256_loadu_si256( (__m256i*)(pb + k*s) ) ) );
+        }
+        __m128i s0 = _mm256_castsi256_si128( sum );
+        __m128i s1 = _mm256_extracti128_si256( sum, 1 );
+        dest[i]   = _mm_cvtsi128_si32( s0 );
+        dest[i+1] = _mm_cvtsi128_si32( _mm_srli_si128( s0, 8 ) );
+        dest[i+2] = _mm_cvtsi128_si32( s1 );
+        dest[i+3] = _mm_cvtsi128_si32( _mm_srli_si128( s1, 8 ) );
+    }
+    pullup_diff_row_sse2( a, b, s, dest, i, n );
+}
+
+__attribute__((target("avx2")))
+static void pullup_var_row_avx2( unsigned char * a, unsigned char * b, int s,
+                                 int * dest, int i, int n )
+{
+    int k;
+
+    for( ; i + 4 <= n; i += 4 )
+    {
+        unsigned char * pa = a + (i<<3);
+        __m256i sum = _mm256_setzero_si256();
+        for( k = 0; k < 3; k++ )
+        {
+            sum = _mm256_add_epi64( sum,
+                    _mm256_sad_epu8( _mm256_loadu_si256( (__m256i*)(pa + k*s) ),
+                                     _mm256_loadu_si256( (__m256i*)(pa + (k+1)*s) ) ) );
+        }
+        __m128i s0 = _mm256_castsi256_si128( sum );
+        __m128i s1 = _mm256_extracti128_si256( sum, 1 );
+        dest[i]   = 4 * _mm_cvtsi128_si32( s0 );
+        dest[i+1] = 4 * _mm_cvtsi128_si32( _mm_srli_si128( s0, 8 ) );
+        dest[i+2] = 4 * _mm_cvtsi128_si32( s1 );
+        dest[i+3] = 4 * _mm_cvtsi128_si32( _mm_srli_si128( s1, 8 ) );
+    }
+    pullup_var_row_sse2( a, b, s, dest, i, n );
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pullup_load_avx2( unsigned char * p )
+{
+    return _mm256_cvtepu8_epi16( _mm_loadu_si128( (__m128i*)p ) );
+}
+
+__attribute__((target("avx2")))
+static void pullup_licomb_row_avx2( unsigned char * a, unsigned char * b, int s,
+                                    int * dest, int i, int n )
+{
+    const __m256i one = _mm256_set1_epi16( 1 );
+    int k;
+
+    for( ; i + 2 <= n; i += 2 )
+    {
+        unsigned char * pa = a + (i<<3);
+        unsigned char * pb = b + (i<<3);
+        __m256i sum = _mm256_setzero_si256();
+        for( k = 0; k < 4; k++ )
+        {
+            __m256i va  = pullup_load_avx2( pa + k*s );
+            __m256i van = pullup_load_avx2( pa + (k+1)*s );
+            __m256i vb  = pullup_load_avx2( pb + k*s );
+            __m256i vbp = pullup_load_avx2( pb + (k-1)*s );
+            __m256i t1 = _mm256_sub_epi16( _mm256_add_epi16( va, va ),
+                                           _mm256_add_epi16( vbp, vb ) );
+            __m256i t2 = _mm256_sub_epi16( _mm256_add_epi16( vb, vb ),
+                                           _mm256_add_epi16( va, van ) );
+            sum = _mm256_add_epi16( sum, _mm256_add_epi16( _mm256_abs_epi16( t1 ),
+                                                           _mm256_abs_epi16( t2 ) ) );
+        }
+        // One block in each 128 bit lane
+        sum = _mm256_madd_epi16( sum, one );
+        sum = _mm256_hadd_epi32( sum, sum );
+        sum = _mm256_hadd_epi32( sum, sum );
+        dest[i]   = _mm_cvtsi128_si32( _mm256_castsi256_si128( sum ) );
+        dest[i+1] = _mm_cvtsi128_si32( _mm256_extracti128_si256( sum, 1 ) );
+    }
+    pullup_licomb_row_sse2( a, b, s, dest, i, n );
+}
+#endif
+#endif
+
 static void pullup_alloc_metrics( struct pullup_context * c,
                                   struct pullup_field * f )
 {
@@ -172,43 +417,76 @@ static void pullup_alloc_metrics( struct pullup_context * c,
     f->var   = calloc( c->metric_len, sizeof(int) );
 }
 
+/*
+ * Computes rows [y_start, y_stop) of a metric.
+ */
 static void pullup_compute_metric( struct pullup_context * c,
                                    struct pullup_field * fa, int pa,
                                    struct pullup_field * fb, int pb,
-                                   int (* func)( unsigned char *,
-                                                 unsigned char *, int),
-                                   int * dest )
+                                   void (* func)( unsigned char *,
+                                                  unsigned char *, int,
+                                                  int *, int, int ),
+                                   int * dest, int y_start, int y_stop )
 {
     unsigned char *a, *b;
-    int x, y;
+    int y;
     int mp    = c->metric_plane;
-    int xstep = c->bpp[mp];
     int ystep = c->stride[mp]<<3;
     int s     = c->stride[mp]<<1; /* field stride */
-    int w     = c->metric_w*xstep;
 
     if( !fa->buffer || !fb->buffer ) return;
 
+    dest += y_start * c->metric_w;
+
     /* Shortcut for duplicate fields (e.g. from RFF flag) */
     if( fa->buffer == fb->buffer && pa == pb )
     {
-        memset( dest, 0, c->metric_len * sizeof(int) );
+        memset( dest, 0, ( y_stop - y_start ) * c->metric_w * sizeof(int) );
         return;
     }
 
-    a = fa->buffer->planes[mp] + pa * c->stride[mp] + c->metric_offset;
-    b = fb->buffer->planes[mp] + pb * c->stride[mp] + c->metric_offset;
+    a = fa->buffer->planes[mp] + pa * c->stride[mp] + c->metric_offset +
+        y_start * ystep;
+    b = fb->buffer->planes[mp] + pb * c->stride[mp] + c->metric_offset +
+        y_start * ystep;
 
-    for( y = c->metric_h; y; y-- )
+    for( y = y_start; y < y_stop; y++ )
     {
-        for( x = 0; x < w; x += xstep )
-        {
-            *dest++ = func( a + x, b + x, s );
-        }
+        func( a, b, s, dest, 0, c->metric_w );
+        dest += c->metric_w;
         a += ystep; b += ystep;
     }
 }
 
+/*
+ * Computes rows [y_start, y_stop) of the metrics of the fields submitted
+ * since the last pullup_finish_metrics().  Different rows can be computed
+ * at the same time.
+ */
+static void pullup_compute_metrics( struct pullup_context * c,
+                                    int y_start, int y_stop )
+{
+    struct pullup_field * f;
+    int parity;
+
+    for( f = c->unmeasured; f && f != c->head; f = f->next )
+    {
+        parity = f->parity;
+        pullup_compute_metric( c, f, parity, f->prev->prev,
+                               parity, c->diff, f->diffs, y_start, y_stop );
+        pullup_compute_metric( c, parity?f->prev:f, 0,
+                               parity?f:f->prev, 1, c->comb, f->comb,
+                               y_start, y_stop );
+        pullup_compute_metric( c, f, parity, f,
+                               -1, c->var, f->var, y_start, y_stop );
+    }
+}
+
+static void pullup_finish_metrics( struct pullup_context * c )
+{
+    c->unmeasured = 0;
+}
+
 static struct pullup_field * pullup_make_field_queue( struct pullup_context * c,
                                                       int len )
 {
@@ -240,17 +518,17 @@ static void pullup_check_field_queue( struct pullup_context * c )
     }
 }
 
-static void pullup_copy_field( struct pullup_context * c,
-                               struct pullup_buffer * dest,
-                               struct pullup_buffer * src,
-                               int parity )
+static void pullup_copy_field_planes( struct pullup_context * c,
+                                      unsigned char ** dest,
+                                      unsigned char ** src,
+                                      int nplanes, int parity )
 {
     int i, j;
     unsigned char *d, *s;
-    for( i = 0; i < c->nplanes; i++ )
+    for( i = 0; i < nplanes; i++ )
     {
-        s = src->planes[i] + parity*c->stride[i];
-        d = dest->planes[i] + parity*c->stride[i];
+        s = src[i] + parity*c->stride[i];
+        d = dest[i] + parity*c->stride[i];
         for( j = c->h[i]>>1; j; j-- )
         {
             memcpy( d, s, c->stride[i] );
@@ -260,6 +538,18 @@ static void pullup_copy_field( struct pullup_context * c,
     }
 }
 
+static void pullup_copy_field( struct pullup_context * c,
+                               struct pullup_buffer * dest,
+                               struct pullup_buffer * src,
+                               int parity )
+{
+    /* The field is already there */
+    if( dest == src ) return;
+
+    pullup_copy_field_planes( c, dest->planes, src->planes,
+                              c->nplanes, parity );
+}
+
 
 static int pullup_queue_length( struct pullup_field * begin,
                                 struct pullup_field * end )
@@ -554,9 +844,25 @@ void pullup_init_context( struct pullup_context * c )
 
     if( c->format == PULLUP_FMT_Y )
     {
-        c->diff = pullup_diff_y;
-        c->comb = pullup_licomb_y;
-        c->var  = pullup_var_y;
+        c->diff = pullup_diff_row;
+        c->comb = pullup_licomb_row;
+        c->var  = pullup_var_row;
+#if PULLUP_X86
+        if( c->cpu & AV_CPU_FLAG_SSE2 )
+        {
+            c->diff = pullup_diff_row_sse2;
+            c->comb = pullup_licomb_row_sse2;
+            c->var  = pullup_var_row_sse2;
+        }
+#ifdef AV_CPU_FLAG_AVX2
+        if( c->cpu & AV_CPU_FLAG_AVX2 )
+        {
+            c->diff = pullup_diff_row_avx2;
+            c->comb = pullup_licomb_row_avx2;
+            c->var  = pullup_var_row_avx2;
+        }
+#endif
+#endif
     }
 }
 
@@ -781,12 +1087,9 @@ void pullup_submit_field( struct pullup_context * c,
     f->breaks = 0;
     f->affinity = 0;
 
-    pullup_compute_metric( c, f, parity, f->prev->prev,
-                           parity, c->diff, f->diffs );
-    pullup_compute_metric( c, parity?f->prev:f, 0,
-                           parity?f:f->prev, 1, c->comb, f->comb );
-    pullup_compute_metric( c, f, parity, f,
-                           -1, c->var, f->var );
+    /* The metrics are computed by pullup_compute_metrics(),
+       all fields of a frame at once. */
+    if( !c->unmeasured ) c->unmeasured = f;
 
     /* Advance the circular list */
     if( !c->first ) c->first = c->head;
@@ -803,7 +1106,7 @@ void pullup_flush_fields( struct pullup_context * c )
         pullup_release_buffer( f->buffer, f->parity );
         f->buffer = 0;
     }
-    c->first = c->last = 0;
+    c->first = c->last = c->unmeasured = 0;
 }
 
 /*
@@ -812,6 +1115,40 @@ void pullup_flush_fields( struct pullup_context * c )
  *
  */
 
+/*
+ * Compute the metrics of this segment of the submitted fields.
+ * Runs on the shared worker pool once per taskset_cycle().
+ */
+static void detelecine_metric_thread( void *thread_args_v )
+{
+    detelecine_thread_arg_t *thread_args = thread_args_v;
+    hb_filter_private_t * pv = thread_args->pv;
+    struct pullup_context * ctx = pv->pullup_ctx;
+    int segment = thread_args->segment;
+
+    pullup_compute_metrics( ctx,
+                            ctx->metric_h * segment / pv->cpu_count,
+                            ctx->metric_h * ( segment + 1 ) / pv->cpu_count );
+}
+
+/*
+ * Compute the metrics of the fields submitted for a frame.
+ *
+ * This function blocks until the metrics are computed.
+ */
+static void detelecine_compute_metrics( hb_filter_private_t * pv )
+{
+    if( pv->cpu_count > 1 )
+    {
+        taskset_cycle( &pv->metric_taskset );
+    }
+    else
+    {
+        pullup_compute_metrics( pv->pullup_ctx, 0, pv->pullup_ctx->metric_h );
+    }
+    pullup_finish_metrics( pv->pullup_ctx );
+}
+
 static int hb_detelecine_init( hb_filter_object_t * filter,
                                hb_filter_init_t * init )
 {
@@ -841,6 +1178,7 @@ static int hb_detelecine_init( hb_filter_object_t * filter,
 
     ctx->format = PULLUP_FMT_Y;
     ctx->nplanes = 4;
+    ctx->cpu = av_get_cpu_flags();
 
     pullup_preinit_context( ctx );
 
@@ -872,6 +1210,32 @@ static int hb_detelecine_init( hb_filter_object_t * filter,
     pv->pullup_fakecount = 1;
     pv->pullup_skipflag = 0;
 
+    pv->cpu_count = hb_get_cpu_count();
+
+    /*
+     * Create metric taskset.
+     */
+    if( pv->cpu_count > 1 &&
+        taskset_init( &pv->metric_taskset, hb_taskpool_get( init->job->h ),
+                      "detelecine_metric_segment", pv->cpu_count,
+                      sizeof( detelecine_thread_arg_t ),
+                      detelecine_metric_thread ) == 0 )
+    {
+        hb_error( "detelecine could not initialize taskset" );
+        taskset_fini( &pv->metric_taskset );
+        pv->cpu_count = 1;
+    }
+
+    int i;
+    for( i = 0; pv->cpu_count > 1 && i < pv->cpu_count; i++ )
+    {
+        detelecine_thread_arg_t *thread_args;
+
+        thread_args = taskset_thread_args( &pv->metric_taskset, i );
+        thread_args->pv = pv;
+        thread_args->segment = i;
+    }
+
     return 0;
 }
 
@@ -889,6 +1253,11 @@ static void hb_detelecine_close( hb_filter_object_t * filter )
         pullup_free_context( pv->pullup_ctx );
     }
 
+    if( pv->cpu_count > 1 )
+    {
+        taskset_fini( &pv->metric_taskset );
+    }
+
     free( pv );
     filter->private_data = NULL;
 }
@@ -951,6 +1320,7 @@ static int hb_detelecine_work( hb_filter_object_t * filter,
     {
         pullup_submit_field( ctx, buf, parity );
     }
+    detelecine_compute_metrics( pv );
     pullup_release_buffer( buf, 2 );
 
     /* Get frame and check if pullup is ready */
@@ -1005,23 +1375,32 @@ static int hb_detelecine_work( hb_filter_object_t * filter,
         }
     }
 
-    /* Check to see if frame buffer is ready for export */
-    if( !frame->buffer )
-    {
-        pullup_pack_frame( ctx, frame );
-    }
-
     out = hb_video_buffer_init( in->f.width, in->f.height );
 
-    /* Copy pullup frame buffer into output buffer */
-    memcpy( out->plane[0].data, frame->buffer->planes[0], frame->buffer->size[0] );
-    memcpy( out->plane[1].data, frame->buffer->planes[1], frame->buffer->size[1] );
-    memcpy( out->plane[2].data, frame->buffer->planes[2], frame->buffer->size[2] );
+    if( frame->buffer )
+    {
+        /* Copy pullup frame buffer into output buffer */
+        memcpy( out->plane[0].data, frame->buffer->planes[0], frame->buffer->size[0] );
+        memcpy( out->plane[1].data, frame->buffer->planes[1], frame->buffer->size[1] );
+        memcpy( out->plane[2].data, frame->buffer->planes[2], frame->buffer->size[2] );
+    }
+    else
+    {
+        /* The fields are in different buffers.  Weave them straight
+           into the output buffer rather than packing them into a
+           pullup buffer first and copying that. */
+        unsigned char * planes[3] = { out->plane[0].data,
+                                      out->plane[1].data,
+                                      out->plane[2].data };
+        pullup_copy_field_planes( ctx, planes, frame->ofields[0]->planes, 3, 0 );
+        pullup_copy_field_planes( ctx, planes, frame->ofields[1]->planes, 3, 1 );
+    }
 
     pullup_release_frame( frame );
 
     out->s = in->s;
     hb_buffer_move_subs( out, in );
+    hb_buffer_copy_qp( out, in );
 
     *buf_out = out;
 
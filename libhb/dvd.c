@@ -28,6 +28,7 @@ static int           hb_dvdread_chapter( hb_dvd_t * d );
 static int           hb_dvdread_angle_count( hb_dvd_t * d );
 static void          hb_dvdread_set_angle( hb_dvd_t * d, int angle );
 static int           hb_dvdread_main_feature( hb_dvd_t * d, hb_list_t * list_title );
+static void          hb_dvdread_set_readahead( hb_dvd_t * d, int enable );
 
 hb_dvd_func_t hb_dvdread_func =
 {
@@ -43,7 +44,8 @@ hb_dvd_func_t hb_dvdread_func =
     hb_dvdread_chapter,
     hb_dvdread_angle_count,
     hb_dvdread_set_angle,
-    hb_dvdread_main_feature
+    hb_dvdread_main_feature,
+    hb_dvdread_set_readahead
 };
 
 static hb_dvd_func_t *dvd_methods = &hb_dvdread_func;
@@ -734,6 +736,10 @@ static int hb_dvdread_start( hb_dvd_t * e, hb_title_t *title, int chapter )
 static void hb_dvdread_stop( hb_dvd_t * e )
 {
     hb_dvdread_t *d = &(e->dvdread);
+    if( d->readahead )
+    {
+        hb_readahead_close( &d->readahead );
+    }
     if( d->ifo )
     {
         ifoClose( d->ifo );
@@ -836,6 +842,93 @@ int is_nav_pack( unsigned char *buf )
     }
 }
 
+/***********************************************************************
+ * hb_dvdread_fill
+ ***********************************************************************
+ * Readahead fill function, runs on the readahead thread
+ **********************************************************************/
+static int hb_dvdread_fill( void * opaque, int64_t pos, uint8_t * buf,
+                            int size )
+{
+    hb_dvdread_t *d = opaque;
+    int block = pos / DVD_VIDEO_LB_LEN;
+    int count = size / DVD_VIDEO_LB_LEN;
+    int result, i;
+
+    result = DVDReadBlocks( d->file, block, count, buf );
+    if( result > 0 )
+    {
+        return result * DVD_VIDEO_LB_LEN;
+    }
+
+    // Something in there can't be read (bad block, DRM or the end of
+    // the VOBs).  Hand out what comes before it, hb_dvdread_read deals
+    // with the block that fails.
+    for( i = 0; i < count; i++ )
+    {
+        if( DVDReadBlocks( d->file, block + i, 1,
+                           buf + i * DVD_VIDEO_LB_LEN ) != 1 )
+        {
+            break;
+        }
+    }
+    return i > 0 ? i * DVD_VIDEO_LB_LEN : -1;
+}
+
+/***********************************************************************
+ * hb_dvdread_set_readahead
+ ***********************************************************************
+ *
+ **********************************************************************/
+static void hb_dvdread_set_readahead( hb_dvd_t * e, int enable )
+{
+    hb_dvdread_t *d = &(e->dvdread);
+
+    if( enable && !d->readahead && d->file )
+    {
+        d->readahead = hb_readahead_init( "dvd readahead", hb_dvdread_fill,
+                                          d, HB_READAHEAD_BLOCK_SIZE,
+                                          HB_READAHEAD_BLOCK_COUNT,
+                                          DVD_VIDEO_LB_LEN );
+        if( d->readahead )
+        {
+            hb_readahead_start( d->readahead,
+                                (int64_t)d->next_vobu * DVD_VIDEO_LB_LEN );
+        }
+    }
+    else if( !enable && d->readahead )
+    {
+        hb_readahead_close( &d->readahead );
+    }
+}
+
+/***********************************************************************
+ * hb_dvdread_read_block
+ ***********************************************************************
+ * Same as DVDReadBlocks( d->file, block, 1, buf ), from the readahead
+ * if it is running.
+ **********************************************************************/
+static int hb_dvdread_read_block( hb_dvdread_t * d, int block, uint8_t * buf )
+{
+    int64_t pos = (int64_t)block * DVD_VIDEO_LB_LEN;
+
+    if( !d->readahead )
+    {
+        return DVDReadBlocks( d->file, block, 1, buf );
+    }
+    if( hb_readahead_tell( d->readahead ) != pos )
+    {
+        // Cell change, angle or error skip
+        hb_readahead_seek( d->readahead, pos );
+    }
+    if( hb_readahead_read( d->readahead, buf,
+                           DVD_VIDEO_LB_LEN ) != DVD_VIDEO_LB_LEN )
+    {
+        return -1;
+    }
+    return 1;
+}
+
 /***********************************************************************
  * hb_dvdread_read
  ***********************************************************************
@@ -868,7 +961,7 @@ static hb_buffer_t * hb_dvdread_read( hb_dvd_t * e )
 
             for( read_retry = 1; read_retry < 1024; read_retry++ )
             {
-                if( DVDReadBlocks( d->file, d->next_vobu, 1, b->data ) == 1 )
+                if( hb_dvdread_read_block( d, d->next_vobu, b->data ) == 1 )
                 {
                     /*
                      * Successful read.
@@ -1093,7 +1186,7 @@ static hb_buffer_t * hb_dvdread_read( hb_dvd_t * e )
     }
     else
     {
-        if( DVDReadBlocks( d->file, d->block, 1, b->data ) != 1 )
+        if( hb_dvdread_read_block( d, d->block, b->data ) != 1 )
         {
             // this may be a real DVD error or may be DRM. Either way
             // we don't want to quit because of one bad block so set
@@ -1337,6 +1430,11 @@ void hb_dvd_set_angle( hb_dvd_t * d, int angle )
     dvd_methods->set_angle(d, angle);
 }
 
+void hb_dvd_set_readahead( hb_dvd_t * d, int enable )
+{
+    dvd_methods->set_readahead(d, enable);
+}
+
 int hb_dvd_main_feature( hb_dvd_t * d, hb_list_t * list_title )
 {
     return dvd_methods->main_feature(d, list_title);
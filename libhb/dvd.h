@@ -42,6 +42,7 @@ struct hb_dvdread_s
     int            in_sync;
     uint16_t       cur_vob_id;
     uint8_t        cur_cell_id;
+    hb_readahead_t * readahead;
 };
 
 struct hb_dvdnav_s
@@ -84,6 +85,7 @@ struct hb_dvd_func_s
     int           (* angle_count) ( hb_dvd_t * );
     void          (* set_angle)   ( hb_dvd_t *, int );
     int           (* main_feature)( hb_dvd_t *, hb_list_t * );
+    void          (* set_readahead)( hb_dvd_t *, int );
 };
 typedef struct hb_dvd_func_s hb_dvd_func_t;
 
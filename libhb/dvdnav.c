@@ -31,6 +31,7 @@ static void          hb_dvdnav_close( hb_dvd_t ** _d );
 static int           hb_dvdnav_angle_count( hb_dvd_t * d );
 static void          hb_dvdnav_set_angle( hb_dvd_t * d, int angle );
 static int           hb_dvdnav_main_feature( hb_dvd_t * d, hb_list_t * list_title );
+static void          hb_dvdnav_set_readahead( hb_dvd_t * d, int enable );
 
 hb_dvd_func_t hb_dvdnav_func =
 {
@@ -46,7 +47,8 @@ hb_dvd_func_t hb_dvdnav_func =
     hb_dvdnav_chapter,
     hb_dvdnav_angle_count,
     hb_dvdnav_set_angle,
-    hb_dvdnav_main_feature
+    hb_dvdnav_main_feature,
+    hb_dvdnav_set_readahead
 };
 
 // there can be at most 999 PGCs per title. round that up to the nearest
@@ -1895,6 +1897,15 @@ static void hb_dvdnav_set_angle( hb_dvd_t * e, int angle )
     }
 }
 
+/***********************************************************************
+ * hb_dvdnav_set_readahead
+ ***********************************************************************
+ * Nothing to do, libdvdnav's read cache already reads whole VOBUs ahead
+ **********************************************************************/
+static void hb_dvdnav_set_readahead( hb_dvd_t * e, int enable )
+{
+}
+
 /***********************************************************************
  * FindChapterIndex
  ***********************************************************************
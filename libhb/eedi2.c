@@ -134,17 +134,41 @@ void eedi2_fill_half_height_buffer_plane( uint8_t * src, uint8_t * dst, int pitc
     }
 }
 
+/*
+ * The filters below process rows [y_start, y_stop) of their output, so a
+ * plane can be split into bands that are filtered at the same time.  They
+ * read rows outside of their band from their inputs, so one filter may
+ * only start on a plane once the filter before it has finished all of it.
+ */
+
+/**
+ * Finds the first row at or after y_start of a loop over every other row from y0
+ * @param y0 First row of the loop
+ * @param y_start First row of the band
+ */
+static int eedi2_first_row( int y0, int y_start )
+{
+    if( y_start <= y0 )
+        return y0;
+    return y_start + ( ( y_start - y0 ) & 1 );
+}
+
 /**
  * A specialized variant of bit_blit, just for resizing the field-height maps EEDI2 generates to frame-height...a simple line doubler
  * @param srcp Pointer to source bitmap plane being copied from
  * @param dstp Pointer to the destination bitmap plane being copied to
  * @param height Height of the input, half-size src plane being copied from
  * @param pitch Stride of both bitmaps
+ * @param y_start First row of srcp to copy
+ * @param y_stop Row of srcp after the last one to copy
  */
-void eedi2_upscale_by_2( uint8_t * srcp, uint8_t * dstp, int height, int pitch )
+void eedi2_upscale_by_2( uint8_t * srcp, uint8_t * dstp, int height, int pitch,
+                         int y_start, int y_stop )
 {
     int y;
-    for( y = height; y > 0; y-- )
+    srcp += pitch * y_start;
+    dstp += pitch * y_start * 2;
+    for( y = y_start; y < y_stop; y++ )
     {
       memcpy( dstp, srcp, pitch );
       dstp += pitch;
@@ -165,22 +189,28 @@ void eedi2_upscale_by_2( uint8_t * srcp, uint8_t * dstp, int height, int pitch )
  * @param lthresh Laplacian threshold, ensures edges are still prominent in the 2nd spatial derivative of the srcp plane (20 is a good default value)
  * @param height Height of half-height single-field frame
  * @param width Width of srcp bitmap rows, as opposed to the padded stride in src_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_build_edge_mask( uint8_t * dstp, int dst_pitch, uint8_t *srcp, int src_pitch,
-                            int mthresh, int lthresh, int vthresh, int height, int width )
+                            int mthresh, int lthresh, int vthresh, int height, int width,
+                            int y_start, int y_stop )
 {
     int x, y;
     
     mthresh = mthresh * 10;
     vthresh = vthresh * 81;
     
-    memset( dstp, 0, ( height / 2 ) * dst_pitch );
+    if( y_start < height / 2 )
+        memset( dstp + y_start * dst_pitch, 0,
+                ( MIN( y_stop, height / 2 ) - y_start ) * dst_pitch );
     
-    srcp += src_pitch;
-    dstp += dst_pitch;
+    y = MAX( y_start, 1 );
+    srcp += src_pitch * y;
+    dstp += dst_pitch * y;
     unsigned char *srcpp = srcp-src_pitch;
     unsigned char *srcpn = srcp+src_pitch;
-    for( y = 1; y < height - 1; ++y )
+    for( ; y < MIN( y_stop, height - 1 ); ++y )
     {
         for( x = 1; x < width-1; ++x )
         {
@@ -244,19 +274,23 @@ void eedi2_build_edge_mask( uint8_t * dstp, int dst_pitch, uint8_t *srcp, int sr
  * @param dstr Dilation threshold, ensures a pixel is only retained as an edge in dstp if this number of adjacent pixels or greater are also edges in mskp (4 is a good default value)
  * @param height Height of half-height field-sized frame
  * @param width Width of mskp bitmap rows, as opposed to the pdded stride in msk_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_dilate_edge_mask( uint8_t *mskp, int msk_pitch, uint8_t *dstp, int dst_pitch,
-                             int dstr, int height, int width )
+                             int dstr, int height, int width, int y_start, int y_stop )
 {
     int x, y;
     
-    eedi2_bit_blit( dstp, dst_pitch, mskp, msk_pitch, width, height );
+    eedi2_bit_blit( dstp + y_start * dst_pitch, dst_pitch,
+                    mskp + y_start * msk_pitch, msk_pitch, width, y_stop - y_start );
     
-    mskp += msk_pitch;
+    y = MAX( y_start, 1 );
+    mskp += msk_pitch * y;
     unsigned char *mskpp = mskp - msk_pitch;
     unsigned char *mskpn = mskp + msk_pitch;
-    dstp += dst_pitch;
-    for( y = 1; y < height - 1; ++y )
+    dstp += dst_pitch * y;
+    for( ; y < MIN( y_stop, height - 1 ); ++y )
     {
         for( x = 1; x < width - 1; ++x )
         {
@@ -292,19 +326,23 @@ void eedi2_dilate_edge_mask( uint8_t *mskp, int msk_pitch, uint8_t *dstp, int ds
  * @param estr Erosion threshold, ensures a pixel isn't retained as an edge in dstp if fewer than this number of adjacent pixels are also edges in mskp (2 is a good default value)
  * @param height Height of half-height field-sized frame
  * @param width Width of mskp bitmap rows, as opposed to the pdded stride in msk_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_erode_edge_mask( uint8_t *mskp, int msk_pitch, uint8_t *dstp, int dst_pitch,
-                            int estr, int height, int width )
+                            int estr, int height, int width, int y_start, int y_stop )
 {
     int x, y;
     
-    eedi2_bit_blit( dstp, dst_pitch, mskp, msk_pitch, width, height );
+    eedi2_bit_blit( dstp + y_start * dst_pitch, dst_pitch,
+                    mskp + y_start * msk_pitch, msk_pitch, width, y_stop - y_start );
     
-    mskp += msk_pitch;
+    y = MAX( y_start, 1 );
+    mskp += msk_pitch * y;
     unsigned char *mskpp = mskp - msk_pitch;
     unsigned char *mskpn = mskp + msk_pitch;
-    dstp += dst_pitch;
-    for ( y = 1; y < height - 1; ++y )
+    dstp += dst_pitch * y;
+    for ( ; y < MIN( y_stop, height - 1 ); ++y )
     {
         for ( x = 1; x < width - 1; ++x )
         {
@@ -341,17 +379,21 @@ void eedi2_erode_edge_mask( uint8_t *mskp, int msk_pitch, uint8_t *dstp, int dst
  * @param dst_pitch Stride of dstp
  * @param height Height of half-height field-sized frame
  * @param width Width of mskp bitmap rows, as opposed to the pdded stride in msk_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_remove_small_gaps( uint8_t * mskp, int msk_pitch, uint8_t * dstp, int dst_pitch, 
-                              int height, int width )
+                              int height, int width, int y_start, int y_stop )
 {
     int x, y;
     
-    eedi2_bit_blit( dstp, dst_pitch, mskp, msk_pitch, width, height );
+    eedi2_bit_blit( dstp + y_start * dst_pitch, dst_pitch,
+                    mskp + y_start * msk_pitch, msk_pitch, width, y_stop - y_start );
     
-    mskp += msk_pitch;
-    dstp += dst_pitch;
-    for( y = 1; y < height - 1; ++y )
+    y = MAX( y_start, 1 );
+    mskp += msk_pitch * y;
+    dstp += dst_pitch * y;
+    for( ; y < MIN( y_stop, height - 1 ); ++y )
     {
         for( x = 3; x < width - 3; ++x )
         {
@@ -391,16 +433,20 @@ void eedi2_remove_small_gaps( uint8_t * mskp, int msk_pitch, uint8_t * dstp, int
  * @param nt Noise threshold (50 is a good default value)
  * @param height Height of half-height field-sized frame
  * @param width Width of srcp bitmap rows, as opposed to the pdded stride in src_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_calc_directions( const int plane, uint8_t * mskp, int msk_pitch, uint8_t * srcp, int src_pitch,
-                            uint8_t * dstp, int dst_pitch, int maxd, int nt, int height, int width  )
+                            uint8_t * dstp, int dst_pitch, int maxd, int nt, int height, int width,
+                            int y_start, int y_stop )
 {
     int x, y, u, i;
     
-    memset( dstp, 255, dst_pitch * height );
-    mskp += msk_pitch;
-    dstp += dst_pitch;
-    srcp += src_pitch;
+    memset( dstp + dst_pitch * y_start, 255, dst_pitch * ( y_stop - y_start ) );
+    y = MAX( y_start, 1 );
+    mskp += msk_pitch * y;
+    dstp += dst_pitch * y;
+    srcp += src_pitch * y;
     unsigned char *src2p = srcp - src_pitch * 2;
     unsigned char *srcpp = srcp - src_pitch;
     unsigned char *srcpn = srcp + src_pitch;
@@ -409,7 +455,7 @@ void eedi2_calc_directions( const int plane, uint8_t * mskp, int msk_pitch, uint
     unsigned char *mskpn = mskp + msk_pitch;
     const int maxdt = plane == 0 ? maxd : ( maxd >> 1 );
 
-    for( y = 1; y < height - 1; ++y )
+    for( ; y < MIN( y_stop, height - 1 ); ++y )
     {
         for( x = 1; x < width - 1; ++x )
         {
@@ -557,21 +603,26 @@ void eedi2_calc_directions( const int plane, uint8_t * mskp, int msk_pitch, uint
  * @param dst_pitch Stride of dstp
  * @param height Height of half-height field-sized frame
  * @param width Width of mskp bitmap rows, as opposed to the pdded stride in msk_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_filter_map( uint8_t * mskp, int msk_pitch, uint8_t * dmskp, int dmsk_pitch,
-                       uint8_t * dstp, int dst_pitch, int height, int width )
+                       uint8_t * dstp, int dst_pitch, int height, int width,
+                       int y_start, int y_stop )
 {
     int x, y, j;
 
-    eedi2_bit_blit( dstp, dst_pitch, dmskp, dmsk_pitch, width, height );
+    eedi2_bit_blit( dstp + y_start * dst_pitch, dst_pitch,
+                    dmskp + y_start * dmsk_pitch, dmsk_pitch, width, y_stop - y_start );
     
-    mskp += msk_pitch;
-    dmskp += dmsk_pitch;
-    dstp += dst_pitch;
+    y = MAX( y_start, 1 );
+    mskp += msk_pitch * y;
+    dmskp += dmsk_pitch * y;
+    dstp += dst_pitch * y;
     unsigned char *dmskpp = dmskp - dmsk_pitch;
     unsigned char *dmskpn = dmskp + dmsk_pitch;
 
-    for( y = 1; y < height - 1; ++y )
+    for( ; y < MIN( y_stop, height - 1 ); ++y )
     {
         for( x = 1; x < width - 1; ++x )
         {
@@ -661,20 +712,25 @@ void eedi2_filter_map( uint8_t * mskp, int msk_pitch, uint8_t * dmskp, int dmsk_
  * @param dst_pitch Stride of dstp
  * @param height Height of half_height field-sized frame
  * @param width Width of dmskp bitmap rows, as opposed to the pdded stride in dmsk_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_filter_dir_map( uint8_t * mskp, int msk_pitch, uint8_t * dmskp, int dmsk_pitch,
-                           uint8_t * dstp, int dst_pitch, int height, int width )
+                           uint8_t * dstp, int dst_pitch, int height, int width,
+                           int y_start, int y_stop )
 {
     int x, y, i;
     
-    eedi2_bit_blit( dstp, dst_pitch, dmskp, dmsk_pitch, width, height );
+    eedi2_bit_blit( dstp + y_start * dst_pitch, dst_pitch,
+                    dmskp + y_start * dmsk_pitch, dmsk_pitch, width, y_stop - y_start );
     
-    dmskp += dmsk_pitch;
+    y = MAX( y_start, 1 );
+    dmskp += dmsk_pitch * y;
     unsigned char *dmskpp = dmskp - dmsk_pitch;
     unsigned char *dmskpn = dmskp + dmsk_pitch;
-    dstp += dst_pitch;
-    mskp += msk_pitch;
-    for( y = 1; y < height - 1; ++y )
+    dstp += dst_pitch * y;
+    mskp += msk_pitch * y;
+    for( ; y < MIN( y_stop, height - 1 ); ++y )
     {
         for( x = 1; x < width - 1; ++x )
         {
@@ -732,20 +788,25 @@ void eedi2_filter_dir_map( uint8_t * mskp, int msk_pitch, uint8_t * dmskp, int d
  * @param dst_pitch Stride of dstp
  * @param height Height of half-height field-sized frame
  * @param width Width of dmskp bitmap rows, as opposed to the pdded stride in dmsk_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_expand_dir_map( uint8_t * mskp, int msk_pitch, uint8_t * dmskp, int dmsk_pitch,
-                           uint8_t * dstp, int dst_pitch, int height, int width )
+                           uint8_t * dstp, int dst_pitch, int height, int width,
+                           int y_start, int y_stop )
 {
     int x, y, i;
 
-    eedi2_bit_blit( dstp, dst_pitch, dmskp, dmsk_pitch, width, height );
+    eedi2_bit_blit( dstp + y_start * dst_pitch, dst_pitch,
+                    dmskp + y_start * dmsk_pitch, dmsk_pitch, width, y_stop - y_start );
     
-    dmskp += dmsk_pitch;
+    y = MAX( y_start, 1 );
+    dmskp += dmsk_pitch * y;
     unsigned char *dmskpp = dmskp - dmsk_pitch;
     unsigned char *dmskpn = dmskp + dmsk_pitch;
-    dstp += dst_pitch;
-    mskp += msk_pitch;
-    for( y = 1; y < height - 1; ++y )
+    dstp += dst_pitch * y;
+    mskp += msk_pitch * y;
+    for( ; y < MIN( y_stop, height - 1 ); ++y )
     {
         for( x = 1; x < width - 1; ++x )
         {
@@ -795,18 +856,22 @@ void eedi2_expand_dir_map( uint8_t * mskp, int msk_pitch, uint8_t * dmskp, int d
  * @param tff Whether or not the frame parity is Top Field First
  * @param height Height of the full-frame output
  * @param width Width of dmskp bitmap rows, as opposed to the pdded stride in dmsk_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_mark_directions_2x( uint8_t * mskp, int msk_pitch, uint8_t * dmskp, int dmsk_pitch,
-                               uint8_t * dstp, int dst_pitch, int tff, int height, int width )
+                               uint8_t * dstp, int dst_pitch, int tff, int height, int width,
+                               int y_start, int y_stop )
 {
     int x, y, i;
-    memset( dstp, 255, dst_pitch * height );
-    dstp  += dst_pitch  * ( 2 - tff );
-    dmskp += dmsk_pitch * ( 1 - tff );
-    mskp  += msk_pitch  * ( 1 - tff );
+    memset( dstp + dst_pitch * y_start, 255, dst_pitch * ( y_stop - y_start ) );
+    y = eedi2_first_row( 2 - tff, y_start );
+    dstp  += dst_pitch  * y;
+    dmskp += dmsk_pitch * ( y - 1 );
+    mskp  += msk_pitch  * ( y - 1 );
     unsigned char *dmskpn = dmskp + dmsk_pitch * 2;
     unsigned char *mskpn = mskp + msk_pitch * 2;
-    for( y = 2 - tff; y < height - 1; y += 2 )
+    for( ; y < MIN( y_stop, height - 1 ); y += 2 )
     {
         for( x = 1; x < width - 1; ++x )
         {
@@ -867,19 +932,24 @@ void eedi2_mark_directions_2x( uint8_t * mskp, int msk_pitch, uint8_t * dmskp, i
  * @param field Field to filter
  * @param height Height of the full-frame output
  * @param width Width of dmskp bitmap rows, as opposed to the pdded stride in dmsk_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_filter_dir_map_2x( uint8_t * mskp, int msk_pitch, uint8_t * dmskp, int dmsk_pitch,
-                              uint8_t * dstp, int dst_pitch, int field, int height, int width )
+                              uint8_t * dstp, int dst_pitch, int field, int height, int width,
+                              int y_start, int y_stop )
 {
     int x, y, i;
-    eedi2_bit_blit( dstp, dst_pitch, dmskp, dmsk_pitch, width, height );
-    dmskp += dmsk_pitch * ( 2 - field );
+    eedi2_bit_blit( dstp + y_start * dst_pitch, dst_pitch,
+                    dmskp + y_start * dmsk_pitch, dmsk_pitch, width, y_stop - y_start );
+    y = eedi2_first_row( 2 - field, y_start );
+    dmskp += dmsk_pitch * y;
     unsigned char *dmskpp = dmskp - dmsk_pitch * 2;
     unsigned char *dmskpn = dmskp + dmsk_pitch * 2;
-    mskp += msk_pitch * ( 1 - field );
+    mskp += msk_pitch * ( y - 1 );
     unsigned char *mskpn = mskp + msk_pitch * 2;
-    dstp += dst_pitch * ( 2 - field );
-    for( y = 2 - field; y < height - 1; y += 2 )
+    dstp += dst_pitch * y;
+    for( ; y < MIN( y_stop, height - 1 ); y += 2 )
     {
         for( x = 1; x < width - 1; ++x )
         {
@@ -944,21 +1014,26 @@ void eedi2_filter_dir_map_2x( uint8_t * mskp, int msk_pitch, uint8_t * dmskp, in
  * @param field Field to filter
  * @param height Height of the full-frame output
  * @param width Width of dmskp bitmap rows, as opposed to the pdded stride in dmsk_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_expand_dir_map_2x( uint8_t * mskp, int msk_pitch, uint8_t * dmskp, int dmsk_pitch,
-                              uint8_t * dstp, int dst_pitch, int field, int height, int width )
+                              uint8_t * dstp, int dst_pitch, int field, int height, int width,
+                              int y_start, int y_stop )
 {
     int x, y, i;
 
-    eedi2_bit_blit( dstp, dst_pitch, dmskp, dmsk_pitch, width, height );
+    eedi2_bit_blit( dstp + y_start * dst_pitch, dst_pitch,
+                    dmskp + y_start * dmsk_pitch, dmsk_pitch, width, y_stop - y_start );
 
-    dmskp += dmsk_pitch * ( 2 - field );
+    y = eedi2_first_row( 2 - field, y_start );
+    dmskp += dmsk_pitch * y;
     unsigned char *dmskpp = dmskp - dmsk_pitch * 2;
     unsigned char *dmskpn = dmskp + dmsk_pitch * 2;
-    mskp += msk_pitch * ( 1 - field );
+    mskp += msk_pitch * ( y - 1 );
     unsigned char *mskpn = mskp + msk_pitch * 2;
-    dstp += dst_pitch * ( 2 - field );
-    for( y = 2 - field; y < height - 1; y += 2)
+    dstp += dst_pitch * y;
+    for( ; y < MIN( y_stop, height - 1 ); y += 2)
     {
         for( x = 1; x < width - 1; ++x )
         {
@@ -1014,23 +1089,28 @@ void eedi2_expand_dir_map_2x( uint8_t * mskp, int msk_pitch, uint8_t * dmskp, in
  * @param field Field to filter
  * @param height Height of the full-frame output
  * @param width Width of dmskp bitmap rows, as opposed to the pdded stride in dmsk_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_fill_gaps_2x( uint8_t *mskp, int msk_pitch, uint8_t * dmskp, int dmsk_pitch,
-                         uint8_t * dstp, int dst_pitch, int field, int height, int width )
+                         uint8_t * dstp, int dst_pitch, int field, int height, int width,
+                         int y_start, int y_stop )
 {
     int x, y, j;
 
-    eedi2_bit_blit( dstp, dst_pitch, dmskp, dmsk_pitch, width, height );
+    eedi2_bit_blit( dstp + y_start * dst_pitch, dst_pitch,
+                    dmskp + y_start * dmsk_pitch, dmsk_pitch, width, y_stop - y_start );
 
-    dmskp += dmsk_pitch * ( 2 - field );
+    y = eedi2_first_row( 2 - field, y_start );
+    dmskp += dmsk_pitch * y;
     unsigned char *dmskpp = dmskp - dmsk_pitch * 2;
     unsigned char *dmskpn = dmskp + dmsk_pitch * 2;
-    mskp += msk_pitch * ( 1 - field );
+    mskp += msk_pitch * ( y - 1 );
     unsigned char *mskpp = mskp - msk_pitch * 2;
     unsigned char *mskpn = mskp + msk_pitch * 2;
     unsigned char *mskpnn = mskpn + msk_pitch * 2;
-    dstp += dst_pitch * ( 2 - field );
-    for( y = 2 - field; y < height - 1; y += 2 )
+    dstp += dst_pitch * y;
+    for( ; y < MIN( y_stop, height - 1 ); y += 2 )
     {
         for( x = 1; x < width - 1; ++x )
         {
@@ -1129,14 +1209,17 @@ void eedi2_fill_gaps_2x( uint8_t *mskp, int msk_pitch, uint8_t * dmskp, int dmsk
  * @nt Noise threshold, (50 is a good default value)
  * @param height Height of the full-frame output
  * @param width Width of dstp bitmap rows, as opposed to the pdded stride in dst_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_interpolate_lattice( const int plane, uint8_t * dmskp, int dmsk_pitch, uint8_t * dstp,
                                 int dst_pitch, uint8_t * omskp, int omsk_pitch, int field, int nt,
-                                int height, int width )
+                                int height, int width, int y_start, int y_stop )
 {
     int x, y, u;
     
-    if( field == 1 )
+    /* The edge row is copied by the band it is in */
+    if( field == 1 && y_stop == height )
     {
         eedi2_bit_blit( dstp + ( height - 1 ) * dst_pitch,
                   dst_pitch,
@@ -1145,7 +1228,7 @@ void eedi2_interpolate_lattice( const int plane, uint8_t * dmskp, int dmsk_pitch
                   width,
                   1 );
     }
-    else
+    else if( field == 0 && y_start == 0 )
     {
         eedi2_bit_blit( dstp,
                   dst_pitch,
@@ -1155,13 +1238,14 @@ void eedi2_interpolate_lattice( const int plane, uint8_t * dmskp, int dmsk_pitch
                   1 );
     }
 
-    dstp += dst_pitch * ( 1 - field );
-    omskp += omsk_pitch * ( 1 - field );
+    y = eedi2_first_row( 2 - field, y_start );
+    dstp += dst_pitch * ( y - 1 );
+    omskp += omsk_pitch * ( y - 1 );
     unsigned char *dstpn = dstp + dst_pitch;
     unsigned char *dstpnn = dstp + dst_pitch * 2;
     unsigned char *omskn = omskp + omsk_pitch * 2;
-    dmskp += dmsk_pitch * ( 2 - field );
-    for( y = 2 - field; y < height - 1; y += 2 )
+    dmskp += dmsk_pitch * y;
+    for( ; y < MIN( y_stop, height - 1 ); y += 2 )
     {
         for( x = 0; x < width; ++x )
         {
@@ -1322,18 +1406,22 @@ void eedi2_interpolate_lattice( const int plane, uint8_t * dmskp, int dmsk_pitch
  * @param field Field to filter
  * @param height Height of the full-frame output
  * @param width Width of dstp bitmap rows, as opposed to the pdded stride in src_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
 void eedi2_post_process( uint8_t * nmskp, int nmsk_pitch, uint8_t * omskp, int omsk_pitch,
-                         uint8_t * dstp, int src_pitch, int field, int height, int width )
+                         uint8_t * dstp, int src_pitch, int field, int height, int width,
+                         int y_start, int y_stop )
 {
     int x, y;
     
-    nmskp += ( 2 - field ) * nmsk_pitch;
-    omskp += ( 2 - field ) * omsk_pitch;
-    dstp += ( 2 - field ) * src_pitch;
+    y = eedi2_first_row( 2 - field, y_start );
+    nmskp += y * nmsk_pitch;
+    omskp += y * omsk_pitch;
+    dstp += y * src_pitch;
     unsigned char *srcpp = dstp - src_pitch;
     unsigned char *srcpn = dstp + src_pitch;
-    for( y = 2 - field; y < height - 1; y += 2 )
+    for( ; y < MIN( y_stop, height - 1 ); y += 2 )
     {
         for( x = 0; x < width; ++x )
         {
@@ -1350,23 +1438,23 @@ void eedi2_post_process( uint8_t * nmskp, int nmsk_pitch, uint8_t * omskp, int o
 }
 
 /**
- * Blurs the source field plane
+ * Blurs the rows of the source field plane, first half of eedi2_gaussian_blur1
  * @param src Pointer to the half-height source field plane
  * @param src_pitch Stride of src
  * @param tmp Pointer to a temporary buffer for juggling bitmaps
  * @param tmp_pitch Stride of tmp
- * @param dst Pointer to the destination to store the blurred field plane
- * @param dst_pitch Stride of dst
- * @param height Height of the hakf-height field-sized frame
- * @param width Width of dstp bitmap rows, as opposed to the padded stride in dst_pitch
+ * @param width Width of src bitmap rows, as opposed to the padded stride in src_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
-void eedi2_gaussian_blur1( uint8_t * src, int src_pitch, uint8_t * tmp, int tmp_pitch, uint8_t * dst, int dst_pitch, int height, int width )
+void eedi2_gaussian_blur1_horizontal( uint8_t * src, int src_pitch, uint8_t * tmp, int tmp_pitch,
+                                      int width, int y_start, int y_stop )
 {
-    uint8_t * srcp = src;
-    uint8_t * dstp = tmp;
+    uint8_t * srcp = src + y_start * src_pitch;
+    uint8_t * dstp = tmp + y_start * tmp_pitch;
     int x, y;
 
-    for( y = 0; y < height; ++y )
+    for( y = y_start; y < y_stop; ++y )
     {
         dstp[0] = ( srcp[3] * 582 + srcp[2] * 7078 + srcp[1] * 31724 + 
                     srcp[0] * 26152 + 32768 ) >> 16;
@@ -1396,125 +1484,114 @@ void eedi2_gaussian_blur1( uint8_t * src, int src_pitch, uint8_t * tmp, int tmp_
         srcp += src_pitch;
         dstp += tmp_pitch;
     }
-    srcp = tmp;
-    dstp = dst;
-    unsigned char *src3p = srcp - tmp_pitch * 3;
-    unsigned char *src2p = srcp - tmp_pitch * 2;
-    unsigned char *srcpp = srcp - tmp_pitch;
-    unsigned char *srcpn = srcp + tmp_pitch;
-    unsigned char *src2n = srcp + tmp_pitch * 2;
-    unsigned char *src3n = srcp + tmp_pitch * 3;
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src3n[x] * 582 + src2n[x] * 7078 + srcpn[x] * 31724 + 
-                     srcp[x] * 26152 + 32768 ) >> 16;
-    }
-    src3p += tmp_pitch;
-    src2p += tmp_pitch;
-    srcpp += tmp_pitch;
-    srcp += tmp_pitch;
-    srcpn += tmp_pitch;
-    src2n += tmp_pitch;
-    src3n += tmp_pitch;
-    dstp += dst_pitch;
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src3n[x] * 582 + src2n[x] * 7078 +
-                    ( srcpp[x] + srcpn[x] ) * 15862 +
-                    srcp[x] * 26152 + 32768 ) >> 16;
-    }
-    src3p += tmp_pitch;
-    src2p += tmp_pitch;
-    srcpp += tmp_pitch;
-    srcp += tmp_pitch;
-    srcpn += tmp_pitch;
-    src2n += tmp_pitch;
-    src3n += tmp_pitch;
-    dstp += dst_pitch;
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src3n[x] * 582 + ( src2p[x] + src2n[x] ) * 3539 + 
-                    ( srcpp[x] + srcpn[x] ) * 15862 +
-                    srcp[x] * 26152 + 32768 ) >> 16;
-    }
-    src3p += src_pitch;
-    src2p += src_pitch;
-    srcpp += src_pitch;
-    srcp += src_pitch;
-    srcpn += src_pitch;
-    src2n += src_pitch;
-    src3n += src_pitch;
-    dstp += dst_pitch;
-    for( y = 3; y < height - 3; ++y )
+}
+
+/**
+ * Blurs the columns of the source field plane, second half of eedi2_gaussian_blur1
+ * @param tmp Pointer to the output of eedi2_gaussian_blur1_horizontal
+ * @param tmp_pitch Stride of tmp
+ * @param dst Pointer to the destination to store the blurred field plane
+ * @param dst_pitch Stride of dst
+ * @param height Height of the half-height field-sized frame
+ * @param width Width of dstp bitmap rows, as opposed to the padded stride in dst_pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
+ */
+void eedi2_gaussian_blur1_vertical( uint8_t * tmp, int tmp_pitch, uint8_t * dst, int dst_pitch,
+                                    int height, int width, int y_start, int y_stop )
+{
+    int x, y;
+
+    for( y = y_start; y < y_stop; ++y )
     {
-        for( x = 0; x < width; ++x )
+        uint8_t * srcp = tmp + y * tmp_pitch;
+        uint8_t * dstp = dst + y * dst_pitch;
+        const int p1 = tmp_pitch;
+        const int p2 = tmp_pitch * 2;
+        const int p3 = tmp_pitch * 3;
+
+        if( y >= 3 && y < height - 3 )
         {
-            dstp[x] = ( ( src3p[x] + src3n[x] ) * 291 +
-                        ( src2p[x] + src2n[x] ) * 3539 +
-                        ( srcpp[x] + srcpn[x] ) * 15862 +
-                        srcp[x] * 26152 + 32768 ) >> 16;
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( ( srcp[x-p3] + srcp[x+p3] ) * 291 +
+                            ( srcp[x-p2] + srcp[x+p2] ) * 3539 +
+                            ( srcp[x-p1] + srcp[x+p1] ) * 15862 +
+                            srcp[x] * 26152 + 32768 ) >> 16;
+            }
+        }
+        else if( y == 0 )
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x+p3] * 582 + srcp[x+p2] * 7078 + srcp[x+p1] * 31724 + 
+                            srcp[x] * 26152 + 32768 ) >> 16;
+            }
+        }
+        else if( y == 1 )
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x+p3] * 582 + srcp[x+p2] * 7078 +
+                            ( srcp[x-p1] + srcp[x+p1] ) * 15862 +
+                            srcp[x] * 26152 + 32768 ) >> 16;
+            }
+        }
+        else if( y == 2 )
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x+p3] * 582 + ( srcp[x-p2] + srcp[x+p2] ) * 3539 + 
+                            ( srcp[x-p1] + srcp[x+p1] ) * 15862 +
+                            srcp[x] * 26152 + 32768 ) >> 16;
+            }
+        }
+        else if( y == height - 3 )
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x-p3] * 582 + ( srcp[x-p2] + srcp[x+p2] ) * 3539 +
+                            ( srcp[x-p1] + srcp[x+p1] ) * 15862 +
+                            srcp[x] * 26152 + 32768 ) >> 16;
+            }
+        }
+        else if( y == height - 2 )
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x-p3] * 582 + srcp[x-p2] * 7078 +
+                            ( srcp[x-p1] + srcp[x+p1] ) * 15862 +
+                            srcp[x] * 26152 + 32768 ) >> 16;
+            }
+        }
+        else
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x-p3] * 582   + srcp[x-p2] * 7078 +
+                            srcp[x-p1] * 31724 + srcp[x] * 26152 + 32768 ) >> 16;
+            }
         }
-        src3p += tmp_pitch;
-        src2p += tmp_pitch;
-        srcpp += tmp_pitch;
-        srcp += tmp_pitch;
-        srcpn += tmp_pitch;
-        src2n += tmp_pitch;
-        src3n += tmp_pitch;
-        dstp += dst_pitch;
-    }
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src3p[x] * 582 + ( src2p[x] + src2n[x] ) *3539 +
-                    ( srcpp[x] + srcpn[x] ) * 15862 +
-                    srcp[x] * 26152 + 32768 ) >> 16;
-    }
-    src3p += tmp_pitch;
-    src2p += tmp_pitch;
-    srcpp += tmp_pitch;
-    srcp += tmp_pitch;
-    srcpn += tmp_pitch;
-    src2n += tmp_pitch;
-    src3n += tmp_pitch;
-    dstp += dst_pitch;
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src3p[x] * 582 + src2p[x] * 7078 +
-                    ( srcpp[x] + srcpn[x] ) * 15862 +
-                     srcp[x] * 26152 + 32768 ) >> 16;
-    }
-    src3p += tmp_pitch;
-    src2p += tmp_pitch;
-    srcpp += tmp_pitch;
-    srcp += tmp_pitch;
-    srcpn += tmp_pitch;
-    src2n += tmp_pitch;
-    src3n += tmp_pitch;
-    dstp += dst_pitch;
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src3p[x] * 582   + src2p[x] * 7078 +
-                    srcpp[x] * 31724 +  srcp[x] * 26152 + 32768 ) >> 16;
     }
 }
 
-
 /**
- * Blurs the spatial derivatives of the source field plane
+ * Blurs the rows of a derivative array, first half of eedi2_gaussian_blur_sqrt2
  * @param src Pointer to the derivative array to filter
  * @param tmp Pointer to a temporary storage for the derivative array while it's being filtered
- * @param dst Pointer to the destination to store the filtered output derivative array
  * @param pitch Stride of the bitmap from which the src array is derived
- * @param height Height of the half-height field-sized frame from which the src array derivs were taken
  * @param width Width of the bitmap from which the src array is derived, as opposed to the padded stride in pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
-void eedi2_gaussian_blur_sqrt2( int *src, int *tmp, int *dst, const int pitch, int height, const int width )
+void eedi2_gaussian_blur_sqrt2_horizontal( int *src, int *tmp, const int pitch, const int width,
+                                           int y_start, int y_stop )
 {
-    int * srcp = src;
-    int * dstp = tmp;
+    int * srcp = src + y_start * pitch;
+    int * dstp = tmp + y_start * pitch;
     int x, y;
     
-    for( y = 0; y < height; ++y )
+    for( y = y_start; y < y_stop; ++y )
     {
         x = 0;
         dstp[x] = ( srcp[x+4] * 678   + srcp[x+3] * 3902  + srcp[x+2] * 13618 +
@@ -1563,159 +1640,120 @@ void eedi2_gaussian_blur_sqrt2( int *src, int *tmp, int *dst, const int pitch, i
         srcp += pitch;
         dstp += pitch;
     }
-    dstp = dst;
-    srcp = tmp;
-    int * src4p = srcp - pitch * 4;
-    int * src3p = srcp - pitch * 3;
-    int * src2p = srcp - pitch * 2;
-    int * srcpp = srcp - pitch;
-    int * srcpn = srcp + pitch;
-    int * src2n = srcp + pitch * 2;
-    int * src3n = srcp + pitch * 3;
-    int * src4n = srcp + pitch * 4;
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src4n[x] * 678   + src3n[x] * 3902  + 
-                    src2n[x] * 13618 + srcpn[x] * 28830 +
-                     srcp[x] * 18508 + 32768 ) >> 18;
-    }
-    src4p += pitch;
-    src3p += pitch;
-    src2p += pitch;
-    srcpp += pitch;
-    srcp += pitch;
-    srcpn += pitch;
-    src2n += pitch;
-    src3n += pitch;
-    src4n += pitch;
-    dstp += pitch;
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src4n[x] * 678 + src3n[x] * 3902 + src2n[x] * 13618 + 
-                    ( srcpp[x] + srcpn[x] ) * 14415 +
-                    srcp[x] * 18508 + 32768 ) >> 18;
-    }
-    src4p += pitch;
-    src3p += pitch;
-    src2p += pitch;
-    srcpp += pitch;
-    srcp += pitch;
-    srcpn += pitch;
-    src2n += pitch;
-    src3n += pitch;
-    src4n += pitch;
-    dstp += pitch;
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src4n[x] * 678 + src3n[x] * 3902 + 
-                    ( src2p[x] + src2n[x] ) * 6809 + 
-                    ( srcpp[x] + srcpn[x] ) * 14415 +
-                    srcp[x] * 18508 + 32768 ) >> 18;
-    }
-    src4p += pitch;
-    src3p += pitch;
-    src2p += pitch;
-    srcpp += pitch;
-    srcp += pitch;
-    srcpn += pitch;
-    src2n += pitch;
-    src3n += pitch;
-    src4n += pitch;
-    dstp += pitch;
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src4n[x] * 678 + ( src3p[x] + src3n[x] ) * 1951 +
-                    ( src2p[x] + src2n[x] ) * 6809 +
-                    ( srcpp[x] + srcpn[x] ) * 14415 +
-                    srcp[x] * 18508 + 32768 ) >> 18;
-    }
-    src4p += pitch;
-    src3p += pitch;
-    src2p += pitch;
-    srcpp += pitch;
-    srcp += pitch;
-    srcpn += pitch;
-    src2n += pitch;
-    src3n += pitch;
-    src4n += pitch;
-    dstp += pitch;
-    for( y = 4; y < height - 4; ++y )
+}
+
+/**
+ * Blurs the columns of a derivative array, second half of eedi2_gaussian_blur_sqrt2
+ * @param tmp Pointer to the output of eedi2_gaussian_blur_sqrt2_horizontal
+ * @param dst Pointer to the destination to store the filtered output derivative array
+ * @param pitch Stride of the bitmap from which the src array is derived
+ * @param height Height of the half-height field-sized frame from which the src array derivs were taken
+ * @param width Width of the bitmap from which the src array is derived, as opposed to the padded stride in pitch
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
+ */
+void eedi2_gaussian_blur_sqrt2_vertical( int *tmp, int *dst, const int pitch, int height, const int width,
+                                         int y_start, int y_stop )
+{
+    int x, y;
+
+    for( y = y_start; y < y_stop; ++y )
     {
-        for( x = 0; x < width; ++x )
+        int * srcp = tmp + y * pitch;
+        int * dstp = dst + y * pitch;
+        const int p1 = pitch;
+        const int p2 = pitch * 2;
+        const int p3 = pitch * 3;
+        const int p4 = pitch * 4;
+
+        if( y >= 4 && y < height - 4 )
         {
-            dstp[x] = ( ( src4p[x] + src4n[x] ) * 339 +
-                        ( src3p[x] + src3n[x] ) * 1951 +
-                        ( src2p[x] + src2n[x] ) * 6809 +
-                        ( srcpp[x] + srcpn[x] ) * 14415 +
-                        srcp[x] * 18508 + 32768 ) >> 18;
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( ( srcp[x-p4] + srcp[x+p4] ) * 339 +
+                            ( srcp[x-p3] + srcp[x+p3] ) * 1951 +
+                            ( srcp[x-p2] + srcp[x+p2] ) * 6809 +
+                            ( srcp[x-p1] + srcp[x+p1] ) * 14415 +
+                            srcp[x] * 18508 + 32768 ) >> 18;
+            }
+        }
+        else if( y == 0 )
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x+p4] * 678   + srcp[x+p3] * 3902  + 
+                            srcp[x+p2] * 13618 + srcp[x+p1] * 28830 +
+                            srcp[x] * 18508 + 32768 ) >> 18;
+            }
+        }
+        else if( y == 1 )
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x+p4] * 678 + srcp[x+p3] * 3902 + srcp[x+p2] * 13618 + 
+                            ( srcp[x-p1] + srcp[x+p1] ) * 14415 +
+                            srcp[x] * 18508 + 32768 ) >> 18;
+            }
+        }
+        else if( y == 2 )
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x+p4] * 678 + srcp[x+p3] * 3902 + 
+                            ( srcp[x-p2] + srcp[x+p2] ) * 6809 + 
+                            ( srcp[x-p1] + srcp[x+p1] ) * 14415 +
+                            srcp[x] * 18508 + 32768 ) >> 18;
+            }
+        }
+        else if( y == 3 )
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x+p4] * 678 + ( srcp[x-p3] + srcp[x+p3] ) * 1951 +
+                            ( srcp[x-p2] + srcp[x+p2] ) * 6809 +
+                            ( srcp[x-p1] + srcp[x+p1] ) * 14415 +
+                            srcp[x] * 18508 + 32768 ) >> 18;
+            }
+        }
+        else if( y == height - 4 )
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x-p4] * 678 +
+                            ( srcp[x-p3] + srcp[x+p3] ) * 1951 +
+                            ( srcp[x-p2] + srcp[x+p2] ) * 6809 +
+                            ( srcp[x-p1] + srcp[x+p1] ) * 14415 +
+                            srcp[x] * 18508 + 32768 ) >> 18;
+            }
+        }
+        else if( y == height - 3 )
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x-p4] * 678 + srcp[x-p3] * 3902 +
+                            ( srcp[x-p2] + srcp[x+p2] ) * 6809 +
+                            ( srcp[x-p1] + srcp[x+p1] ) * 14415 +
+                            srcp[x] * 18508 + 32768 ) >> 18;
+            }
+        }
+        else if( y == height - 2 )
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x-p4] * 678 + srcp[x-p3] * 3902 + srcp[x-p2] * 13618 +
+                            ( srcp[x-p1] + srcp[x+p1] ) * 14415 +
+                            srcp[x] * 18508 + 32768 ) >> 18;
+            }
+        }
+        else
+        {
+            for( x = 0; x < width; ++x )
+            {
+                dstp[x] = ( srcp[x-p4] * 678   + srcp[x-p3] * 3902 +
+                            srcp[x-p2] * 13618 + srcp[x-p1] * 28830 +
+                            srcp[x] * 18508 + 32768 ) >> 18;
+            }
         }
-        src4p += pitch;
-        src3p += pitch;
-        src2p += pitch;
-        srcpp += pitch;
-        srcp += pitch;
-        srcpn += pitch;
-        src2n += pitch;
-        src3n += pitch;
-        src4n += pitch;
-        dstp += pitch;
-    }
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src4p[x] * 678 +
-                    ( src3p[x] + src3n[x] ) * 1951 +
-                    ( src2p[x] + src2n[x] ) * 6809 +
-                    ( srcpp[x] + srcpn[x] ) * 14415 +
-                    srcp[x] * 18508 + 32768 ) >> 18;
-    }
-    src4p += pitch;
-    src3p += pitch;
-    src2p += pitch;
-    srcpp += pitch;
-    srcp += pitch;
-    srcpn += pitch;
-    src2n += pitch;
-    src3n += pitch;
-    src4n += pitch;
-    dstp += pitch;
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src4p[x] * 678 + src3p[x] * 3902 +
-                    ( src2p[x] + src2n[x] ) * 6809 +
-                    ( srcpp[x] + srcpn[x] ) * 14415 +
-                    srcp[x] * 18508 + 32768 ) >> 18;
-    }
-    src4p += pitch;
-    src3p += pitch;
-    src2p += pitch;
-    srcpp += pitch;
-    srcp += pitch;
-    srcpn += pitch;
-    src2n += pitch;
-    src3n += pitch;
-    src4n += pitch;
-    dstp += pitch;
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src4p[x] * 678 + src3p[x] * 3902 + src2p[x] * 13618 +
-                    ( srcpp[x] + srcpn[x] ) * 14415 +
-                    srcp[x] * 18508 + 32768 ) >> 18;
-    }
-    src4p += pitch;
-    src3p += pitch;
-    src2p += pitch;
-    srcpp += pitch;
-    srcp += pitch;
-    srcpn += pitch;
-    src2n += pitch;
-    src3n += pitch;
-    src4n += pitch;
-    dstp += pitch;
-    for( x = 0; x < width; ++x )
-    {
-        dstp[x] = ( src4p[x] * 678   + src3p[x] * 3902 +
-                    src2p[x] * 13618 + srcpp[x] * 28830 +
-                    srcp[x]  * 18508 + 32768 ) >> 18;
     }
 }
 
@@ -1728,43 +1766,23 @@ void eedi2_gaussian_blur_sqrt2( int *src, int *tmp, int *dst, const int pitch, i
  * @param x2 Pointed to the array to store the x/x derivatives
  * @param y2 Pointer to the array to store the y/y derivatives
  * @param xy Pointer to the array to store the x/y derivatives
+ * @param y_start First row to derive
+ * @param y_stop Row after the last one to derive
  */
-void eedi2_calc_derivatives( uint8_t *srcp, int src_pitch, int height, int width, int *x2, int *y2, int *xy)
+void eedi2_calc_derivatives( uint8_t *srcp, int src_pitch, int height, int width, int *x2, int *y2, int *xy,
+                             int y_start, int y_stop )
 {
-    
-    unsigned char * srcpp = srcp - src_pitch;
-    unsigned char * srcpn = srcp + src_pitch;
     int x, y;
+
+    srcp += src_pitch * y_start;
+    x2 += src_pitch * y_start;
+    y2 += src_pitch * y_start;
+    xy += src_pitch * y_start;
+    for( y = y_start; y < y_stop; ++y )
     {
-        const int Ix = srcp[1] -  srcp[0];
-        const int Iy = srcp[0] - srcpn[0];
-        x2[0] = ( Ix * Ix ) >> 1;
-        y2[0] = ( Iy * Iy ) >> 1;
-        xy[0] = ( Ix * Iy ) >> 1;
-    }
-    for( x = 1; x < width - 1; ++x )
-    {
-        const int Ix = srcp[x+1] -  srcp[x-1];
-        const int Iy = srcp[x]   - srcpn[x];
-        x2[x] = ( Ix * Ix ) >> 1;
-        y2[x] = ( Iy * Iy ) >> 1;
-        xy[x] = ( Ix * Iy ) >> 1;
-    }
-    {
-        const int Ix = srcp[x] -  srcp[x-1];
-        const int Iy = srcp[x] - srcpn[x];
-        x2[x] = ( Ix * Ix ) >> 1;
-        y2[x] = ( Iy * Iy ) >> 1;
-        xy[x] = ( Ix * Iy ) >> 1;
-    }
-    srcpp += src_pitch;
-    srcp += src_pitch;
-    srcpn += src_pitch;
-    x2 += src_pitch;
-    y2 += src_pitch;
-    xy += src_pitch;
-    for( y = 1; y < height - 1; ++y )
-    {
+        // The first and last rows are their own neighbors
+        unsigned char * srcpp = y == 0 ? srcp : srcp - src_pitch;
+        unsigned char * srcpn = y == height - 1 ? srcp : srcp + src_pitch;
         {
             const int Ix =  srcp[1] -  srcp[0];
             const int Iy = srcpp[0] - srcpn[0];
@@ -1787,35 +1805,11 @@ void eedi2_calc_derivatives( uint8_t *srcp, int src_pitch, int height, int width
             y2[x] = ( Iy *Iy ) >> 1;
             xy[x] = ( Ix *Iy ) >> 1;
         }
-        srcpp += src_pitch;
         srcp += src_pitch;
-        srcpn += src_pitch;
         x2 += src_pitch;
         y2 += src_pitch;
         xy += src_pitch;
     }
-    {
-        const int Ix =  srcp[1] - srcp[0];
-        const int Iy = srcpp[0] - srcp[0];
-        x2[0] = ( Ix * Ix ) >> 1;
-        y2[0] = ( Iy * Iy ) >> 1;
-        xy[0] = ( Ix * Iy ) >> 1;
-    }
-    for( x = 1; x < width - 1; ++x )
-    {
-        const int Ix =  srcp[x+1] - srcp[x-1];
-        const int Iy = srcpp[x]   - srcp[x];
-        x2[x] = ( Ix * Ix ) >> 1;
-        y2[x] = ( Iy * Iy ) >> 1;
-        xy[x] = ( Ix * Iy ) >> 1;
-    }
-    {
-        const int Ix =  srcp[x] - srcp[x-1];
-        const int Iy = srcpp[x] - srcp[x];
-        x2[x] = ( Ix * Ix ) >> 1;
-        y2[x] = ( Iy * Iy ) >> 1;
-        xy[x] = ( Ix * Iy ) >> 1;
-    }
 }
 
 /**
@@ -1831,22 +1825,26 @@ void eedi2_calc_derivatives( uint8_t *srcp, int src_pitch, int height, int width
  * @param height Height of the full-frame output plane
  * @param width Width of dstp bitmap rows, as opposed to the padded stride in dst_pitch
  * @param field Field to filter
+ * @param y_start First row to filter
+ * @param y_stop Row after the last one to filter
  */
-void eedi2_post_process_corner( int *x2, int *y2, int *xy, const int pitch, uint8_t * mskp, int msk_pitch, uint8_t * dstp, int dst_pitch, int height, int width, int field )
+void eedi2_post_process_corner( int *x2, int *y2, int *xy, const int pitch, uint8_t * mskp, int msk_pitch, uint8_t * dstp, int dst_pitch, int height, int width, int field, int y_start, int y_stop )
 {
-    mskp += ( 8 - field ) * msk_pitch;
-    dstp += ( 8 - field ) * dst_pitch;
+    int x, y = eedi2_first_row( 8 - field, y_start );
+    int y2row = 3 + ( y - ( 8 - field ) ) / 2;
+
+    mskp += y * msk_pitch;
+    dstp += y * dst_pitch;
     unsigned char * dstpp = dstp - dst_pitch;
     unsigned char * dstpn = dstp + dst_pitch;
-    x2 += pitch * 3;
-    y2 += pitch * 3;
-    xy += pitch * 3;
+    x2 += pitch * y2row;
+    y2 += pitch * y2row;
+    xy += pitch * y2row;
     int *x2n = x2 + pitch;
     int *y2n = y2 + pitch;
     int *xyn = xy + pitch;
-    int x, y;
     
-    for( y = 8 - field; y < height - 7; y += 2 )
+    for( ; y < MIN( y_stop, height - 7 ); y += 2 )
     {
         for( x = 4; x < width - 4; ++x )
         {
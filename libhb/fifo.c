@@ -13,17 +13,24 @@
 #include <malloc.h>
 #endif
 
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
+
 #define FIFO_TIMEOUT 200
 //#define HB_FIFO_DEBUG 1
+// Fill frames from hb_frame_buffer_init_nozero() with garbage to catch
+// readers of pixels that were never written
+//#define HB_BUFFER_DEBUG 1
 
 /* Fifo */
 struct hb_fifo_s
 {
     hb_lock_t    * lock;
     hb_cond_t    * cond_full;
-    int            wait_full;
+    volatile int   wait_full;
     hb_cond_t    * cond_empty;
-    int            wait_empty;
+    volatile int   wait_empty;
     uint32_t       capacity;
     uint32_t       thresh;
     uint32_t       size;
@@ -31,6 +38,17 @@ struct hb_fifo_s
     hb_buffer_t  * first;
     hb_buffer_t  * last;
 
+    // Single producer / single consumer ring, see hb_fifo_init_spsc().
+    // Each slot holds one push, which may be a list of buffers.
+    int                 spsc;
+    hb_buffer_t      ** ring;
+    uint32_t            ring_mask;
+    volatile uint32_t   ring_head;  // Consumer: next slot to read
+    volatile uint32_t   ring_tail;  // Producer: next slot to write
+    volatile uint32_t   pushed;     // Producer: buffers pushed
+    volatile uint32_t   popped;     // Consumer: buffers removed
+    hb_buffer_t       * ring_first; // Consumer: rest of the slot being read
+
 #if defined(HB_FIFO_DEBUG)
     // Fifo list for debugging
     hb_fifo_t    * next;
@@ -56,18 +74,90 @@ static hb_fifo_t fifo_list =
  * too much memory. */
 #define BUFFER_POOL_MAX_ELEMENTS 32
 
+/* Each thread keeps a small cache ("magazine") of free buffers per pool
+ * in front of the shared pools, see buffer_cache_take(). A thread caches
+ * at most BUFFER_CACHE_MAX_BYTES worth of buffers of each size, and never
+ * more than BUFFER_CACHE_MAX_ELEMENTS of them. */
+#define BUFFER_CACHE_MAX_ELEMENTS 16
+#define BUFFER_CACHE_MAX_BYTES    (8 << 20)
+
+/* Frame buffers are large and all the same size for a given picture
+ * geometry, so rounding them up to a power of 2 wastes a lot of memory
+ * (a 1080p YUV420 frame lands in the 4MB pool). hb_frame_buffer_init()
+ * gets them from pools of buffers of the exact frame size instead. A pool
+ * keeps FRAME_POOL_DEFAULT_ELEMENTS free buffers unless its working set
+ * was set with hb_frame_buffer_pool_init(). */
+#define MAX_FRAME_POOLS             8
+#define FRAME_POOL_DEFAULT_ELEMENTS 8
+
+typedef struct
+{
+    int           alloc;        // Exact buffer size, 0 if the pool is unused
+    int           capacity;
+    int           count;
+    hb_buffer_t * list;
+} frame_pool_t;
+
 struct hb_buffer_pools_s
 {
-    int64_t allocated;
+    volatile int64_t allocated;
     hb_lock_t *lock;
     hb_fifo_t *pool[MAX_BUFFER_POOLS];
+    frame_pool_t frame_pool[MAX_FRAME_POOLS];   // Protected by lock
+
+    // Statistics, see hb_buffer_pool_free()
+    volatile int64_t cache_hits;    // Taken from a thread cache
+    volatile int64_t pool_hits;     // Thread cache refilled from a pool
+    volatile int64_t misses;        // Had to malloc
 } buffers;
 
+#define buffers_add( field, n ) __sync_fetch_and_add( &buffers.field, (n) )
+
+typedef struct
+{
+    hb_buffer_t * list[MAX_BUFFER_POOLS];
+    int           count[MAX_BUFFER_POOLS];
+
+    // Statistics not yet added to the totals in buffers
+    int64_t       cache_hits;
+    int64_t       pool_hits;
+    int64_t       misses;
+} buffer_cache_t;
+
+static void buffer_cache_flush( buffer_cache_t * cache );
+
+#ifdef USE_PTHREAD
+static pthread_once_t buffer_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  buffer_cache_key;
+static int            buffer_cache_enabled;
+
+// Called when a thread exits with its cache still set
+static void buffer_cache_destroy( void * data )
+{
+    buffer_cache_t * cache = data;
+
+    buffer_cache_flush( cache );
+    free( cache );
+}
+
+static void buffer_cache_key_init( void )
+{
+    buffer_cache_enabled =
+        pthread_key_create( &buffer_cache_key, buffer_cache_destroy ) == 0;
+}
+#endif
 
 void hb_buffer_pool_init( void )
 {
     buffers.lock = hb_lock_init();
     buffers.allocated = 0;
+    buffers.cache_hits = 0;
+    buffers.pool_hits = 0;
+    buffers.misses = 0;
+
+#ifdef USE_PTHREAD
+    pthread_once( &buffer_cache_once, buffer_cache_key_init );
+#endif
 
     /* we allocate pools for sizes 2^10 through 2^25. requests larger than
      * 2^25 will get passed through to malloc. */
@@ -168,6 +258,12 @@ void fifo_list_validate( void )
     buffer_pools_validate();
     while ( next )
     {
+        if ( next->spsc )
+        {
+            // Not protected by the lock, can't be walked from here
+            next = next->next;
+            continue;
+        }
         count = 0;
         hb_lock( next->lock );
         b = next->first;
@@ -225,12 +321,23 @@ void fifo_list_validate( void )
 }
 #endif
 
+static buffer_cache_t * buffer_cache_get( int create );
+
 void hb_buffer_pool_free( void )
 {
     int i;
     int count;
     int64_t freed = 0;
     hb_buffer_t *b;
+    buffer_cache_t *cache;
+
+    // Other threads of the job have exited by now and returned their
+    // cached buffers to the pools. Return ours too.
+    cache = buffer_cache_get( 0 );
+    if ( cache != NULL )
+    {
+        buffer_cache_flush( cache );
+    }
 
     hb_lock(buffers.lock);
 
@@ -254,58 +361,284 @@ void hb_buffer_pool_free( void )
         }
     }
 
+    for( i = 0; i < MAX_FRAME_POOLS; ++i)
+    {
+        frame_pool_t *fp = &buffers.frame_pool[i];
+
+        if ( fp->alloc == 0 )
+            continue;
+
+        count = 0;
+        while( ( b = fp->list ) )
+        {
+            fp->list = b->next;
+            freed += b->alloc;
+            free( b->data );
+            free( b );
+            count++;
+        }
+        if ( count )
+        {
+            hb_deep_log( 2, "Freed %d frame buffers of size %d", count,
+                    fp->alloc);
+        }
+        memset( fp, 0, sizeof( *fp ) );
+    }
+
     hb_deep_log( 2, "Allocated %"PRId64" bytes of buffers on this pass and Freed %"PRId64" bytes, "
            "%"PRId64" bytes leaked", buffers.allocated, freed, buffers.allocated - freed);
+    hb_deep_log( 2, "Buffer allocations: %"PRId64" thread cache hits, "
+           "%"PRId64" pool hits, %"PRId64" misses",
+           buffers.cache_hits, buffers.pool_hits, buffers.misses);
     buffers.allocated = 0;
+    buffers.cache_hits = 0;
+    buffers.pool_hits = 0;
+    buffers.misses = 0;
     hb_unlock(buffers.lock);
 }
 
-static hb_fifo_t *size_to_pool( int size )
+static int size_to_index( int size )
 {
     int i;
-    for ( i = 0; i < 30; ++i )
+    for ( i = 10; i < 26; ++i )
     {
         if ( size <= (1 << i) )
         {
-            return buffers.pool[i];
+            return i;
         }
     }
+    return -1;
+}
+
+static hb_fifo_t *size_to_pool( int size )
+{
+    int i = size_to_index( size );
+    return i < 0 ? NULL : buffers.pool[i];
+}
+
+static void buffer_free( hb_buffer_t * b )
+{
+    if( b->data )
+    {
+        free( b->data );
+        buffers_add( allocated, -b->alloc );
+    }
+    free( b );
+}
+
+/*
+ * Per-thread buffer caches.
+ *
+ * hb_buffer_init() and hb_buffer_close() take and return buffers from
+ * the calling thread's cache without any locking. Only when the cache
+ * for a size runs empty (or full) is it refilled from (or drained to)
+ * the shared pool, half a cache at a time, so the pool lock is taken
+ * once per batch rather than once per buffer.
+ */
+static buffer_cache_t * buffer_cache_get( int create )
+{
+#ifdef USE_PTHREAD
+    buffer_cache_t * cache;
+
+    if ( !buffer_cache_enabled )
+        return NULL;
+
+    cache = pthread_getspecific( buffer_cache_key );
+    if ( cache == NULL && create )
+    {
+        cache = calloc( 1, sizeof( buffer_cache_t ) );
+        if ( cache != NULL && pthread_setspecific( buffer_cache_key, cache ) )
+        {
+            free( cache );
+            cache = NULL;
+        }
+    }
+    return cache;
+#else
     return NULL;
+#endif
 }
 
-hb_buffer_t * hb_buffer_init( int size )
+static int buffer_cache_limit( int index )
+{
+    int limit = BUFFER_CACHE_MAX_BYTES >> index;
+
+    if ( limit < 1 )
+        return 1;
+    if ( limit > BUFFER_CACHE_MAX_ELEMENTS )
+        return BUFFER_CACHE_MAX_ELEMENTS;
+    return limit;
+}
+
+// Adds the statistics gathered by this thread to the totals
+static void buffer_cache_stats( buffer_cache_t * cache )
+{
+    buffers_add( cache_hits, cache->cache_hits );
+    buffers_add( pool_hits, cache->pool_hits );
+    buffers_add( misses, cache->misses );
+    cache->cache_hits = 0;
+    cache->pool_hits = 0;
+    cache->misses = 0;
+}
+
+// Moves up to 'count' buffers from the pool to the cache
+static void buffer_cache_refill( buffer_cache_t * cache, int index, int count )
+{
+    hb_fifo_t * f = buffers.pool[index];
+    hb_buffer_t * last;
+    int n = 1;
+
+    hb_lock( f->lock );
+    last = f->first;
+    if ( last != NULL )
+    {
+        while ( n < count && last->next != NULL )
+        {
+            last = last->next;
+            n++;
+        }
+        cache->list[index] = f->first;
+        cache->count[index] = n;
+        f->first = last->next;
+        if ( f->first == NULL )
+        {
+            f->last = NULL;
+        }
+        f->size -= n;
+        last->next = NULL;
+    }
+    hb_unlock( f->lock );
+}
+
+// Moves 'count' buffers from the cache to the pool. Buffers that don't
+// fit in the pool are freed.
+static void buffer_cache_drain( buffer_cache_t * cache, int index, int count )
+{
+    hb_fifo_t * f = buffers.pool[index];
+    hb_buffer_t * first, * last = NULL, * b;
+    int n = 0;
+
+    first = cache->list[index];
+    if ( first == NULL || count <= 0 )
+        return;
+
+    hb_lock( f->lock );
+    b = first;
+    while ( n < count && b != NULL && f->size + n < f->capacity )
+    {
+        last = b;
+        b = b->next;
+        n++;
+    }
+    if ( n > 0 )
+    {
+        cache->list[index] = b;
+        last->next = f->first;
+        f->first = first;
+        if ( f->last == NULL )
+        {
+            f->last = last;
+        }
+        f->size += n;
+    }
+    hb_unlock( f->lock );
+
+    // The pool is full, free the rest of the batch
+    while ( n < count && ( b = cache->list[index] ) != NULL )
+    {
+        cache->list[index] = b->next;
+        b->next = NULL;
+        buffer_free( b );
+        n++;
+    }
+    cache->count[index] -= n;
+}
+
+static void buffer_cache_flush( buffer_cache_t * cache )
+{
+    int i;
+
+    for ( i = 10; i < 26; ++i )
+    {
+        if ( buffers.pool[i] != NULL )
+        {
+            buffer_cache_drain( cache, i, cache->count[i] );
+        }
+    }
+    buffer_cache_stats( cache );
+}
+
+// Returns a free buffer of the pool's size or NULL if none is available
+static hb_buffer_t * buffer_cache_take( int index )
 {
+    buffer_cache_t * cache = buffer_cache_get( 1 );
     hb_buffer_t * b;
-    // Certain libraries (hrm ffmpeg) expect buffers passed to them to
-    // end on certain alignments (ffmpeg is 8). So allocate some extra bytes.
-    // Note that we can't simply align the end of our buffer because
-    // sometimes we feed data to these libraries starting from arbitrary
-    // points within the buffer.
-    int alloc = size + 16;
-    hb_fifo_t *buffer_pool = size_to_pool( alloc );
 
-    if( buffer_pool )
+    if ( cache == NULL )
     {
-        b = hb_fifo_get( buffer_pool );
+        return hb_fifo_get( buffers.pool[index] );
+    }
 
-        if( b )
+    if ( cache->count[index] > 0 )
+    {
+        cache->cache_hits++;
+    }
+    else
+    {
+        buffer_cache_refill( cache, index,
+                             ( buffer_cache_limit( index ) + 1 ) / 2 );
+        if ( cache->count[index] > 0 )
+        {
+            cache->pool_hits++;
+        }
+        else
+        {
+            cache->misses++;
+        }
+        // Slow path anyway, publish statistics
+        buffer_cache_stats( cache );
+        if ( cache->count[index] == 0 )
         {
-            /*
-             * Zero the contents of the buffer, would be nice if we
-             * didn't have to do this.
-             */
-            uint8_t *data = b->data;
-            memset( b, 0, sizeof(hb_buffer_t) );
-            b->alloc = buffer_pool->buffer_size;
-            b->size = size;
-            b->data = data;
-            return( b );
+            return NULL;
         }
     }
+    b = cache->list[index];
+    cache->list[index] = b->next;
+    cache->count[index]--;
+    b->next = NULL;
+    return b;
+}
+
+// Keeps a buffer for reuse, returns 0 if there is no room for it
+static int buffer_cache_give( int index, hb_buffer_t * b )
+{
+    buffer_cache_t * cache = buffer_cache_get( 1 );
+    int limit;
+
+    if ( cache == NULL )
+    {
+        if ( hb_fifo_is_full( buffers.pool[index] ) )
+            return 0;
+        hb_fifo_push_head( buffers.pool[index], b );
+        return 1;
+    }
+
+    limit = buffer_cache_limit( index );
+    if ( cache->count[index] >= limit )
+    {
+        buffer_cache_drain( cache, index, ( limit + 1 ) / 2 );
+    }
+    b->next = cache->list[index];
+    cache->list[index] = b;
+    cache->count[index]++;
+    return 1;
+}
+
+// Allocates a new buffer with 'alloc' bytes of storage
+static hb_buffer_t * buffer_new( int size, int alloc )
+{
+    hb_buffer_t * b;
 
-    /*
-     * No existing buffers, create a new one
-     */
     if( !( b = calloc( sizeof( hb_buffer_t ), 1 ) ) )
     {
         hb_log( "out of memory" );
@@ -313,7 +646,7 @@ hb_buffer_t * hb_buffer_init( int size )
     }
 
     b->size  = size;
-    b->alloc  = buffer_pool ? buffer_pool->buffer_size : alloc;
+    b->alloc = alloc;
 
     if (size)
     {
@@ -331,15 +664,197 @@ hb_buffer_t * hb_buffer_init( int size )
             free( b );
             return NULL;
         }
-        hb_lock(buffers.lock);
-        buffers.allocated += b->alloc;
-        hb_unlock(buffers.lock);
+        buffers_add( allocated, b->alloc );
     }
     return b;
 }
 
+// Prepares a buffer taken from a pool for reuse
+static hb_buffer_t * buffer_reuse( hb_buffer_t * b, int size, int zero )
+{
+    if ( !zero )
+    {
+        /*
+         * The caller lays out the frame format and planes itself,
+         * only reset the rest.
+         */
+        b->size = size;
+        b->offset = 0;
+        b->sequence = 0;
+        b->refs = NULL;
+        memset( &b->s, 0, sizeof(b->s) );
+        memset( &b->qp, 0, sizeof(b->qp) );
+        b->sub = NULL;
+        b->next = NULL;
+        return( b );
+    }
+
+    /*
+     * Zero the contents of the buffer, would be nice if we
+     * didn't have to do this.
+     */
+    uint8_t *data = b->data;
+    int alloc = b->alloc;
+    memset( b, 0, sizeof(hb_buffer_t) );
+    b->alloc = alloc;
+    b->size = size;
+    b->data = data;
+    return( b );
+}
+
+static hb_buffer_t * buffer_init( int size, int zero )
+{
+    hb_buffer_t * b;
+    // Certain libraries (hrm ffmpeg) expect buffers passed to them to
+    // end on certain alignments (ffmpeg is 8). So allocate some extra bytes.
+    // Note that we can't simply align the end of our buffer because
+    // sometimes we feed data to these libraries starting from arbitrary
+    // points within the buffer.
+    int alloc = size + 16;
+    int index = size_to_index( alloc );
+    hb_fifo_t *buffer_pool = index < 0 ? NULL : buffers.pool[index];
+
+    if( buffer_pool )
+    {
+        b = buffer_cache_take( index );
+
+        if( b )
+        {
+            return buffer_reuse( b, size, zero );
+        }
+    }
+
+    /*
+     * No existing buffers, create a new one
+     */
+    return buffer_new( size, buffer_pool ? buffer_pool->buffer_size : alloc );
+}
+
+hb_buffer_t * hb_buffer_init( int size )
+{
+    return buffer_init( size, 1 );
+}
+
+/*
+ * Frame buffer pools, see MAX_FRAME_POOLS. Frames are allocated at most
+ * a few hundred times a second, so the pools simply live under
+ * buffers.lock. Must be called with buffers.lock held.
+ */
+static frame_pool_t * frame_pool_find( int alloc, int create )
+{
+    frame_pool_t * unused = NULL;
+    int i;
+
+    for ( i = 0; i < MAX_FRAME_POOLS; i++ )
+    {
+        frame_pool_t * fp = &buffers.frame_pool[i];
+
+        if ( fp->alloc == alloc )
+            return fp;
+        if ( fp->alloc == 0 && unused == NULL )
+            unused = fp;
+    }
+    if ( unused != NULL && create )
+    {
+        unused->alloc = alloc;
+        unused->capacity = FRAME_POOL_DEFAULT_ELEMENTS;
+        return unused;
+    }
+    return NULL;
+}
+
+// Frame buffers have the same padding as other buffers, see hb_buffer_init()
+static int frame_pool_alloc_size( int size )
+{
+    int alloc = size + 16;
+    int index = size_to_index( alloc );
+
+    // Power of 2 sizes are handled just as well by the regular pools
+    if ( index >= 0 && alloc == 1 << index )
+        return 0;
+    return alloc;
+}
+
+static hb_buffer_t * frame_buffer_init( int size, int zero )
+{
+    int alloc = frame_pool_alloc_size( size );
+    frame_pool_t * fp;
+    hb_buffer_t * b = NULL;
+
+    if ( alloc == 0 )
+        return buffer_init( size, zero );
+
+    hb_lock( buffers.lock );
+    fp = frame_pool_find( alloc, 1 );
+    if ( fp != NULL && fp->list != NULL )
+    {
+        b = fp->list;
+        fp->list = b->next;
+        fp->count--;
+    }
+    hb_unlock( buffers.lock );
+
+    if ( fp == NULL )
+    {
+        // Too many different frame sizes in use
+        return buffer_init( size, zero );
+    }
+    if ( b != NULL )
+    {
+        buffers_add( pool_hits, 1 );
+        return buffer_reuse( b, size, zero );
+    }
+    buffers_add( misses, 1 );
+    return buffer_new( size, alloc );
+}
+
+// Returns 1 if the buffer was kept in a frame pool
+static int frame_buffer_close( hb_buffer_t * b )
+{
+    frame_pool_t * fp;
+    int kept = 0;
+
+    hb_lock( buffers.lock );
+    fp = frame_pool_find( b->alloc, 0 );
+    if ( fp != NULL && fp->count < fp->capacity )
+    {
+        b->next = fp->list;
+        fp->list = b;
+        fp->count++;
+        kept = 1;
+    }
+    hb_unlock( buffers.lock );
+
+    return kept;
+}
+
+// Sets the number of free buffers kept for frames of the given geometry.
+// do_job() sizes this to the number of frames its fifos can hold.
+void hb_frame_buffer_pool_init( int pix_fmt, int width, int height, int count )
+{
+    int alloc = frame_pool_alloc_size( hb_frame_buffer_size( pix_fmt, width,
+                                                             height ) );
+    frame_pool_t * fp;
+
+    if ( alloc == 0 )
+        return;
+
+    hb_lock( buffers.lock );
+    fp = frame_pool_find( alloc, 1 );
+    if ( fp != NULL && fp->capacity < count )
+    {
+        fp->capacity = count;
+    }
+    hb_unlock( buffers.lock );
+}
+
+static void buffer_unshare( hb_buffer_t * b, int copy );
+
 void hb_buffer_realloc( hb_buffer_t * b, int size )
 {
+    // Callers realloc in order to write to the buffer
+    buffer_unshare( b, 1 );
+
     if ( size > b->alloc || b->data == NULL )
     {
         uint32_t orig = b->data != NULL ? b->alloc : 0;
@@ -347,9 +862,7 @@ void hb_buffer_realloc( hb_buffer_t * b, int size )
         b->data  = realloc( b->data, size );
         b->alloc = size;
 
-        hb_lock(buffers.lock);
-        buffers.allocated += size - orig;
-        hb_unlock(buffers.lock);
+        buffers_add( allocated, size - orig );
     }
 }
 
@@ -386,6 +899,117 @@ hb_buffer_t * hb_buffer_dup( const hb_buffer_t * src )
     return buf;
 }
 
+/*
+ * Shared buffers.
+ *
+ * hb_buffer_share() returns a new buffer that references the data of
+ * src instead of copying it. Buffers that share data carry a pointer to a
+ * common reference count that is allocated the first time the data is
+ * shared, and the data goes back to the pools when the last of them is
+ * closed. Shared data is read-only; hb_buffer_make_writable() gives a
+ * buffer its own copy before it is modified.
+ */
+hb_buffer_t * hb_buffer_share( hb_buffer_t * src )
+{
+    hb_buffer_t * b;
+
+    if ( src == NULL )
+        return NULL;
+
+    if ( src->data == NULL )
+        return hb_buffer_dup( src );
+
+    if ( src->refs == NULL )
+    {
+        // Nobody else can be using the data, we own the only reference
+        src->refs = malloc( sizeof( *src->refs ) );
+        if ( src->refs == NULL )
+        {
+            return hb_buffer_dup( src );
+        }
+        *src->refs = 1;
+    }
+
+    if( !( b = calloc( sizeof( hb_buffer_t ), 1 ) ) )
+    {
+        hb_log( "out of memory" );
+        return NULL;
+    }
+    __sync_fetch_and_add( src->refs, 1 );
+
+    *b = *src;
+    b->next = NULL;
+    b->sub  = NULL;
+    b->qp.table = hb_buffer_share( src->qp.table );
+
+    return b;
+}
+
+// Drops this buffer's reference to shared data. Returns 1 if other
+// buffers still use the data, 0 if this buffer was the last user.
+static int buffer_unref( hb_buffer_t * b )
+{
+    volatile int * refs = b->refs;
+
+    if ( refs == NULL )
+        return 0;
+
+    b->refs = NULL;
+    if ( __sync_sub_and_fetch( refs, 1 ) > 0 )
+        return 1;
+
+    free( (void*)refs );
+    return 0;
+}
+
+// Gives b data of its own, copying the shared contents if 'copy' is set
+static void buffer_unshare( hb_buffer_t * b, int copy )
+{
+    hb_buffer_t * tmp;
+    uint8_t * data;
+    int alloc;
+
+    if ( b->refs == NULL )
+        return;
+
+    if ( *b->refs == 1 )
+    {
+        // The other users are gone, the data is ours
+        buffer_unref( b );
+        return;
+    }
+
+    if ( b->s.type == FRAME_BUF )
+        tmp = frame_buffer_init( b->size, 0 );
+    else
+        tmp = buffer_init( b->size, 0 );
+    if ( tmp == NULL )
+        return;
+
+    if ( copy )
+        memcpy( tmp->data, b->data, b->size );
+
+    // Hand the shared data to tmp and release it from there, the
+    // other users may have gone away since we looked.
+    data  = b->data;
+    alloc = b->alloc;
+    b->data  = tmp->data;
+    b->alloc = tmp->alloc;
+    tmp->data  = data;
+    tmp->alloc = alloc;
+    tmp->refs  = b->refs;
+    b->refs    = NULL;
+    hb_buffer_close( &tmp );
+
+    if ( b->s.type == FRAME_BUF )
+        hb_buffer_init_planes( b );
+}
+
+void hb_buffer_make_writable( hb_buffer_t * b )
+{
+    buffer_unshare( b, 1 );
+}
+
 int hb_buffer_copy(hb_buffer_t * dst, const hb_buffer_t * src)
 {
     if (src == NULL || dst == NULL)
@@ -394,6 +1018,9 @@ int hb_buffer_copy(hb_buffer_t * dst, const hb_buffer_t * src)
     if ( dst->size < src->size )
         return -1;
 
+    // All of the shared contents get overwritten, no need to copy them
+    buffer_unshare( dst, 0 );
+
     memcpy( dst->data, src->data, src->size );
     dst->s = src->s;
     dst->f = src->f;
@@ -438,12 +1065,11 @@ void hb_buffer_init_planes( hb_buffer_t * b )
     hb_buffer_init_planes_internal( b, has_plane );
 }
 
-// this routine gets a buffer for an uncompressed picture
-// with pixel format pix_fmt and dimensions width x height.
-hb_buffer_t * hb_frame_buffer_init( int pix_fmt, int width, int height )
+// this routine returns the size of the buffer needed for an uncompressed
+// picture with pixel format pix_fmt and dimensions width x height.
+int hb_frame_buffer_size( int pix_fmt, int width, int height )
 {
     const AVPixFmtDescriptor *desc = &av_pix_fmt_descriptors[pix_fmt];
-    hb_buffer_t * buf;
     int p;
     uint8_t has_plane[4] = {0,};
 
@@ -461,20 +1087,66 @@ hb_buffer_t * hb_frame_buffer_init( int pix_fmt, int width, int height )
                     hb_image_height_stride( pix_fmt, height, p );
         }
     }
+    return size;
+}
+
+static hb_buffer_t * frame_buffer_alloc( int pix_fmt, int width, int height,
+                                         int zero )
+{
+    const AVPixFmtDescriptor *desc = &av_pix_fmt_descriptors[pix_fmt];
+    hb_buffer_t * buf;
+    int p;
+    uint8_t has_plane[4] = {0,};
 
-    buf = hb_buffer_init( size );
+    for( p = 0; p < 4; p++ )
+    {
+        has_plane[desc->comp[p].plane] = 1;
+    }
+
+    buf = frame_buffer_init( hb_frame_buffer_size( pix_fmt, width, height ),
+                             zero );
     if( buf == NULL )
         return NULL;
 
     buf->s.type = FRAME_BUF;
+    buf->f.x = 0;
+    buf->f.y = 0;
     buf->f.width = width;
     buf->f.height = height;
     buf->f.fmt = pix_fmt;
 
+    if ( !zero )
+    {
+        for( p = 0; p < 4; p++ )
+        {
+            if ( !has_plane[p] )
+                memset( &buf->plane[p], 0, sizeof(buf->plane[p]) );
+        }
+#if defined(HB_BUFFER_DEBUG)
+        memset( buf->data, 0xa5, buf->size );
+#endif
+    }
+
     hb_buffer_init_planes_internal( buf, has_plane );
     return buf;
 }
 
+// this routine gets a buffer for an uncompressed picture
+// with pixel format pix_fmt and dimensions width x height.
+hb_buffer_t * hb_frame_buffer_init( int pix_fmt, int width, int height )
+{
+    return frame_buffer_alloc( pix_fmt, width, height, 1 );
+}
+
+// like hb_frame_buffer_init(), but only the picture format and plane
+// layout are initialized. Use it when every plane is going to be written
+// anyway. Reading pixels before writing them returns whatever a previous
+// user of the buffer left there (garbage in HB_BUFFER_DEBUG builds).
+hb_buffer_t * hb_frame_buffer_init_nozero( int pix_fmt, int width, int height )
+{
+    return frame_buffer_alloc( pix_fmt, width, height, 0 );
+}
+
 // this routine reallocs a buffer for an uncompressed YUV420 video frame
 // with dimensions width x height.
 void hb_video_buffer_realloc( hb_buffer_t * buf, int width, int height )
@@ -511,15 +1183,17 @@ void hb_video_buffer_realloc( hb_buffer_t * buf, int width, int height )
 // from src to dst.
 void hb_buffer_swap_copy( hb_buffer_t *src, hb_buffer_t *dst )
 {
-    uint8_t *data  = dst->data;
-    int      size  = dst->size;
-    int      alloc = dst->alloc;
+    uint8_t      *data  = dst->data;
+    int           size  = dst->size;
+    int           alloc = dst->alloc;
+    volatile int *refs  = dst->refs;
 
     *dst = *src;
 
     src->data  = data;
     src->size  = size;
     src->alloc = alloc;
+    src->refs  = refs;
 }
 
 // Frees the specified buffer list.
@@ -530,29 +1204,39 @@ void hb_buffer_close( hb_buffer_t ** _b )
     while( b )
     {
         hb_buffer_t * next = b->next;
-        hb_fifo_t *buffer_pool = size_to_pool( b->alloc );
+        int index = size_to_index( b->alloc );
 
         b->next = NULL;
 
         // Close any attached subtitle buffers
         hb_buffer_close( &b->sub );
 
-        if( buffer_pool && b->data && !hb_fifo_is_full( buffer_pool ) )
+        // and the quantizer table
+        hb_buffer_close( &b->qp.table );
+
+        if( buffer_unref( b ) )
         {
-            hb_fifo_push_head( buffer_pool, b );
+            // The data is still used by other buffers
+            free( b );
             b = next;
             continue;
         }
-        // either the pool is full or this size doesn't use a pool
-        // free the buf 
-        if( b->data )
+
+        if( index >= 0 && buffers.pool[index] && b->data &&
+            buffers.pool[index]->buffer_size == b->alloc &&
+            buffer_cache_give( index, b ) )
         {
-            free( b->data );
-            hb_lock(buffers.lock);
-            buffers.allocated -= b->alloc;
-            hb_unlock(buffers.lock);
+            b = next;
+            continue;
+        }
+        if( b->data && frame_buffer_close( b ) )
+        {
+            b = next;
+            continue;
         }
-        free( b );
+        // either the pool is full or this size doesn't use a pool
+        // free the buf 
+        buffer_free( b );
         b = next;
     }
 
@@ -566,6 +1250,15 @@ void hb_buffer_move_subs( hb_buffer_t * dst, hb_buffer_t * src )
     src->sub       = NULL;
 }
 
+// Gives dst (a frame made from src by a filter that keeps the geometry)
+// a reference to the quantizer table of src.
+void hb_buffer_copy_qp( hb_buffer_t * dst, hb_buffer_t * src )
+{
+    hb_buffer_close( &dst->qp.table );
+    dst->qp       = src->qp;
+    dst->qp.table = hb_buffer_share( src->qp.table );
+}
+
 hb_fifo_t * hb_fifo_init( int capacity, int thresh )
 {
     hb_fifo_t * f;
@@ -584,11 +1277,211 @@ hb_fifo_t * hb_fifo_init( int capacity, int thresh )
     return f;
 }
 
+/*
+ * Single producer / single consumer fifos.
+ *
+ * Most pipeline fifos are written by exactly one thread and read by
+ * exactly one other thread.  For those, push and get only touch their
+ * own end of a ring of buffer lists and never take f->lock.  The lock
+ * and the condition variables are only used to park the consumer when
+ * the ring is empty and the producer when it is full.  The parking side
+ * sets its wait flag, issues a barrier and checks again before sleeping;
+ * the other side issues a barrier after updating the ring and before
+ * testing the flag, so a wakeup can not get lost.
+ *
+ * hb_fifo_get*, hb_fifo_see* and hb_fifo_push_head may only be called
+ * from the consumer thread, hb_fifo_push* and hb_fifo_full_wait only
+ * from the producer thread.  hb_fifo_size and hb_fifo_is_full may be
+ * called from anywhere.
+ */
+#define fifo_barrier() __sync_synchronize()
+
+#define SPSC_WAIT_SIZE 1    // Producer waits for size to drop to thresh
+#define SPSC_WAIT_SLOT 2    // Producer waits for a free ring slot
+
+hb_fifo_t * hb_fifo_init_spsc( int capacity, int thresh )
+{
+    hb_fifo_t * f = hb_fifo_init( capacity, thresh );
+    uint32_t    slots = 16;
+
+    // A push may carry a list of buffers and hb_fifo_push() does not
+    // respect capacity, so leave room for bursts of pushes.
+    while( slots < 4 * f->capacity )
+    {
+        slots <<= 1;
+    }
+    f->ring = calloc( slots, sizeof( hb_buffer_t * ) );
+    f->ring_mask = slots - 1;
+    f->spsc = 1;
+
+    return f;
+}
+
+static inline uint32_t spsc_size( hb_fifo_t * f )
+{
+    return f->pushed - f->popped;
+}
+
+static inline int spsc_avail( hb_fifo_t * f )
+{
+    return f->ring_first != NULL || f->ring_head != f->ring_tail;
+}
+
+// Consumer: returns the next buffer to be read without removing it
+static hb_buffer_t * spsc_first( hb_fifo_t * f )
+{
+    if( f->ring_first == NULL && f->ring_head != f->ring_tail )
+    {
+        fifo_barrier();
+        f->ring_first = f->ring[f->ring_head & f->ring_mask];
+        fifo_barrier();
+        f->ring_head++;
+        fifo_barrier();
+        if( f->wait_full == SPSC_WAIT_SLOT )
+        {
+            hb_lock( f->lock );
+            hb_cond_signal( f->cond_full );
+            hb_unlock( f->lock );
+        }
+    }
+    return f->ring_first;
+}
+
+// Consumer: sleep until there is something to read or FIFO_TIMEOUT
+static void spsc_wait_empty( hb_fifo_t * f )
+{
+    hb_lock( f->lock );
+    f->wait_empty = 1;
+    fifo_barrier();
+    if( !spsc_avail( f ) )
+    {
+        hb_cond_timedwait( f->cond_empty, f->lock, FIFO_TIMEOUT );
+    }
+    f->wait_empty = 0;
+    hb_unlock( f->lock );
+}
+
+static hb_buffer_t * spsc_get( hb_fifo_t * f )
+{
+    hb_buffer_t * b = spsc_first( f );
+
+    if( b == NULL )
+    {
+        return NULL;
+    }
+    f->ring_first = b->next;
+    b->next       = NULL;
+    f->popped    += 1;
+    fifo_barrier();
+    if( f->wait_full == SPSC_WAIT_SIZE &&
+        spsc_size( f ) <= f->capacity - f->thresh )
+    {
+        hb_lock( f->lock );
+        hb_cond_signal( f->cond_full );
+        hb_unlock( f->lock );
+    }
+    return b;
+}
+
+static hb_buffer_t * spsc_see2( hb_fifo_t * f )
+{
+    hb_buffer_t * b = spsc_first( f );
+
+    if( b == NULL )
+    {
+        return NULL;
+    }
+    if( b->next != NULL )
+    {
+        return b->next;
+    }
+    if( f->ring_head != f->ring_tail )
+    {
+        fifo_barrier();
+        return f->ring[f->ring_head & f->ring_mask];
+    }
+    return NULL;
+}
+
+// Producer: sleep until the fifo drains below capacity or FIFO_TIMEOUT
+static int spsc_full_wait( hb_fifo_t * f )
+{
+    if( spsc_size( f ) >= f->capacity )
+    {
+        hb_lock( f->lock );
+        f->wait_full = SPSC_WAIT_SIZE;
+        fifo_barrier();
+        if( spsc_size( f ) >= f->capacity )
+        {
+            hb_cond_timedwait( f->cond_full, f->lock, FIFO_TIMEOUT );
+        }
+        f->wait_full = 0;
+        hb_unlock( f->lock );
+    }
+    return spsc_size( f ) < f->capacity;
+}
+
+static void spsc_push( hb_fifo_t * f, hb_buffer_t * b )
+{
+    hb_buffer_t * tmp;
+    uint32_t      count = 1;
+
+    for( tmp = b; tmp->next != NULL; tmp = tmp->next )
+    {
+        count++;
+    }
+
+    // Only a producer that pushes without hb_fifo_full_wait() can
+    // run out of slots.  Block until the consumer frees one.
+    while( f->ring_tail - f->ring_head > f->ring_mask )
+    {
+        hb_lock( f->lock );
+        f->wait_full = SPSC_WAIT_SLOT;
+        fifo_barrier();
+        if( f->ring_tail - f->ring_head > f->ring_mask )
+        {
+            hb_cond_timedwait( f->cond_full, f->lock, FIFO_TIMEOUT );
+        }
+        f->wait_full = 0;
+        hb_unlock( f->lock );
+    }
+
+    f->ring[f->ring_tail & f->ring_mask] = b;
+    f->pushed += count;
+    fifo_barrier();
+    f->ring_tail++;
+    fifo_barrier();
+    if( f->wait_empty )
+    {
+        hb_lock( f->lock );
+        hb_cond_signal( f->cond_empty );
+        hb_unlock( f->lock );
+    }
+}
+
 int hb_fifo_size_bytes( hb_fifo_t * f )
 {
     int ret = 0;
     hb_buffer_t * link;
 
+    if( f->spsc )
+    {
+        uint32_t slot;
+
+        for( link = f->ring_first; link; link = link->next )
+        {
+            ret += link->size;
+        }
+        for( slot = f->ring_head; slot != f->ring_tail; slot++ )
+        {
+            for( link = f->ring[slot & f->ring_mask]; link; link = link->next )
+            {
+                ret += link->size;
+            }
+        }
+        return ret;
+    }
+
     hb_lock( f->lock );
     link = f->first;
     while ( link )
@@ -605,6 +1498,11 @@ int hb_fifo_size( hb_fifo_t * f )
 {
     int ret;
 
+    if( f->spsc )
+    {
+        return spsc_size( f );
+    }
+
     hb_lock( f->lock );
     ret = f->size;
     hb_unlock( f->lock );
@@ -616,6 +1514,11 @@ int hb_fifo_is_full( hb_fifo_t * f )
 {
     int ret;
 
+    if( f->spsc )
+    {
+        return spsc_size( f ) >= f->capacity;
+    }
+
     hb_lock( f->lock );
     ret = ( f->size >= f->capacity );
     hb_unlock( f->lock );
@@ -627,6 +1530,11 @@ float hb_fifo_percent_full( hb_fifo_t * f )
 {
     float ret;
 
+    if( f->spsc )
+    {
+        return spsc_size( f ) / f->capacity;
+    }
+
     hb_lock( f->lock );
     ret = f->size / f->capacity;
     hb_unlock( f->lock );
@@ -640,6 +1548,15 @@ hb_buffer_t * hb_fifo_get_wait( hb_fifo_t * f )
 {
     hb_buffer_t * b;
 
+    if( f->spsc )
+    {
+        if( !spsc_avail( f ) )
+        {
+            spsc_wait_empty( f );
+        }
+        return spsc_get( f );
+    }
+
     hb_lock( f->lock );
     if( f->size < 1 )
     {
@@ -670,6 +1587,11 @@ hb_buffer_t * hb_fifo_get( hb_fifo_t * f )
 {
     hb_buffer_t * b;
 
+    if( f->spsc )
+    {
+        return spsc_get( f );
+    }
+
     hb_lock( f->lock );
     if( f->size < 1 )
     {
@@ -694,6 +1616,15 @@ hb_buffer_t * hb_fifo_see_wait( hb_fifo_t * f )
 {
     hb_buffer_t * b;
 
+    if( f->spsc )
+    {
+        if( !spsc_avail( f ) )
+        {
+            spsc_wait_empty( f );
+        }
+        return spsc_first( f );
+    }
+
     hb_lock( f->lock );
     if( f->size < 1 )
     {
@@ -717,6 +1648,11 @@ hb_buffer_t * hb_fifo_see( hb_fifo_t * f )
 {
     hb_buffer_t * b;
 
+    if( f->spsc )
+    {
+        return spsc_first( f );
+    }
+
     hb_lock( f->lock );
     if( f->size < 1 )
     {
@@ -733,6 +1669,11 @@ hb_buffer_t * hb_fifo_see2( hb_fifo_t * f )
 {
     hb_buffer_t * b;
 
+    if( f->spsc )
+    {
+        return spsc_see2( f );
+    }
+
     hb_lock( f->lock );
     if( f->size < 2 )
     {
@@ -751,6 +1692,11 @@ int hb_fifo_full_wait( hb_fifo_t * f )
 {
     int result;
 
+    if( f->spsc )
+    {
+        return spsc_full_wait( f );
+    }
+
     hb_lock( f->lock );
     if( f->size >= f->capacity )
     {
@@ -771,6 +1717,13 @@ void hb_fifo_push_wait( hb_fifo_t * f, hb_buffer_t * b )
         return;
     }
 
+    if( f->spsc )
+    {
+        spsc_full_wait( f );
+        spsc_push( f, b );
+        return;
+    }
+
     hb_lock( f->lock );
     if( f->size >= f->capacity )
     {
@@ -808,6 +1761,12 @@ void hb_fifo_push( hb_fifo_t * f, hb_buffer_t * b )
         return;
     }
 
+    if( f->spsc )
+    {
+        spsc_push( f, b );
+        return;
+    }
+
     hb_lock( f->lock );
     if( f->size > 0 )
     {
@@ -843,6 +1802,22 @@ void hb_fifo_push_head( hb_fifo_t * f, hb_buffer_t * b )
         return;
     }
 
+    if( f->spsc )
+    {
+        // Only the consumer may put buffers back at the head
+        tmp = b;
+        while( tmp->next )
+        {
+            tmp = tmp->next;
+            size += 1;
+        }
+        spsc_first( f );
+        tmp->next = f->ring_first;
+        f->ring_first = b;
+        f->popped -= size + 1;
+        return;
+    }
+
     hb_lock( f->lock );
 
     /*
@@ -910,6 +1885,7 @@ void hb_fifo_close( hb_fifo_t ** _f )
     hb_lock_close( &f->lock );
     hb_cond_close( &f->cond_empty );
     hb_cond_close( &f->cond_full );
+    free( f->ring );
 
 #if defined(HB_FIFO_DEBUG)
     // Remove the fifo from the global fifo list
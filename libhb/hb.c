@@ -9,6 +9,7 @@
  
 #include "hb.h"
 #include "hbffmpeg.h"
+#include "taskset.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -66,6 +67,9 @@ struct hb_handle_s
 
     // power management opaque pointer
     void *system_sleep_opaque;
+
+    /* Worker threads shared by the tasksets of all filters */
+    hb_taskpool_t * taskpool;
 } ;
 
 hb_work_object_t * hb_objects = NULL;
@@ -461,6 +465,8 @@ hb_handle_t * hb_init( int verbose, int update_check )
 
     h->interjob = calloc( sizeof( hb_interjob_t ), 1 );
 
+    h->taskpool = hb_taskpool_init( hb_get_cpu_count() );
+
     /* libavcodec */
     hb_avcodec_init();
 
@@ -562,6 +568,8 @@ hb_handle_t * hb_init_dl( int verbose, int update_check )
 
     h->pause_lock = hb_lock_init();
 
+    h->taskpool = hb_taskpool_init( hb_get_cpu_count() );
+
     /* libavcodec */
     hb_avcodec_init();
 
@@ -1552,6 +1560,7 @@ void hb_start( hb_handle_t * h )
     p.minutes   = -1;
     p.seconds   = -1;
     p.sequence_id = 0;
+    p.write_stalled = 0;
 #undef p
     hb_unlock( h->state_lock );
 
@@ -1688,6 +1697,8 @@ void hb_close( hb_handle_t ** _h )
 
     hb_system_sleep_opaque_close(&h->system_sleep_opaque);
 
+    hb_taskpool_close( &h->taskpool );
+
     free( h->interjob );
 
     free( h );
@@ -1887,9 +1898,15 @@ void hb_set_state( hb_handle_t * h, hb_state_t * s )
 
         // Set which job is being worked on
         if (h->current_job)
+        {
             h->state.param.working.sequence_id = h->current_job->sequence_id;
+            h->state.param.working.write_stalled = h->current_job->write_stalled;
+        }
         else
+        {
             h->state.param.working.sequence_id = 0;
+            h->state.param.working.write_stalled = 0;
+        }
     }
     hb_unlock( h->state_lock );
     hb_unlock( h->pause_lock );
@@ -1910,3 +1927,9 @@ hb_interjob_t * hb_interjob_get( hb_handle_t * h )
 {
     return h->interjob;
 }
+
+/* Passes a pointer to the worker pool shared by filter tasksets */
+hb_taskpool_t * hb_taskpool_get( hb_handle_t * h )
+{
+    return h->taskpool;
+}
@@ -37,13 +37,23 @@ void         hb_title_close( hb_title_t ** );
 /***********************************************************************
  * hb.c
  **********************************************************************/
+typedef struct hb_taskpool_s hb_taskpool_t;
+
 int  hb_get_pid( hb_handle_t * );
 void hb_set_state( hb_handle_t *, hb_state_t * );
+hb_taskpool_t * hb_taskpool_get( hb_handle_t * );
 
 /***********************************************************************
  * fifo.c
  **********************************************************************/
 
+// Scale of the quantizers in hb_buffer_t.qp, same values as libavcodec's
+// FF_QSCALE_TYPE_*
+#define HB_QSCALE_TYPE_MPEG1    0
+#define HB_QSCALE_TYPE_MPEG2    1
+#define HB_QSCALE_TYPE_H264     2
+#define HB_QSCALE_TYPE_VP56     3
+
 /*
  * Holds a packet of data that is moving through the transcoding process.
  * 
@@ -56,6 +66,8 @@ struct hb_buffer_s
     int           alloc;    // used internally by the packet allocator (hb_buffer_init)
     uint8_t *     data;     // packet data
     int           offset;   // used internally by packet lists (hb_list_t)
+    volatile int * refs;    // number of buffers sharing data, NULL if not
+                            // shared (see hb_buffer_share)
 
     /*
      * Corresponds to the order that this packet was read from the demuxer.
@@ -124,6 +136,19 @@ struct hb_buffer_s
     //   associated video packets.
     hb_buffer_t * sub;
 
+    // Video packets from decoders that export them:
+    //   The quantizer of each macroblock of the frame, used by the
+    //   deblock filter to pick its strength per block.  The table is
+    //   read-only and shared by buffers that share the frame.
+    struct qp
+    {
+        hb_buffer_t * table;    // one byte per macroblock
+        int           stride;   // bytes per row of macroblocks
+        int           width;    // macroblocks per row
+        int           height;   // rows of macroblocks
+        int           type;     // HB_QSCALE_TYPE_*
+    } qp;
+
     // Packets in a list:
     //   the next packet in the list
     hb_buffer_t * next;
@@ -131,20 +156,27 @@ struct hb_buffer_s
 
 void hb_buffer_pool_init( void );
 void hb_buffer_pool_free( void );
+void hb_frame_buffer_pool_init( int pix_fmt, int w, int h, int count );
 
 hb_buffer_t * hb_buffer_init( int size );
 hb_buffer_t * hb_frame_buffer_init( int pix_fmt, int w, int h);
+hb_buffer_t * hb_frame_buffer_init_nozero( int pix_fmt, int w, int h );
+int           hb_frame_buffer_size( int pix_fmt, int w, int h );
 void          hb_buffer_init_planes( hb_buffer_t * b );
 void          hb_buffer_realloc( hb_buffer_t *, int size );
 void          hb_video_buffer_realloc( hb_buffer_t * b, int w, int h );
 void          hb_buffer_reduce( hb_buffer_t * b, int size );
 void          hb_buffer_close( hb_buffer_t ** );
 hb_buffer_t * hb_buffer_dup( const hb_buffer_t * src );
+hb_buffer_t * hb_buffer_share( hb_buffer_t * src );
+void          hb_buffer_make_writable( hb_buffer_t * b );
 int           hb_buffer_copy( hb_buffer_t * dst, const hb_buffer_t * src );
 void          hb_buffer_swap_copy( hb_buffer_t *src, hb_buffer_t *dst );
 void          hb_buffer_move_subs( hb_buffer_t * dst, hb_buffer_t * src );
+void          hb_buffer_copy_qp( hb_buffer_t * dst, hb_buffer_t * src );
 
 hb_fifo_t   * hb_fifo_init( int capacity, int thresh );
+hb_fifo_t   * hb_fifo_init_spsc( int capacity, int thresh );
 int           hb_fifo_size( hb_fifo_t * );
 int           hb_fifo_size_bytes( hb_fifo_t * );
 int           hb_fifo_is_full( hb_fifo_t * );
@@ -221,6 +253,22 @@ static inline hb_buffer_t * hb_video_buffer_init( int width, int height )
     return hb_frame_buffer_init( AV_PIX_FMT_YUV420P, width, height );
 }
 
+// same as hb_video_buffer_init(), for callers that write every plane,
+// see hb_frame_buffer_init_nozero().
+static inline hb_buffer_t * hb_video_buffer_init_nozero( int width, int height )
+{
+    return hb_frame_buffer_init_nozero( AV_PIX_FMT_YUV420P, width, height );
+}
+
+// converts luma row y of a frame to the corresponding row of plane p,
+// for filters that process frames in horizontal stripes.
+static inline int hb_plane_row( const hb_buffer_t * b, int p, int y )
+{
+    if ( y >= b->f.height )
+        return b->plane[p].height;
+    return y * b->plane[p].height / b->f.height;
+}
+
 /***********************************************************************
  * Threads: update.c, scan.c, work.c, reader.c, muxcommon.c
  **********************************************************************/
@@ -277,6 +325,33 @@ void          hb_batch_close( hb_batch_t ** _d );
 int           hb_batch_title_count( hb_batch_t * d );
 hb_title_t  * hb_batch_title_scan( hb_batch_t * d, int t );
 
+/***********************************************************************
+ * readahead.c
+ **********************************************************************/
+typedef struct hb_readahead_s hb_readahead_t;
+
+// Reads up to size bytes of the source at pos into buf. Returns the
+// number of bytes read, 0 at the end of the source or < 0 on error.
+typedef int hb_readahead_fill_t( void * opaque, int64_t pos,
+                                 uint8_t * buf, int size );
+
+#define HB_READAHEAD_BLOCK_SIZE  (1024 * 1024)
+#define HB_READAHEAD_BLOCK_COUNT 4
+
+hb_readahead_t * hb_readahead_init( const char * name,
+                                    hb_readahead_fill_t * fill, void * opaque,
+                                    int block_size, int block_count,
+                                    int align );
+void             hb_readahead_close( hb_readahead_t ** );
+void             hb_readahead_start( hb_readahead_t *, int64_t pos );
+void             hb_readahead_stop( hb_readahead_t * );
+void             hb_readahead_seek( hb_readahead_t *, int64_t pos );
+int64_t          hb_readahead_tell( hb_readahead_t * );
+int              hb_readahead_get( hb_readahead_t *, int size,
+                                   const uint8_t ** data );
+int              hb_readahead_read( hb_readahead_t *, uint8_t * buf,
+                                    int size );
+
 /***********************************************************************
  * dvd.c
  **********************************************************************/
@@ -296,6 +371,7 @@ int          hb_dvd_is_break( hb_dvd_t * d );
 void         hb_dvd_close( hb_dvd_t ** );
 int          hb_dvd_angle_count( hb_dvd_t * d );
 void         hb_dvd_set_angle( hb_dvd_t * d, int angle );
+void         hb_dvd_set_readahead( hb_dvd_t * d, int enable );
 int          hb_dvd_main_feature( hb_dvd_t * d, hb_list_t * list_title );
 
 hb_bd_t     * hb_bd_init( char * path );
@@ -310,6 +386,7 @@ hb_buffer_t * hb_bd_read( hb_bd_t * d );
 int           hb_bd_chapter( hb_bd_t * d );
 void          hb_bd_close( hb_bd_t ** _d );
 void          hb_bd_set_angle( hb_bd_t * d, int angle );
+void          hb_bd_set_readahead( hb_bd_t * d, int enable );
 int           hb_bd_main_feature( hb_bd_t * d, hb_list_t * list_title );
 
 hb_stream_t * hb_bd_stream_open( hb_title_t *title );
@@ -322,6 +399,7 @@ int          hb_stream_seek( hb_stream_t *, float );
 int          hb_stream_seek_ts( hb_stream_t * stream, int64_t ts );
 int          hb_stream_seek_chapter( hb_stream_t *, int );
 int          hb_stream_chapter( hb_stream_t * );
+void         hb_stream_set_readahead( hb_stream_t *, int enable );
 
 hb_buffer_t * hb_ts_decode_pkt( hb_stream_t *stream, const uint8_t * pkt );
 
@@ -10,6 +10,7 @@
 
 #define MIN_BUFFERING (1024*1024*10)
 #define MAX_BUFFERING (1024*1024*50)
+#define MAX_WRITE_BUFFERING (1024*1024*16)
 
 struct hb_mux_object_s
 {
@@ -31,27 +32,46 @@ typedef struct
     uint64_t        bytes;
     mux_fifo_t      mf;
     int             buffered_size;
+    uint8_t         continuous; // audio or video (see add_mux_track)
+    uint8_t         rdy;        // track is ready to output
+    uint8_t         eof;
 } hb_track_t;
 
+typedef struct
+{
+    hb_mux_data_t * mux_data;
+    hb_buffer_t   * buf;
+} mux_write_t;
+
 typedef struct
 {
     hb_lock_t       * mutex;
     int               ref;
     int               done;
+    hb_job_t        * job;
     hb_mux_object_t * m;
     double            pts;        // end time of next muxing chunk
     double            interleave; // size in 90KHz ticks of media chunks we mux
     uint32_t          ntracks;    // total number of tracks we're muxing
-    uint32_t          eof;        // bitmask of track with eof
-    uint32_t          rdy;        // bitmask of tracks ready to output
-    uint32_t          allEof;     // valid bits in eof (all tracks)
-    uint32_t          allRdy;     // valid bits in rdy (audio & video tracks)
-    hb_track_t      * track[32];  // array of tracks to mux ('ntrack' elements)
-                                  // NOTE- this array could be dynamically 
-                                  // allocated but the eof & rdy logic has to 
-                                  // be changed to handle more than 32 tracks 
-                                  // anyway so we keep it simple and fast.
+    uint32_t          nalloc;     // allocated size of 'track'
+    uint32_t          ncontinuous;// audio & video tracks
+    uint32_t          nrdy;       // continuous tracks that are ready to output
+    uint32_t          neof;       // tracks with eof
+    hb_track_t     ** track;      // array of tracks to mux ('ntrack' elements)
     int               buffered_size;
+
+    // The container muxer writes the output file on a thread of its own
+    // (see mux_write_loop) so the track threads never wait on the disk
+    // while they hold 'mutex'.
+    hb_thread_t     * writer;
+    hb_cond_t       * write_cond; // write queue changed
+    mux_write_t     * wq;         // write queue
+    uint32_t          wq_in;      // number of bufs put into wq
+    uint32_t          wq_out;     // number of bufs taken out of wq
+    uint32_t          wq_len;     // wq length (must be power of two)
+    int               write_size; // bytes in wq
+    int               write_eof;  // nothing more will be queued
+    int               write_stalls;
 } hb_mux_t;
 
 struct hb_work_private_s
@@ -92,22 +112,65 @@ struct hb_work_private_s
 static void add_mux_track( hb_mux_t *mux, hb_mux_data_t *mux_data,
                            int is_continuous )
 {
-    int max_tracks = sizeof(mux->track) / sizeof(*(mux->track));
-    if ( mux->ntracks >= max_tracks )
+    if ( mux->ntracks == mux->nalloc )
     {
-        hb_error( "add_mux_track: too many tracks (>%d)", max_tracks );
-        return;
+        mux->nalloc = mux->nalloc ? mux->nalloc * 2 : 8;
+        mux->track = realloc( mux->track, mux->nalloc * sizeof(*mux->track) );
     }
 
     hb_track_t *track = calloc( sizeof( hb_track_t ), 1 );
     track->mux_data = mux_data;
     track->mf.flen = 8;
     track->mf.fifo = calloc( sizeof(track->mf.fifo[0]), track->mf.flen );
+    track->continuous = is_continuous;
+
+    mux->track[mux->ntracks++] = track;
+    mux->ncontinuous += is_continuous;
+}
+
+// Tracks are ready to output when they have data past the next
+// interleave point. Only the continuous tracks are counted, all of them
+// have to be ready before anything is output.
+static void set_rdy( hb_mux_t *mux, hb_track_t *track )
+{
+    if ( !track->rdy )
+    {
+        track->rdy = 1;
+        mux->nrdy += track->continuous;
+    }
+}
+
+static void clear_rdy( hb_mux_t *mux, hb_track_t *track )
+{
+    if ( track->rdy )
+    {
+        track->rdy = 0;
+        mux->nrdy -= track->continuous;
+    }
+}
+
+// Mark all continuous tracks ready, i.e. force output
+static void set_all_rdy( hb_mux_t *mux )
+{
+    int i;
+
+    for ( i = 0; mux->nrdy < mux->ncontinuous && i < mux->ntracks; ++i )
+    {
+        if ( mux->track[i]->continuous )
+        {
+            set_rdy( mux, mux->track[i] );
+        }
+    }
+}
 
-    int t = mux->ntracks++;
-    mux->track[t] = track;
-    mux->allEof |= 1 << t;
-    mux->allRdy |= is_continuous << t;
+static int all_rdy( hb_mux_t *mux )
+{
+    return mux->nrdy == mux->ncontinuous;
+}
+
+static int all_eof( hb_mux_t *mux )
+{
+    return mux->neof == mux->ntracks;
 }
 
 static int mf_full( hb_track_t * track )
@@ -127,7 +190,7 @@ static void mf_push( hb_mux_t * mux, int tk, hb_buffer_t *buf )
     hb_buffer_reduce( buf, buf->size );
     if ( track->buffered_size > MAX_BUFFERING )
     {
-        mux->rdy = mux->allRdy;
+        set_all_rdy( mux );
     }
     if ( ( ( in + 1 ) & mask ) == ( track->mf.out & mask ) )
     {
@@ -194,8 +257,83 @@ static void MoveToInternalFifos( int tk, hb_mux_t *mux, hb_buffer_t * buf )
     {
         // buffer is past our next interleave point so
         // note that this track is ready to be output.
-        mux->rdy |= ( 1 << tk );
+        set_rdy( mux, mux->track[tk] );
+    }
+}
+
+// Queue a buf for the writer thread. Called with mux->mutex held.
+static void mux_write_push( hb_mux_t *mux, hb_mux_data_t *mux_data,
+                            hb_buffer_t *buf )
+{
+    uint32_t mask = mux->wq_len - 1;
+
+    if ( mux->wq_in - mux->wq_out == mux->wq_len )
+    {
+        // queue is full - expand it to double the current size.
+        // Like the track fifos, elements have to be copied one by one
+        // because the mask changes.
+        uint32_t nmask = mux->wq_len * 2 - 1;
+        mux_write_t *nwq = malloc( mux->wq_len * 2 * sizeof(*nwq) );
+        uint32_t indx;
+        for ( indx = mux->wq_out; indx != mux->wq_in; ++indx )
+        {
+            nwq[indx & nmask] = mux->wq[indx & mask];
+        }
+        free( mux->wq );
+        mux->wq = nwq;
+        mux->wq_len *= 2;
+        mask = nmask;
+    }
+    mux->wq[mux->wq_in & mask].mux_data = mux_data;
+    mux->wq[mux->wq_in & mask].buf = buf;
+    mux->wq_in++;
+    mux->write_size += buf->size;
+    hb_cond_broadcast( mux->write_cond );
+}
+
+// The writer thread. Passes the queued bufs to the container muxer, in
+// the order they were queued, without holding mux->mutex while it does.
+static void mux_write_loop( void * _mux )
+{
+    hb_mux_t        * mux = _mux;
+    hb_mux_object_t * m = mux->m;
+    mux_write_t       w;
+    int               size;
+
+    hb_lock( mux->mutex );
+    while ( 1 )
+    {
+        while ( mux->wq_out == mux->wq_in && !mux->write_eof )
+        {
+            hb_cond_wait( mux->write_cond, mux->mutex );
+        }
+        if ( mux->wq_out == mux->wq_in )
+        {
+            break;
+        }
+        w = mux->wq[mux->wq_out & (mux->wq_len - 1)];
+        ++mux->wq_out;
+        hb_unlock( mux->mutex );
+
+        size = w.buf->size;
+        if ( *mux->job->die )
+        {
+            hb_buffer_close( &w.buf );
+        }
+        else
+        {
+            m->mux( m, w.mux_data, w.buf );
+        }
+
+        hb_lock( mux->mutex );
+        mux->write_size -= size;
+        if ( mux->write_size < MAX_WRITE_BUFFERING / 2 )
+        {
+            mux->job->write_stalled = 0;
+        }
+        hb_cond_broadcast( mux->write_cond );
     }
+    hb_unlock( mux->mutex );
 }
 
 static void OutputTrackChunk( hb_mux_t *mux, int tk, hb_mux_object_t *m )
@@ -208,7 +346,14 @@ static void OutputTrackChunk( hb_mux_t *mux, int tk, hb_mux_object_t *m )
         buf = mf_pull( mux, tk );
         track->frames += 1;
         track->bytes  += buf->size;
-        m->mux( m, track->mux_data, buf );
+        if ( mux->writer )
+        {
+            mux_write_push( mux, track->mux_data, buf );
+        }
+        else
+        {
+            m->mux( m, track->mux_data, buf );
+        }
     }
 }
 
@@ -228,16 +373,32 @@ static int muxWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
         hb_unlock( mux->mutex );
         return HB_WORK_DONE;
     }
+    track = mux->track[pv->track];
+
+    // If the output can't keep up, hold up the encoders here rather
+    // than queue without limit. The UI sees this as write_stalled.
+    if ( mux->write_size > MAX_WRITE_BUFFERING && !*job->die )
+    {
+        job->write_stalled = 1;
+        mux->write_stalls++;
+        while ( mux->write_size > MAX_WRITE_BUFFERING && !*job->die )
+        {
+            hb_cond_wait( mux->write_cond, mux->mutex );
+        }
+    }
 
     if ( buf->size <= 0 )
     {
         // EOF - mark this track as done
         hb_buffer_close( &buf );
-        mux->eof |= ( 1 << pv->track );
-        mux->rdy |= ( 1 << pv->track );
+        if ( !track->eof )
+        {
+            track->eof = 1;
+            mux->neof++;
+        }
+        set_rdy( mux, track );
     }
-    else if ( ( job->pass != 0 && job->pass != 2 ) ||
-              ( mux->eof & (1 << pv->track) ) )
+    else if ( ( job->pass != 0 && job->pass != 2 ) || track->eof )
     {
         hb_buffer_close( &buf );
     }
@@ -247,18 +408,17 @@ static int muxWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
     }
     *buf_in = NULL;
 
-    if ( ( mux->rdy & mux->allRdy ) != mux->allRdy )
+    if ( !all_rdy( mux ) )
     {
         hb_unlock( mux->mutex );
         return HB_WORK_OK;
     }
 
-    int more = mux->rdy;
+    int more = 1;
     // all tracks have at least 'interleave' ticks of data. Output
     // all that we can in 'interleave' size chunks.
-    while ( (( mux->rdy & mux->allRdy ) == mux->allRdy && 
-            more && mux->buffered_size > MIN_BUFFERING ) ||
-            ( mux->eof == mux->allEof ) ) 
+    while ( ( all_rdy( mux ) && more &&
+              mux->buffered_size > MIN_BUFFERING ) || all_eof( mux ) )
     {
         more = 0;
         for ( i = 0; i < mux->ntracks; ++i )
@@ -269,29 +429,29 @@ static int muxWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
             {
                 // If the track's fifo is still full, advance
                 // the currint interleave point and try again.
-                mux->rdy = mux->allRdy;
+                set_all_rdy( mux );
                 break;
             }
 
             // if the track is at eof or still has data that's past
             // our next interleave point then leave it marked as rdy.
             // Otherwise clear rdy.
-            if ( ( mux->eof & (1 << i) ) == 0 &&
+            if ( !track->eof &&
                  ( track->mf.out == track->mf.in ||
                    track->mf.fifo[(track->mf.in-1) & (track->mf.flen-1)]->s.stop
                      < mux->pts + mux->interleave ) )
             {
-                mux->rdy &=~ ( 1 << i );
+                clear_rdy( mux, track );
             }
             if ( track->mf.out != track->mf.in )
             {
-                more |= ( 1 << i );
+                more = 1;
             }
         }
 
         // if all the tracks are at eof we're just purging their
         // remaining data -- keep going until all internal fifos are empty.
-        if ( mux->eof == mux->allEof )
+        if ( all_eof( mux ) )
         {
             for ( i = 0; i < mux->ntracks; ++i )
             {
@@ -337,6 +497,17 @@ void muxClose( hb_work_object_t * w )
             hb_set_state( job->h, &state );
         }
 
+        if( mux->writer )
+        {
+            // Let the writer finish what is queued
+            mux->write_eof = 1;
+            hb_cond_broadcast( mux->write_cond );
+            hb_unlock( mux->mutex );
+            hb_thread_close( &mux->writer );
+            hb_lock( mux->mutex );
+            job->write_stalled = 0;
+        }
+
         if( mux->m )
         {
             mux->m->end( mux->m );
@@ -378,6 +549,11 @@ void muxClose( hb_work_object_t * w )
                             (float) ( sb.st_size - bytes_total ) /
                             frames_total );
                 }
+                if( mux->write_stalls )
+                {
+                    hb_log( "mux: output was too slow, encoding waited "
+                            "on it %d times", mux->write_stalls );
+                }
             }
         }
     
@@ -396,7 +572,13 @@ void muxClose( hb_work_object_t * w )
             }
             free( track );
         }
+        free( mux->track );
+        free( mux->wq );
         hb_unlock( mux->mutex );
+        if( mux->write_cond )
+        {
+            hb_cond_close( &mux->write_cond );
+        }
         hb_lock_close( &mux->mutex );
         free( mux );
     }
@@ -447,6 +629,13 @@ hb_work_object_t * hb_muxer_init( hb_job_t * job )
     hb_work_object_t  * muxer;
 
     mux->mutex = hb_lock_init();
+    mux->job = job;
+
+    // The track threads start as their tracks are added, so allocate
+    // all the tracks up front. 'track' must not move under them.
+    mux->nalloc = 1 + hb_list_count( job->list_audio ) +
+                      hb_list_count( job->list_subtitle );
+    mux->track = calloc( sizeof(*mux->track), mux->nalloc );
 
     // set up to interleave track data in blocks of 1 video frame time.
     // (the best case for buffering and playout latency). The container-
@@ -474,6 +663,12 @@ hb_work_object_t * hb_muxer_init( hb_job_t * job )
         if( mux->m )
         {
             mux->m->init( mux->m );
+
+            mux->wq_len = 256;
+            mux->wq = calloc( sizeof(mux->wq[0]), mux->wq_len );
+            mux->write_cond = hb_cond_init();
+            mux->writer = hb_thread_init( "mux writer", mux_write_loop, mux,
+                                          HB_NORMAL_PRIORITY );
         }
     }
 
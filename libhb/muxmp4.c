@@ -7,6 +7,8 @@
    For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
  */
 
+#include <unistd.h>
+
 #include "mp4v2/mp4v2.h"
 #include "a52dec/a52.h"
 
@@ -29,6 +31,21 @@ struct hb_mux_object_s
     MP4TrackId chapter_track;
     int current_chapter;
     uint64_t chapter_duration;
+
+    /* Space reserved for the moov at the start of mdat (fast start) */
+    MP4TrackId moov_track;
+    uint32_t   moov_size;
+
+    /* Segmented output, see MP4NextSegment */
+    char     * path;            // file being written
+    int        segment;         // number of the file, 0 when not segmenting
+    int64_t    segment_start;   // start time of the file
+    int64_t    segment_end;     // next file starts at the first IDR after
+    MP4FileHandle prev_file;    // previous file, until its audio is complete
+    char     * prev_path;
+    MP4TrackId prev_moov_track;
+    uint32_t   prev_moov_size;
+    int        prev_tracks;     // audio tracks still writing to prev_file
 };
 
 struct hb_mux_data_s
@@ -42,6 +59,8 @@ struct hb_mux_data_s
     // audio frame duration info
     int sample_rate;
     int samples_per_frame;
+
+    int         prev;    // still writing to the previous segment
 };
 
 /* Tune video track chunk duration.
@@ -78,10 +97,290 @@ static const uint16_t ac3_bitrate_tab[19] = {
 };  
 
 
+/**********************************************************************
+ * Fast start
+ **********************************************************************
+ * libmp4v2 writes the moov at the end of the file, and MP4Optimize
+ * moves it to the front by copying the whole file.  Instead, MP4Init
+ * writes a single sample of zeros, big enough to hold the moov, as the
+ * very first data of mdat.  The sample is on a track of its own that
+ * MP4End deletes again before closing the file.  Once the file is
+ * closed, MP4FastStart moves the moov into the reserved space, in front
+ * of all the real samples, so none of the chunk offsets change and only
+ * the moov itself is written a second time.
+ *********************************************************************/
+
+/* Estimate the size of the moov from the duration and the tracks of the
+ * job.  The sample tables take almost all of it. */
+static uint32_t MP4EstimateMoovSize( hb_job_t * job )
+{
+    hb_title_t    * title = job->title;
+    hb_chapter_t  * chapter;
+    hb_audio_t    * audio;
+    hb_coverart_t * art;
+    int64_t         duration;
+    double          seconds, fps, size;
+    int             i, spf;
+
+    if( job->pts_to_stop )
+    {
+        duration = job->pts_to_stop + 90000;
+    }
+    else if( job->frame_to_stop )
+    {
+        duration = (int64_t)job->frame_to_stop * 90000 *
+                   title->rate_base / title->rate;
+    }
+    else
+    {
+        duration = 0;
+        for( i = job->chapter_start; i <= job->chapter_end; i++ )
+        {
+            chapter   = hb_list_item( job->list_chapter, i - 1 );
+            duration += chapter->duration;
+        }
+    }
+    if( job->mp4_segment_duration &&
+        duration > ( job->mp4_segment_duration + 30 ) * 90000LL )
+    {
+        /* Segments run to the first IDR after their duration */
+        duration = ( job->mp4_segment_duration + 30 ) * 90000LL;
+    }
+    seconds = (double)duration / 90000.;
+    fps     = (double)job->vrate / job->vrate_base;
+
+    /* Video: stsz, stts and ctts entries, sdtp, plus the chunk tables
+     * for chunks of 4 frames.  Keyframes are noise. */
+    size = seconds * fps * ( 4 + 8 + 8 + 1 + 20 / 4 );
+
+    /* Audio: stsz entries and the chunk tables */
+    for( i = 0; i < hb_list_count( job->list_audio ); i++ )
+    {
+        audio = hb_list_item( job->list_audio, i );
+        spf   = audio->config.out.samples_per_frame;
+        if( audio->config.out.codec & HB_ACODEC_PASS_FLAG )
+            spf = audio->config.in.samples_per_frame;
+        if( spf <= 0 )
+            spf = 1024;
+        size += seconds * audio->config.out.samplerate / spf * 8 +
+                seconds * fps / 4 * 20;
+    }
+
+    /* Subtitles are sparse, but every gap is a sample too */
+    size += hb_list_count( job->list_subtitle ) * seconds * 32;
+
+    /* Chapters, metadata and cover art */
+    size += hb_list_count( job->list_chapter ) * 64;
+    if( job->metadata && job->metadata->list_coverart )
+    {
+        for( i = 0; i < hb_list_count( job->metadata->list_coverart ); i++ )
+        {
+            art   = hb_list_item( job->metadata->list_coverart, i );
+            size += art->size;
+        }
+    }
+
+    /* Headers, stsd and tags, then a bit of margin */
+    size = ( size + 64 * 1024 ) * 1.25;
+    if( size > 512 * 1024 * 1024 )
+        size = 512 * 1024 * 1024;
+
+    return size;
+}
+
+static int MP4ReserveMoov( hb_mux_object_t * m )
+{
+    uint8_t * zeros;
+
+    m->moov_size = MP4EstimateMoovSize( m->job );
+    m->moov_track = MP4AddSubtitleTrack( m->file, 90000, 0, 0 );
+    if( m->moov_track == MP4_INVALID_TRACK_ID )
+    {
+        return 0;
+    }
+
+    /* One sample per chunk, so the sample is written out right away */
+    MP4SetTrackDurationPerChunk( m->file, m->moov_track, 1 );
+
+    zeros = calloc( 1, m->moov_size );
+    if( zeros == NULL ||
+        !MP4WriteSample( m->file, m->moov_track, zeros, m->moov_size,
+                         1, 0, 1 ) )
+    {
+        free( zeros );
+        MP4DeleteTrack( m->file, m->moov_track );
+        m->moov_track = MP4_INVALID_TRACK_ID;
+        return 0;
+    }
+    free( zeros );
+
+    hb_deep_log( 2, "muxmp4: reserved %"PRIu32" bytes for the moov",
+                 m->moov_size );
+    return 1;
+}
+
+static uint64_t MP4ReadBE( const uint8_t * p, int len )
+{
+    uint64_t v = 0;
+
+    while( len-- )
+        v = ( v << 8 ) | *p++;
+    return v;
+}
+
+static void MP4WriteBE( uint8_t * p, uint64_t v, int len )
+{
+    while( len-- )
+    {
+        p[len] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+/* Move the moov of the closed file into the space MP4ReserveMoov left
+ * at the start of mdat.  Returns 0 when the file was left alone. */
+static int MP4FastStart( const char * path, uint32_t reserved )
+{
+    FILE     * f;
+    uint8_t    hdr[16], buf[4096], * moov = NULL;
+    uint64_t   pos, size, fsize, start, end, mdat_pos = 0, mdat_size = 0,
+               moov_pos = 0, moov_size = 0, new_mdat, new_size;
+    int        i, len, mdat_hdr = 0, new_hdr, ok = 0;
+
+    f = fopen( path, "r+b" );
+    if( f == NULL )
+        return 0;
+
+    fseeko( f, 0, SEEK_END );
+    fsize = ftello( f );
+
+    /* Find mdat and moov among the top level atoms */
+    for( pos = 0; pos + 8 <= fsize; pos += size )
+    {
+        fseeko( f, pos, SEEK_SET );
+        if( fread( hdr, 1, 8, f ) != 8 )
+            goto done;
+        size = MP4ReadBE( hdr, 4 );
+        len  = 8;
+        if( size == 1 )
+        {
+            if( fread( hdr + 8, 1, 8, f ) != 8 )
+                goto done;
+            size = MP4ReadBE( hdr + 8, 8 );
+            len  = 16;
+        }
+        else if( size == 0 )
+        {
+            size = fsize - pos;
+        }
+        if( size < len || pos + size > fsize )
+            goto done;
+
+        if( !memcmp( hdr + 4, "mdat", 4 ) && !mdat_size )
+        {
+            mdat_pos  = pos;
+            mdat_size = size;
+            mdat_hdr  = len;
+        }
+        else if( !memcmp( hdr + 4, "moov", 4 ) )
+        {
+            moov_pos  = pos;
+            moov_size = size;
+        }
+    }
+
+    /* The reserved sample is the first thing in mdat, and the moov has
+     * to be the last atom so it can be cut off */
+    start = mdat_pos;
+    end   = mdat_pos + mdat_hdr + reserved;
+    if( !mdat_size || !moov_size || moov_pos < mdat_pos + mdat_size ||
+        moov_pos + moov_size != fsize || mdat_hdr + reserved > mdat_size )
+        goto done;
+
+    new_hdr  = ( mdat_pos + mdat_size - ( end - 8 ) ) > UINT32_MAX ? 16 : 8;
+    new_mdat = end - new_hdr;
+    new_size = mdat_pos + mdat_size - new_mdat;
+    if( start + moov_size + 8 > new_mdat )
+    {
+        hb_log( "muxmp4: moov is %"PRIu64" bytes, %"PRIu32" were reserved",
+                moov_size, reserved );
+        goto done;
+    }
+
+    /* Make sure it really is our sample that gets overwritten */
+    fseeko( f, mdat_pos + mdat_hdr, SEEK_SET );
+    for( pos = mdat_pos + mdat_hdr; pos < end; pos += len )
+    {
+        len = MIN( sizeof( buf ), end - pos );
+        if( fread( buf, 1, len, f ) != (size_t)len )
+            goto done;
+        for( i = 0; i < len; i++ )
+        {
+            if( buf[i] )
+                goto done;
+        }
+    }
+
+    moov = malloc( moov_size );
+    fseeko( f, moov_pos, SEEK_SET );
+    if( moov == NULL || fread( moov, 1, moov_size, f ) != moov_size )
+        goto done;
+
+    /* moov, a free atom over the rest of the reserved space, and the
+     * new mdat header right in front of the first real sample */
+    fseeko( f, start, SEEK_SET );
+    if( fwrite( moov, 1, moov_size, f ) != moov_size )
+        goto fail;
+    MP4WriteBE( hdr, new_mdat - start - moov_size, 4 );
+    memcpy( hdr + 4, "free", 4 );
+    if( fwrite( hdr, 1, 8, f ) != 8 )
+        goto fail;
+    fseeko( f, new_mdat, SEEK_SET );
+    if( new_hdr == 16 )
+    {
+        MP4WriteBE( hdr, 1, 4 );
+        memcpy( hdr + 4, "mdat", 4 );
+        MP4WriteBE( hdr + 8, new_size, 8 );
+    }
+    else
+    {
+        MP4WriteBE( hdr, new_size, 4 );
+        memcpy( hdr + 4, "mdat", 4 );
+    }
+    if( fwrite( hdr, 1, new_hdr, f ) != new_hdr )
+        goto fail;
+    if( fflush( f ) )
+        goto fail;
+
+    /* Drop the old moov at the end */
+#if defined( SYS_MINGW )
+    fseeko( f, moov_pos + 4, SEEK_SET );
+    fwrite( "free", 1, 4, f );
+#else
+    if( ftruncate( fileno( f ), moov_pos ) )
+    {
+        fseeko( f, moov_pos + 4, SEEK_SET );
+        fwrite( "free", 1, 4, f );
+    }
+#endif
+    ok = 1;
+    goto done;
+
+fail:
+    hb_error( "muxmp4: failed to move the moov, %s is damaged", path );
+
+done:
+    free( moov );
+    fclose( f );
+    return ok;
+}
+
 /**********************************************************************
  * MP4Init
  **********************************************************************
- * Allocates hb_mux_data_t structures, create file and write headers
+ * Allocates hb_mux_data_t structures, create file and write headers.
+ * Every new segment of segmented output gets its file and tracks from
+ * here too, the hb_mux_data_t structures are kept then.
  *********************************************************************/
 static int MP4Init( hb_mux_object_t * m )
 {
@@ -92,6 +391,7 @@ static int MP4Init( hb_mux_object_t * m )
     hb_mux_data_t * mux_data;
     int i;
     int subtitle_default;
+    int reopen = m->segment > 1;
 
     /* Flags for enabling/disabling tracks in an MP4. */
     typedef enum { TRACK_DISABLED = 0x0, TRACK_ENABLED = 0x1, TRACK_IN_MOVIE = 0x2, TRACK_IN_PREVIEW = 0x4, TRACK_IN_POSTER = 0x8}  track_header_flags;
@@ -100,13 +400,13 @@ static int MP4Init( hb_mux_object_t * m )
     if (job->largeFileSize)
     /* Use 64-bit MP4 file */
     {
-        m->file = MP4Create( job->file, MP4_DETAILS_ERROR, MP4_CREATE_64BIT_DATA );
+        m->file = MP4Create( m->path, MP4_DETAILS_ERROR, MP4_CREATE_64BIT_DATA );
         hb_deep_log( 2, "muxmp4: using 64-bit MP4 formatting.");
     }
     else
     /* Limit MP4s to less than 4 GB */
     {
-        m->file = MP4Create( job->file, MP4_DETAILS_ERROR, 0 );
+        m->file = MP4Create( m->path, MP4_DETAILS_ERROR, 0 );
     }
 
     if (m->file == MP4_INVALID_FILE_HANDLE)
@@ -117,8 +417,9 @@ static int MP4Init( hb_mux_object_t * m )
     }
 
     /* Video track */
-    mux_data      = calloc(1, sizeof( hb_mux_data_t ) );
-    job->mux_data = mux_data;
+    if( !reopen )
+        job->mux_data = calloc(1, sizeof( hb_mux_data_t ) );
+    mux_data = job->mux_data;
 
     if (!(MP4SetTimeScale( m->file, 90000 )))
     {
@@ -269,8 +570,9 @@ static int MP4Init( hb_mux_object_t * m )
     for( i = 0; i < hb_list_count( job->list_audio ); i++ )
     {
         audio = hb_list_item( job->list_audio, i );
-        mux_data = calloc(1, sizeof( hb_mux_data_t ) );
-        audio->priv.mux_data = mux_data;
+        if( !reopen )
+            audio->priv.mux_data = calloc(1, sizeof( hb_mux_data_t ) );
+        mux_data = audio->priv.mux_data;
 
         switch ( audio->config.out.codec & HB_ACODEC_MASK )
         {
@@ -522,8 +824,9 @@ static int MP4Init( hb_mux_object_t * m )
             else
                 width = job->width;
 
-            mux_data = calloc(1, sizeof( hb_mux_data_t ) );
-            subtitle->mux_data = mux_data;
+            if( !reopen )
+                subtitle->mux_data = calloc(1, sizeof( hb_mux_data_t ) );
+            mux_data = subtitle->mux_data;
             mux_data->subtitle = 1;
             mux_data->sub_format = subtitle->format;
             mux_data->track = MP4AddSubtitleTrack( m->file, 90000, width, height );
@@ -587,8 +890,9 @@ static int MP4Init( hb_mux_object_t * m )
         else if( subtitle && subtitle->format == PICTURESUB && 
             subtitle->config.dest == PASSTHRUSUB )
         {
-            mux_data = calloc(1, sizeof( hb_mux_data_t ) );
-            subtitle->mux_data = mux_data;
+            if( !reopen )
+                subtitle->mux_data = calloc(1, sizeof( hb_mux_data_t ) );
+            mux_data = subtitle->mux_data;
             mux_data->subtitle = 1;
             mux_data->sub_format = subtitle->format;
 
@@ -636,8 +940,11 @@ static int MP4Init( hb_mux_object_t * m )
         textTrack = MP4AddChapterTextTrack(m->file, 1, 0);
 
         m->chapter_track = textTrack;
-        m->chapter_duration = 0;
-        m->current_chapter = job->chapter_start;
+        if( !reopen )
+        {
+            m->chapter_duration = 0;
+            m->current_chapter = job->chapter_start;
+        }
     }
 
     /* Add encoded-by metadata listing version and build date */
@@ -655,6 +962,12 @@ static int MP4Init( hb_mux_object_t * m )
 
     free(tool_string);
 
+    /* Reserve space for the moov before any real sample is written */
+    if( job->mp4_optimize && !MP4ReserveMoov( m ) )
+    {
+        hb_log( "muxmp4: could not reserve space for the moov" );
+    }
+
     return 0;
 }
 
@@ -901,12 +1214,268 @@ static void hb_muxmp4_process_subtitle_style( uint8_t *input,
 
 }
 
+/**********************************************************************
+ * MP4CloseFile
+ **********************************************************************
+ * Finishes and closes one output file
+ *********************************************************************/
+static void MP4CloseFile( hb_mux_object_t * m, MP4FileHandle file,
+                          const char * path, MP4TrackId moov_track,
+                          uint32_t moov_size )
+{
+    hb_job_t   * job   = m->job;
+
+    if ( job->config.h264.init_delay )
+    {
+           // Insert track edit to get A/V back in sync.  The edit amount is
+           // the init_delay.
+           int64_t edit_amt = job->config.h264.init_delay;
+           MP4AddTrackEdit(file, 1, MP4_INVALID_EDIT_ID, edit_amt,
+                           MP4GetTrackDuration(file, 1), 0);
+            if ( m->job->chapter_markers )
+            {
+                // apply same edit to chapter track to keep it in sync with video
+                MP4AddTrackEdit(file, m->chapter_track, MP4_INVALID_EDIT_ID,
+                                edit_amt,
+                                MP4GetTrackDuration(file, m->chapter_track), 0);
+            }
+     }
+
+    /*
+     * Write the MP4 iTunes metadata if we have any metadata
+     */
+    if( job->metadata )
+    {
+        hb_metadata_t *md = job->metadata;
+        const MP4Tags* tags;
+
+        hb_deep_log( 2, "Writing Metadata to output file...");
+
+        /* allocate tags structure */
+        tags = MP4TagsAlloc();
+        /* fetch data from MP4 file (in case it already has some data) */
+        MP4TagsFetch( tags, file );
+
+        /* populate */
+        if( md->name )
+            MP4TagsSetName( tags, md->name );
+        if( md->artist )
+            MP4TagsSetArtist( tags, md->artist );
+        if( md->composer )
+            MP4TagsSetComposer( tags, md->composer );
+        if( md->comment )
+            MP4TagsSetComments( tags, md->comment );
+        if( md->release_date )
+            MP4TagsSetReleaseDate( tags, md->release_date );
+        if( md->album )
+            MP4TagsSetAlbum( tags, md->album );
+        if( md->album_artist )
+            MP4TagsSetAlbumArtist( tags, md->album_artist );
+        if( md->genre )
+            MP4TagsSetGenre( tags, md->genre );
+        if( md->description )
+            MP4TagsSetDescription( tags, md->description );
+        if( md->long_description )
+            MP4TagsSetLongDescription( tags, md->long_description );
+
+        if( md->list_coverart )
+        {
+            hb_coverart_t * coverart;
+            int ii;
+
+            for ( ii = 0; ii < hb_list_count( md->list_coverart ); ii++ )
+            {
+                coverart = hb_list_item( md->list_coverart, ii );
+                MP4TagArtwork art;
+                int type;
+                switch ( coverart->type )
+                {
+                    case HB_ART_BMP:
+                        type = MP4_ART_BMP;
+                        break;
+                    case HB_ART_GIF:
+                        type = MP4_ART_GIF;
+                        break;
+                    case HB_ART_JPEG:
+                        type = MP4_ART_JPEG;
+                        break;
+                    case HB_ART_PNG:
+                        type = MP4_ART_PNG;
+                        break;
+                    default:
+                        type = MP4_ART_UNDEFINED;
+                        break;
+                }
+                art.data = coverart->data;
+                art.size = coverart->size;
+                art.type = type;
+                MP4TagsAddArtwork( tags, &art );
+            }
+        }
+
+        /* push data to MP4 file */
+        MP4TagsStore( tags, file );
+        /* free memory associated with structure */
+        MP4TagsFree( tags );
+    }
+
+    if ( moov_track != MP4_INVALID_TRACK_ID )
+    {
+        MP4DeleteTrack( file, moov_track );
+    }
+
+    MP4Close( file );
+
+    if ( moov_track != MP4_INVALID_TRACK_ID &&
+         MP4FastStart( path, moov_size ) )
+    {
+        hb_deep_log( 2, "muxmp4: moved the moov to the reserved space" );
+    }
+    else if ( job->mp4_optimize )
+    {
+        hb_log( "muxmp4: optimizing file" );
+        char filename[1024]; memset( filename, 0, 1024 );
+        snprintf( filename, 1024, "%s.tmp", path );
+        MP4Optimize( path, filename, MP4_DETAILS_ERROR );
+        remove( path );
+        rename( filename, path );
+    }
+}
+
+/* Write the chapter the last frame belongs to */
+static void MP4AddLastChapter( hb_mux_object_t * m )
+{
+    hb_chapter_t *chapter = NULL;
+    int64_t duration = m->sum_dur - m->chapter_duration;
+    /* The final chapter can have a very short duration - if it's less
+     * than 1.5 seconds just skip it. */
+    if ( duration >= (90000*3)/2 )
+    {
+
+        chapter = hb_list_item( m->job->list_chapter,
+                                m->current_chapter - 1 );
+
+        MP4AddChapter( m->file,
+                       m->chapter_track,
+                       duration,
+                       (chapter != NULL) ? chapter->title : NULL);
+    }
+}
+
+/**********************************************************************
+ * Segmented output
+ **********************************************************************
+ * With job->mp4_segment_duration set, the output is a series of
+ * complete mp4 files that each hold about that many seconds.  Every
+ * segment starts with an IDR frame, so they play on their own, and a
+ * segment can be used as soon as the next one has been started.
+ *
+ * Video moves on to the next file at the IDR.  The muxer gets audio
+ * interleaved in chunks, so the audio up to the IDR can still arrive
+ * after it.  Each audio track keeps writing to the previous file until
+ * it gets to the start time of the IDR, and the previous file is closed
+ * once all of them have.
+ *********************************************************************/
+static char * MP4SegmentPath( const char * file, int segment )
+{
+    const char * ext = strrchr( file, '.' );
+
+    if( ext == NULL || strchr( ext, '/' ) || strchr( ext, '\\' ) )
+    {
+        ext = file + strlen( file );
+    }
+    return hb_strdup_printf( "%.*s-%05d%s", (int)( ext - file ), file,
+                             segment, ext );
+}
+
+static void MP4FinishSegment( hb_mux_object_t * m )
+{
+    hb_job_t      * job = m->job;
+    hb_audio_t    * audio;
+    int             i;
+
+    if( m->prev_file == MP4_INVALID_FILE_HANDLE )
+        return;
+
+    MP4CloseFile( m, m->prev_file, m->prev_path, m->prev_moov_track,
+                  m->prev_moov_size );
+    hb_log( "muxmp4: finished segment %s", m->prev_path );
+
+    for( i = 0; i < hb_list_count( job->list_audio ); i++ )
+    {
+        audio = hb_list_item( job->list_audio, i );
+        audio->priv.mux_data->prev = 0;
+    }
+    m->prev_tracks = 0;
+    m->prev_file = MP4_INVALID_FILE_HANDLE;
+    free( m->prev_path );
+    m->prev_path = NULL;
+}
+
+/* Start the next segment with the video frame at 'start' */
+static void MP4NextSegment( hb_mux_object_t * m, int64_t start )
+{
+    hb_job_t      * job = m->job;
+    hb_audio_t    * audio;
+    hb_subtitle_t * subtitle;
+    int             i;
+
+    // Only one file waits for its audio at a time
+    MP4FinishSegment( m );
+
+    if( job->chapter_markers )
+    {
+        MP4AddLastChapter( m );
+        m->chapter_duration = m->sum_dur;
+    }
+
+    m->prev_file       = m->file;
+    m->prev_path       = m->path;
+    m->prev_moov_track = m->moov_track;
+    m->prev_moov_size  = m->moov_size;
+    m->file            = MP4_INVALID_FILE_HANDLE;
+    m->moov_track      = MP4_INVALID_TRACK_ID;
+
+    m->segment++;
+    m->segment_start = start;
+    m->segment_end   = start + job->mp4_segment_duration * 90000LL;
+    m->path          = MP4SegmentPath( job->file, m->segment );
+    MP4Init( m );
+    if( m->file == MP4_INVALID_FILE_HANDLE )
+    {
+        // MP4Init has already failed the job
+        return;
+    }
+
+    for( i = 0; i < hb_list_count( job->list_audio ); i++ )
+    {
+        audio = hb_list_item( job->list_audio, i );
+        audio->priv.mux_data->prev = 1;
+        m->prev_tracks++;
+    }
+    // Subtitles are sparse, they can't be waited for
+    for( i = 0; i < hb_list_count( job->list_subtitle ); i++ )
+    {
+        subtitle = hb_list_item( job->list_subtitle, i );
+        if( subtitle->mux_data )
+        {
+            subtitle->mux_data->sum_dur = start;
+        }
+    }
+    if( m->prev_tracks == 0 )
+    {
+        MP4FinishSegment( m );
+    }
+}
+
 static int MP4Mux( hb_mux_object_t * m, hb_mux_data_t * mux_data,
                    hb_buffer_t * buf )
 {
     hb_job_t * job = m->job;
+    MP4FileHandle file = m->file;
     int64_t duration;
     int64_t offset = 0;
+    int next_segment = 0;
     hb_buffer_t *tmp;
 
     if( mux_data == job->mux_data )
@@ -923,6 +1492,14 @@ static int MP4Mux( hb_mux_object_t * m, hb_mux_data_t * mux_data,
             }
         }
 
+        // The next segment starts with the first IDR after segment_end
+        if( m->segment && buf && buf->s.start >= m->segment_end &&
+            ( buf->s.frametype == HB_FRAME_IDR ||
+              buf->s.frametype == HB_FRAME_KEY ) )
+        {
+            next_segment = 1;
+        }
+
         // We delay muxing video by one frame so that we can calculate
         // the dts to dts duration of the frames.
         tmp = buf;
@@ -960,7 +1537,7 @@ static int MP4Mux( hb_mux_object_t * m, hb_mux_data_t * mux_data,
                 chapter = hb_list_item( m->job->list_chapter,
                                         buf->s.new_chap - 2 );
 
-                MP4AddChapter( m->file,
+                MP4AddChapter( file,
                                m->chapter_track,
                                duration,
                                (chapter != NULL) ? chapter->title : NULL);
@@ -1039,6 +1616,23 @@ static int MP4Mux( hb_mux_object_t * m, hb_mux_data_t * mux_data,
     else
     {
         /* Audio */
+        if( mux_data->prev )
+        {
+            if( buf->s.start >= m->segment_start )
+            {
+                // Caught up with the video, on to the new segment
+                mux_data->prev = 0;
+                if( --m->prev_tracks == 0 )
+                {
+                    MP4FinishSegment( m );
+                }
+            }
+            else
+            {
+                file = m->prev_file;
+            }
+        }
+
         if (mux_data->samples_per_frame > 0)
             // frame size is fixed and known
             duration = MP4_INVALID_DURATION;
@@ -1090,7 +1684,7 @@ static int MP4Mux( hb_mux_object_t * m, hb_mux_data_t * mux_data,
                 break; /* nothing to mark */
         }
 
-        if( !MP4WriteSampleDependency( m->file,
+        if( !MP4WriteSampleDependency( file,
                                        mux_data->track,
                                        buf->data,
                                        buf->size,
@@ -1141,7 +1735,7 @@ static int MP4Mux( hb_mux_object_t * m, hb_mux_data_t * mux_data,
                 if ( mux_data->sum_dur < buf->s.start )
                 {
                     uint8_t empty[2] = {0,0};
-                    if( !MP4WriteSample( m->file,
+                    if( !MP4WriteSample( file,
                                         mux_data->track,
                                         empty,
                                         2,
@@ -1182,7 +1776,7 @@ static int MP4Mux( hb_mux_object_t * m, hb_mux_data_t * mux_data,
                 output[0] = ( buffersize >> 8 ) & 0xff;
                 output[1] = buffersize & 0xff;
 
-                if( !MP4WriteSample( m->file,
+                if( !MP4WriteSample( file,
                                      mux_data->track,
                                      output,
                                      buffersize + stylesize + 2,
@@ -1213,7 +1807,7 @@ static int MP4Mux( hb_mux_object_t * m, hb_mux_data_t * mux_data,
             if ( mux_data->sum_dur < buf->s.start )
             {
                 uint8_t empty[2] = {0,0};
-                if( !MP4WriteSample( m->file,
+                if( !MP4WriteSample( file,
                                     mux_data->track,
                                     empty,
                                     2,
@@ -1226,7 +1820,7 @@ static int MP4Mux( hb_mux_object_t * m, hb_mux_data_t * mux_data,
                 } 
                 mux_data->sum_dur += buf->s.start - mux_data->sum_dur;
             }
-            if( !MP4WriteSample( m->file,
+            if( !MP4WriteSample( file,
                                  mux_data->track,
                                  buf->data,
                                  buf->size,
@@ -1246,7 +1840,7 @@ static int MP4Mux( hb_mux_object_t * m, hb_mux_data_t * mux_data,
         /*
          * Audio
          */
-        if( !MP4WriteSample( m->file,
+        if( !MP4WriteSample( file,
                              mux_data->track,
                              buf->data,
                              buf->size,
@@ -1258,6 +1852,19 @@ static int MP4Mux( hb_mux_object_t * m, hb_mux_data_t * mux_data,
             *job->die = 1;
         }
     }
+
+    if( next_segment )
+    {
+        MP4NextSegment( m, m->delay_buf->s.start );
+    }
+    else if( mux_data == job->mux_data &&
+             m->prev_file != MP4_INVALID_FILE_HANDLE &&
+             buf->s.start > m->segment_start + 90000LL * 10 )
+    {
+        // Don't hold the previous segment open for audio that is
+        // missing or far behind
+        MP4FinishSegment( m );
+    }
     hb_buffer_close( &buf );
 
     return 0;
@@ -1276,129 +1883,14 @@ static int MP4End( hb_mux_object_t * m )
         /* Write our final chapter marker */
         if( m->job->chapter_markers )
         {
-            hb_chapter_t *chapter = NULL;
-            int64_t duration = m->sum_dur - m->chapter_duration;
-            /* The final chapter can have a very short duration - if it's less
-             * than 1.5 seconds just skip it. */
-            if ( duration >= (90000*3)/2 )
-            {
-
-                chapter = hb_list_item( m->job->list_chapter,
-                                        m->current_chapter - 1 );
-
-                MP4AddChapter( m->file,
-                               m->chapter_track,
-                               duration,
-                               (chapter != NULL) ? chapter->title : NULL);
-            }
-        }
-
-        if ( job->config.h264.init_delay )
-        {
-               // Insert track edit to get A/V back in sync.  The edit amount is
-               // the init_delay.
-               int64_t edit_amt = job->config.h264.init_delay;
-               MP4AddTrackEdit(m->file, 1, MP4_INVALID_EDIT_ID, edit_amt,
-                               MP4GetTrackDuration(m->file, 1), 0);
-                if ( m->job->chapter_markers )
-                {
-                    // apply same edit to chapter track to keep it in sync with video
-                    MP4AddTrackEdit(m->file, m->chapter_track, MP4_INVALID_EDIT_ID,
-                                    edit_amt,
-                                    MP4GetTrackDuration(m->file, m->chapter_track), 0);
-                }
-         }
-
-        /*
-         * Write the MP4 iTunes metadata if we have any metadata
-         */
-        if( job->metadata )
-        {
-            hb_metadata_t *md = job->metadata;
-            const MP4Tags* tags;
-
-            hb_deep_log( 2, "Writing Metadata to output file...");
-
-            /* allocate tags structure */
-            tags = MP4TagsAlloc();
-            /* fetch data from MP4 file (in case it already has some data) */
-            MP4TagsFetch( tags, m->file );
-
-            /* populate */
-            if( md->name )
-                MP4TagsSetName( tags, md->name );
-            if( md->artist )
-                MP4TagsSetArtist( tags, md->artist );
-            if( md->composer )
-                MP4TagsSetComposer( tags, md->composer );
-            if( md->comment )
-                MP4TagsSetComments( tags, md->comment );
-            if( md->release_date )
-                MP4TagsSetReleaseDate( tags, md->release_date );
-            if( md->album )
-                MP4TagsSetAlbum( tags, md->album );
-            if( md->album_artist )
-                MP4TagsSetAlbumArtist( tags, md->album_artist );
-            if( md->genre )
-                MP4TagsSetGenre( tags, md->genre );
-            if( md->description )
-                MP4TagsSetDescription( tags, md->description );
-            if( md->long_description )
-                MP4TagsSetLongDescription( tags, md->long_description );
-
-            if( md->list_coverart )
-            {
-                hb_coverart_t * coverart;
-                int ii;
-
-                for ( ii = 0; ii < hb_list_count( md->list_coverart ); ii++ )
-                {
-                    coverart = hb_list_item( md->list_coverart, ii );
-                    MP4TagArtwork art;
-                    int type;
-                    switch ( coverart->type )
-                    {
-                        case HB_ART_BMP:
-                            type = MP4_ART_BMP;
-                            break;
-                        case HB_ART_GIF:
-                            type = MP4_ART_GIF;
-                            break;
-                        case HB_ART_JPEG:
-                            type = MP4_ART_JPEG;
-                            break;
-                        case HB_ART_PNG:
-                            type = MP4_ART_PNG;
-                            break;
-                        default:
-                            type = MP4_ART_UNDEFINED;
-                            break;
-                    }
-                    art.data = coverart->data;
-                    art.size = coverart->size;
-                    art.type = type;
-                    MP4TagsAddArtwork( tags, &art );
-                }
-            }
-
-            /* push data to MP4 file */
-            MP4TagsStore( tags, m->file );
-            /* free memory associated with structure */
-            MP4TagsFree( tags );
+            MP4AddLastChapter( m );
         }
 
-        MP4Close( m->file );
-
-        if ( job->mp4_optimize )
-        {
-            hb_log( "muxmp4: optimizing file" );
-            char filename[1024]; memset( filename, 0, 1024 );
-            snprintf( filename, 1024, "%s.tmp", job->file );
-            MP4Optimize( job->file, filename, MP4_DETAILS_ERROR );
-            remove( job->file );
-            rename( filename, job->file );
-        }
+        MP4CloseFile( m, m->file, m->path, m->moov_track, m->moov_size );
     }
+    MP4FinishSegment( m );
+    free( m->path );
+    m->path = NULL;
 
     return 0;
 }
@@ -1410,6 +1902,16 @@ hb_mux_object_t * hb_mux_mp4_init( hb_job_t * job )
     m->mux       = MP4Mux;
     m->end       = MP4End;
     m->job       = job;
+    if( job->mp4_segment_duration > 0 )
+    {
+        m->segment     = 1;
+        m->segment_end = job->mp4_segment_duration * 90000LL;
+        m->path        = MP4SegmentPath( job->file, m->segment );
+    }
+    else
+    {
+        m->path        = strdup( job->file );
+    }
     return m;
 }
 
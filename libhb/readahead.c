@@ -0,0 +1,376 @@
+/* readahead.c
+
+   Copyright (c) 2003-2013 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include "hb.h"
+
+/*
+ * Readahead for the sources read by ReadLoop.
+ *
+ * A thread of its own fills a ring of large blocks with the data that
+ * follows the read position, so the reader gets its packets out of
+ * memory instead of issuing a small read (and waiting on the media or
+ * the network) for each one.  Packets are handed out as pointers into
+ * the ring, only a packet that straddles two blocks is copied.
+ *
+ * Between hb_readahead_start() and hb_readahead_stop() the fill
+ * function runs on the readahead thread, so the source must not touch
+ * whatever the fill function uses (file handle, library state) itself.
+ */
+
+typedef struct
+{
+    uint8_t * data;
+    int64_t   pos;      // source position of data[0]
+    int       len;      // bytes in data, 0 at the end, < 0 on error
+} hb_readahead_block_t;
+
+struct hb_readahead_s
+{
+    char                 * name;
+    hb_readahead_fill_t  * fill;
+    void                 * opaque;
+    int                    block_size;
+    int                    block_count;
+    int                    align;
+
+    hb_thread_t          * thread;
+    hb_lock_t            * lock;
+    hb_cond_t            * cond;
+    hb_readahead_block_t * blocks;
+    int                    head;        // block holding the read position
+    int                    full;        // filled blocks from head on
+    int64_t                fill_pos;    // where the next fill starts
+    int                    filling;     // thread is in fill()
+    int                    running;     // between start and stop
+    int                    done;        // last fill hit the end or an error
+    int                    generation;  // fills from before a stop are dropped
+    int                    die;
+
+    // Only touched by the reader
+    int64_t                pos;         // read position
+    const uint8_t        * rd;          // data at pos in the head block
+    const uint8_t        * rd_end;      // end of the head block's data
+    uint8_t              * bounce;      // packets that straddle blocks
+};
+
+static void readahead_thread( void * _ra )
+{
+    hb_readahead_t * ra = _ra;
+    hb_readahead_block_t * b;
+    int64_t pos;
+    int generation, len;
+
+    hb_lock( ra->lock );
+    while( !ra->die )
+    {
+        if( !ra->running || ra->done || ra->full == ra->block_count )
+        {
+            hb_cond_wait( ra->cond, ra->lock );
+            continue;
+        }
+        b = &ra->blocks[( ra->head + ra->full ) % ra->block_count];
+        pos = ra->fill_pos;
+        generation = ra->generation;
+
+        ra->filling = 1;
+        hb_unlock( ra->lock );
+
+        len = ra->fill( ra->opaque, pos, b->data, ra->block_size );
+
+        hb_lock( ra->lock );
+        ra->filling = 0;
+        if( generation == ra->generation )
+        {
+            b->pos = pos;
+            b->len = len;
+            ra->full++;
+            if( len > 0 )
+                ra->fill_pos = pos + len;
+            else
+                ra->done = 1;
+        }
+        hb_cond_broadcast( ra->cond );
+    }
+    hb_unlock( ra->lock );
+}
+
+hb_readahead_t * hb_readahead_init( const char * name,
+                                    hb_readahead_fill_t * fill, void * opaque,
+                                    int block_size, int block_count,
+                                    int align )
+{
+    hb_readahead_t * ra;
+    int ii;
+
+    ra = calloc( 1, sizeof( hb_readahead_t ) );
+    if( ra == NULL )
+        return NULL;
+
+    ra->name        = strdup( name );
+    ra->fill        = fill;
+    ra->opaque      = opaque;
+    ra->block_size  = block_size;
+    ra->block_count = block_count < 2 ? 2 : block_count;
+    ra->align       = align < 1 ? 1 : align;
+    ra->blocks      = calloc( ra->block_count, sizeof( hb_readahead_block_t ) );
+    ra->bounce      = malloc( block_size );
+    if( ra->blocks == NULL || ra->bounce == NULL )
+        goto fail;
+    for( ii = 0; ii < ra->block_count; ii++ )
+    {
+        ra->blocks[ii].data = malloc( block_size );
+        if( ra->blocks[ii].data == NULL )
+            goto fail;
+    }
+
+    ra->lock   = hb_lock_init();
+    ra->cond   = hb_cond_init();
+    ra->thread = hb_thread_init( ra->name, readahead_thread, ra,
+                                 HB_NORMAL_PRIORITY );
+    if( ra->thread == NULL )
+        goto fail;
+
+    hb_deep_log( 2, "%s: reading ahead %d blocks of %d bytes", ra->name,
+                 ra->block_count, ra->block_size );
+    return ra;
+
+fail:
+    hb_error( "%s: could not set up readahead", name );
+    hb_readahead_close( &ra );
+    return NULL;
+}
+
+void hb_readahead_close( hb_readahead_t ** _ra )
+{
+    hb_readahead_t * ra = *_ra;
+    int ii;
+
+    if( ra == NULL )
+        return;
+
+    if( ra->thread != NULL )
+    {
+        hb_lock( ra->lock );
+        ra->die = 1;
+        hb_cond_broadcast( ra->cond );
+        hb_unlock( ra->lock );
+        hb_thread_close( &ra->thread );
+    }
+    if( ra->lock != NULL )
+        hb_lock_close( &ra->lock );
+    if( ra->cond != NULL )
+        hb_cond_close( &ra->cond );
+    for( ii = 0; ra->blocks != NULL && ii < ra->block_count; ii++ )
+    {
+        free( ra->blocks[ii].data );
+    }
+    free( ra->blocks );
+    free( ra->bounce );
+    free( ra->name );
+    free( ra );
+
+    *_ra = NULL;
+}
+
+/*
+ * Start reading ahead from position pos.  The first fill starts at pos
+ * rounded down to the alignment given to hb_readahead_init().
+ */
+void hb_readahead_start( hb_readahead_t * ra, int64_t pos )
+{
+    hb_lock( ra->lock );
+    ra->pos      = pos;
+    ra->fill_pos = pos - pos % ra->align;
+    ra->running  = 1;
+    hb_cond_broadcast( ra->cond );
+    hb_unlock( ra->lock );
+}
+
+/*
+ * Stop reading ahead and drop everything that was read.  When this
+ * returns the fill function is no longer running.
+ */
+void hb_readahead_stop( hb_readahead_t * ra )
+{
+    hb_lock( ra->lock );
+    ra->running = 0;
+    ra->generation++;
+    while( ra->filling )
+    {
+        hb_cond_wait( ra->cond, ra->lock );
+    }
+    ra->full   = 0;
+    ra->done   = 0;
+    ra->rd     = NULL;
+    ra->rd_end = NULL;
+    hb_unlock( ra->lock );
+}
+
+/*
+ * Move the read position.  Positions that have already been read ahead
+ * are served from the ring, anything else restarts the readahead there.
+ */
+void hb_readahead_seek( hb_readahead_t * ra, int64_t pos )
+{
+    hb_readahead_block_t * b;
+    int ii;
+
+    hb_lock( ra->lock );
+    for( ii = 0; ra->running && ii < ra->full; ii++ )
+    {
+        b = &ra->blocks[( ra->head + ii ) % ra->block_count];
+        if( b->len <= 0 )
+            break;
+        if( pos >= b->pos && pos < b->pos + b->len )
+        {
+            ra->head    = ( ra->head + ii ) % ra->block_count;
+            ra->full   -= ii;
+            ra->pos     = pos;
+            ra->rd      = b->data + ( pos - b->pos );
+            ra->rd_end  = b->data + b->len;
+            hb_cond_broadcast( ra->cond );
+            hb_unlock( ra->lock );
+            return;
+        }
+    }
+    hb_unlock( ra->lock );
+
+    hb_readahead_stop( ra );
+    hb_readahead_start( ra, pos );
+}
+
+int64_t hb_readahead_tell( hb_readahead_t * ra )
+{
+    return ra->pos;
+}
+
+// Drops the blocks that have been read to their end.  Called with
+// the lock held.
+static void readahead_release( hb_readahead_t * ra )
+{
+    hb_readahead_block_t * b;
+
+    while( ra->full > 0 )
+    {
+        b = &ra->blocks[ra->head];
+        if( b->len <= 0 || ra->pos < b->pos + b->len )
+            break;
+        ra->head = ( ra->head + 1 ) % ra->block_count;
+        ra->full--;
+        hb_cond_broadcast( ra->cond );
+    }
+}
+
+static int readahead_get( hb_readahead_t * ra, int size,
+                          const uint8_t ** data )
+{
+    hb_readahead_block_t * b;
+    int ii, off, len, n = 0;
+
+    if( size > ra->block_size )
+        size = ra->block_size;
+
+    hb_lock( ra->lock );
+    readahead_release( ra );
+    for( ii = 0; n < size && ii < ra->block_count; ii++ )
+    {
+        while( ra->full <= ii && ra->running )
+        {
+            hb_cond_wait( ra->cond, ra->lock );
+        }
+        if( ra->full <= ii )
+            break;
+
+        b = &ra->blocks[( ra->head + ii ) % ra->block_count];
+        if( b->len <= 0 )
+        {
+            if( n == 0 )
+                n = b->len;
+            break;
+        }
+        off = ra->pos + n - b->pos;
+        len = MIN( size - n, b->len - off );
+        if( ii == 0 && len == size )
+        {
+            // All in one block, no copy
+            *data = b->data + off;
+            n = size;
+            break;
+        }
+        memcpy( ra->bounce + n, b->data + off, len );
+        *data = ra->bounce;
+        n += len;
+    }
+    if( n > 0 )
+    {
+        ra->pos += n;
+        if( *data == ra->bounce )
+        {
+            readahead_release( ra );
+        }
+    }
+
+    // Further reads from the head block don't need the lock
+    ra->rd = ra->rd_end = NULL;
+    if( ra->full > 0 )
+    {
+        b = &ra->blocks[ra->head];
+        if( b->len > 0 && ra->pos >= b->pos && ra->pos <= b->pos + b->len )
+        {
+            ra->rd     = b->data + ( ra->pos - b->pos );
+            ra->rd_end = b->data + b->len;
+        }
+    }
+    hb_unlock( ra->lock );
+
+    return n;
+}
+
+/*
+ * Get the next size bytes (at most one block) at the read position and
+ * advance it.  *data points into the ring, and stays valid until the
+ * next call for this readahead.  Returns the number of bytes, which is
+ * short only at the end of the source, 0 at the end and < 0 if the
+ * source couldn't be read at the read position.
+ */
+int hb_readahead_get( hb_readahead_t * ra, int size, const uint8_t ** data )
+{
+    if( ra->rd != NULL && ra->rd_end - ra->rd >= size )
+    {
+        *data = ra->rd;
+        ra->rd  += size;
+        ra->pos += size;
+        return size;
+    }
+    return readahead_get( ra, size, data );
+}
+
+/*
+ * Like hb_readahead_get(), but copies the data to buf, fread style.
+ */
+int hb_readahead_read( hb_readahead_t * ra, uint8_t * buf, int size )
+{
+    const uint8_t * data;
+    int len, want, n = 0;
+
+    while( n < size )
+    {
+        want = MIN( size - n, ra->block_size );
+        len  = hb_readahead_get( ra, want, &data );
+        if( len <= 0 )
+        {
+            return n > 0 ? n : len;
+        }
+        memcpy( buf + n, data, len );
+        n += len;
+        if( len < want )
+            break;
+    }
+    return n;
+}
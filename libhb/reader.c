@@ -480,6 +480,15 @@ void ReadLoop( void * _w )
         hb_stream_seek_chapter( r->stream, start );
     }
 
+    // From here on the source is read sequentially, read it ahead in
+    // large blocks on a thread of its own
+    if (r->bd)
+        hb_bd_set_readahead( r->bd, 1 );
+    else if (r->dvd)
+        hb_dvd_set_readahead( r->dvd, 1 );
+    else if (r->stream)
+        hb_stream_set_readahead( r->stream, 1 );
+
     list  = hb_list_init();
 
     while(!*r->die && !r->job->done && !done)
@@ -11,11 +11,24 @@
 #include "hbffmpeg.h"
 #include <ass/ass.h>
 
+#if ( defined( __GNUC__ ) || defined( __clang__ ) ) && \
+    ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define BLEND_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct
+{
+    void (* row)( uint8_t *, const uint8_t *, const uint8_t *, int, int );
+    void (* row_h2)( uint8_t *, const uint8_t *, const uint8_t *, int, int );
+} blend_dsp_t;
+
 struct hb_filter_private_s
 {
     // Common
     int               crop[4];
     int               type;
+    blend_dsp_t       dsp;
 
     // VOBSUB
     hb_list_t       * sub_list; // List of active subs
@@ -24,6 +37,7 @@ struct hb_filter_private_s
     ASS_Library     * ssa;
     ASS_Renderer    * renderer;
     ASS_Track       * ssaTrack;
+    hb_list_t       * ssa_overlays; // YUVA overlays of the last libass render
 };
 
 // VOBSUB
@@ -77,15 +91,218 @@ hb_filter_object_t hb_filter_render_sub =
     .close         = hb_rendersub_close,
 };
 
-static void blend( hb_buffer_t *dst, hb_buffer_t *src, int left, int top )
+/*
+ * Row functions for blend().  They blend pixels [x, w) of a row of the
+ * subtitle into a row of the picture, with the alpha of the subtitle
+ * pixel (blend_row) or of every second one (blend_row_h2, for chroma
+ * that is subsampled horizontally).  Pixels with an alpha of 0 are left
+ * as they are, vectors of them are skipped entirely, so the transparent
+ * rows and runs that make up most of a subtitle bitmap cost one compare.
+ */
+static inline uint8_t blend_pixel( uint8_t out, uint8_t in, uint8_t alpha )
 {
-    int xx, yy;
+    return ( (uint16_t)out * ( 255 - alpha ) + (uint16_t)in * alpha ) >> 8;
+}
+
+static void blend_row_c( uint8_t * out, const uint8_t * in,
+                         const uint8_t * a, int x, int w )
+{
+    for( ; x < w; x++ )
+    {
+        if( a[x] )
+            out[x] = blend_pixel( out[x], in[x], a[x] );
+    }
+}
+
+static void blend_row_h2_c( uint8_t * out, const uint8_t * in,
+                            const uint8_t * a, int x, int w )
+{
+    for( ; x < w; x++ )
+    {
+        if( a[x << 1] )
+            out[x] = blend_pixel( out[x], in[x], a[x << 1] );
+    }
+}
+
+#if BLEND_X86
+/*
+ * SSE2 and AVX2 versions of the row functions, 16 pixels at a time.
+ * They compute exactly what the C versions do and leave the end of the
+ * row to them.
+ */
+__attribute__((target("sse2")))
+static inline __m128i blend_sse2( __m128i out, __m128i in, __m128i alpha )
+{
+    __m128i r;
+
+    r = _mm_add_epi16(
+            _mm_mullo_epi16( out, _mm_sub_epi16( _mm_set1_epi16( 255 ),
+                                                 alpha ) ),
+            _mm_mullo_epi16( in, alpha ) );
+    r = _mm_srli_epi16( r, 8 );
+
+    // Transparent pixels keep their value
+    alpha = _mm_cmpeq_epi16( alpha, _mm_setzero_si128() );
+    return _mm_or_si128( _mm_and_si128( alpha, out ),
+                         _mm_andnot_si128( alpha, r ) );
+}
+
+__attribute__((target("sse2")))
+static void blend_row_sse2( uint8_t * out, const uint8_t * in,
+                            const uint8_t * a, int x, int w )
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i av, ov, iv, lo, hi;
+
+    for( ; x + 16 <= w; x += 16 )
+    {
+        av = _mm_loadu_si128( (const __m128i*)(a + x) );
+        if( _mm_movemask_epi8( _mm_cmpeq_epi8( av, zero ) ) == 0xFFFF )
+            continue;
+
+        ov = _mm_loadu_si128( (const __m128i*)(out + x) );
+        iv = _mm_loadu_si128( (const __m128i*)(in + x) );
+        lo = blend_sse2( _mm_unpacklo_epi8( ov, zero ),
+                         _mm_unpacklo_epi8( iv, zero ),
+                         _mm_unpacklo_epi8( av, zero ) );
+        hi = blend_sse2( _mm_unpackhi_epi8( ov, zero ),
+                         _mm_unpackhi_epi8( iv, zero ),
+                         _mm_unpackhi_epi8( av, zero ) );
+        _mm_storeu_si128( (__m128i*)(out + x), _mm_packus_epi16( lo, hi ) );
+    }
+    blend_row_c( out, in, a, x, w );
+}
+
+__attribute__((target("sse2")))
+static void blend_row_h2_sse2( uint8_t * out, const uint8_t * in,
+                               const uint8_t * a, int x, int w )
+{
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i even  = _mm_set1_epi16( 0xFF );
+    __m128i alo, ahi, ov, iv, lo, hi;
+
+    for( ; x + 16 <= w; x += 16 )
+    {
+        // The alpha of every second pixel, as 16 bit values
+        alo = _mm_and_si128(
+                _mm_loadu_si128( (const __m128i*)(a + 2 * x) ), even );
+        ahi = _mm_and_si128(
+                _mm_loadu_si128( (const __m128i*)(a + 2 * x + 16) ), even );
+        if( _mm_movemask_epi8( _mm_cmpeq_epi16( _mm_or_si128( alo, ahi ),
+                                                zero ) ) == 0xFFFF )
+            continue;
+
+        ov = _mm_loadu_si128( (const __m128i*)(out + x) );
+        iv = _mm_loadu_si128( (const __m128i*)(in + x) );
+        lo = blend_sse2( _mm_unpacklo_epi8( ov, zero ),
+                         _mm_unpacklo_epi8( iv, zero ), alo );
+        hi = blend_sse2( _mm_unpackhi_epi8( ov, zero ),
+                         _mm_unpackhi_epi8( iv, zero ), ahi );
+        _mm_storeu_si128( (__m128i*)(out + x), _mm_packus_epi16( lo, hi ) );
+    }
+    blend_row_h2_c( out, in, a, x, w );
+}
+
+#ifdef AV_CPU_FLAG_AVX2
+__attribute__((target("avx2")))
+static inline __m128i blend_avx2( __m128i out, __m128i in, __m256i alpha )
+{
+    __m256i o = _mm256_cvtepu8_epi16( out );
+    __m256i r;
+
+    r = _mm256_add_epi16(
+            _mm256_mullo_epi16( o, _mm256_sub_epi16( _mm256_set1_epi16( 255 ),
+                                                     alpha ) ),
+            _mm256_mullo_epi16( _mm256_cvtepu8_epi16( in ), alpha ) );
+    r = _mm256_srli_epi16( r, 8 );
+
+    // Transparent pixels keep their value
+    r = _mm256_blendv_epi8( r, o, _mm256_cmpeq_epi16( alpha,
+                                                      _mm256_setzero_si256() ) );
+    return _mm_packus_epi16( _mm256_castsi256_si128( r ),
+                             _mm256_extracti128_si256( r, 1 ) );
+}
+
+__attribute__((target("avx2")))
+static void blend_row_avx2( uint8_t * out, const uint8_t * in,
+                            const uint8_t * a, int x, int w )
+{
+    __m128i av;
+
+    for( ; x + 16 <= w; x += 16 )
+    {
+        av = _mm_loadu_si128( (const __m128i*)(a + x) );
+        if( _mm_testz_si128( av, av ) )
+            continue;
+
+        _mm_storeu_si128( (__m128i*)(out + x), blend_avx2(
+            _mm_loadu_si128( (const __m128i*)(out + x) ),
+            _mm_loadu_si128( (const __m128i*)(in + x) ),
+            _mm256_cvtepu8_epi16( av ) ) );
+    }
+    blend_row_c( out, in, a, x, w );
+}
+
+__attribute__((target("avx2")))
+static void blend_row_h2_avx2( uint8_t * out, const uint8_t * in,
+                               const uint8_t * a, int x, int w )
+{
+    const __m256i even = _mm256_set1_epi16( 0xFF );
+    __m256i av;
+
+    for( ; x + 16 <= w; x += 16 )
+    {
+        // The alpha of every second pixel, as 16 bit values
+        av = _mm256_and_si256(
+                _mm256_loadu_si256( (const __m256i*)(a + 2 * x) ), even );
+        if( _mm256_testz_si256( av, av ) )
+            continue;
+
+        _mm_storeu_si128( (__m128i*)(out + x), blend_avx2(
+            _mm_loadu_si128( (const __m128i*)(out + x) ),
+            _mm_loadu_si128( (const __m128i*)(in + x) ), av ) );
+    }
+    blend_row_h2_c( out, in, a, x, w );
+}
+#endif
+#endif
+
+static void blend_dsp_init( blend_dsp_t * dsp )
+{
+    dsp->row    = blend_row_c;
+    dsp->row_h2 = blend_row_h2_c;
+
+#if BLEND_X86
+    int cpu_flags = av_get_cpu_flags();
+
+    if( cpu_flags & AV_CPU_FLAG_SSE2 )
+    {
+        dsp->row    = blend_row_sse2;
+        dsp->row_h2 = blend_row_h2_sse2;
+    }
+#ifdef AV_CPU_FLAG_AVX2
+    if( cpu_flags & AV_CPU_FLAG_AVX2 )
+    {
+        dsp->row    = blend_row_avx2;
+        dsp->row_h2 = blend_row_h2_avx2;
+    }
+#endif
+#endif
+}
+
+static void blend( const blend_dsp_t * dsp, hb_buffer_t *dst,
+                   hb_buffer_t *src, int left, int top )
+{
+    int yy;
     int ww, hh;
     int x0, y0;
     uint8_t *y_in, *y_out;
     uint8_t *u_in, *u_out;
     uint8_t *v_in, *v_out;
-    uint8_t *a_in, alpha;
+    uint8_t *a_in;
+
+    // Frames duplicated by vfr share their picture, don't draw on the others
+    hb_buffer_make_writable( dst );
 
     x0 = y0 = 0;
     if( left < 0 )
@@ -113,16 +330,8 @@ static void blend( hb_buffer_t *dst, hb_buffer_t *src, int left, int top )
         y_in   = src->plane[0].data + yy * src->plane[0].stride;
         y_out   = dst->plane[0].data + ( yy + top ) * dst->plane[0].stride;
         a_in = src->plane[3].data + yy * src->plane[3].stride;
-        for( xx = x0; xx < ww; xx++ )
-        {
-            alpha = a_in[xx];
-            /*
-             * Merge the luminance and alpha with the picture
-             */
-            y_out[left + xx] = 
-                ( (uint16_t)y_out[left + xx] * ( 255 - alpha ) +
-                     (uint16_t)y_in[xx] * alpha ) >> 8;
-        }
+
+        dsp->row( y_out + left, y_in, a_in, x0, ww );
     }
 
     // Blend U & V
@@ -142,19 +351,17 @@ static void blend( hb_buffer_t *dst, hb_buffer_t *src, int left, int top )
         v_out = dst->plane[2].data + ( yy + ( top >> hshift ) ) * dst->plane[2].stride;
         a_in = src->plane[3].data + ( yy << hshift ) * src->plane[3].stride;
 
-        for( xx = x0 >> wshift; xx < ww >> wshift; xx++ )
+        if( wshift )
         {
-            alpha = a_in[xx << wshift];
-
-            // Blend averge U and alpha
-            u_out[(left >> wshift) + xx] =
-                ( (uint16_t)u_out[(left >> wshift) + xx] * ( 255 - alpha ) +
-                  (uint16_t)u_in[xx] * alpha ) >> 8;
-
-            // Blend V and alpha
-            v_out[(left >> wshift) + xx] =
-                ( (uint16_t)v_out[(left >> wshift) + xx] * ( 255 - alpha ) +
-                  (uint16_t)v_in[xx] * alpha ) >> 8;
+            dsp->row_h2( u_out + ( left >> wshift ), u_in, a_in,
+                         x0 >> wshift, ww >> wshift );
+            dsp->row_h2( v_out + ( left >> wshift ), v_in, a_in,
+                         x0 >> wshift, ww >> wshift );
+        }
+        else
+        {
+            dsp->row( u_out + left, u_in, a_in, x0, ww );
+            dsp->row( v_out + left, v_in, a_in, x0, ww );
         }
     }
 }
@@ -240,7 +447,7 @@ static void ApplySub( hb_filter_private_t * pv, hb_buffer_t * buf, hb_buffer_t *
         left = sub->f.x;
     }
 
-    blend( buf, sub, left, top );
+    blend( &pv->dsp, buf, sub, left, top );
 }
 
 // Assumes that the input buffer has the same dimensions
@@ -404,24 +611,48 @@ static hb_buffer_t * RenderSSAFrame( hb_filter_private_t * pv, ASS_Image * frame
     return sub;
 }
 
+static void FlushSSAOverlays( hb_filter_private_t * pv )
+{
+    hb_buffer_t *sub;
+
+    while( ( sub = hb_list_item( pv->ssa_overlays, 0 ) ) )
+    {
+        hb_list_rem( pv->ssa_overlays, sub );
+        hb_buffer_close( &sub );
+    }
+}
+
 static void ApplySSASubs( hb_filter_private_t * pv, hb_buffer_t * buf )
 {
     ASS_Image *frameList;
     hb_buffer_t *sub;
+    int changed, ii;
+
     frameList = ass_render_frame( pv->renderer, pv->ssaTrack,
-                                  buf->s.start / 90, NULL );
+                                  buf->s.start / 90, &changed );
+    // The overlays are kept for as long as libass renders the same images
+    if ( changed || !frameList )
+        FlushSSAOverlays( pv );
     if ( !frameList )
         return;
 
-    ASS_Image *frame;
-    for (frame = frameList; frame; frame = frame->next) {
-        sub = RenderSSAFrame( pv, frame );
-        if( sub )
-        {
-            ApplySub( pv, buf, sub );
-            hb_buffer_close( &sub );
+    if ( hb_list_count( pv->ssa_overlays ) == 0 )
+    {
+        ASS_Image *frame;
+        for (frame = frameList; frame; frame = frame->next) {
+            sub = RenderSSAFrame( pv, frame );
+            if( sub )
+            {
+                hb_list_add( pv->ssa_overlays, sub );
+            }
         }
     }
+
+    for( ii = 0; ii < hb_list_count( pv->ssa_overlays ); ii++ )
+    {
+        sub = hb_list_item( pv->ssa_overlays, ii );
+        ApplySub( pv, buf, sub );
+    }
 }
 
 static void ssa_log(int level, const char *fmt, va_list args, void *data)
@@ -437,6 +668,8 @@ static int ssa_init( hb_filter_object_t * filter,
 {
     hb_filter_private_t * pv = filter->private_data;
 
+    pv->ssa_overlays = hb_list_init();
+
     pv->ssa = ass_library_init();
     if ( !pv->ssa ) {
         hb_error( "decssasub: libass initialization failed\n" );
@@ -522,6 +755,11 @@ static void ssa_close( hb_filter_object_t * filter )
         ass_renderer_done( pv->renderer );
     if ( pv->ssa )
         ass_library_done( pv->ssa );
+    if ( pv->ssa_overlays )
+    {
+        FlushSSAOverlays( pv );
+        hb_list_close( &pv->ssa_overlays );
+    }
 
     free( pv );
     filter->private_data = NULL;
@@ -676,6 +914,8 @@ static int hb_rendersub_init( hb_filter_object_t * filter,
     hb_subtitle_t *subtitle;
     int ii;
 
+    blend_dsp_init( &pv->dsp );
+
     if( filter->settings )
     {
         sscanf( filter->settings, "%d:%d:%d:%d",
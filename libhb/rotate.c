@@ -32,7 +32,7 @@ struct hb_filter_private_s
 
     int              cpu_count;
 
-    taskset_t         rotate_taskset;        // Threads for Rotate - one per CPU
+    taskset_t         rotate_taskset;        // Rotate segments - one per CPU
     rotate_arguments_t *rotate_arguments;     // Arguments to thread for work
 };
 
@@ -67,13 +67,59 @@ typedef struct rotate_thread_arg_s {
 } rotate_thread_arg_t;
 
 /*
- * rotate this segment of all three planes in a single thread.
+ * flip rows [start, stop) of a plane in place. Without a 90 degree
+ * rotation every pixel just trades places with its mirror image, so
+ * when flipping vertically only the top half of the rows is walked.
+ */
+static void rotate_plane_inplace( hb_filter_private_t * pv, uint8_t * data,
+                                  int stride, int w, int h,
+                                  int start, int stop )
+{
+    int x, y;
+
+    for( y = start; y < stop; y++ )
+    {
+        uint8_t * a = &data[y * stride];
+        uint8_t * b = ( pv->mode & 1 ) ? &data[(h - y - 1) * stride] : a;
+        uint8_t tmp;
+
+        if( !( pv->mode & 2 ) )
+        {
+            // Vertical flip only, exchange the rows
+            if( a == b )
+                continue;
+            for( x = 0; x < w; x++ )
+            {
+                tmp = a[x]; a[x] = b[x]; b[x] = tmp;
+            }
+        }
+        else if( a == b )
+        {
+            // Reverse the row
+            for( x = 0; x < w / 2; x++ )
+            {
+                tmp = a[x]; a[x] = a[w - x - 1]; a[w - x - 1] = tmp;
+            }
+        }
+        else
+        {
+            // Exchange the rows, reversing both
+            for( x = 0; x < w; x++ )
+            {
+                tmp = a[x]; a[x] = b[w - x - 1]; b[w - x - 1] = tmp;
+            }
+        }
+    }
+}
+
+/*
+ * rotate this segment of all three planes.
+ * Runs on the shared worker pool once per taskset_cycle().
  */
 void rotate_filter_thread( void *thread_args_v )
 {
     rotate_arguments_t *rotate_work = NULL;
     hb_filter_private_t * pv;
-    int run = 1;
     int plane;
     int segment, segment_start, segment_stop;
     rotate_thread_arg_t *thread_args = thread_args_v;
@@ -86,104 +132,92 @@ void rotate_filter_thread( void *thread_args_v )
     pv = thread_args->pv;
     segment = thread_args->segment;
 
-    hb_log("Rotate thread started for segment %d", segment);
+    rotate_work = &pv->rotate_arguments[segment];
+    if( rotate_work->dst == NULL )
+    {
+        hb_error( "Thread started when no work available" );
+        return;
+    }
 
-    while( run )
+    /*
+     * Process all three planes, but only this segment of it.
+     */
+    dst_buf = rotate_work->dst;
+    src_buf = rotate_work->src;
+    for( plane = 0; plane < 3; plane++)
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->rotate_taskset, segment );
+        int dst_stride, src_stride;
+
+        dst = dst_buf->plane[plane].data;
+        dst_stride = dst_buf->plane[plane].stride;
+        src_stride = src_buf->plane[plane].stride;
 
-        if( taskset_thread_stop( &pv->rotate_taskset, segment ) )
+        int h = src_buf->plane[plane].height;
+        int w = src_buf->plane[plane].width;
+        // In place, a vertical flip only visits the top half of the rows
+        int rows = h;
+        if( dst_buf == src_buf && ( pv->mode & 1 ) )
+        {
+            rows = ( h + 1 ) / 2;
+        }
+
+        segment_start = ( rows / pv->cpu_count ) * segment;
+        if( segment == pv->cpu_count - 1 )
         {
             /*
-             * No more work to do, exit this thread.
+             * Final segment
              */
-            run = 0;
-            goto report_completion;
-        } 
+            segment_stop = rows;
+        } else {
+            segment_stop = ( rows / pv->cpu_count ) * ( segment + 1 );
+        }
 
-        rotate_work = &pv->rotate_arguments[segment];
-        if( rotate_work->dst == NULL )
+        if( dst_buf == src_buf )
         {
-            hb_error( "Thread started when no work available" );
-            hb_snooze(500);
-            goto report_completion;
+            rotate_plane_inplace( pv, dst, dst_stride, w, h,
+                                  segment_start, segment_stop );
+            continue;
         }
-        
-        /*
-         * Process all three planes, but only this segment of it.
-         */
-        dst_buf = rotate_work->dst;
-        src_buf = rotate_work->src;
-        for( plane = 0; plane < 3; plane++)
-        {
-            int dst_stride, src_stride;
-
-            dst = dst_buf->plane[plane].data;
-            dst_stride = dst_buf->plane[plane].stride;
-            src_stride = src_buf->plane[plane].stride;
 
-            int h = src_buf->plane[plane].height;
-            int w = src_buf->plane[plane].width;
-            segment_start = ( h / pv->cpu_count ) * segment;
-            if( segment == pv->cpu_count - 1 )
-            {
-                /*
-                 * Final segment
-                 */
-                segment_stop = h;
-            } else {
-                segment_stop = ( h / pv->cpu_count ) * ( segment + 1 );
-            }
+        for( y = segment_start; y < segment_stop; y++ )
+        {
+            uint8_t * cur;
+            int x, xo, yo;
 
-            for( y = segment_start; y < segment_stop; y++ )
+            cur = &src_buf->plane[plane].data[y * src_stride];
+            for( x = 0; x < w; x++)
             {
-                uint8_t * cur;
-                int x, xo, yo;
-
-                cur = &src_buf->plane[plane].data[y * src_stride];
-                for( x = 0; x < w; x++)
+                if( pv->mode & 1 )
+                {
+                    yo = h - y - 1;
+                }
+                else
+                {
+                    yo = y;
+                }
+                if( pv->mode & 2 )
+                {
+                    xo = w - x - 1;
+                }
+                else
+                {
+                    xo = x;
+                }
+                if( pv->mode & 4 ) // Rotate 90 clockwise
                 {
-                    if( pv->mode & 1 )
-                    {
-                        yo = h - y - 1;
-                    }
-                    else
-                    {
-                        yo = y;
-                    }
-                    if( pv->mode & 2 )
-                    {
-                        xo = w - x - 1;
-                    }
-                    else
-                    {
-                        xo = x;
-                    }
-                    if( pv->mode & 4 ) // Rotate 90 clockwise
-                    {
-                        int tmp = xo;
-                        xo = h - yo - 1;
-                        yo = tmp;
-                    }
-                    dst[yo*dst_stride + xo] = cur[x];
+                    int tmp = xo;
+                    xo = h - yo - 1;
+                    yo = tmp;
                 }
+                dst[yo*dst_stride + xo] = cur[x];
             }
         }
-
-report_completion:
-        /*
-         * Finished this segment, let everyone know.
-         */
-        taskset_thread_complete( &pv->rotate_taskset, segment );
     }
 }
 
 
 /*
- * threaded rotate - each thread rotates a single segment of all
+ * threaded rotate - each pool task rotates a single segment of all
  * three planes. Where a segment is defined as the frame divided by
  * the number of CPUs.
  *
@@ -207,7 +241,7 @@ static void rotate_filter(
     }
 
     /*
-     * Allow the taskset threads to make one pass over the data.
+     * Allow the taskset to make one pass over the data.
      */
     taskset_cycle( &pv->rotate_taskset );
 
@@ -238,8 +272,10 @@ static int hb_rotate_init( hb_filter_object_t * filter,
      */
     pv->rotate_arguments = malloc( sizeof( rotate_arguments_t ) * pv->cpu_count );
     if( pv->rotate_arguments == NULL ||
-        taskset_init( &pv->rotate_taskset, /*thread_count*/pv->cpu_count,
-                      sizeof( rotate_thread_arg_t ) ) == 0 )
+        taskset_init( &pv->rotate_taskset, hb_taskpool_get( init->job->h ),
+                      "rotate_filter_segment", pv->cpu_count,
+                      sizeof( rotate_thread_arg_t ),
+                      rotate_filter_thread ) == 0 )
     {
             hb_error( "rotate could not initialize taskset" );
     }
@@ -254,14 +290,6 @@ static int hb_rotate_init( hb_filter_object_t * filter,
         thread_args->pv = pv;
         thread_args->segment = i;
         pv->rotate_arguments[i].dst = NULL;
-    
-        if( taskset_thread_spawn( &pv->rotate_taskset, i,
-                                  "rotate_filter_segment",
-                                  rotate_filter_thread,
-                                  HB_NORMAL_PRIORITY ) == 0 )
-        {
-            hb_error( "rotate could not spawn thread" );
-        }
     }
     // Set init width/height so the next stage in the pipline
     // knows what it will be getting
@@ -276,6 +304,11 @@ static int hb_rotate_init( hb_filter_object_t * filter,
         init->par_width = init->par_height;
         init->par_height = tmp;
     }
+    else
+    {
+        // Flips just move pixels around within the frame
+        filter->flags |= HB_FILTER_FLAG_INPLACE;
+    }
     pv->width = init->width;
     pv->height = init->height;
     pv->par_width = init->par_width;
@@ -348,19 +381,18 @@ static int hb_rotate_work( hb_filter_object_t * filter,
         return HB_FILTER_DONE;
     }
 
-    int width_out, height_out;
-    if ( pv->mode & 4 )
-    {
-        width_out = in->f.height;
-        height_out = in->f.width;
-    }
-    else
+    if ( filter->flags & HB_FILTER_FLAG_INPLACE )
     {
-        width_out = in->f.width;
-        height_out = in->f.height;
+        rotate_filter( pv, in, in );
+
+        *buf_in = NULL;
+        *buf_out = in;
+
+        return HB_FILTER_OK;
     }
 
-    out = hb_video_buffer_init( width_out, height_out );
+    // 90 degree rotation, exchange width and height
+    out = hb_video_buffer_init( in->f.height, in->f.width );
 
     // Rotate!
     rotate_filter( pv, out, in );
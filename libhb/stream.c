@@ -10,6 +10,13 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#ifndef SYS_MINGW
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define HB_STREAM_MMAP 1
+#endif
 
 #include "hb.h"
 #include "hbffmpeg.h"
@@ -20,6 +27,9 @@
 #define min(a, b) a < b ? a : b
 #define HB_MAX_PROBE_SIZE (1*1024*1024)
 
+// How far ahead of the read position mapped files are paged in
+#define HB_STREAM_MAP_ADVISE (1*1024*1024)
+
 /*
  * This table defines how ISO MPEG stream type codes map to HandBrake
  * codecs. It is indexed by the 8 bit stream type and contains the codec
@@ -197,6 +207,11 @@ struct hb_stream_s
 
     char    *path;
     FILE    *file_handle;
+    hb_readahead_t *readahead;  // reads file_handle while the reader runs
+    const uint8_t *map;         // the whole file when it could be mapped
+    off_t   map_pos;            // read position in map
+    off_t   map_advised;        // end of the range paged in ahead of map_pos
+    off_t   file_size;          // kept while mapped or reading ahead
     hb_stream_type_t hb_stream_type;
     hb_title_t *title;
 
@@ -285,6 +300,229 @@ static void hb_ps_resolve_stream_types(hb_stream_t *stream);
 void hb_ts_stream_reset(hb_stream_t *stream);
 void hb_ps_stream_reset(hb_stream_t *stream);
 
+/*
+ * File access.  Local files are mapped when they are opened, so packets
+ * are parsed straight out of the page cache and seeks don't cost
+ * anything.  Otherwise reads go through stdio until the reader turns on
+ * readahead (see hb_stream_set_readahead).  From then on file_handle
+ * belongs to the readahead thread and everything below goes through
+ * the readahead ring instead.
+ */
+#ifdef HB_STREAM_MMAP
+static off_t map_page_mask;
+#endif
+
+static void stream_map( hb_stream_t *stream )
+{
+#ifdef HB_STREAM_MMAP
+    struct stat st;
+    void *map;
+    int fd = fileno( stream->file_handle );
+
+    if ( fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) || st.st_size <= 0 )
+    {
+        return;
+    }
+    if ( (uint64_t)st.st_size > (size_t)-1 ||
+         ( sizeof(void*) < 8 && st.st_size > ( 1 << 30 ) ) )
+    {
+        // Don't use up the address space of 32 bit builds
+        return;
+    }
+    map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    if ( map == MAP_FAILED )
+    {
+        hb_deep_log( 2, "stream: mmap of %s failed (%s), using stdio",
+                     stream->path, strerror( errno ) );
+        return;
+    }
+    if ( map_page_mask == 0 )
+    {
+        map_page_mask = sysconf( _SC_PAGESIZE ) - 1;
+    }
+    stream->map = map;
+    stream->file_size = st.st_size;
+    stream->map_pos = ftello( stream->file_handle );
+    stream->map_advised = 0;
+#endif
+}
+
+static void stream_unmap( hb_stream_t *stream )
+{
+#ifdef HB_STREAM_MMAP
+    if ( stream->map )
+    {
+        munmap( (void*)stream->map, stream->file_size );
+        stream->map = NULL;
+    }
+#endif
+}
+
+// Page in the part of the map that is about to be read, so the reads
+// don't stall on page faults one page at a time.
+static inline void stream_map_advise( hb_stream_t *stream, off_t end )
+{
+#ifdef HB_STREAM_MMAP
+    off_t start;
+
+    if ( end < stream->map_advised - HB_STREAM_MAP_ADVISE / 2 ||
+         stream->map_advised >= stream->file_size )
+    {
+        return;
+    }
+    start = MAX( stream->map_advised, stream->map_pos ) & ~map_page_mask;
+    end   = MIN( start + HB_STREAM_MAP_ADVISE, stream->file_size );
+    madvise( (void*)( stream->map + start ), end - start, MADV_WILLNEED );
+    stream->map_advised = end;
+#endif
+}
+
+// Bytes left in the map at the read position, at most size
+static inline int stream_map_avail( hb_stream_t *stream, size_t size )
+{
+    off_t left = stream->file_size - stream->map_pos;
+
+    if ( left <= 0 )
+        return 0;
+    if ( (uint64_t)left < size )
+        return left;
+    return size;
+}
+
+static int stream_fill( void *opaque, int64_t pos, uint8_t *buf, int size )
+{
+    hb_stream_t *stream = opaque;
+
+    if ( ftello( stream->file_handle ) != pos &&
+         fseeko( stream->file_handle, pos, SEEK_SET ) != 0 )
+    {
+        return -1;
+    }
+    size = fread( buf, 1, size, stream->file_handle );
+    if ( size == 0 && ferror( stream->file_handle ) )
+    {
+        return -1;
+    }
+    return size;
+}
+
+static size_t stream_read( hb_stream_t *stream, void *buf, size_t size )
+{
+    if ( stream->map )
+    {
+        int len = stream_map_avail( stream, size );
+        stream_map_advise( stream, stream->map_pos + len );
+        memcpy( buf, stream->map + stream->map_pos, len );
+        stream->map_pos += len;
+        return len;
+    }
+    if ( stream->readahead )
+    {
+        int len = hb_readahead_read( stream->readahead, buf, size );
+        return len > 0 ? len : 0;
+    }
+    return fread( buf, 1, size, stream->file_handle );
+}
+
+// Like stream_read but gives a pointer to the data, which is only valid
+// until the next read or seek.
+static int stream_get( hb_stream_t *stream, int size, const uint8_t **data )
+{
+    if ( stream->map )
+    {
+        int len = stream_map_avail( stream, size );
+        stream_map_advise( stream, stream->map_pos + len );
+        *data = stream->map + stream->map_pos;
+        stream->map_pos += len;
+        return len;
+    }
+    if ( stream->readahead )
+    {
+        return hb_readahead_get( stream->readahead, size, data );
+    }
+    *data = stream->ts.packet;
+    return fread( stream->ts.packet, 1, size, stream->file_handle );
+}
+
+static int stream_seek( hb_stream_t *stream, off_t offset, int whence )
+{
+    if ( stream->map )
+    {
+        if ( whence == SEEK_CUR )
+            offset += stream->map_pos;
+        else if ( whence == SEEK_END )
+            offset += stream->file_size;
+        if ( offset < 0 )
+            return -1;
+        if ( offset < stream->map_pos ||
+             offset > stream->map_advised )
+        {
+            // Start paging in again at the new position
+            stream->map_advised = 0;
+        }
+        stream->map_pos = offset;
+        return 0;
+    }
+    if ( stream->readahead )
+    {
+        if ( whence == SEEK_CUR )
+            offset += hb_readahead_tell( stream->readahead );
+        else if ( whence == SEEK_END )
+            offset += stream->file_size;
+        if ( offset < 0 )
+            return -1;
+        hb_readahead_seek( stream->readahead, offset );
+        return 0;
+    }
+    return fseeko( stream->file_handle, offset, whence );
+}
+
+static off_t stream_tell( hb_stream_t *stream )
+{
+    if ( stream->map )
+    {
+        return stream->map_pos;
+    }
+    if ( stream->readahead )
+    {
+        return hb_readahead_tell( stream->readahead );
+    }
+    return ftello( stream->file_handle );
+}
+
+// stdio needs the file locked around stream_getc, the map and the
+// readahead don't
+static void stream_lock( hb_stream_t *stream )
+{
+    if ( !stream->map && !stream->readahead )
+        flockfile( stream->file_handle );
+}
+
+static void stream_unlock( hb_stream_t *stream )
+{
+    if ( !stream->map && !stream->readahead )
+        funlockfile( stream->file_handle );
+}
+
+static int stream_getc( hb_stream_t *stream )
+{
+    if ( stream->map )
+    {
+        if ( stream->map_pos >= stream->file_size )
+            return EOF;
+        stream_map_advise( stream, stream->map_pos + 1 );
+        return stream->map[stream->map_pos++];
+    }
+    if ( stream->readahead )
+    {
+        const uint8_t *c;
+        if ( hb_readahead_get( stream->readahead, 1, &c ) == 1 )
+            return *c;
+        return EOF;
+    }
+    return getc_unlocked( stream->file_handle );
+}
+
 /*
  * logging routines.
  * these frontend hb_log because transport streams can have a lot of errors
@@ -544,7 +782,7 @@ static int hb_stream_check_for_ps(hb_stream_t *stream)
     uint8_t sc_buf[4];
     int pos = 0;
 
-    fseek(stream->file_handle, 0, SEEK_SET);
+    stream_seek( stream, 0, SEEK_SET);
 
     // program streams should start with a PACK then some other mpeg start
     // code (usually a SYS but that might be missing if we only have a clip).
@@ -552,7 +790,7 @@ static int hb_stream_check_for_ps(hb_stream_t *stream)
     {
         int offset;
 
-        if ( fread(buf, 1, sizeof(buf), stream->file_handle) != sizeof(buf) )
+        if ( stream_read( stream, buf, sizeof(buf) ) != sizeof(buf) )
             return 0;
 
         for ( offset = 0; offset < 8*1024-27; ++offset )
@@ -582,23 +820,23 @@ static int hb_stream_check_for_ps(hb_stream_t *stream)
                 data_len = (b[4] << 8) + b[5];
                 if ( data_len && sid > 0xba && sid < 0xf9 )
                 {
-                    prev = ftell( stream->file_handle );
+                    prev = stream_tell( stream );
                     pos = prev - ( sizeof(buf) - offset );
                     pos += pes_offset + 6 + data_len;
-                    fseek( stream->file_handle, pos, SEEK_SET );
-                    if ( fread(sc_buf, 1, 4, stream->file_handle) != 4 )
+                    stream_seek( stream, pos, SEEK_SET );
+                    if ( stream_read( stream, sc_buf, 4 ) != 4 )
                         return 0;
                     if (sc_buf[0] == 0x00 && sc_buf[1] == 0x00 &&
                         sc_buf[2] == 0x01)
                     {
                         return 1;
                     }
-                    fseek( stream->file_handle, prev, SEEK_SET );
+                    stream_seek( stream, prev, SEEK_SET );
                 }
             }
         }
-        fseek( stream->file_handle, -27, SEEK_CUR );
-        pos = ftell( stream->file_handle );
+        stream_seek( stream, -27, SEEK_CUR );
+        pos = stream_tell( stream );
     }
     return 0;
 }
@@ -607,7 +845,7 @@ static int hb_stream_get_type(hb_stream_t *stream)
 {
     uint8_t buf[2048*4];
 
-    if ( fread(buf, 1, sizeof(buf), stream->file_handle) == sizeof(buf) )
+    if ( stream_read( stream, buf, sizeof(buf) ) == sizeof(buf) )
     {
         int psize;
         if ( ( psize = hb_stream_check_for_ts(buf) ) != 0 )
@@ -636,6 +874,11 @@ static int hb_stream_get_type(hb_stream_t *stream)
 
 static void hb_stream_delete_dynamic( hb_stream_t *d )
 {
+    if ( d->readahead )
+    {
+        hb_readahead_close( &d->readahead );
+    }
+    stream_unmap( d );
     if( d->file_handle )
     {
         fclose( d->file_handle );
@@ -841,6 +1084,7 @@ hb_stream_t * hb_stream_open( char *path, hb_title_t *title, int scan )
     d->path = strdup( path );
     if (d->path != NULL )
     {
+        stream_map( d );
         if ( hb_stream_get_type( d ) != 0 )
         {
             if( !scan )
@@ -852,6 +1096,7 @@ hb_stream_t * hb_stream_open( char *path, hb_title_t *title, int scan )
             hb_stream_seek( d, 0. );
             return d;
         }
+        stream_unmap( d );
         fclose( d->file_handle );
         d->file_handle = NULL;
         if ( ffmpeg_open( d, title, scan ) )
@@ -1108,21 +1353,21 @@ hb_title_t * hb_stream_title_scan(hb_stream_t *stream, hb_title_t * title)
  */
 static const uint8_t *next_packet( hb_stream_t *stream )
 {
-    uint8_t *buf = stream->ts.packet + stream->packetsize - 188;
+    const uint8_t *pkt, *buf;
 
     while ( 1 )
     {
-        if ( fread(stream->ts.packet, 1, stream->packetsize, stream->file_handle) !=
-             stream->packetsize )
+        if ( stream_get(stream, stream->packetsize, &pkt) != stream->packetsize )
         {
             return NULL;
         }
+        buf = pkt + stream->packetsize - 188;
         if (buf[0] == 0x47)
         {
             return buf;
         }
         // lost sync - back up to where we started then try to re-establish.
-        off_t pos = ftello(stream->file_handle) - stream->packetsize;
+        off_t pos = stream_tell(stream) - stream->packetsize;
         off_t pos2 = align_to_next_packet(stream);
         if ( pos2 == 0 )
         {
@@ -1143,21 +1388,21 @@ static void skip_to_next_pack( hb_stream_t *src_stream )
     uint32_t strt_code = -1;
     int c;
 
-    flockfile( src_stream->file_handle );
-    while ( ( c = getc_unlocked( src_stream->file_handle ) ) != EOF )
+    stream_lock( src_stream );
+    while ( ( c = stream_getc( src_stream ) ) != EOF )
     {
         strt_code = ( strt_code << 8 ) | c;
         if ( strt_code == 0x000001ba )
             // we found the start of the next pack
             break;
     }
-    funlockfile( src_stream->file_handle );
+    stream_unlock( src_stream );
 
     // if we didn't terminate on an eof back up so the next read
     // starts on the pack boundary.
     if ( c != EOF )
     {
-        fseeko( src_stream->file_handle, -4, SEEK_CUR );
+        stream_seek( src_stream, -4, SEEK_CUR );
     }
 }
 
@@ -1501,7 +1746,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
     {
         const uint8_t *buf;
         int adapt_len;
-        fseeko( stream->file_handle, fpos, SEEK_SET );
+        stream_seek( stream, fpos, SEEK_SET );
         align_to_next_packet( stream );
         int pid = stream->ts.list[ts_index_of_video(stream)].pid;
         buf = hb_ts_stream_getPEStype( stream, pid, &adapt_len );
@@ -1529,7 +1774,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
                 ++stream->has_IDRs;
             }
         }
-        pp.pos = ftello(stream->file_handle);
+        pp.pos = stream_tell( stream );
         if ( !stream->has_IDRs )
         {
             // Scan a little more to see if we will stumble upon one
@@ -1554,7 +1799,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
 
         // round address down to nearest dvd sector start
         fpos &=~ ( HB_DVD_READ_BUFFER_SIZE - 1 );
-        fseeko( stream->file_handle, fpos, SEEK_SET );
+        stream_seek( stream, fpos, SEEK_SET );
         if ( stream->hb_stream_type == program )
         {
             skip_to_next_pack( stream );
@@ -1599,7 +1844,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
         }
 
         pp.pts = pes_info.pts;
-        pp.pos = ftello(stream->file_handle);
+        pp.pos = stream_tell( stream );
     }
     return pp;
 }
@@ -1659,8 +1904,8 @@ static void hb_stream_duration(hb_stream_t *stream, hb_title_t *inTitle)
     struct pts_pos *pp = ptspos;
     int i;
 
-    fseeko(stream->file_handle, 0, SEEK_END);
-    uint64_t fsize = ftello(stream->file_handle);
+    stream_seek( stream, 0, SEEK_END);
+    uint64_t fsize = stream_tell( stream );
     uint64_t fincr = fsize / NDURSAMPLES;
     uint64_t fpos = fincr / 2;
     for ( i = NDURSAMPLES; --i >= 0; fpos += fincr )
@@ -1674,7 +1919,7 @@ static void hb_stream_duration(hb_stream_t *stream, hb_title_t *inTitle)
     inTitle->minutes  = ( dur % 3600 ) / 60;
     inTitle->seconds  = dur % 60;
 
-    rewind(stream->file_handle);
+    stream_seek( stream, 0, SEEK_SET );
 }
 
 /***********************************************************************
@@ -1756,6 +2001,55 @@ int hb_stream_chapter( hb_stream_t * src_stream )
     return( src_stream->chapter + 1 );
 }
 
+/***********************************************************************
+ * hb_stream_set_readahead
+ ***********************************************************************
+ * Read transport and program streams ahead in large blocks on a thread
+ * of their own (for the reader, not for scans).
+ **********************************************************************/
+void hb_stream_set_readahead( hb_stream_t * stream, int enable )
+{
+    off_t pos;
+
+    if ( stream->file_handle == NULL )
+    {
+        // ffmpeg reads the file itself, BD streams are fed by bd.c
+        return;
+    }
+#ifdef HB_STREAM_MMAP
+    if ( stream->map )
+    {
+        // The kernel reads mapped files ahead by itself
+        madvise( (void*)stream->map, stream->file_size,
+                 enable ? MADV_SEQUENTIAL : MADV_NORMAL );
+        return;
+    }
+#endif
+    if ( enable && stream->readahead == NULL )
+    {
+        pos = ftello( stream->file_handle );
+        fseeko( stream->file_handle, 0, SEEK_END );
+        stream->file_size = ftello( stream->file_handle );
+        fseeko( stream->file_handle, pos, SEEK_SET );
+
+        stream->readahead = hb_readahead_init( "stream readahead",
+                                               stream_fill, stream,
+                                               HB_READAHEAD_BLOCK_SIZE,
+                                               HB_READAHEAD_BLOCK_COUNT,
+                                               64 * 1024 );
+        if ( stream->readahead )
+        {
+            hb_readahead_start( stream->readahead, pos );
+        }
+    }
+    else if ( !enable && stream->readahead != NULL )
+    {
+        pos = hb_readahead_tell( stream->readahead );
+        hb_readahead_close( &stream->readahead );
+        fseeko( stream->file_handle, pos, SEEK_SET );
+    }
+}
+
 /***********************************************************************
  * hb_stream_seek
  ***********************************************************************
@@ -1769,16 +2063,16 @@ int hb_stream_seek( hb_stream_t * stream, float f )
     }
     off_t stream_size, cur_pos, new_pos;
     double pos_ratio = f;
-    cur_pos = ftello( stream->file_handle );
-    fseeko( stream->file_handle, 0, SEEK_END );
-    stream_size = ftello( stream->file_handle );
+    cur_pos = stream_tell( stream );
+    stream_seek( stream, 0, SEEK_END );
+    stream_size = stream_tell( stream );
     new_pos = (off_t) ((double) (stream_size) * pos_ratio);
     new_pos &=~ (HB_DVD_READ_BUFFER_SIZE - 1);
 
-    int r = fseeko( stream->file_handle, new_pos, SEEK_SET );
+    int r = stream_seek( stream, new_pos, SEEK_SET );
     if (r == -1)
     {
-        fseeko( stream->file_handle, cur_pos, SEEK_SET );
+        stream_seek( stream, cur_pos, SEEK_SET );
         return 0;
     }
 
@@ -2521,18 +2815,18 @@ static off_t align_to_next_packet(hb_stream_t *stream)
 {
     uint8_t buf[MAX_HOLE];
     off_t pos = 0;
-    off_t start = ftello(stream->file_handle);
+    off_t start = stream_tell( stream );
     off_t orig;
 
     if ( start >= stream->packetsize ) {
         start -= stream->packetsize;
-        fseeko(stream->file_handle, start, SEEK_SET);
+        stream_seek( stream, start, SEEK_SET);
     }
     orig = start;
 
     while (1)
     {
-        if (fread(buf, sizeof(buf), 1, stream->file_handle) == 1)
+        if (stream_read(stream, buf, sizeof(buf)) == sizeof(buf))
         {
             const uint8_t *bp = buf;
             int i;
@@ -2549,15 +2843,15 @@ static off_t align_to_next_packet(hb_stream_t *stream)
                 pos = ( bp - buf ) - stream->packetsize + 188;
                 break;
             }
-            fseeko(stream->file_handle, -8 * stream->packetsize, SEEK_CUR);
-            start = ftello(stream->file_handle);
+            stream_seek( stream, -8 * stream->packetsize, SEEK_CUR);
+            start = stream_tell( stream );
         }
         else
         {
             return 0;
         }
     }
-    fseeko(stream->file_handle, start+pos, SEEK_SET);
+    stream_seek( stream, start+pos, SEEK_SET);
     return start - orig + pos;
 }
 
@@ -3372,8 +3666,8 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
     int c;
 
 #define cp (b->data)
-    flockfile( stream->file_handle );
-    while ( ( c = getc_unlocked( stream->file_handle ) ) != EOF )
+    stream_lock( stream );
+    while ( ( c = stream_getc( stream ) ) != EOF )
     {
         start_code = ( start_code << 8 ) | c;
         if ( ( start_code >> 8 )== 0x000001 )
@@ -3405,17 +3699,17 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
         }
 
         // There are at least 8 bytes.  More if this is mpeg2 pack.
-        fread( cp+pos, 1, 8, stream->file_handle );
+        stream_read( stream, cp+pos, 8 );
         int mark = cp[pos] >> 4;
         pos += 8;
 
         if ( mark != 0x02 )
         {
             // mpeg-2 pack,
-            fread( cp+pos, 1, 2, stream->file_handle );
+            stream_read( stream, cp+pos, 2 );
             pos += 2;
             int len = cp[start+13] & 0x7;
-            fread( cp+pos, 1, len, stream->file_handle );
+            stream_read( stream, cp+pos, len );
             pos += len;
         }
     }
@@ -3425,11 +3719,11 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
     else if ( stream_id >= 0xbb )
     {
         int len = 0;
-        c = getc_unlocked( stream->file_handle );
+        c = stream_getc( stream );
         if ( c == EOF )
             goto done;
         len = c << 8;
-        c = getc_unlocked( stream->file_handle );
+        c = stream_getc( stream );
         if ( c == EOF )
             goto done;
         len |= c;
@@ -3445,7 +3739,7 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
         if ( len )
         {
             // Length is non-zero, read the packet all at once
-            len = fread( cp+pos, 1, len, stream->file_handle );
+            len = stream_read( stream, cp+pos, len );
             pos += len;
         }
         else
@@ -3453,7 +3747,7 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
             // Length is zero, read bytes till we find a start code.
             // Only video PES packets are allowed to have zero length.
             start_code = -1;
-            while ( ( c = getc_unlocked( stream->file_handle ) ) != EOF )
+            while ( ( c = stream_getc( stream ) ) != EOF )
             {
                 start_code = ( start_code << 8 ) | c;
                 if ( pos  >= b->alloc )
@@ -3472,14 +3766,14 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
             if ( c == EOF )
                 goto done;
             pos -= 4;
-            fseeko( stream->file_handle, -4, SEEK_CUR );
+            stream_seek( stream, -4, SEEK_CUR );
         }
     }
     else
     {
         // Unknown, find next start code
         start_code = -1;
-        while ( ( c = getc_unlocked( stream->file_handle ) ) != EOF )
+        while ( ( c = stream_getc( stream ) ) != EOF )
         {
             start_code = ( start_code << 8 ) | c;
             if ( pos  >= b->alloc )
@@ -3496,11 +3790,11 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
         if ( c == EOF )
             goto done;
         pos -= 4;
-        fseeko( stream->file_handle, -4, SEEK_CUR );
+        stream_seek( stream, -4, SEEK_CUR );
     }
 done:
     // Parse packet for information we might need
-    funlockfile( stream->file_handle );
+    stream_unlock( stream );
     int len = pos - b->size;
     b->size = pos;
 #undef cp
@@ -3875,7 +4169,7 @@ static void hb_ps_stream_find_streams(hb_stream_t *stream)
     int ii, jj;
     hb_buffer_t *buf  = hb_buffer_init(HB_DVD_READ_BUFFER_SIZE);
 
-    fseeko( stream->file_handle, 0, SEEK_SET );
+    stream_seek( stream, 0, SEEK_SET );
     // Scan beginning of file, then if no program stream map is found
     // seek to 20% and scan again since there's occasionally no
     // audio at the beginning (particularly for vobs).
@@ -4496,9 +4790,9 @@ static int hb_ts_stream_find_pids(hb_stream_t *stream)
     // changes PMTs (and thus video & audio PIDs) when 'programs' change. Since
     // we may have the tail of the previous program at the beginning of this
     // file, take our PMT from the middle of the file.
-    fseeko(stream->file_handle, 0, SEEK_END);
-    uint64_t fsize = ftello(stream->file_handle);
-    fseeko(stream->file_handle, fsize >> 1, SEEK_SET);
+    stream_seek( stream, 0, SEEK_END);
+    uint64_t fsize = stream_tell( stream );
+    stream_seek( stream, fsize >> 1, SEEK_SET);
     align_to_next_packet(stream);
 
     // Read the Transport Stream Packets (188 bytes each) looking at first for PID 0 (the PAT PID), then decode that
@@ -11,224 +11,250 @@
 #include "ports.h"
 #include "taskset.h"
 
-int
-taskset_init( taskset_t *ts, int thread_count, size_t arg_size )
+/*
+ * Worker pool shared by all tasksets.
+ *
+ * Tasksets with segments left to hand out sit on a run queue.  Idle
+ * workers take the next segment of the taskset at the head of the queue,
+ * so concurrently cycling tasksets (e.g. decomb and rotate in the same
+ * job) share the same fixed number of threads.
+ */
+struct hb_taskpool_s
 {
-    int init_step;
+    int               thread_count;
+    hb_thread_t    ** threads;
+    hb_lock_t       * lock;         // Protects the pool and all its tasksets
+    hb_cond_t       * work_ready;   // A taskset was queued
+    taskset_t       * queue_head;
+    taskset_t       * queue_tail;
+    volatile int      die;
+};
 
-    init_step = 0;
-    memset( ts, 0, sizeof( *ts ) );
-    ts->thread_count = thread_count;
-    ts->arg_size = arg_size;
-    ts->bitmap_elements = ( ts->thread_count + 31 ) / 32;
-    ts->task_threads = malloc( sizeof( hb_thread_t* ) * ts->thread_count );
-    if( ts->task_threads == NULL )
-        goto fail;
-    init_step++;
+static void taskpool_dequeue( hb_taskpool_t *pool, taskset_t *ts )
+{
+    taskset_t *prev = NULL, *cur = pool->queue_head;
 
-    if( arg_size != 0 )
+    while( cur != NULL && cur != ts )
     {
-        ts->task_threads_args = malloc( arg_size * ts->thread_count );
-        if( ts->task_threads == NULL )
-            goto fail;
+        prev = cur;
+        cur = cur->queue_next;
     }
-    init_step++;
+    if( cur == NULL )
+        return;
 
-    ts->task_begin_bitmap = malloc( sizeof( uint32_t  ) * ts->bitmap_elements );
-    if( ts->task_begin_bitmap == NULL )
-        goto fail;
-    init_step++;
+    if( prev == NULL )
+        pool->queue_head = ts->queue_next;
+    else
+        prev->queue_next = ts->queue_next;
+    if( pool->queue_tail == ts )
+        pool->queue_tail = prev;
+    ts->queue_next = NULL;
+}
 
-    ts->task_complete_bitmap = malloc( sizeof( uint32_t ) * ts->bitmap_elements );
-    if( ts->task_complete_bitmap == NULL )
-        goto fail;
-    init_step++;
+/*
+ * Run the next segment of the taskset.  Called with the pool lock held,
+ * which is dropped while the segment does its work.
+ */
+static void taskpool_run_segment( hb_taskpool_t *pool, taskset_t *ts )
+{
+    int segment = ts->task_next++;
 
-    ts->task_stop_bitmap = malloc( sizeof( uint32_t ) * ts->bitmap_elements );
-    if( ts->task_stop_bitmap == NULL )
-        goto fail;
-    init_step++;
+    if( ts->task_next >= ts->segment_count )
+    {
+        /* Everything has been handed out, nothing more for the workers */
+        taskpool_dequeue( pool, ts );
+    }
+    hb_unlock( pool->lock );
 
-    ts->task_cond_lock = hb_lock_init();
-    if( ts->task_cond_lock == NULL)
-        goto fail;
-    init_step++;
+    ts->task_func( taskset_thread_args( ts, segment ) );
 
-    ts->task_begin = hb_cond_init();
-    if( ts->task_begin == NULL)
-        goto fail;
-    init_step++;
+    hb_lock( pool->lock );
+    if( --ts->task_pending == 0 )
+    {
+        hb_cond_broadcast( ts->task_complete );
+    }
+}
 
-    ts->task_complete = hb_cond_init();
-    if( ts->task_complete == NULL)
-        goto fail;
-    init_step++;
+static void taskpool_thread( void *_pool )
+{
+    hb_taskpool_t *pool = _pool;
 
-    /*
-     * Initialize all arg data to 0.
-     */
-    memset(ts->task_threads_args, 0, ts->arg_size * ts->thread_count );
+    hb_lock( pool->lock );
+    while( 1 )
+    {
+        while( pool->queue_head == NULL && !pool->die )
+        {
+            hb_cond_wait( pool->work_ready, pool->lock );
+        }
+        if( pool->queue_head == NULL )
+        {
+            break;
+        }
+        taskpool_run_segment( pool, pool->queue_head );
+    }
+    hb_unlock( pool->lock );
+}
 
-    /*
-     * Inialize bitmaps to all bits set.  This means that any unused bits
-     * in the bitmap are already in the "condition satisfied" state allowing
-     * us to test the bitmap 32bits at a time without having to mask off
-     * the end.
-     */
-    memset(ts->task_begin_bitmap, 0xFF, sizeof( uint32_t ) * ts->bitmap_elements );
-    memset(ts->task_complete_bitmap, 0xFF, sizeof( uint32_t ) * ts->bitmap_elements );
-    memset(ts->task_stop_bitmap, 0, sizeof( uint32_t ) * ts->bitmap_elements );
-    
-    /*
-     * Important to start off with the threads locked waiting
-     * on input, no work completed, and not asked to stop.
-     */
-    bit_nclear( ts->task_begin_bitmap, 0, ts->thread_count - 1 );
-    bit_nclear( ts->task_complete_bitmap, 0, ts->thread_count - 1 );
-    bit_nclear( ts->task_stop_bitmap, 0, ts->thread_count - 1 );
-    return (1);
+hb_taskpool_t *
+hb_taskpool_init( int thread_count )
+{
+    hb_taskpool_t *pool;
+    int i;
+
+    if( thread_count < 1 )
+        thread_count = 1;
+
+    pool = calloc( 1, sizeof( hb_taskpool_t ) );
+    if( pool == NULL )
+        return NULL;
 
-fail:
-    switch (init_step)
+    pool->threads = calloc( thread_count, sizeof( hb_thread_t* ) );
+    if( pool->threads == NULL )
     {
-        default:
-            hb_cond_close( &ts->task_complete );
-            /* FALL THROUGH */
-        case 7:
-            hb_cond_close( &ts->task_begin );
-            /* FALL THROUGH */
-        case 6:
-            hb_lock_close( &ts->task_cond_lock );
-            /* FALL THROUGH */
-        case 5:
-            free( ts->task_stop_bitmap );
-            /* FALL THROUGH */
-        case 4:
-            free( ts->task_complete_bitmap );
-            /* FALL THROUGH */
-        case 3:
-            free( ts->task_begin_bitmap );
-            /* FALL THROUGH */
-        case 2:
-            if( ts->task_threads_args == NULL )
-                free( ts->task_threads_args );
-            /* FALL THROUGH */
-        case 1:
-            free( ts->task_threads );
-            /* FALL THROUGH */
-        case 0:
+        free( pool );
+        return NULL;
+    }
+    pool->lock = hb_lock_init();
+    pool->work_ready = hb_cond_init();
+
+    for( i = 0; i < thread_count; i++ )
+    {
+        pool->threads[i] = hb_thread_init( "taskpool", taskpool_thread, pool,
+                                           HB_NORMAL_PRIORITY );
+        if( pool->threads[i] == NULL )
+        {
+            hb_error( "taskpool: could not spawn thread %d", i );
             break;
+        }
     }
-    return (0);
+    pool->thread_count = i;
+    hb_deep_log( 2, "taskpool: started %d worker threads", pool->thread_count );
+
+    return pool;
 }
 
 int
-taskset_thread_spawn( taskset_t *ts, int thr_idx, const char *descr,
-                      thread_func_t *func, int priority )
+hb_taskpool_thread_count( hb_taskpool_t *pool )
 {
-    ts->task_threads[thr_idx] = hb_thread_init( descr, func,
-                                                taskset_thread_args( ts, thr_idx ),
-                                                priority);
-    return( ts->task_threads[thr_idx] != NULL );
+    return pool->thread_count;
 }
 
 void
-taskset_cycle( taskset_t *ts )
+hb_taskpool_close( hb_taskpool_t **_pool )
 {
-    hb_lock( ts->task_cond_lock );
+    hb_taskpool_t *pool = *_pool;
+    int i;
 
-    /*
-     * Signal all threads that their work is available.
-     */
-    bit_nset( ts->task_begin_bitmap, 0, ts->thread_count - 1 );
-    hb_cond_broadcast( ts->task_begin );
+    if( pool == NULL )
+        return;
 
-    /*
-     * Wait until all threads have completed.  Note that we must
-     * loop here as hb_cond_wait() on some platforms (e.g pthead_cond_wait)
-     * may unblock prematurely.
-     */
-    do
-    {
-        hb_cond_wait( ts->task_complete, ts->task_cond_lock );
-    } while ( !allbits_set( ts->task_complete_bitmap, ts->bitmap_elements ) );
+    hb_lock( pool->lock );
+    pool->die = 1;
+    hb_cond_broadcast( pool->work_ready );
+    hb_unlock( pool->lock );
 
-    /*
-     * Clear completion indications for next time.
-     */
-    bit_nclear( ts->task_complete_bitmap, 0, ts->thread_count - 1 );
+    for( i = 0; i < pool->thread_count; i++ )
+    {
+        hb_thread_close( &pool->threads[i] );
+    }
+    hb_cond_close( &pool->work_ready );
+    hb_lock_close( &pool->lock );
+    free( pool->threads );
+    free( pool );
 
-    hb_unlock( ts->task_cond_lock );
+    *_pool = NULL;
 }
 
-/*
- * Block current thread until work is available for it.
- */
-void
-taskset_thread_wait4start( taskset_t *ts, int thr_idx )
+int
+taskset_init( taskset_t *ts, hb_taskpool_t *pool, const char *descr,
+              int segment_count, size_t arg_size, thread_func_t *func )
 {
-    hb_lock( ts->task_cond_lock );
-    while ( bit_is_clear( ts->task_begin_bitmap, thr_idx ) )
-        hb_cond_wait( ts->task_begin, ts->task_cond_lock );
+    memset( ts, 0, sizeof( *ts ) );
+    ts->pool = pool;
+    ts->name = descr;
+    ts->segment_count = segment_count;
+    ts->arg_size = arg_size;
+    ts->task_func = func;
 
-    /*
-     * We've been released for one run.  Insure we block the next
-     * time through the loop.
-     */
-    bit_clear( ts->task_begin_bitmap, thr_idx );
-    hb_unlock( ts->task_cond_lock );
-}
+    if( pool == NULL || func == NULL || segment_count < 1 )
+        return (0);
 
-/*
- * Current thread has completed its work.  Indicate completion,
- * and if all threads in this task set have completed, wakeup
- * anyone waiting for this condition.
- */
-void
-taskset_thread_complete( taskset_t *ts, int thr_idx )
-{
-    hb_lock( ts->task_cond_lock );
-    bit_set( ts->task_complete_bitmap, thr_idx );
-    if( allbits_set( ts->task_complete_bitmap, ts->bitmap_elements ) )
+    if( arg_size != 0 )
     {
-        hb_cond_signal( ts->task_complete );
+        /*
+         * Initialize all arg data to 0.
+         */
+        ts->task_threads_args = calloc( segment_count, arg_size );
+        if( ts->task_threads_args == NULL )
+            return (0);
     }
-    hb_unlock( ts->task_cond_lock );
+
+    ts->task_complete = hb_cond_init();
+    if( ts->task_complete == NULL )
+    {
+        free( ts->task_threads_args );
+        ts->task_threads_args = NULL;
+        return (0);
+    }
+    return (1);
 }
 
 void
-taskset_fini( taskset_t *ts )
+taskset_cycle( taskset_t *ts )
 {
-    int i;
+    hb_taskpool_t *pool = ts->pool;
+
+    if( ts->task_complete == NULL )
+        return;
+
+    hb_lock( pool->lock );
 
-    hb_lock( ts->task_cond_lock );
     /*
-     * Tell each thread to stop, and then cleanup.
+     * Queue the segments and signal the workers that they are available.
      */
-    bit_nset( ts->task_stop_bitmap, 0, ts->thread_count - 1 );
-    bit_nset( ts->task_begin_bitmap, 0, ts->thread_count - 1 );
-    hb_cond_broadcast( ts->task_begin );
+    ts->task_next = 0;
+    ts->task_pending = ts->segment_count;
+    ts->queue_next = NULL;
+    if( pool->queue_tail != NULL )
+        pool->queue_tail->queue_next = ts;
+    else
+        pool->queue_head = ts;
+    pool->queue_tail = ts;
+    hb_cond_broadcast( pool->work_ready );
 
     /*
-     * Wait for all threads to exit.
+     * Rather than sleep while the workers run our segments, help out.
+     * This also guarantees progress when every worker is busy with
+     * another filter's segments.
      */
-    hb_cond_wait( ts->task_complete, ts->task_cond_lock );
-    hb_unlock( ts->task_cond_lock );
+    while( ts->task_next < ts->segment_count )
+    {
+        taskpool_run_segment( pool, ts );
+    }
 
     /*
-     * Clean up taskset memory.
+     * Wait until all segments have completed.  Note that we must
+     * loop here as hb_cond_wait() on some platforms (e.g pthead_cond_wait)
+     * may unblock prematurely.
      */
-    for( i = 0; i < ts->thread_count; i++)
+    while( ts->task_pending > 0 )
     {
-        hb_thread_close( &ts->task_threads[i] );
+        hb_cond_wait( ts->task_complete, pool->lock );
     }
-    hb_lock_close( &ts->task_cond_lock );
-    hb_cond_close( &ts->task_begin );
-    hb_cond_close( &ts->task_complete );
-    free( ts->task_threads );
+
+    hb_unlock( pool->lock );
+}
+
+void
+taskset_fini( taskset_t *ts )
+{
+    /*
+     * taskset_cycle() does not return until all segments are done, so
+     * there is nothing left in flight here.  Clean up taskset memory.
+     */
+    if( ts->task_complete != NULL )
+        hb_cond_close( &ts->task_complete );
     if( ts->task_threads_args != NULL )
         free( ts->task_threads_args );
-    free( ts->task_begin_bitmap );
-    free( ts->task_complete_bitmap );
-    free( ts->task_stop_bitmap );
+    ts->task_threads_args = NULL;
 }
@@ -14,31 +14,38 @@
 
 #include "bits.h"
 
-typedef struct hb_taskset_s {
-    int                thread_count;
+/*
+ * A taskset is a group of segment jobs that are run together, once per
+ * call to taskset_cycle().  The segments are not run on threads of their
+ * own, they are queued to the worker pool owned by the hb_handle_t
+ * (see hb_taskpool_get()) which is shared by every taskset of every filter.
+ */
+typedef struct hb_taskset_s taskset_t;
+
+struct hb_taskset_s {
+    hb_taskpool_t    * pool;
+    const char       * name;
+    int                segment_count;
     int                arg_size;
-    int                bitmap_elements;
-    hb_thread_t     ** task_threads;
     uint8_t          * task_threads_args;
-    uint32_t         * task_begin_bitmap;    // Threads can begin
-    uint32_t         * task_complete_bitmap; // Threads have completed
-    uint32_t         * task_stop_bitmap;     // Threads should exit
-    hb_lock_t        * task_cond_lock;       // Held during condition tests
-    hb_cond_t        * task_begin;           // Threads can begin work
-    hb_cond_t        * task_complete;        // Threads have finished work.
-} taskset_t;
-
-int taskset_init( taskset_t *, int /*thread_count*/, size_t /*user_arg_size*/ );
+    thread_func_t    * task_func;            // Run once per segment per cycle
+    int                task_next;            // Next segment to hand out
+    int                task_pending;         // Segments not yet completed
+    hb_cond_t        * task_complete;        // All segments have completed
+    taskset_t        * queue_next;           // Link in the pool run queue
+};
+
+hb_taskpool_t * hb_taskpool_init( int /*thread_count*/ );
+void            hb_taskpool_close( hb_taskpool_t ** );
+int             hb_taskpool_thread_count( hb_taskpool_t * );
+
+int  taskset_init( taskset_t *, hb_taskpool_t *, const char * /*descr*/,
+                   int /*segment_count*/, size_t /*user_arg_size*/,
+                   thread_func_t * );
 void taskset_cycle( taskset_t * );
 void taskset_fini( taskset_t * );
 
-int  taskset_thread_spawn( taskset_t *, int /*thr_idx*/, const char * /*descr*/,
-                           thread_func_t *, int /*priority*/ );
-void taskset_thread_wait4start( taskset_t *, int );
-void taskset_thread_complete( taskset_t *, int );
-
 static inline void *taskset_thread_args( taskset_t *, int );
-static inline int   taskset_thread_stop( taskset_t *, int );
 
 static inline void *
 taskset_thread_args( taskset_t *ts, int thr_idx )
@@ -46,10 +53,4 @@ taskset_thread_args( taskset_t *ts, int thr_idx )
     return( ts->task_threads_args + ( ts->arg_size * thr_idx ) );
 }
 
-static inline int
-taskset_thread_stop( taskset_t *ts, int thr_idx )
-{
-    return bit_is_set( ts->task_stop_bitmap, thr_idx );
-}
-
 #endif /* HB_TASKSET_H */
@@ -24,6 +24,7 @@ static void work_func();
 static void do_job( hb_job_t *);
 static void work_loop( void * );
 static void filter_loop( void * );
+static void fused_filter_loop( void * );
 
 #define FIFO_UNBOUNDED 65536
 #define FIFO_UNBOUNDED_WAKE 65535
@@ -34,6 +35,9 @@ static void filter_loop( void * );
 #define FIFO_MINI 4
 #define FIFO_MINI_WAKE 3
 
+// Luma rows per stripe when running fused filters
+#define FUSED_STRIPE_HEIGHT 32
+
 /**
  * Allocates work object and launches work thread with work_func.
  * @param jobs Handle to hb_list_t.
@@ -219,6 +223,10 @@ void hb_display_job_info( hb_job_t * job )
 
             if( job->mp4_optimize )
                 hb_log( "     + optimized for progressive web downloads");
+
+            if( job->mp4_segment_duration )
+                hb_log( "     + segments of %d seconds",
+                        job->mp4_segment_duration );
             
             if( job->color_matrix_code )
                 hb_log( "     + custom color matrix: %s", job->color_matrix_code == 1 ? "ITU Bt.601 (SD)" : job->color_matrix_code == 2 ? "ITU Bt.709 (HD)" : "Custom" );
@@ -749,9 +757,12 @@ static void do_job( hb_job_t * job )
         }
     }
     
+    // The decoder -> sync -> filter chain -> encoder edges each have
+    // exactly one producer and one consumer thread, so they can use
+    // the lock-free fifo variant.
     job->fifo_mpeg2  = hb_fifo_init( FIFO_LARGE, FIFO_LARGE_WAKE );
-    job->fifo_raw    = hb_fifo_init( FIFO_SMALL, FIFO_SMALL_WAKE );
-    job->fifo_sync   = hb_fifo_init( FIFO_SMALL, FIFO_SMALL_WAKE );
+    job->fifo_raw    = hb_fifo_init_spsc( FIFO_SMALL, FIFO_SMALL_WAKE );
+    job->fifo_sync   = hb_fifo_init_spsc( FIFO_SMALL, FIFO_SMALL_WAKE );
     job->fifo_mpeg4  = hb_fifo_init( FIFO_LARGE, FIFO_LARGE_WAKE );
     job->fifo_render = NULL; // Attached to filter chain
 
@@ -799,8 +810,8 @@ static void do_job( hb_job_t * job )
             audio = hb_list_item(job->list_audio, i);
 
             /* set up the audio work structures */
-            audio->priv.fifo_raw  = hb_fifo_init(FIFO_SMALL, FIFO_SMALL_WAKE);
-            audio->priv.fifo_sync = hb_fifo_init(FIFO_SMALL, FIFO_SMALL_WAKE);
+            audio->priv.fifo_raw  = hb_fifo_init_spsc(FIFO_SMALL, FIFO_SMALL_WAKE);
+            audio->priv.fifo_sync = hb_fifo_init_spsc(FIFO_SMALL, FIFO_SMALL_WAKE);
             audio->priv.fifo_out  = hb_fifo_init(FIFO_LARGE, FIFO_LARGE_WAKE);
             audio->priv.fifo_in   = hb_fifo_init(FIFO_LARGE, FIFO_LARGE_WAKE);
 
@@ -1052,15 +1063,45 @@ static void do_job( hb_job_t * job )
             int i;
             hb_fifo_t * fifo_in = job->fifo_sync;
 
+            hb_filter_object_t * prev = NULL;
+
             for( i = 0; i < filter_count; i++ )
             {
                 hb_filter_object_t * filter = hb_list_item( job->list_filter, i );
 
+                // An in-place stripe filter followed by another stripe
+                // filter are run together by one thread.  The frame
+                // is passed from one to the next a stripe at a time
+                // while it is still in cache rather than through a fifo.
+                if( job->fuse_filters && prev != NULL &&
+                    prev->stripe_work != NULL &&
+                    ( prev->flags & HB_FILTER_FLAG_INPLACE ) &&
+                    filter->stripe_work != NULL )
+                {
+                    hb_log( "work: fusing filter %s with %s",
+                            filter->name, prev->name );
+                    prev->fuse_next = filter;
+                    filter->fused = 1;
+                    filter->fifo_in = NULL;
+                    filter->fifo_out = prev->fifo_out;
+                    prev->fifo_out = NULL;
+                    prev = filter;
+                    continue;
+                }
                 filter->fifo_in = fifo_in;
-                filter->fifo_out = hb_fifo_init( FIFO_MINI, FIFO_MINI_WAKE );
+                filter->fifo_out = hb_fifo_init_spsc( FIFO_MINI, FIFO_MINI_WAKE );
                 fifo_in = filter->fifo_out;
+                prev = filter;
             }
             job->fifo_render = fifo_in;
+
+            // Keep as many free frame buffers around as the fifos between
+            // the decoder and the encoder can hold
+            int frames = 2 * FIFO_SMALL + filter_count * FIFO_MINI;
+            hb_frame_buffer_pool_init( AV_PIX_FMT_YUV420P, title->width,
+                                       title->height, frames );
+            hb_frame_buffer_pool_init( AV_PIX_FMT_YUV420P, job->width,
+                                       job->height, frames );
         }
         else if ( !job->list_filter )
         {
@@ -1182,8 +1223,15 @@ static void do_job( hb_job_t * job )
             // Filters were initialized earlier, so we just need
             // to start the filter's thread
             filter->done = &job->done;
-            filter->thread = hb_thread_init( filter->name, filter_loop, filter,
-                                             HB_LOW_PRIORITY );
+            if( filter->fused )
+            {
+                // Run by the thread of the first filter it is fused with
+                continue;
+            }
+            filter->thread = hb_thread_init( filter->name,
+                                    filter->fuse_next ? fused_filter_loop :
+                                                        filter_loop,
+                                    filter, HB_LOW_PRIORITY );
         }
     }
 
@@ -1577,6 +1625,14 @@ static void filter_loop( void * _f )
             break;
         }
 
+        // In-place filters overwrite the frame they are given.  If the
+        // frame data is shared this is where it gets copied, otherwise
+        // the same buffer is handed through.
+        if ( f->flags & HB_FILTER_FLAG_INPLACE )
+        {
+            hb_buffer_make_writable( buf_in );
+        }
+
         buf_out = NULL;
         f->status = f->work( f, &buf_in, &buf_out );
 
@@ -1616,3 +1672,109 @@ static void filter_loop( void * _f )
     }
 }
 
+/**
+ * Runs a chain of fused filters (see fuse_next) on one thread.
+ * Every filter of the chain but the last works in place, so each
+ * stripe of a frame is run through the whole chain before the next
+ * stripe is started.
+ * @param _f Handle to the first filter of the chain.
+ */
+static void fused_filter_loop( void * _f )
+{
+    hb_filter_object_t * head = _f;
+    hb_filter_object_t * last, * f;
+    hb_buffer_t      * buf_in, * buf_out;
+    int                y;
+
+    for( last = head; last->fuse_next != NULL; last = last->fuse_next );
+
+    while( !*head->done && last->status != HB_FILTER_DONE )
+    {
+        buf_in = hb_fifo_get_wait( head->fifo_in );
+        if ( buf_in == NULL )
+            continue;
+
+        if ( *head->done )
+        {
+            hb_buffer_close( &buf_in );
+            break;
+        }
+
+        if ( buf_in->size <= 0 )
+        {
+            // End of stream, let each filter see it and flush
+            buf_out = buf_in;
+            for( f = head; f != NULL && buf_out != NULL; f = f->fuse_next )
+            {
+                buf_in = buf_out;
+                buf_out = NULL;
+                f->status = f->work( f, &buf_in, &buf_out );
+                if( buf_in )
+                {
+                    hb_buffer_close( &buf_in );
+                }
+            }
+            last->status = HB_FILTER_DONE;
+        }
+        else
+        {
+            if ( buf_in->s.new_chap )
+            {
+                head->chapter_time = buf_in->s.start;
+                head->chapter_val = buf_in->s.new_chap;
+            }
+
+            hb_buffer_make_writable( buf_in );
+            for( f = head; f != NULL; f = f->fuse_next )
+            {
+                // All but the last filter work in place on buf_in
+                f->stripe_begin( f, buf_in, &buf_out );
+            }
+            for( y = 0; y < buf_in->f.height; y += FUSED_STRIPE_HEIGHT )
+            {
+                for( f = head; f != NULL; f = f->fuse_next )
+                {
+                    f->stripe_work( f, buf_in,
+                                    f == last ? buf_out : buf_in,
+                                    y, y + FUSED_STRIPE_HEIGHT );
+                }
+            }
+            if ( buf_out != buf_in )
+            {
+                hb_buffer_close( &buf_in );
+            }
+
+            if ( head->chapter_val &&
+                 head->chapter_time <= buf_out->s.start )
+            {
+                buf_out->s.new_chap = head->chapter_val;
+                head->chapter_val = 0;
+            }
+        }
+
+        if( buf_out )
+        {
+            while ( !*head->done )
+            {
+                if ( hb_fifo_full_wait( last->fifo_out ) )
+                {
+                    hb_fifo_push( last->fifo_out, buf_out );
+                    buf_out = NULL;
+                    break;
+                }
+            }
+            if( buf_out )
+            {
+                hb_buffer_close( &buf_out );
+            }
+        }
+    }
+    // Consume data in incoming fifo till job complete so that
+    // residual data does not stall the pipeline
+    while( !*head->done )
+    {
+        buf_in = hb_fifo_get_wait( head->fifo_in );
+        if ( buf_in != NULL )
+            hb_buffer_close( &buf_in );
+    }
+}
@@ -0,0 +1,343 @@
+/* yadif.c
+
+   Copyright (c) 2003-2013 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include "hb.h"
+#include "hbffmpeg.h"
+#include "yadif.h"
+
+#if ( defined( __GNUC__ ) || defined( __clang__ ) ) && \
+    ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define YADIF_X86 1
+#include <immintrin.h>
+#endif
+
+#define ABS(a) ((a) > 0 ? (a) : (-(a)))
+#define MIN3(a,b,c) MIN(MIN(a,b),c)
+#define MAX3(a,b,c) MAX(MAX(a,b),c)
+
+static void yadif_filter_line_c( uint8_t * dst, const uint8_t * prev,
+                                 const uint8_t * cur, const uint8_t * next,
+                                 int x, int w, int stride, int parity,
+                                 int spatial )
+{
+    const uint8_t *prev2 = parity ? prev : cur ;
+    const uint8_t *next2 = parity ? cur  : next;
+
+    for( ; x < w; x++ )
+    {
+        int c              = cur[x-stride];
+        int d              = (prev2[x] + next2[x])>>1;
+        int e              = cur[x+stride];
+        int temporal_diff0 = ABS(prev2[x] - next2[x]);
+        int temporal_diff1 = ( ABS(prev[x-stride] - c) + ABS(prev[x+stride] - e) ) >> 1;
+        int temporal_diff2 = ( ABS(next[x-stride] - c) + ABS(next[x+stride] - e) ) >> 1;
+        int diff           = MAX3(temporal_diff0>>1, temporal_diff1, temporal_diff2);
+        int spatial_pred   = (c+e)>>1;
+        int spatial_score  = ABS(cur[x-stride-1] - cur[x+stride-1]) + ABS(c-e) +
+                             ABS(cur[x-stride+1] - cur[x+stride+1]) - 1;
+
+#define YADIF_CHECK(j)\
+        {   int score = ABS(cur[x-stride-1+j] - cur[x+stride-1-j])\
+                      + ABS(cur[x-stride  +j] - cur[x+stride  -j])\
+                      + ABS(cur[x-stride+1+j] - cur[x+stride+1-j]);\
+            if( score < spatial_score ){\
+                spatial_score = score;\
+                spatial_pred  = (cur[x-stride  +j] + cur[x+stride  -j])>>1;\
+
+        YADIF_CHECK(-1) YADIF_CHECK(-2) }} }}
+        YADIF_CHECK( 1) YADIF_CHECK( 2) }} }}
+#undef YADIF_CHECK
+
+        if( spatial )
+        {
+            int b = (prev2[x-2*stride] + next2[x-2*stride])>>1;
+            int f = (prev2[x+2*stride] + next2[x+2*stride])>>1;
+
+            int max = MAX3(d-e, d-c, MIN(b-c, f-e));
+            int min = MIN3(d-e, d-c, MAX(b-c, f-e));
+
+            diff = MAX3( diff, min, -max );
+        }
+
+        if( spatial_pred > d + diff )
+        {
+            spatial_pred = d + diff;
+        }
+        else if( spatial_pred < d - diff )
+        {
+            spatial_pred = d - diff;
+        }
+
+        dst[x] = spatial_pred;
+    }
+}
+
+#if YADIF_X86
+/*
+ * The SIMD versions work on pixels widened to 16 bits, 8 (SSE2) or 16
+ * (AVX2) at a time, and give exactly the same result as the C version.
+ * The edge directed checks are chained like in C: the -2 (+2) slope only
+ * replaces the prediction where the -1 (+1) slope has, and each check
+ * compares against the score left by the ones before it.  diff can't be
+ * negative, so the final clamp is a max followed by a min.
+ */
+__attribute__((target("sse2")))
+static inline __m128i yadif_load_sse2( const uint8_t * p )
+{
+    return _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)p ),
+                              _mm_setzero_si128() );
+}
+
+__attribute__((target("sse2")))
+static inline __m128i yadif_absdiff_sse2( __m128i a, __m128i b )
+{
+    return _mm_sub_epi16( _mm_max_epi16( a, b ), _mm_min_epi16( a, b ) );
+}
+
+__attribute__((target("sse2")))
+static inline __m128i yadif_select_sse2( __m128i mask, __m128i a, __m128i b )
+{
+    return _mm_or_si128( _mm_and_si128( mask, a ),
+                         _mm_andnot_si128( mask, b ) );
+}
+
+__attribute__((target("sse2")))
+static void yadif_filter_line_sse2( uint8_t * dst, const uint8_t * prev,
+                                    const uint8_t * cur, const uint8_t * next,
+                                    int x, int w, int stride, int parity,
+                                    int spatial )
+{
+    const uint8_t *prev2 = parity ? prev : cur ;
+    const uint8_t *next2 = parity ? cur  : next;
+    const uint8_t *up    = cur - stride;
+    const uint8_t *down  = cur + stride;
+    const __m128i one    = _mm_set1_epi16( 1 );
+    __m128i u[7], l[7], ad[7], sd[5];
+    int k;
+
+    for( ; x + 8 <= w; x += 8 )
+    {
+        // u[k], l[k]: line above at x + k - 3, line below at x + 3 - k.
+        // ad[k] is the difference of u[k] and l[k], sd[k] that of the
+        // pixels either side of them, so the score of slope j (j = 0 being
+        // the vertical) is sd[j + 2] + ad[j + 3].
+        for( k = 0; k < 7; k++ )
+        {
+            u[k]  = yadif_load_sse2( up   + x + k - 3 );
+            l[k]  = yadif_load_sse2( down + x + 3 - k );
+            ad[k] = yadif_absdiff_sse2( u[k], l[k] );
+        }
+        for( k = 0; k < 5; k++ )
+        {
+            sd[k] = _mm_add_epi16( yadif_absdiff_sse2( u[k], l[k + 2] ),
+                                   yadif_absdiff_sse2( u[k + 2], l[k] ) );
+        }
+        __m128i c  = u[3];
+        __m128i e  = l[3];
+        __m128i p2 = yadif_load_sse2( prev2 + x );
+        __m128i n2 = yadif_load_sse2( next2 + x );
+        __m128i d  = _mm_srli_epi16( _mm_add_epi16( p2, n2 ), 1 );
+
+        __m128i td0 = _mm_srli_epi16( yadif_absdiff_sse2( p2, n2 ), 1 );
+        __m128i td1 = _mm_srli_epi16( _mm_add_epi16(
+            yadif_absdiff_sse2( yadif_load_sse2( prev + x - stride ), c ),
+            yadif_absdiff_sse2( yadif_load_sse2( prev + x + stride ), e ) ), 1 );
+        __m128i td2 = _mm_srli_epi16( _mm_add_epi16(
+            yadif_absdiff_sse2( yadif_load_sse2( next + x - stride ), c ),
+            yadif_absdiff_sse2( yadif_load_sse2( next + x + stride ), e ) ), 1 );
+        __m128i diff = _mm_max_epi16( _mm_max_epi16( td0, td1 ), td2 );
+
+        __m128i pred  = _mm_srli_epi16( _mm_add_epi16( c, e ), 1 );
+        __m128i score = _mm_sub_epi16( _mm_add_epi16( sd[2], ad[3] ), one );
+        __m128i s, m, m2;
+
+        // -1 then -2
+        s = _mm_add_epi16( sd[1], ad[2] );
+        m = _mm_cmplt_epi16( s, score );
+        score = yadif_select_sse2( m, s, score );
+        pred  = yadif_select_sse2( m, _mm_srli_epi16(
+                    _mm_add_epi16( u[2], l[2] ), 1 ), pred );
+        s  = _mm_add_epi16( sd[0], ad[1] );
+        m2 = _mm_and_si128( m, _mm_cmplt_epi16( s, score ) );
+        score = yadif_select_sse2( m2, s, score );
+        pred  = yadif_select_sse2( m2, _mm_srli_epi16(
+                    _mm_add_epi16( u[1], l[1] ), 1 ), pred );
+
+        // +1 then +2
+        s = _mm_add_epi16( sd[3], ad[4] );
+        m = _mm_cmplt_epi16( s, score );
+        score = yadif_select_sse2( m, s, score );
+        pred  = yadif_select_sse2( m, _mm_srli_epi16(
+                    _mm_add_epi16( u[4], l[4] ), 1 ), pred );
+        s  = _mm_add_epi16( sd[4], ad[5] );
+        m2 = _mm_and_si128( m, _mm_cmplt_epi16( s, score ) );
+        pred  = yadif_select_sse2( m2, _mm_srli_epi16(
+                    _mm_add_epi16( u[5], l[5] ), 1 ), pred );
+
+        if( spatial )
+        {
+            __m128i b = _mm_srli_epi16( _mm_add_epi16(
+                yadif_load_sse2( prev2 + x - 2*stride ),
+                yadif_load_sse2( next2 + x - 2*stride ) ), 1 );
+            __m128i f = _mm_srli_epi16( _mm_add_epi16(
+                yadif_load_sse2( prev2 + x + 2*stride ),
+                yadif_load_sse2( next2 + x + 2*stride ) ), 1 );
+            __m128i de = _mm_sub_epi16( d, e );
+            __m128i dc = _mm_sub_epi16( d, c );
+            __m128i bc = _mm_sub_epi16( b, c );
+            __m128i fe = _mm_sub_epi16( f, e );
+            __m128i max = _mm_max_epi16( _mm_max_epi16( de, dc ),
+                                         _mm_min_epi16( bc, fe ) );
+            __m128i min = _mm_min_epi16( _mm_min_epi16( de, dc ),
+                                         _mm_max_epi16( bc, fe ) );
+
+            diff = _mm_max_epi16( _mm_max_epi16( diff, min ),
+                                  _mm_sub_epi16( _mm_setzero_si128(), max ) );
+        }
+
+        pred = _mm_max_epi16( pred, _mm_sub_epi16( d, diff ) );
+        pred = _mm_min_epi16( pred, _mm_add_epi16( d, diff ) );
+        _mm_storel_epi64( (__m128i*)(dst + x), _mm_packus_epi16( pred, pred ) );
+    }
+    yadif_filter_line_c( dst, prev, cur, next, x, w, stride, parity, spatial );
+}
+
+#ifdef AV_CPU_FLAG_AVX2
+__attribute__((target("avx2")))
+static inline __m256i yadif_load_avx2( const uint8_t * p )
+{
+    return _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*)p ) );
+}
+
+__attribute__((target("avx2")))
+static inline __m256i yadif_absdiff_avx2( __m256i a, __m256i b )
+{
+    return _mm256_abs_epi16( _mm256_sub_epi16( a, b ) );
+}
+
+__attribute__((target("avx2")))
+static void yadif_filter_line_avx2( uint8_t * dst, const uint8_t * prev,
+                                    const uint8_t * cur, const uint8_t * next,
+                                    int x, int w, int stride, int parity,
+                                    int spatial )
+{
+    const uint8_t *prev2 = parity ? prev : cur ;
+    const uint8_t *next2 = parity ? cur  : next;
+    const uint8_t *up    = cur - stride;
+    const uint8_t *down  = cur + stride;
+    const __m256i one    = _mm256_set1_epi16( 1 );
+    __m256i u[7], l[7], ad[7], sd[5];
+    int k;
+
+    for( ; x + 16 <= w; x += 16 )
+    {
+        for( k = 0; k < 7; k++ )
+        {
+            u[k]  = yadif_load_avx2( up   + x + k - 3 );
+            l[k]  = yadif_load_avx2( down + x + 3 - k );
+            ad[k] = yadif_absdiff_avx2( u[k], l[k] );
+        }
+        for( k = 0; k < 5; k++ )
+        {
+            sd[k] = _mm256_add_epi16( yadif_absdiff_avx2( u[k], l[k + 2] ),
+                                      yadif_absdiff_avx2( u[k + 2], l[k] ) );
+        }
+        __m256i c  = u[3];
+        __m256i e  = l[3];
+        __m256i p2 = yadif_load_avx2( prev2 + x );
+        __m256i n2 = yadif_load_avx2( next2 + x );
+        __m256i d  = _mm256_srli_epi16( _mm256_add_epi16( p2, n2 ), 1 );
+
+        __m256i td0 = _mm256_srli_epi16( yadif_absdiff_avx2( p2, n2 ), 1 );
+        __m256i td1 = _mm256_srli_epi16( _mm256_add_epi16(
+            yadif_absdiff_avx2( yadif_load_avx2( prev + x - stride ), c ),
+            yadif_absdiff_avx2( yadif_load_avx2( prev + x + stride ), e ) ), 1 );
+        __m256i td2 = _mm256_srli_epi16( _mm256_add_epi16(
+            yadif_absdiff_avx2( yadif_load_avx2( next + x - stride ), c ),
+            yadif_absdiff_avx2( yadif_load_avx2( next + x + stride ), e ) ), 1 );
+        __m256i diff = _mm256_max_epi16( _mm256_max_epi16( td0, td1 ), td2 );
+
+        __m256i pred  = _mm256_srli_epi16( _mm256_add_epi16( c, e ), 1 );
+        __m256i score = _mm256_sub_epi16( _mm256_add_epi16( sd[2], ad[3] ), one );
+        __m256i s, m, m2;
+
+        // -1 then -2
+        s = _mm256_add_epi16( sd[1], ad[2] );
+        m = _mm256_cmpgt_epi16( score, s );
+        score = _mm256_blendv_epi8( score, s, m );
+        pred  = _mm256_blendv_epi8( pred, _mm256_srli_epi16(
+                    _mm256_add_epi16( u[2], l[2] ), 1 ), m );
+        s  = _mm256_add_epi16( sd[0], ad[1] );
+        m2 = _mm256_and_si256( m, _mm256_cmpgt_epi16( score, s ) );
+        score = _mm256_blendv_epi8( score, s, m2 );
+        pred  = _mm256_blendv_epi8( pred, _mm256_srli_epi16(
+                    _mm256_add_epi16( u[1], l[1] ), 1 ), m2 );
+
+        // +1 then +2
+        s = _mm256_add_epi16( sd[3], ad[4] );
+        m = _mm256_cmpgt_epi16( score, s );
+        score = _mm256_blendv_epi8( score, s, m );
+        pred  = _mm256_blendv_epi8( pred, _mm256_srli_epi16(
+                    _mm256_add_epi16( u[4], l[4] ), 1 ), m );
+        s  = _mm256_add_epi16( sd[4], ad[5] );
+        m2 = _mm256_and_si256( m, _mm256_cmpgt_epi16( score, s ) );
+        pred  = _mm256_blendv_epi8( pred, _mm256_srli_epi16(
+                    _mm256_add_epi16( u[5], l[5] ), 1 ), m2 );
+
+        if( spatial )
+        {
+            __m256i b = _mm256_srli_epi16( _mm256_add_epi16(
+                yadif_load_avx2( prev2 + x - 2*stride ),
+                yadif_load_avx2( next2 + x - 2*stride ) ), 1 );
+            __m256i f = _mm256_srli_epi16( _mm256_add_epi16(
+                yadif_load_avx2( prev2 + x + 2*stride ),
+                yadif_load_avx2( next2 + x + 2*stride ) ), 1 );
+            __m256i de = _mm256_sub_epi16( d, e );
+            __m256i dc = _mm256_sub_epi16( d, c );
+            __m256i bc = _mm256_sub_epi16( b, c );
+            __m256i fe = _mm256_sub_epi16( f, e );
+            __m256i max = _mm256_max_epi16( _mm256_max_epi16( de, dc ),
+                                            _mm256_min_epi16( bc, fe ) );
+            __m256i min = _mm256_min_epi16( _mm256_min_epi16( de, dc ),
+                                            _mm256_max_epi16( bc, fe ) );
+
+            diff = _mm256_max_epi16( _mm256_max_epi16( diff, min ),
+                                     _mm256_sub_epi16( _mm256_setzero_si256(), max ) );
+        }
+
+        pred = _mm256_max_epi16( pred, _mm256_sub_epi16( d, diff ) );
+        pred = _mm256_min_epi16( pred, _mm256_add_epi16( d, diff ) );
+        _mm_storeu_si128( (__m128i*)(dst + x),
+                          _mm_packus_epi16( _mm256_castsi256_si128( pred ),
+                                            _mm256_extracti128_si256( pred, 1 ) ) );
+    }
+    yadif_filter_line_sse2( dst, prev, cur, next, x, w, stride, parity, spatial );
+}
+#endif
+#endif
+
+void yadif_dsp_init( yadif_dsp_t * dsp )
+{
+    dsp->filter_line = yadif_filter_line_c;
+
+#if YADIF_X86
+    int cpu_flags = av_get_cpu_flags();
+
+    if( cpu_flags & AV_CPU_FLAG_SSE2 )
+    {
+        dsp->filter_line = yadif_filter_line_sse2;
+    }
+#ifdef AV_CPU_FLAG_AVX2
+    if( cpu_flags & AV_CPU_FLAG_AVX2 )
+    {
+        dsp->filter_line = yadif_filter_line_avx2;
+    }
+#endif
+#endif
+}
@@ -0,0 +1,35 @@
+/* yadif.h
+
+   Copyright (c) 2003-2013 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef HB_YADIF_H
+#define HB_YADIF_H
+
+/*
+ * Yadif line filter shared by deinterlace and decomb.
+ *
+ * filter_line interpolates pixels [x, w) of the line at dst from the
+ * lines above and below it in cur, and from the same line in the
+ * adjacent fields, which are taken from prev and cur (parity set) or
+ * cur and next (parity clear).  prev, cur and next point at the same
+ * line as dst in their frames.  With spatial set the prediction is also
+ * checked against the lines two above and below in the adjacent fields.
+ *
+ * The lines are read from 2 lines above to 2 lines below, and from 3
+ * pixels left of x to 3 pixels right of w - 1.
+ */
+typedef struct
+{
+    void (* filter_line)( uint8_t * dst, const uint8_t * prev,
+                          const uint8_t * cur, const uint8_t * next,
+                          int x, int w, int stride, int parity, int spatial );
+} yadif_dsp_t;
+
+void yadif_dsp_init( yadif_dsp_t * dsp );
+
+#endif /* HB_YADIF_H */
@@ -60,6 +60,7 @@ static int    rotate                = 0;
 static char * rotate_opt            = 0;
 static int    rotate_val            = 0;
 static int    grayscale   = 0;
+static int    fuse_filters = 0;
 static int    vcodec      = HB_VCODEC_FFMPEG_MPEG4;
 static hb_list_t * audios = NULL;
 static hb_audio_config_t * audio = NULL;
@@ -122,6 +123,7 @@ static int    preset        = 0;
 static char * preset_name   = 0;
 static int    cfr           = 0;
 static int    mp4_optimize  = 0;
+static int    mp4_segment_duration = 0;
 static int    ipod_atom     = 0;
 static int    color_matrix_code = 0;
 static int    preview_count = 10;
@@ -1535,6 +1537,7 @@ static int HandleEvents( hb_handle_t * h )
 
             job->deinterlace = deinterlace;
             job->grayscale   = grayscale;
+            job->fuse_filters = fuse_filters;
             
             hb_filter_object_t * filter;
 
@@ -1788,6 +1791,10 @@ static int HandleEvents( hb_handle_t * h )
             {
                 job->mp4_optimize = 1;
             }
+            if (mp4_segment_duration)
+            {
+                job->mp4_segment_duration = mp4_segment_duration;
+            }
             if (ipod_atom)
             {
                 job->ipod_atom = 1;
@@ -2823,6 +2830,10 @@ static int HandleEvents( hb_handle_t * h )
                          "%02dh%02dm%02ds)", p.rate_cur, p.rate_avg,
                          p.hours, p.minutes, p.seconds );
             }
+            if( p.write_stalled )
+            {
+                fprintf( stdout, ", waiting on output" );
+            }
             fflush(stdout);
             break;
 #undef p
@@ -2936,6 +2947,10 @@ static void ShowHelp()
     "    -4, --large-file        Create 64-bit mp4 files that can hold more than 4 GB\n"
     "                            of data. Note: breaks pre-iOS iPod compatibility.\n"
     "    -O, --optimize          Optimize mp4 files for HTTP streaming (\"fast start\")\n"
+    "        --segment <number>  Split mp4 output into files of about <number>\n"
+    "                            seconds each, named <output>-00001.mp4 etc.\n"
+    "                            Every file starts with a keyframe and plays on\n"
+    "                            its own.\n"
     "    -I, --ipod-atom         Mark mp4 files so 5.5G iPods will accept them\n"
     "\n"
 
@@ -3258,9 +3273,14 @@ static void ShowHelp()
      "          <SL:SC:TL:TC>     (default 4:3:6:4.5)\n"
      "    -7, --deblock           Deblock video with pp7 filter\n"
      "          <QP:M>            (default 5:2)\n"
+     "                            QP 0 follows the quantizers of the source\n"
+     "                            where the decoder provides them\n"
      "        --rotate            Flips images axes\n"
      "          <M>               (default 3)\n"
     "    -g, --grayscale         Grayscale encoding\n"
+    "        --fuse-filters      Run adjacent filters that support it (denoise,\n"
+    "                            crop/scale) together on one thread, a stripe\n"
+    "                            of the picture at a time\n"
     "\n"
 
     "### Subtitle Options------------------------------------------------------------\n\n"
@@ -3466,6 +3486,7 @@ static int ParseOptions( int argc, char ** argv )
     #define H264_LEVEL          286
     #define NORMALIZE_MIX       287
     #define AUDIO_DITHER        288
+    #define SEGMENT             289
     
     for( ;; )
     {
@@ -3481,6 +3502,7 @@ static int ParseOptions( int argc, char ** argv )
             { "output",      required_argument, NULL,    'o' },
             { "large-file",  no_argument,       NULL,    '4' },
             { "optimize",    no_argument,       NULL,    'O' },
+            { "segment",     required_argument, NULL,    SEGMENT },
             { "ipod-atom",   no_argument,       NULL,    'I' },
 
             { "title",       required_argument, NULL,    't' },
@@ -3517,6 +3539,7 @@ static int ParseOptions( int argc, char ** argv )
             { "decomb",      optional_argument, NULL,    '5' },
             { "grayscale",   no_argument,       NULL,    'g' },
             { "rotate",      optional_argument, NULL,   ROTATE_FILTER },
+            { "fuse-filters", no_argument,      &fuse_filters, 1 },
             { "strict-anamorphic",  no_argument, &anamorphic_mode, 1 },
             { "loose-anamorphic", no_argument, &anamorphic_mode, 2 },
             { "custom-anamorphic", no_argument, &anamorphic_mode, 3 },
@@ -3637,6 +3660,9 @@ static int ParseOptions( int argc, char ** argv )
             case 'O':
                 mp4_optimize = 1;
                 break;
+            case SEGMENT:
+                mp4_segment_duration = atoi( optarg );
+                break;
             case 'I':
                 ipod_atom = 1;
                 break;